@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+#
+# Copyright 2012 Scott MacDonald
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Compares two sets of gfxsandbox_bench results.
+
+    gfxsandbox_bench --json baseline.json      # before the change
+    gfxsandbox_bench --json current.json       # after the change
+    compare.py baseline.json current.json
+
+A benchmark is flagged as a regression when both its mean and median time
+went up by more than the threshold, and Welch's t-test says the difference
+is unlikely to be noise. Every benchmark is a separate test, so the p-values
+are adjusted with the Holm-Bonferroni method to keep the chance of any false
+alarm across the whole run below alpha. The exit status is 1 if anything
+regressed, so this can gate a build. Only the standard library is used.
+"""
+
+import argparse
+import json
+import math
+import sys
+
+
+def mean_and_variance(samples):
+    mean = sum(samples) / len(samples)
+    variance = sum((x - mean) ** 2 for x in samples) / (len(samples) - 1)
+    return mean, variance
+
+
+def incomplete_beta_fraction(a, b, x):
+    """Continued fraction for the incomplete beta function, evaluated with
+    the modified Lentz method."""
+    tiny = 1e-300
+    c = 1.0
+    d = 1.0 - (a + b) * x / (a + 1.0)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    result = d
+
+    for m in range(1, 300):
+        m2 = 2 * m
+
+        # Even step
+        numerator = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2))
+        d = 1.0 + numerator * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + numerator / c
+        c = c if abs(c) > tiny else tiny
+        result *= d * c
+
+        # Odd step
+        numerator = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0))
+        d = 1.0 + numerator * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + numerator / c
+        c = c if abs(c) > tiny else tiny
+        delta = d * c
+        result *= delta
+
+        if abs(delta - 1.0) < 1e-12:
+            break
+
+    return result
+
+
+def regularized_incomplete_beta(a, b, x):
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+
+    log_front = (math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) +
+                 a * math.log(x) + b * math.log(1.0 - x))
+
+    # The continued fraction converges quickly on one side of the mean of
+    # the distribution, so use the symmetry relation on the other
+    if x < (a + 1.0) / (a + b + 2.0):
+        return math.exp(log_front) * incomplete_beta_fraction(a, b, x) / a
+
+    return 1.0 - math.exp(log_front) * incomplete_beta_fraction(b, a, 1.0 - x) / b
+
+
+def welch_t_test(first, second):
+    """Returns the t statistic and two sided p-value of Welch's unequal
+    variances t-test."""
+    mean1, var1 = mean_and_variance(first)
+    mean2, var2 = mean_and_variance(second)
+    se1 = var1 / len(first)
+    se2 = var2 / len(second)
+
+    if se1 + se2 == 0.0:
+        return 0.0, (1.0 if mean1 == mean2 else 0.0)
+
+    t = (mean2 - mean1) / math.sqrt(se1 + se2)
+
+    # Welch-Satterthwaite estimate of the degrees of freedom
+    dof = (se1 + se2) ** 2 / (se1 ** 2 / (len(first) - 1) +
+                              se2 ** 2 / (len(second) - 1))
+
+    p = regularized_incomplete_beta(dof / 2.0, 0.5, dof / (dof + t * t))
+    return t, p
+
+
+def median(samples):
+    ordered = sorted(samples)
+    middle = len(ordered) // 2
+
+    if len(ordered) % 2:
+        return ordered[middle]
+
+    return 0.5 * (ordered[middle - 1] + ordered[middle])
+
+
+def holm_adjust(p_values):
+    """Returns Holm-Bonferroni adjusted p-values, in the same order. A test
+    is significant at level alpha when its adjusted p-value is below it."""
+    count = len(p_values)
+    order = sorted(range(count), key=lambda i: p_values[i])
+    adjusted = [1.0] * count
+    running = 0.0
+
+    for rank, i in enumerate(order):
+        running = max(running, min(1.0, (count - rank) * p_values[i]))
+        adjusted[i] = running
+
+    return adjusted
+
+
+def load_results(path):
+    with open(path) as f:
+        results = json.load(f)
+
+    if results.get("suite") != "gfxsandbox_bench":
+        sys.exit("%s is not a gfxsandbox_bench results file" % path)
+
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Flag benchmarks that got significantly slower.")
+    parser.add_argument("baseline", help="results to compare against")
+    parser.add_argument("current", help="new results")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="smallest slowdown of both the mean and median "
+                             "worth flagging, in percent (default 10)")
+    parser.add_argument("--alpha", type=float, default=0.01,
+                        help="chance of a false alarm across all of the "
+                             "benchmarks together (default 0.01)")
+    args = parser.parse_args()
+
+    baseline = load_results(args.baseline)
+    current = load_results(args.current)
+
+    if baseline.get("context") != current.get("context"):
+        print("warning: the results come from different machines or drivers")
+        print("  baseline: %s" % json.dumps(baseline.get("context")))
+        print("  current:  %s" % json.dumps(current.get("context")))
+
+    old = dict((b["name"], b) for b in baseline["benchmarks"])
+    compared = []
+
+    print("%-40s %14s %14s %8s %8s %8s  %s" %
+          ("benchmark", "baseline ns", "current ns", "mean", "median",
+           "holm p", "verdict"))
+
+    for bench in current["benchmarks"]:
+        name = bench["name"]
+
+        if name not in old:
+            print("%-40s %14s %14.1f %8s %8s %8s  new" %
+                  (name, "-", bench["mean"], "-", "-", "-"))
+            continue
+
+        before = old.pop(name)["samples"]
+        after = bench["samples"]
+
+        if len(before) < 2 or len(after) < 2:
+            print("%-40s needs at least two samples on each side" % name)
+            continue
+
+        t, p = welch_t_test(before, after)
+        mean_before = sum(before) / len(before)
+        mean_after = sum(after) / len(after)
+        mean_change = 100.0 * (mean_after - mean_before) / mean_before
+        median_change = 100.0 * (median(after) - median(before)) / median(before)
+        compared.append((name, mean_before, mean_after, mean_change,
+                         median_change, p))
+
+    adjusted = holm_adjust([c[5] for c in compared])
+    regressions = 0
+
+    for (name, mean_before, mean_after, mean_change, median_change, p), \
+            p_holm in zip(compared, adjusted):
+        # A single slow sample can move the mean a long way, so the median
+        # has to agree before the change counts
+        if p_holm >= args.alpha:
+            verdict = "same"
+        elif min(mean_change, median_change) >= args.threshold:
+            verdict = "REGRESSION"
+            regressions += 1
+        elif max(mean_change, median_change) <= -args.threshold:
+            verdict = "faster"
+        else:
+            verdict = "same"
+
+        print("%-40s %14.1f %14.1f %+7.1f%% %+7.1f%% %8.4f  %s" %
+              (name, mean_before, mean_after, mean_change, median_change,
+               p_holm, verdict))
+
+    for name in sorted(old):
+        print("%-40s missing from the current results" % name)
+
+    if regressions:
+        print("%d benchmark%s regressed" %
+              (regressions, "" if regressions == 1 else "s"))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,6 @@
+// Blends from the first color to the second as fade goes from 0 to 1. Shared
+// by every shader that crossfades between the two images
+vec4 crossfade( vec4 first, vec4 second, float fade )
+{
+    return mix( first, second, fade );
+}
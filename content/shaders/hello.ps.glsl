@@ -1,14 +1,40 @@
 #version 110
-// simple fragment shader 2
+#ifdef TEXTURE_ARRAY
+#extension GL_EXT_texture_array : require
+#endif
+// simple fragment shader 2. With TEXTURE_ARRAY defined both images are layers
+// of one array texture
+#include "crossfade.glsl"
+
 uniform float fade_factor;
+varying vec2 texcoord;
+
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray textures;
+uniform float layers[2];
+
+void main()
+{
+    gl_FragColor =
+        crossfade( texture2DArray( textures, vec3( texcoord, layers[0] ) ),
+                   texture2DArray( textures, vec3( texcoord, layers[1] ) ),
+                   fade_factor );
+}
+#else
 uniform sampler2D textures[2];
 
-varying vec2 texcoord;
+// Corners of each image within its texture, as (u0, v0, u1, v1). Covers the
+// whole texture unless the images are packed in an atlas
+uniform vec4 uv_rects[2];
 
 void main()
 {
+    vec2 uv0 = mix( uv_rects[0].xy, uv_rects[0].zw, texcoord );
+    vec2 uv1 = mix( uv_rects[1].xy, uv_rects[1].zw, texcoord );
+
     gl_FragColor =
-        mix( texture2D( textures[0], texcoord ),
-             texture2D( textures[1], texcoord ),
-             fade_factor );
+        crossfade( texture2D( textures[0], uv0 ),
+                   texture2D( textures[1], uv1 ),
+                   fade_factor );
 }
+#endif
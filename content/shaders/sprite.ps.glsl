@@ -0,0 +1,16 @@
+#version 110
+// Crossfades each sprite between the two textures
+#include "crossfade.glsl"
+
+uniform sampler2D textures[2];
+
+varying vec2 texcoord;
+varying float fade;
+
+void main()
+{
+    gl_FragColor =
+        crossfade( texture2D( textures[0], texcoord ),
+                   texture2D( textures[1], texcoord ),
+                   fade );
+}
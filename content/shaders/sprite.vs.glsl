@@ -0,0 +1,21 @@
+#version 110
+// Instanced sprite. position is a corner of the unit quad, everything else
+// is per instance
+attribute vec2 position;
+attribute vec4 transform;       // center xy, half size zw
+attribute vec4 rotationFade;    // cos and sin of the rotation, fade
+attribute vec4 uvRect;          // u0 v0 u1 v1
+
+varying vec2 texcoord;
+varying float fade;
+
+void main()
+{
+    vec2 corner  = position * transform.zw;
+    vec2 rotated = vec2( corner.x * rotationFade.x - corner.y * rotationFade.y,
+                         corner.x * rotationFade.y + corner.y * rotationFade.x );
+
+    gl_Position = vec4( transform.xy + rotated, 0.0, 1.0 );
+    texcoord    = mix( uvRect.xy, uvRect.zw, position * vec2( 0.5 ) + vec2( 0.5 ) );
+    fade        = rotationFade.z;
+}
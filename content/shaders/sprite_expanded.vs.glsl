@@ -0,0 +1,15 @@
+#version 110
+// Sprite that was already transformed on the CPU
+attribute vec2 position;
+attribute vec2 uv;
+attribute float fade_factor;
+
+varying vec2 texcoord;
+varying float fade;
+
+void main()
+{
+    gl_Position = vec4( position, 0.0, 1.0 );
+    texcoord    = uv;
+    fade        = fade_factor;
+}
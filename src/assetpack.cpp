@@ -0,0 +1,432 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "assetpack.h"
+#include "util.h"
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+const char * const ASSET_PACK_FILE = "content.pack";
+
+AssetPack GAssetPack;
+
+/**
+ * Rounds an offset up to the next blob boundary
+ */
+static uint64_t alignBlobOffset( uint64_t offset )
+{
+    return ( offset + PACK_BLOB_ALIGNMENT - 1 ) & ~static_cast<uint64_t>( PACK_BLOB_ALIGNMENT - 1 );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// AssetPack
+/////////////////////////////////////////////////////////////////////////////
+AssetPack::AssetPack()
+    : mFile(),
+      mpHeader( NULL ),
+      mpSlots( NULL ),
+      mpNames( NULL )
+{
+}
+
+AssetPack::~AssetPack()
+{
+}
+
+/**
+ * Maps a pack file. Everything the index refers to is checked against the
+ * size of the file here, so lookups don't have to
+ *
+ * \param  filename  Path to the pack
+ * \return           True if the pack was opened
+ */
+bool AssetPack::open( const std::string& filename )
+{
+    close();
+
+    std::shared_ptr<MappedFile> file( new MappedFile );
+
+    if (! file->open( filename ) )
+    {
+        return false;
+    }
+
+    if ( file->size() < sizeof( PackHeader ) )
+    {
+        std::cerr << filename << " is too small to be a pack" << std::endl;
+        return false;
+    }
+
+    mFile    = file;
+    mpHeader = reinterpret_cast<const PackHeader*>( file->data() );
+
+    if (! validate( filename ) )
+    {
+        close();
+        return false;
+    }
+
+    mpSlots = reinterpret_cast<const PackEntry*>( file->data() + mpHeader->indexOffset );
+    mpNames = reinterpret_cast<const char*>( file->data() + mpHeader->namesOffset );
+
+    return true;
+}
+
+/**
+ * Checks the header and every index slot of a freshly mapped pack
+ */
+bool AssetPack::validate( const std::string& filename ) const
+{
+    const PackHeader& header = *mpHeader;
+    uint64_t fileSize        = mFile->size();
+
+    if ( memcmp( header.magic, "GPAK", 4 ) != 0 )
+    {
+        std::cerr << filename << " is not a pack file" << std::endl;
+        return false;
+    }
+
+    if ( header.version != PACK_VERSION )
+    {
+        std::cerr << filename << " has pack version " << header.version
+                  << ", expected " << PACK_VERSION << std::endl;
+        return false;
+    }
+
+    uint64_t indexSize = static_cast<uint64_t>( header.slotCount ) * sizeof( PackEntry );
+
+    if ( header.slotCount == 0 ||
+         ( header.slotCount & ( header.slotCount - 1 ) ) != 0 ||
+         header.indexOffset % sizeof( uint64_t ) != 0 ||
+         header.indexOffset > fileSize ||
+         indexSize > fileSize - header.indexOffset ||
+         header.namesOffset > fileSize ||
+         header.namesSize > fileSize - header.namesOffset )
+    {
+        std::cerr << filename << " has a corrupt header" << std::endl;
+        return false;
+    }
+
+    const PackEntry * pSlots =
+        reinterpret_cast<const PackEntry*>( mFile->data() + header.indexOffset );
+    uint32_t usedSlots = 0;
+
+    for ( uint32_t i = 0; i < header.slotCount; ++i )
+    {
+        const PackEntry& entry = pSlots[i];
+
+        if ( entry.type == PACK_ENTRY_EMPTY )
+        {
+            continue;
+        }
+
+        usedSlots++;
+
+        bool ok = ( entry.type == PACK_ENTRY_DATA || entry.type == PACK_ENTRY_IMAGE ) &&
+                  entry.offset % PACK_BLOB_ALIGNMENT == 0 &&
+                  entry.offset <= fileSize &&
+                  entry.size <= fileSize - entry.offset &&
+                  entry.nameOffset <= header.namesSize &&
+                  entry.nameLength <= header.namesSize - entry.nameOffset;
+
+        if ( ok && entry.type == PACK_ENTRY_IMAGE )
+        {
+            ok = ( entry.format == PIXEL_FORMAT_BGR8 || entry.format == PIXEL_FORMAT_BGRA8 ) &&
+                 static_cast<uint64_t>( entry.width ) * entry.height *
+                     bytesPerPixel( static_cast<PixelFormat>( entry.format ) ) == entry.size;
+        }
+
+        if (! ok )
+        {
+            std::cerr << filename << " has a corrupt index entry" << std::endl;
+            return false;
+        }
+    }
+
+    // Lookups stop at the first empty slot, so the table must never be full
+    if ( usedSlots != header.entryCount || usedSlots == header.slotCount )
+    {
+        std::cerr << filename << " has a corrupt index" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Unmaps the pack. Images loaded from it stay valid, since they hold their
+ * own reference to the mapping
+ */
+void AssetPack::close()
+{
+    mFile.reset();
+    mpHeader = NULL;
+    mpSlots  = NULL;
+    mpNames  = NULL;
+}
+
+/**
+ * Looks up an entry in the pack's hash table
+ *
+ * \param  name  Name the entry was added with
+ * \return       The entry, or NULL if there is no such entry or no pack
+ */
+const PackEntry * AssetPack::find( const std::string& name ) const
+{
+    if (! isOpen() )
+    {
+        return NULL;
+    }
+
+    uint64_t hash = hashData( name.data(), name.size() );
+    uint32_t mask = mpHeader->slotCount - 1;
+
+    for ( uint32_t i = 0; i < mpHeader->slotCount; ++i )
+    {
+        const PackEntry& entry = mpSlots[ ( hash + i ) & mask ];
+
+        if ( entry.type == PACK_ENTRY_EMPTY )
+        {
+            return NULL;
+        }
+
+        if ( entry.nameHash == hash &&
+             entry.nameLength == name.size() &&
+             memcmp( mpNames + entry.nameOffset, name.data(), name.size() ) == 0 )
+        {
+            return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+const unsigned char * AssetPack::entryData( const PackEntry& entry ) const
+{
+    assert( isOpen() );
+    return mFile->data() + entry.offset;
+}
+
+/**
+ * Loads an image entry. The image points into the pack's mapping rather than
+ * owning a copy of the pixels
+ *
+ * \param  name    Name of the entry
+ * \param  pImage  Receives the image
+ * \return         True if the pack has an image with that name
+ */
+bool AssetPack::loadImage( const std::string& name, Image * pImage ) const
+{
+    assert( pImage != NULL );
+
+    const PackEntry * pEntry = find( name );
+
+    if ( pEntry == NULL || pEntry->type != PACK_ENTRY_IMAGE )
+    {
+        return false;
+    }
+
+    pImage->width         = static_cast<int>( pEntry->width );
+    pImage->height        = static_cast<int>( pEntry->height );
+    pImage->format        = static_cast<PixelFormat>( pEntry->format );
+    pImage->mapping       = mFile;
+    pImage->mappingOffset = static_cast<size_t>( pEntry->offset );
+    pImage->buffer.clear();
+
+    return true;
+}
+
+/**
+ * Loads a data entry as text
+ *
+ * \param  name   Name of the entry
+ * \param  pText  Receives the entry's contents
+ * \return        True if the pack has a data entry with that name
+ */
+bool AssetPack::loadText( const std::string& name, std::string * pText ) const
+{
+    assert( pText != NULL );
+
+    const PackEntry * pEntry = find( name );
+
+    if ( pEntry == NULL || pEntry->type != PACK_ENTRY_DATA )
+    {
+        return false;
+    }
+
+    pText->assign( reinterpret_cast<const char*>( entryData( *pEntry ) ),
+                   static_cast<size_t>( pEntry->size ) );
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// AssetPackWriter
+/////////////////////////////////////////////////////////////////////////////
+AssetPackWriter::AssetPackWriter()
+    : mItems()
+{
+}
+
+bool AssetPackWriter::addData( const std::string& name, const void * pData, size_t size )
+{
+    PackEntry entry;
+    memset( &entry, 0, sizeof( entry ) );
+    entry.type = PACK_ENTRY_DATA;
+
+    return add( name, pData, size, entry );
+}
+
+bool AssetPackWriter::addImage( const std::string& name, const Image& image )
+{
+    PackEntry entry;
+    memset( &entry, 0, sizeof( entry ) );
+    entry.type   = PACK_ENTRY_IMAGE;
+    entry.format = image.format;
+    entry.width  = static_cast<uint32_t>( image.width );
+    entry.height = static_cast<uint32_t>( image.height );
+
+    return add( name, image.pixels(), image.size(), entry );
+}
+
+bool AssetPackWriter::add( const std::string& name,
+                           const void * pData,
+                           size_t size,
+                           const PackEntry& entry )
+{
+    for ( size_t i = 0; i < mItems.size(); ++i )
+    {
+        if ( mItems[i].name == name )
+        {
+            std::cerr << "Pack already has an entry named " << name << std::endl;
+            return false;
+        }
+    }
+
+    const unsigned char * pBytes = static_cast<const unsigned char*>( pData );
+
+    Item item;
+    item.entry          = entry;
+    item.entry.nameHash = hashData( name.data(), name.size() );
+    item.entry.size     = size;
+    item.name           = name;
+    item.data.assign( pBytes, pBytes + size );
+
+    mItems.push_back( item );
+    return true;
+}
+
+/**
+ * Lays out the index, names and blobs and writes them to disk. The pack is
+ * written under a temporary name and renamed into place, so a failed build
+ * never leaves a truncated pack behind
+ *
+ * \param  filename  Path of the pack to write
+ * \return           True if the pack was written
+ */
+bool AssetPackWriter::write( const std::string& filename ) const
+{
+    // Keep the table at most half full so probe sequences stay short
+    uint32_t slotCount = 1;
+
+    while ( slotCount < mItems.size() * 2 )
+    {
+        slotCount *= 2;
+    }
+
+    std::vector<PackEntry> slots( slotCount );
+    memset( &slots[0], 0, slots.size() * sizeof( PackEntry ) );
+
+    std::string names;
+
+    for ( size_t i = 0; i < mItems.size(); ++i )
+    {
+        names += mItems[i].name;
+    }
+
+    PackHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, "GPAK", 4 );
+    header.version     = PACK_VERSION;
+    header.entryCount  = static_cast<uint32_t>( mItems.size() );
+    header.slotCount   = slotCount;
+    header.indexOffset = sizeof( PackHeader );
+    header.namesOffset = header.indexOffset + slotCount * sizeof( PackEntry );
+    header.namesSize   = names.size();
+
+    uint64_t nextOffset = header.namesOffset + header.namesSize;
+    uint32_t nameOffset = 0;
+
+    for ( size_t i = 0; i < mItems.size(); ++i )
+    {
+        PackEntry entry  = mItems[i].entry;
+        entry.offset     = alignBlobOffset( nextOffset );
+        entry.nameOffset = nameOffset;
+        entry.nameLength = static_cast<uint32_t>( mItems[i].name.size() );
+
+        nextOffset  = entry.offset + entry.size;
+        nameOffset += entry.nameLength;
+
+        uint32_t slot = static_cast<uint32_t>( entry.nameHash ) & ( slotCount - 1 );
+
+        while ( slots[slot].type != PACK_ENTRY_EMPTY )
+        {
+            slot = ( slot + 1 ) & ( slotCount - 1 );
+        }
+
+        slots[slot] = entry;
+    }
+
+    std::string tempName = filename + ".tmp";
+    FILE * pFile         = fopen( tempName.c_str(), "wb" );
+
+    if ( pFile == NULL )
+    {
+        std::cerr << "Failed to create " << tempName << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite( &header, sizeof( header ), 1, pFile ) == 1 &&
+              fwrite( &slots[0], sizeof( PackEntry ), slotCount, pFile ) == slotCount &&
+              fwrite( names.data(), 1, names.size(), pFile ) == names.size();
+
+    // Blobs go in the order they were added, which is also the layout order
+    const char padding[PACK_BLOB_ALIGNMENT] = { 0 };
+    uint64_t position = header.namesOffset + header.namesSize;
+
+    for ( size_t i = 0; ok && i < mItems.size(); ++i )
+    {
+        const Item& item = mItems[i];
+        size_t gap       = static_cast<size_t>( alignBlobOffset( position ) - position );
+
+        ok = fwrite( padding, 1, gap, pFile ) == gap &&
+             ( item.data.empty() ||
+               fwrite( &item.data[0], 1, item.data.size(), pFile ) == item.data.size() );
+
+        position += gap + item.data.size();
+    }
+
+    ok = ( fclose( pFile ) == 0 ) && ok;
+
+    if ( !ok || rename( tempName.c_str(), filename.c_str() ) != 0 )
+    {
+        std::cerr << "Failed to write " << filename << std::endl;
+        remove( tempName.c_str() );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_ASSETPACK_H
+#define SCOTT_GFXSANDBOX_ASSETPACK_H
+
+#include "tga.h"
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// Pack file the program loads its content from when it exists
+extern const char * const ASSET_PACK_FILE;
+
+/**
+ * What a pack entry holds
+ */
+enum PackEntryType
+{
+    PACK_ENTRY_EMPTY = 0,       // unused hash table slot
+    PACK_ENTRY_DATA  = 1,       // file contents, stored as is
+    PACK_ENTRY_IMAGE = 2        // decoded pixels, ready to upload
+};
+
+/**
+ * Start of a pack file. A pack is laid out as the header, the index (a hash
+ * table of PackEntry slots), the entry names, and then the blobs. Every blob
+ * starts on a PACK_BLOB_ALIGNMENT boundary. Numbers are stored in the byte
+ * order of the machine that built the pack
+ */
+struct PackHeader
+{
+    char magic[4];              // "GPAK"
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t slotCount;         // size of the index, a power of two
+    uint64_t indexOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+/**
+ * One slot of the pack index. Entries are found by hashing their name with
+ * hashData and probing linearly from slot ( hash & ( slotCount - 1 ) )
+ */
+struct PackEntry
+{
+    uint64_t nameHash;
+    uint64_t offset;            // start of the blob from the start of the file
+    uint64_t size;              // size of the blob in bytes
+    uint32_t nameOffset;        // start of the name in the names block
+    uint32_t nameLength;
+    uint32_t type;              // PackEntryType
+    uint32_t format;            // PixelFormat of image entries
+    uint32_t width;             // image entries only
+    uint32_t height;            // image entries only
+};
+
+const uint32_t PACK_VERSION = 1;
+const size_t PACK_BLOB_ALIGNMENT = 256;
+
+/**
+ * Read only access to a pack file. The file is memory mapped, so opening it
+ * is a single open() call and entries are only read from disk when they are
+ * touched. Images loaded from the pack point straight into the mapping, and
+ * keep it alive for as long as they exist.
+ */
+class AssetPack
+{
+public:
+    AssetPack();
+    ~AssetPack();
+
+    // Map a pack and check that its index is sound
+    bool open( const std::string& filename );
+    void close();
+
+    bool isOpen() const { return mpHeader != NULL; }
+    size_t entryCount() const { return isOpen() ? mpHeader->entryCount : 0; }
+
+    // Find an entry by name, or NULL if it isn't in the pack
+    const PackEntry * find( const std::string& name ) const;
+
+    // Pointer to the start of an entry's blob
+    const unsigned char * entryData( const PackEntry& entry ) const;
+
+    // The mapping itself, for keeping it alive while pointing into it
+    std::shared_ptr<MappedFile> mappedFile() const { return mFile; }
+
+    // Load an image entry without copying its pixels
+    bool loadImage( const std::string& name, Image * pImage ) const;
+
+    // Copy a data entry into a string
+    bool loadText( const std::string& name, std::string * pText ) const;
+
+private:
+    AssetPack( const AssetPack& );
+    AssetPack& operator = ( const AssetPack& );
+
+    bool validate( const std::string& filename ) const;
+
+    std::shared_ptr<MappedFile> mFile;
+    const PackHeader * mpHeader;
+    const PackEntry * mpSlots;
+    const char * mpNames;
+};
+
+/**
+ * Collects entries in memory and writes them out as a pack file
+ */
+class AssetPackWriter
+{
+public:
+    AssetPackWriter();
+
+    // Add a file's contents. Returns false if the name is already taken
+    bool addData( const std::string& name, const void * pData, size_t size );
+
+    // Add decoded pixels. Returns false if the name is already taken
+    bool addImage( const std::string& name, const Image& image );
+
+    // Write everything added so far
+    bool write( const std::string& filename ) const;
+
+    size_t entryCount() const { return mItems.size(); }
+
+private:
+    struct Item
+    {
+        PackEntry entry;
+        std::string name;
+        std::vector<unsigned char> data;
+    };
+
+    bool add( const std::string& name,
+              const void * pData,
+              size_t size,
+              const PackEntry& entry );
+
+    std::vector<Item> mItems;
+};
+
+// Pack shared by the whole program, empty unless opened
+extern AssetPack GAssetPack;
+
+#endif
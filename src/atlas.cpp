@@ -0,0 +1,680 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "atlas.h"
+#include "glutil.h"
+#include "glstate.h"
+#include "imagecodec.h"
+#include "parallel.h"
+#include "texture.h"
+#include "timing.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+// Image sets smaller than this are packed on a single thread
+const size_t PARALLEL_PACK_MIN_IMAGES = 64;
+
+// Smallest atlas size the packer tries
+const int MIN_ATLAS_SIZE = 64;
+
+/**
+ * Copies a row of pixels, adding an opaque alpha channel if the destination
+ * has one and the source doesn't
+ */
+static void copyRow( const unsigned char * pSource,
+                     PixelFormat sourceFormat,
+                     unsigned char * pDest,
+                     PixelFormat destFormat,
+                     int count )
+{
+    if ( sourceFormat == destFormat )
+    {
+        memcpy( pDest, pSource, count * bytesPerPixel( destFormat ) );
+        return;
+    }
+
+    assert( sourceFormat == PIXEL_FORMAT_BGR8 && destFormat == PIXEL_FORMAT_BGRA8 );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        pDest[i * 4 + 0] = pSource[i * 3 + 0];
+        pDest[i * 4 + 1] = pSource[i * 3 + 1];
+        pDest[i * 4 + 2] = pSource[i * 3 + 2];
+        pDest[i * 4 + 3] = 0xFF;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SkylinePacker
+/////////////////////////////////////////////////////////////////////////////
+SkylinePacker::SkylinePacker( int width, int height )
+    : mWidth( width ),
+      mHeight( height ),
+      mUsedArea( 0 ),
+      mSkyline()
+{
+    Segment floor = { 0, 0, width };
+    mSkyline.push_back( floor );
+}
+
+/**
+ * Works out how high a rectangle would sit if its left edge was placed at the
+ * start of a skyline segment
+ *
+ * \return  The y position, or -1 if the rectangle doesn't fit there
+ */
+int SkylinePacker::fit( size_t index, int width, int height ) const
+{
+    int x = mSkyline[index].x;
+
+    if ( x + width > mWidth )
+    {
+        return -1;
+    }
+
+    // The rectangle rests on the highest segment underneath it
+    int y         = 0;
+    int remaining = width;
+
+    for ( size_t i = index; remaining > 0; ++i )
+    {
+        y = std::max( y, mSkyline[i].y );
+
+        if ( y + height > mHeight )
+        {
+            return -1;
+        }
+
+        remaining -= mSkyline[i].width;
+    }
+
+    return y;
+}
+
+/**
+ * Places a rectangle as low as possible, preferring the narrowest segment
+ * when there is a tie so that wide gaps are kept for wide rectangles
+ *
+ * \param  width   Width of the rectangle
+ * \param  height  Height of the rectangle
+ * \param  pX      Receives the left edge of the rectangle
+ * \param  pY      Receives the bottom edge of the rectangle
+ * \return         True if the rectangle was placed
+ */
+bool SkylinePacker::insert( int width, int height, int * pX, int * pY )
+{
+    assert( pX != NULL && pY != NULL );
+
+    int bestIndex = -1;
+    int bestY     = INT_MAX;
+    int bestWidth = INT_MAX;
+
+    for ( size_t i = 0; i < mSkyline.size(); ++i )
+    {
+        int y = fit( i, width, height );
+
+        if ( y >= 0 &&
+             ( y < bestY || ( y == bestY && mSkyline[i].width < bestWidth ) ) )
+        {
+            bestIndex = static_cast<int>( i );
+            bestY     = y;
+            bestWidth = mSkyline[i].width;
+        }
+    }
+
+    if ( bestIndex < 0 )
+    {
+        return false;
+    }
+
+    Segment top = { mSkyline[bestIndex].x, bestY + height, width };
+    mSkyline.insert( mSkyline.begin() + bestIndex, top );
+
+    // Cut away the parts of the following segments that are now covered
+    int right = top.x + top.width;
+    size_t i  = bestIndex + 1;
+
+    while ( i < mSkyline.size() && mSkyline[i].x < right )
+    {
+        int overlap = right - mSkyline[i].x;
+
+        if ( overlap >= mSkyline[i].width )
+        {
+            mSkyline.erase( mSkyline.begin() + i );
+            continue;
+        }
+
+        mSkyline[i].x     += overlap;
+        mSkyline[i].width -= overlap;
+        break;
+    }
+
+    // Neighbouring segments at the same height act as one
+    for ( i = 0; i + 1 < mSkyline.size(); )
+    {
+        if ( mSkyline[i].y == mSkyline[i + 1].y )
+        {
+            mSkyline[i].width += mSkyline[i + 1].width;
+            mSkyline.erase( mSkyline.begin() + i + 1 );
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    mUsedArea += static_cast<size_t>( width ) * height;
+
+    *pX = top.x;
+    *pY = bestY;
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// TextureAtlas
+/////////////////////////////////////////////////////////////////////////////
+TextureAtlas::TextureAtlas()
+    : mTexture( 0 ),
+      mTarget( GL_TEXTURE_2D ),
+      mWidth( 0 ),
+      mHeight( 0 ),
+      mLayers( 0 ),
+      mRegions(),
+      mIndex(),
+      mStats()
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+    // The texture goes away with the context, which is usually gone by the
+    // time globals are destroyed. Nothing to do here
+}
+
+bool TextureAtlas::isArraySupported()
+{
+    return GLEW_VERSION_3_0 || GLEW_EXT_texture_array;
+}
+
+/**
+ * Loads the images, packs them and uploads the result as a single texture
+ *
+ * \param  files   Images to put in the atlas
+ * \param  layout  How to store the images. ATLAS_LAYOUT_ARRAY fails unless
+ *                 the images all have the same size
+ * \param  gutter  Texels of edge padding around each image in a 2D atlas
+ * \return         True if the atlas was built
+ */
+bool TextureAtlas::build( const std::vector<std::string>& files,
+                          AtlasLayout layout,
+                          int gutter )
+{
+    assert( gutter >= 0 );
+    destroy();
+
+    if ( files.empty() )
+    {
+        return false;
+    }
+
+    mStats             = AtlasStats();
+    mStats.imageCount  = files.size();
+    mStats.threadCount = hardwareThreadCount();
+
+    // Decode everything up front, the packer needs to know every size
+    double start = currentTimeMs();
+
+    std::vector<Image> images( files.size() );
+    std::vector<char> loaded( files.size(), 0 );
+
+    parallelFor( files.size(), mStats.threadCount, [&]( size_t i )
+    {
+        loaded[i] = loadImageFile( files[i], &images[i] ) ? 1 : 0;
+    });
+
+    mStats.decodeMs = currentTimeMs() - start;
+
+    for ( size_t i = 0; i < files.size(); ++i )
+    {
+        if (! loaded[i] )
+        {
+            std::cerr << "Failed to load atlas image " << files[i] << std::endl;
+            return false;
+        }
+    }
+
+    bool sameSize   = true;
+    bool sameFormat = true;
+
+    for ( size_t i = 1; i < images.size(); ++i )
+    {
+        sameSize   = sameSize && images[i].width == images[0].width &&
+                     images[i].height == images[0].height;
+        sameFormat = sameFormat && images[i].format == images[0].format;
+    }
+
+    PixelFormat format = sameFormat ? images[0].format : PIXEL_FORMAT_BGRA8;
+
+    GLint maxLayers = 0;
+
+    if ( isArraySupported() )
+    {
+        glGetIntegerv( GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers );
+    }
+
+    bool arrayPossible = sameSize && static_cast<GLint>( images.size() ) <= maxLayers;
+
+    if ( layout == ATLAS_LAYOUT_ARRAY && !arrayPossible )
+    {
+        std::cerr << "Array atlases need images of the same size, and array "
+                  << "texture support" << std::endl;
+        return false;
+    }
+
+    bool useArray = ( layout == ATLAS_LAYOUT_ARRAY ) ||
+                    ( layout == ATLAS_LAYOUT_AUTO && arrayPossible );
+
+    mRegions.resize( images.size() );
+
+    for ( size_t i = 0; i < images.size(); ++i )
+    {
+        mRegions[i].name   = files[i];
+        mRegions[i].width  = images[i].width;
+        mRegions[i].height = images[i].height;
+    }
+
+    std::vector<unsigned char> pixels;
+    size_t pixelSize = bytesPerPixel( format );
+
+    if ( useArray )
+    {
+        mTarget = GL_TEXTURE_2D_ARRAY;
+        mWidth  = images[0].width;
+        mHeight = images[0].height;
+        mLayers = static_cast<int>( images.size() );
+
+        for ( size_t i = 0; i < images.size(); ++i )
+        {
+            mRegions[i].layer = static_cast<int>( i );
+        }
+
+        start = currentTimeMs();
+
+        size_t layerSize = static_cast<size_t>( mWidth ) * mHeight * pixelSize;
+        pixels.resize( layerSize * mLayers );
+
+        // Rows are tightly packed, so a layer converts like one long row.
+        // Mixed formats widen the 3 byte images to the shared BGRA layout
+        parallelFor( images.size(), mStats.threadCount, [&]( size_t i )
+        {
+            copyRow( images[i].pixels(),
+                     images[i].format,
+                     &pixels[layerSize * i],
+                     format,
+                     mWidth * mHeight );
+        });
+
+        mStats.blitMs = currentTimeMs() - start;
+    }
+    else
+    {
+        GLint maxSize = 0;
+        glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+
+        mTarget = GL_TEXTURE_2D;
+        mLayers = 1;
+
+        start = currentTimeMs();
+
+        if (! pack2D( images, gutter, maxSize ) )
+        {
+            std::cerr << "Atlas images don't fit in a " << maxSize << "x"
+                      << maxSize << " texture" << std::endl;
+            return false;
+        }
+
+        mStats.packMs = currentTimeMs() - start;
+        start         = currentTimeMs();
+
+        blit2D( images, format, gutter, &pixels );
+        mStats.blitMs = currentTimeMs() - start;
+    }
+
+    start = currentTimeMs();
+
+    if (! upload( format, pixels ) )
+    {
+        return false;
+    }
+
+    mStats.uploadMs = currentTimeMs() - start;
+
+    size_t imageTexels = 0;
+
+    for ( size_t i = 0; i < mRegions.size(); ++i )
+    {
+        const AtlasRegion& region = mRegions[i];
+        mIndex[region.name] = i;
+        imageTexels += static_cast<size_t>( region.width ) * region.height;
+    }
+
+    mStats.width     = mWidth;
+    mStats.height    = mHeight;
+    mStats.layers    = mLayers;
+    mStats.occupancy = static_cast<double>( imageTexels ) /
+                       ( static_cast<double>( mWidth ) * mHeight * mLayers );
+
+    return true;
+}
+
+/**
+ * Tries increasingly large power of two atlas sizes and keeps the smallest
+ * one that every image fits in. With enough images the sizes are tried in
+ * parallel, and larger sizes are skipped once a smaller one has worked.
+ *
+ * \return  False if the images don't fit in a maxSize square
+ */
+bool TextureAtlas::pack2D( const std::vector<Image>& images, int gutter, int maxSize )
+{
+    // Packing tall rectangles first gives a flatter skyline
+    std::vector<size_t> order( images.size() );
+    size_t totalArea = 0;
+    int widest  = 0;
+    int tallest = 0;
+
+    for ( size_t i = 0; i < images.size(); ++i )
+    {
+        order[i] = i;
+
+        int width  = images[i].width  + gutter * 2;
+        int height = images[i].height + gutter * 2;
+
+        totalArea += static_cast<size_t>( width ) * height;
+        widest     = std::max( widest, width );
+        tallest    = std::max( tallest, height );
+    }
+
+    std::sort( order.begin(), order.end(), [&]( size_t a, size_t b )
+    {
+        if ( images[a].height != images[b].height )
+        {
+            return images[a].height > images[b].height;
+        }
+
+        return images[a].width > images[b].width;
+    });
+
+    // Square and 2:1 sizes that could possibly hold everything, smallest first
+    std::vector< std::pair<int, int> > candidates;
+
+    for ( int width = MIN_ATLAS_SIZE; width <= maxSize; width *= 2 )
+    {
+        for ( int height = width / 2; height <= width * 2 && height <= maxSize; height *= 2 )
+        {
+            if ( width >= widest && height >= tallest &&
+                 static_cast<size_t>( width ) * height >= totalArea )
+            {
+                candidates.push_back( std::make_pair( width, height ) );
+            }
+        }
+    }
+
+    std::stable_sort( candidates.begin(), candidates.end(),
+                      []( const std::pair<int, int>& a, const std::pair<int, int>& b )
+    {
+        return static_cast<size_t>( a.first ) * a.second <
+               static_cast<size_t>( b.first ) * b.second;
+    });
+
+    std::vector< std::vector< std::pair<int, int> > > positions( candidates.size() );
+    std::atomic<size_t> best( candidates.size() );
+    std::atomic<size_t> tried( 0 );
+
+    size_t threads = images.size() >= PARALLEL_PACK_MIN_IMAGES ? mStats.threadCount : 1;
+
+    parallelFor( candidates.size(), threads, [&]( size_t c )
+    {
+        if ( c > best.load() )
+        {
+            return;
+        }
+
+        tried++;
+
+        SkylinePacker packer( candidates[c].first, candidates[c].second );
+        std::vector< std::pair<int, int> > placed( images.size() );
+
+        for ( size_t i = 0; i < order.size(); ++i )
+        {
+            const Image& image = images[ order[i] ];
+
+            if (! packer.insert( image.width  + gutter * 2,
+                                 image.height + gutter * 2,
+                                 &placed[ order[i] ].first,
+                                 &placed[ order[i] ].second ) )
+            {
+                return;
+            }
+        }
+
+        positions[c].swap( placed );
+
+        size_t current = best.load();
+
+        while ( c < current && !best.compare_exchange_weak( current, c ) )
+        {
+        }
+    });
+
+    mStats.candidatesTried = tried.load();
+
+    if ( best.load() == candidates.size() )
+    {
+        return false;
+    }
+
+    mWidth  = candidates[ best.load() ].first;
+    mHeight = candidates[ best.load() ].second;
+
+    const std::vector< std::pair<int, int> >& placed = positions[ best.load() ];
+
+    for ( size_t i = 0; i < mRegions.size(); ++i )
+    {
+        AtlasRegion& region = mRegions[i];
+
+        region.x  = placed[i].first  + gutter;
+        region.y  = placed[i].second + gutter;
+        region.u0 = static_cast<float>( region.x ) / mWidth;
+        region.v0 = static_cast<float>( region.y ) / mHeight;
+        region.u1 = static_cast<float>( region.x + region.width )  / mWidth;
+        region.v1 = static_cast<float>( region.y + region.height ) / mHeight;
+    }
+
+    return true;
+}
+
+/**
+ * Copies the images into their regions and fills each gutter with copies of
+ * the nearest edge texels. Regions don't overlap, so the images are copied in
+ * parallel
+ */
+void TextureAtlas::blit2D( const std::vector<Image>& images,
+                           PixelFormat format,
+                           int gutter,
+                           std::vector<unsigned char> * pPixels ) const
+{
+    size_t pixelSize = bytesPerPixel( format );
+    size_t pitch     = mWidth * pixelSize;
+
+    pPixels->assign( pitch * mHeight, 0 );
+    unsigned char * pAtlas = &(*pPixels)[0];
+
+    parallelFor( images.size(), mStats.threadCount, [&]( size_t i )
+    {
+        const Image& image        = images[i];
+        const AtlasRegion& region = mRegions[i];
+        size_t sourcePitch        = image.width * bytesPerPixel( image.format );
+
+        for ( int row = 0; row < image.height; ++row )
+        {
+            unsigned char * pRow = pAtlas + ( region.y + row ) * pitch;
+
+            copyRow( image.pixels() + row * sourcePitch,
+                     image.format,
+                     pRow + region.x * pixelSize,
+                     format,
+                     image.width );
+
+            for ( int g = 1; g <= gutter; ++g )
+            {
+                memcpy( pRow + ( region.x - g ) * pixelSize,
+                        pRow + region.x * pixelSize,
+                        pixelSize );
+                memcpy( pRow + ( region.x + image.width - 1 + g ) * pixelSize,
+                        pRow + ( region.x + image.width - 1 ) * pixelSize,
+                        pixelSize );
+            }
+        }
+
+        // Gutter rows copy the padded first and last rows, corners included
+        size_t paddedSize = ( image.width + gutter * 2 ) * pixelSize;
+        size_t left       = ( region.x - gutter ) * pixelSize;
+
+        for ( int g = 1; g <= gutter; ++g )
+        {
+            memcpy( pAtlas + ( region.y - g ) * pitch + left,
+                    pAtlas + region.y * pitch + left,
+                    paddedSize );
+            memcpy( pAtlas + ( region.y + image.height - 1 + g ) * pitch + left,
+                    pAtlas + ( region.y + image.height - 1 ) * pitch + left,
+                    paddedSize );
+        }
+    });
+}
+
+/**
+ * Creates the atlas texture and uploads the packed pixels
+ */
+bool TextureAtlas::upload( PixelFormat format, const std::vector<unsigned char>& pixels )
+{
+    glGenTextures( 1, &mTexture );
+
+    if ( mTarget == GL_TEXTURE_2D )
+    {
+        uploadTexturePixels( mTexture, mWidth, mHeight, format, &pixels[0] );
+    }
+    else
+    {
+        GStateCache.bindTexture( 0, GL_TEXTURE_2D_ARRAY, mTexture );
+
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE );
+
+        // Layers are tightly packed, which rows of BGR images with odd
+        // widths aren't by default
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        glTexImage3D( GL_TEXTURE_2D_ARRAY,
+                      0,
+                      textureInternalFormat( format ),
+                      mWidth,
+                      mHeight,
+                      mLayers,
+                      0,
+                      textureFormat( format ),
+                      GL_UNSIGNED_BYTE,
+                      &pixels[0] );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    }
+
+    if ( checkGlFailure( "Uploading texture atlas" ) )
+    {
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Deletes the atlas texture and forgets its regions
+ */
+void TextureAtlas::destroy()
+{
+    if ( mTexture != 0 )
+    {
+        glDeleteTextures( 1, &mTexture );
+
+        // GL reuses names, so the cache must not think it is still bound
+        GStateCache.invalidate();
+        mTexture = 0;
+    }
+
+    mRegions.clear();
+    mIndex.clear();
+    mWidth  = 0;
+    mHeight = 0;
+    mLayers = 0;
+}
+
+const AtlasRegion * TextureAtlas::find( const std::string& name ) const
+{
+    std::map<std::string, size_t>::const_iterator itr = mIndex.find( name );
+    return itr == mIndex.end() ? NULL : &mRegions[itr->second];
+}
+
+/**
+ * Converts a texture coordinate within an image (0 to 1 across the image) to
+ * the matching coordinate in the atlas. Layers of array atlases cover the
+ * whole texture, so for those the coordinate is unchanged
+ */
+void TextureAtlas::remapUv( const AtlasRegion& region,
+                            float u,
+                            float v,
+                            float * pU,
+                            float * pV )
+{
+    assert( pU != NULL && pV != NULL );
+
+    *pU = region.u0 + ( region.u1 - region.u0 ) * u;
+    *pV = region.v0 + ( region.v1 - region.v0 ) * v;
+}
+
+void TextureAtlas::printStats() const
+{
+    printf( "Atlas: %zu images in %dx%dx%d %s, %.1f%% occupied, "
+            "%zu sizes tried on %zu threads\n",
+            mStats.imageCount,
+            mStats.width,
+            mStats.height,
+            mStats.layers,
+            mTarget == GL_TEXTURE_2D_ARRAY ? "array" : "2D",
+            mStats.occupancy * 100.0,
+            mStats.candidatesTried,
+            mStats.threadCount );
+    printf( "Atlas build: decode %.3f ms, pack %.3f ms, blit %.3f ms, "
+            "upload %.3f ms\n",
+            mStats.decodeMs,
+            mStats.packMs,
+            mStats.blitMs,
+            mStats.uploadMs );
+}
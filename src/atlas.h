@@ -0,0 +1,199 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_ATLAS_H
+#define SCOTT_GFXSANDBOX_ATLAS_H
+
+#include "tga.h"
+#include <GL/glew.h>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Packs rectangles into a fixed size area with the skyline bottom-left
+ * heuristic. The packer only tracks the top edge of the packed area, which
+ * wastes a little space under overhangs but makes each insert cheap.
+ */
+class SkylinePacker
+{
+public:
+    SkylinePacker( int width, int height );
+
+    // Find room for a rectangle. Returns false if it doesn't fit
+    bool insert( int width, int height, int * pX, int * pY );
+
+    // Area covered by inserted rectangles
+    size_t usedArea() const { return mUsedArea; }
+
+private:
+    struct Segment
+    {
+        int x;
+        int y;          // height of the skyline over this segment
+        int width;
+    };
+
+    int fit( size_t index, int width, int height ) const;
+
+    int mWidth;
+    int mHeight;
+    size_t mUsedArea;
+    std::vector<Segment> mSkyline;
+};
+
+/**
+ * How an atlas stores its images
+ */
+enum AtlasLayout
+{
+    ATLAS_LAYOUT_AUTO,      // array when the images allow it, else 2D
+    ATLAS_LAYOUT_2D,        // images packed side by side in a 2D texture
+    ATLAS_LAYOUT_ARRAY      // one layer per image of a GL_TEXTURE_2D_ARRAY
+};
+
+/**
+ * Where an image ended up in an atlas
+ */
+struct AtlasRegion
+{
+    AtlasRegion()
+        : name(),
+          x( 0 ),
+          y( 0 ),
+          width( 0 ),
+          height( 0 ),
+          layer( 0 ),
+          u0( 0.0f ),
+          v0( 0.0f ),
+          u1( 1.0f ),
+          v1( 1.0f )
+    {
+    }
+
+    std::string name;       // file the image was loaded from
+    int x, y;               // texel position of the image, not the gutter
+    int width, height;
+    int layer;              // always 0 in 2D atlases
+    float u0, v0, u1, v1;   // texture coordinates of the image's corners
+};
+
+/**
+ * Timings and space usage of an atlas build
+ */
+struct AtlasStats
+{
+    AtlasStats()
+        : imageCount( 0 ),
+          width( 0 ),
+          height( 0 ),
+          layers( 0 ),
+          occupancy( 0.0 ),
+          candidatesTried( 0 ),
+          threadCount( 0 ),
+          decodeMs( 0.0 ),
+          packMs( 0.0 ),
+          blitMs( 0.0 ),
+          uploadMs( 0.0 )
+    {
+    }
+
+    size_t imageCount;
+    int width;
+    int height;
+    int layers;
+    double occupancy;           // fraction of texels holding image data
+    size_t candidatesTried;     // atlas sizes the packer attempted
+    size_t threadCount;
+    double decodeMs;
+    double packMs;
+    double blitMs;
+    double uploadMs;
+};
+
+/**
+ * Loads a set of images into one texture so that draws using different images
+ * can share a binding.
+ *
+ * In a 2D atlas every image is surrounded by a gutter of copies of its edge
+ * texels, so bilinear filtering at the edge of an image never picks up its
+ * neighbours. Several atlas sizes are packed in parallel and the smallest one
+ * that fits is kept. Images that all have the same size and format can
+ * instead become the layers of a texture array, which needs no gutters and
+ * wastes no space.
+ *
+ * Consumers look an image up with find() and sample through remapUv().
+ * Decoding and copying images into the atlas is split over worker threads.
+ */
+class TextureAtlas
+{
+public:
+    TextureAtlas();
+    ~TextureAtlas();
+
+    // Load and pack the images, and upload the atlas texture
+    bool build( const std::vector<std::string>& files,
+                AtlasLayout layout = ATLAS_LAYOUT_AUTO,
+                int gutter = 2 );
+
+    // Delete the texture. Must be called while the context is current
+    void destroy();
+
+    // Region of an image, or NULL if it isn't in the atlas
+    const AtlasRegion * find( const std::string& name ) const;
+
+    // Map a texture coordinate of an image to the atlas
+    static void remapUv( const AtlasRegion& region,
+                         float u,
+                         float v,
+                         float * pU,
+                         float * pV );
+
+    GLuint texture() const { return mTexture; }
+    GLenum target() const { return mTarget; }
+    size_t regionCount() const { return mRegions.size(); }
+    const AtlasRegion& region( size_t index ) const { return mRegions[index]; }
+    const AtlasStats& stats() const { return mStats; }
+
+    // Print sizes and timings of the last build
+    void printStats() const;
+
+    // Check if the current context supports array texture atlases
+    static bool isArraySupported();
+
+private:
+    TextureAtlas( const TextureAtlas& );
+    TextureAtlas& operator = ( const TextureAtlas& );
+
+    bool pack2D( const std::vector<Image>& images, int gutter, int maxSize );
+    void blit2D( const std::vector<Image>& images,
+                 PixelFormat format,
+                 int gutter,
+                 std::vector<unsigned char> * pPixels ) const;
+    bool upload( PixelFormat format, const std::vector<unsigned char>& pixels );
+
+private:
+    GLuint mTexture;
+    GLenum mTarget;
+    int mWidth;
+    int mHeight;
+    int mLayers;
+    std::vector<AtlasRegion> mRegions;
+    std::map<std::string, size_t> mIndex;
+    AtlasStats mStats;
+};
+
+#endif
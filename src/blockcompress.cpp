@@ -0,0 +1,780 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "blockcompress.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#define GFXSANDBOX_BLOCK_SSE2 1
+#include <emmintrin.h>
+#endif
+
+const int BLOCK_TEXELS = 16;
+
+// Rounds of single step endpoint tweaks tried after the least squares fit
+const int ENDPOINT_SEARCH_PASSES = 4;
+
+// Interpolation weights of the first endpoint for each 2-bit color index
+const float INDEX_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+/**
+ * A block's texels with one array per channel, so that four texels can be
+ * compared against a palette entry at once
+ */
+struct BlockColors
+{
+    alignas( 16 ) float r[BLOCK_TEXELS];
+    alignas( 16 ) float g[BLOCK_TEXELS];
+    alignas( 16 ) float b[BLOCK_TEXELS];
+};
+
+/**
+ * Candidate endpoints for a color block, with the indices and error they give
+ */
+struct ColorFit
+{
+    uint16_t color0;
+    uint16_t color1;
+    uint32_t indices;
+    float error;
+};
+
+size_t blockSize( BlockFormat format )
+{
+    return ( format == BLOCK_FORMAT_BC1 ? 8 : 16 );
+}
+
+size_t compressedImageSize( BlockFormat format, int width, int height )
+{
+    size_t blocksX = static_cast<size_t>( width + 3 ) / 4;
+    size_t blocksY = static_cast<size_t>( height + 3 ) / 4;
+
+    return blocksX * blocksY * blockSize( format );
+}
+
+const char * blockSearchKernelName()
+{
+#ifdef GFXSANDBOX_BLOCK_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/**
+ * Expands a 5:6:5 color to 8 bits per channel by replicating the high bits,
+ * which is what the hardware does
+ */
+static void unpack565( uint16_t color, int * pRgb )
+{
+    int r = ( color >> 11 ) & 31;
+    int g = ( color >> 5 ) & 63;
+    int b = color & 31;
+
+    pRgb[0] = ( r << 3 ) | ( r >> 2 );
+    pRgb[1] = ( g << 2 ) | ( g >> 4 );
+    pRgb[2] = ( b << 3 ) | ( b >> 2 );
+}
+
+/**
+ * Rounds an 8 bit per channel color to the nearest 5:6:5 color
+ */
+static uint16_t pack565( float r, float g, float b )
+{
+    int r5 = std::min( std::max( static_cast<int>( r * ( 31.0f / 255.0f ) + 0.5f ), 0 ), 31 );
+    int g6 = std::min( std::max( static_cast<int>( g * ( 63.0f / 255.0f ) + 0.5f ), 0 ), 63 );
+    int b5 = std::min( std::max( static_cast<int>( b * ( 31.0f / 255.0f ) + 0.5f ), 0 ), 31 );
+
+    return static_cast<uint16_t>( ( r5 << 11 ) | ( g6 << 5 ) | b5 );
+}
+
+/**
+ * Builds the four colors a block can choose from. With fourColor false the
+ * block is in BC1's three color mode, where index 3 is transparent black
+ */
+static void colorPalette( uint16_t color0, uint16_t color1, bool fourColor, int palette[4][3] )
+{
+    unpack565( color0, palette[0] );
+    unpack565( color1, palette[1] );
+
+    for ( int c = 0; c < 3; ++c )
+    {
+        if ( fourColor )
+        {
+            palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+            palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+        }
+        else
+        {
+            palette[2][c] = ( palette[0][c] + palette[1][c] ) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+#ifdef GFXSANDBOX_BLOCK_SSE2
+/**
+ * Picks the closest palette entry for every texel, four texels at a time
+ *
+ * \return  Sum of the squared errors of the chosen entries
+ */
+static float fitIndices( const BlockColors& colors, const int palette[4][3], uint32_t * pIndices )
+{
+    __m128 total      = _mm_setzero_ps();
+    uint32_t indices  = 0;
+
+    for ( int group = 0; group < BLOCK_TEXELS; group += 4 )
+    {
+        __m128 r = _mm_load_ps( colors.r + group );
+        __m128 g = _mm_load_ps( colors.g + group );
+        __m128 b = _mm_load_ps( colors.b + group );
+
+        __m128 bestError  = _mm_set1_ps( FLT_MAX );
+        __m128i bestIndex = _mm_setzero_si128();
+
+        for ( int p = 0; p < 4; ++p )
+        {
+            __m128 dr = _mm_sub_ps( r, _mm_set1_ps( static_cast<float>( palette[p][0] ) ) );
+            __m128 dg = _mm_sub_ps( g, _mm_set1_ps( static_cast<float>( palette[p][1] ) ) );
+            __m128 db = _mm_sub_ps( b, _mm_set1_ps( static_cast<float>( palette[p][2] ) ) );
+
+            __m128 error = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dr, dr ), _mm_mul_ps( dg, dg ) ),
+                                       _mm_mul_ps( db, db ) );
+
+            // Strictly less, so ties go to the lower index like the scalar path
+            __m128i closer = _mm_castps_si128( _mm_cmplt_ps( error, bestError ) );
+
+            bestError = _mm_min_ps( error, bestError );
+            bestIndex = _mm_or_si128( _mm_andnot_si128( closer, bestIndex ),
+                                      _mm_and_si128( closer, _mm_set1_epi32( p ) ) );
+        }
+
+        total = _mm_add_ps( total, bestError );
+
+        alignas( 16 ) uint32_t chosen[4];
+        _mm_store_si128( reinterpret_cast<__m128i*>( chosen ), bestIndex );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            indices |= chosen[i] << ( 2 * ( group + i ) );
+        }
+    }
+
+    alignas( 16 ) float sums[4];
+    _mm_store_ps( sums, total );
+
+    *pIndices = indices;
+    return ( sums[0] + sums[1] ) + ( sums[2] + sums[3] );
+}
+#else
+/**
+ * Picks the closest palette entry for every texel
+ *
+ * \return  Sum of the squared errors of the chosen entries
+ */
+static float fitIndices( const BlockColors& colors, const int palette[4][3], uint32_t * pIndices )
+{
+    float sums[4]    = { 0.0f, 0.0f, 0.0f, 0.0f };
+    uint32_t indices = 0;
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        float bestError = FLT_MAX;
+        uint32_t best   = 0;
+
+        for ( int p = 0; p < 4; ++p )
+        {
+            float dr = colors.r[i] - static_cast<float>( palette[p][0] );
+            float dg = colors.g[i] - static_cast<float>( palette[p][1] );
+            float db = colors.b[i] - static_cast<float>( palette[p][2] );
+            float error = dr * dr + dg * dg + db * db;
+
+            if ( error < bestError )
+            {
+                bestError = error;
+                best      = p;
+            }
+        }
+
+        sums[i % 4] += bestError;
+        indices     |= best << ( 2 * i );
+    }
+
+    *pIndices = indices;
+    return ( sums[0] + sums[1] ) + ( sums[2] + sums[3] );
+}
+#endif
+
+/**
+ * Works out the indices and error of a pair of endpoints, and keeps them if
+ * they beat the best fit so far
+ *
+ * \return  True if the endpoints were better
+ */
+static bool tryEndpoints( const BlockColors& colors,
+                          uint16_t color0,
+                          uint16_t color1,
+                          ColorFit * pBest )
+{
+    int palette[4][3];
+    colorPalette( color0, color1, true, palette );
+
+    uint32_t indices = 0;
+    float error      = fitIndices( colors, palette, &indices );
+
+    if ( error < pBest->error )
+    {
+        pBest->color0  = color0;
+        pBest->color1  = color1;
+        pBest->indices = indices;
+        pBest->error   = error;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Finds the endpoints that best reproduce the texels for a given choice of
+ * palette entries, by least squares
+ *
+ * \return  False if the indices don't constrain both endpoints
+ */
+static bool refitEndpoints( const BlockColors& colors,
+                            uint32_t indices,
+                            uint16_t * pColor0,
+                            uint16_t * pColor1 )
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float a[3] = { 0.0f, 0.0f, 0.0f };
+    float b[3] = { 0.0f, 0.0f, 0.0f };
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        float w0 = INDEX_WEIGHTS[ ( indices >> ( 2 * i ) ) & 3 ];
+        float w1 = 1.0f - w0;
+
+        aa += w0 * w0;
+        ab += w0 * w1;
+        bb += w1 * w1;
+
+        a[0] += w0 * colors.r[i];  b[0] += w1 * colors.r[i];
+        a[1] += w0 * colors.g[i];  b[1] += w1 * colors.g[i];
+        a[2] += w0 * colors.b[i];  b[2] += w1 * colors.b[i];
+    }
+
+    float determinant = aa * bb - ab * ab;
+
+    if ( fabsf( determinant ) < 1e-6f )
+    {
+        return false;
+    }
+
+    float e0[3], e1[3];
+
+    for ( int c = 0; c < 3; ++c )
+    {
+        e0[c] = ( bb * a[c] - ab * b[c] ) / determinant;
+        e1[c] = ( aa * b[c] - ab * a[c] ) / determinant;
+    }
+
+    *pColor0 = pack565( e0[0], e0[1], e0[2] );
+    *pColor1 = pack565( e1[0], e1[1], e1[2] );
+
+    return true;
+}
+
+/**
+ * Moves one channel of a 5:6:5 color by one step
+ *
+ * \return  False if the channel is already at the end of its range
+ */
+static bool nudge565( uint16_t color, int channel, int delta, uint16_t * pResult )
+{
+    const int SHIFT[3] = { 11, 5, 0 };
+    const int MAX[3]   = { 31, 63, 31 };
+
+    int value = ( ( color >> SHIFT[channel] ) & MAX[channel] ) + delta;
+
+    if ( value < 0 || value > MAX[channel] )
+    {
+        return false;
+    }
+
+    *pResult = static_cast<uint16_t>( ( color & ~( MAX[channel] << SHIFT[channel] ) ) |
+                                      ( value << SHIFT[channel] ) );
+    return true;
+}
+
+/**
+ * Encodes the color half of a block in four color mode. The endpoints start
+ * at the ends of the texels' principal axis, are refined by least squares and
+ * then by a local search over single steps of each 5:6:5 channel. Every
+ * candidate is scored with the SIMD index search
+ */
+static void encodeColorBlock( const unsigned char * pBgra, unsigned char * pBlock )
+{
+    BlockColors colors;
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        colors.r[i] = pBgra[i * 4 + 2];
+        colors.g[i] = pBgra[i * 4 + 1];
+        colors.b[i] = pBgra[i * 4 + 0];
+
+        mean[0] += colors.r[i];
+        mean[1] += colors.g[i];
+        mean[2] += colors.b[i];
+    }
+
+    for ( int c = 0; c < 3; ++c )
+    {
+        mean[c] /= BLOCK_TEXELS;
+    }
+
+    // Covariance of the texels, for finding the axis they spread along
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        float r = colors.r[i] - mean[0];
+        float g = colors.g[i] - mean[1];
+        float b = colors.b[i] - mean[2];
+
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // Power iteration converges on the principal axis quickly enough for a
+    // 3x3 matrix. It starts from the covariance row of the channel that
+    // varies most: a fixed start like grey can be mapped to zero, eg when
+    // red and green trade off at the same brightness, which would collapse
+    // the endpoints to the mean. That row is only zero when every texel is
+    // the same color, and then the channel's own axis is as good as any
+    static const int rowIndices[3][3] = { { 0, 1, 2 }, { 1, 3, 4 }, { 2, 4, 5 } };
+
+    int major = 0;
+
+    for ( int c = 1; c < 3; ++c )
+    {
+        if ( covariance[rowIndices[c][c]] > covariance[rowIndices[major][major]] )
+        {
+            major = c;
+        }
+    }
+
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+    axis[major]   = 1.0f;
+
+    float seedLength = std::max( std::max( fabsf( covariance[rowIndices[major][0]] ),
+                                           fabsf( covariance[rowIndices[major][1]] ) ),
+                                 fabsf( covariance[rowIndices[major][2]] ) );
+
+    if ( seedLength >= 1e-6f )
+    {
+        for ( int c = 0; c < 3; ++c )
+        {
+            axis[c] = covariance[rowIndices[major][c]] / seedLength;
+        }
+    }
+
+    for ( int iteration = 0; iteration < 8; ++iteration )
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float length = std::max( std::max( fabsf( x ), fabsf( y ) ), fabsf( z ) );
+
+        if ( length < 1e-6f )
+        {
+            break;      // every texel is the same color
+        }
+
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    float lowest  = FLT_MAX;
+    float highest = -FLT_MAX;
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        float t = ( colors.r[i] - mean[0] ) * axis[0] +
+                  ( colors.g[i] - mean[1] ) * axis[1] +
+                  ( colors.b[i] - mean[2] ) * axis[2];
+
+        lowest  = std::min( lowest, t );
+        highest = std::max( highest, t );
+    }
+
+    float scale = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    lowest  /= scale;
+    highest /= scale;
+
+    ColorFit best;
+    best.color0  = 0;
+    best.color1  = 0;
+    best.indices = 0;
+    best.error   = FLT_MAX;
+
+    tryEndpoints( colors,
+                  pack565( mean[0] + axis[0] * highest,
+                           mean[1] + axis[1] * highest,
+                           mean[2] + axis[2] * highest ),
+                  pack565( mean[0] + axis[0] * lowest,
+                           mean[1] + axis[1] * lowest,
+                           mean[2] + axis[2] * lowest ),
+                  &best );
+
+    uint16_t color0 = 0;
+    uint16_t color1 = 0;
+
+    if ( best.error > 0.0f && refitEndpoints( colors, best.indices, &color0, &color1 ) )
+    {
+        tryEndpoints( colors, color0, color1, &best );
+    }
+
+    for ( int pass = 0; pass < ENDPOINT_SEARCH_PASSES && best.error > 0.0f; ++pass )
+    {
+        bool improved = false;
+
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            for ( int delta = -1; delta <= 1; delta += 2 )
+            {
+                uint16_t nudged = 0;
+
+                if ( nudge565( best.color0, channel, delta, &nudged ) )
+                {
+                    improved |= tryEndpoints( colors, nudged, best.color1, &best );
+                }
+
+                if ( nudge565( best.color1, channel, delta, &nudged ) )
+                {
+                    improved |= tryEndpoints( colors, best.color0, nudged, &best );
+                }
+            }
+        }
+
+        if (! improved )
+        {
+            break;
+        }
+    }
+
+    // Four color mode needs color0 > color1. Swapping the endpoints swaps
+    // indices 0 with 1 and 2 with 3. Equal endpoints can only be decoded in
+    // three color mode, where index 0 is still the endpoint
+    uint16_t first   = best.color0;
+    uint16_t second  = best.color1;
+    uint32_t indices = best.indices;
+
+    if ( first < second )
+    {
+        std::swap( first, second );
+        indices ^= 0x55555555;
+    }
+    else if ( first == second )
+    {
+        indices = 0;
+    }
+
+    pBlock[0] = static_cast<unsigned char>( first & 0xFF );
+    pBlock[1] = static_cast<unsigned char>( first >> 8 );
+    pBlock[2] = static_cast<unsigned char>( second & 0xFF );
+    pBlock[3] = static_cast<unsigned char>( second >> 8 );
+
+    for ( int i = 0; i < 4; ++i )
+    {
+        pBlock[4 + i] = static_cast<unsigned char>( indices >> ( 8 * i ) );
+    }
+}
+
+/**
+ * Builds the eight alphas a BC3 alpha block can choose from, in the mode
+ * where the first endpoint is the larger one
+ */
+static void alphaPalette( int alpha0, int alpha1, int palette[8] )
+{
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+
+    for ( int i = 2; i < 8; ++i )
+    {
+        palette[i] = ( ( 8 - i ) * alpha0 + ( i - 1 ) * alpha1 ) / 7;
+    }
+}
+
+/**
+ * Encodes the alpha half of a BC3 block between the block's lowest and
+ * highest alpha
+ */
+static void encodeAlphaBlock( const unsigned char * pBgra, unsigned char * pBlock )
+{
+    int lowest  = 255;
+    int highest = 0;
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        lowest  = std::min( lowest,  static_cast<int>( pBgra[i * 4 + 3] ) );
+        highest = std::max( highest, static_cast<int>( pBgra[i * 4 + 3] ) );
+    }
+
+    int palette[8];
+    alphaPalette( highest, lowest, palette );
+
+    uint64_t indices = 0;
+
+    for ( int i = 0; i < BLOCK_TEXELS && highest != lowest; ++i )
+    {
+        int alpha     = pBgra[i * 4 + 3];
+        int bestError = 256;
+        uint64_t best = 0;
+
+        for ( int p = 0; p < 8; ++p )
+        {
+            int error = abs( alpha - palette[p] );
+
+            if ( error < bestError )
+            {
+                bestError = error;
+                best      = p;
+            }
+        }
+
+        indices |= best << ( 3 * i );
+    }
+
+    pBlock[0] = static_cast<unsigned char>( highest );
+    pBlock[1] = static_cast<unsigned char>( lowest );
+
+    for ( int i = 0; i < 6; ++i )
+    {
+        pBlock[2 + i] = static_cast<unsigned char>( indices >> ( 8 * i ) );
+    }
+}
+
+/**
+ * Compresses one block of 16 BGRA texels
+ *
+ * \param  format  Format to compress to
+ * \param  pBgra   Texels, four rows of four
+ * \param  pBlock  Receives blockSize( format ) bytes
+ */
+void encodeBlock( BlockFormat format, const unsigned char * pBgra, unsigned char * pBlock )
+{
+    if ( format == BLOCK_FORMAT_BC3 )
+    {
+        encodeAlphaBlock( pBgra, pBlock );
+        pBlock += 8;
+    }
+
+    encodeColorBlock( pBgra, pBlock );
+}
+
+/**
+ * Decompresses one block into 16 BGRA texels. The arithmetic matches what
+ * desktop GPUs do, give or take a unit of rounding
+ *
+ * \param  format  Format of the block
+ * \param  pBlock  The compressed block
+ * \param  pBgra   Receives the texels, four rows of four
+ */
+void decodeBlock( BlockFormat format, const unsigned char * pBlock, unsigned char * pBgra )
+{
+    int alphas[BLOCK_TEXELS];
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        alphas[i] = 255;
+    }
+
+    if ( format == BLOCK_FORMAT_BC3 )
+    {
+        int alpha0 = pBlock[0];
+        int alpha1 = pBlock[1];
+        int palette[8];
+
+        if ( alpha0 > alpha1 )
+        {
+            alphaPalette( alpha0, alpha1, palette );
+        }
+        else
+        {
+            // Six interpolated alphas plus fully transparent and opaque
+            palette[0] = alpha0;
+            palette[1] = alpha1;
+
+            for ( int i = 2; i < 6; ++i )
+            {
+                palette[i] = ( ( 6 - i ) * alpha0 + ( i - 1 ) * alpha1 ) / 5;
+            }
+
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        uint64_t indices = 0;
+
+        for ( int i = 0; i < 6; ++i )
+        {
+            indices |= static_cast<uint64_t>( pBlock[2 + i] ) << ( 8 * i );
+        }
+
+        for ( int i = 0; i < BLOCK_TEXELS; ++i )
+        {
+            alphas[i] = palette[ ( indices >> ( 3 * i ) ) & 7 ];
+        }
+
+        pBlock += 8;
+    }
+
+    uint16_t color0 = static_cast<uint16_t>( pBlock[0] | ( pBlock[1] << 8 ) );
+    uint16_t color1 = static_cast<uint16_t>( pBlock[2] | ( pBlock[3] << 8 ) );
+    uint32_t indices = pBlock[4] | ( pBlock[5] << 8 ) | ( pBlock[6] << 16 ) |
+                       ( static_cast<uint32_t>( pBlock[7] ) << 24 );
+
+    // BC3 color blocks are always in four color mode
+    bool fourColor = ( format == BLOCK_FORMAT_BC3 || color0 > color1 );
+
+    int palette[4][3];
+    colorPalette( color0, color1, fourColor, palette );
+
+    for ( int i = 0; i < BLOCK_TEXELS; ++i )
+    {
+        int index = ( indices >> ( 2 * i ) ) & 3;
+
+        pBgra[i * 4 + 0] = static_cast<unsigned char>( palette[index][2] );
+        pBgra[i * 4 + 1] = static_cast<unsigned char>( palette[index][1] );
+        pBgra[i * 4 + 2] = static_cast<unsigned char>( palette[index][0] );
+        pBgra[i * 4 + 3] = static_cast<unsigned char>(
+            ( !fourColor && index == 3 ) ? 0 : alphas[i] );
+    }
+}
+
+/**
+ * Compresses a whole image. Blocks that hang over the right or top edge
+ * repeat the edge texels. Rows of blocks are independent, so they are spread
+ * over worker threads
+ *
+ * \param  image        Image to compress
+ * \param  format       Format to compress to
+ * \param  pOutput      Receives the blocks, in the same row order as the image
+ * \param  threadCount  Threads to use, or zero for one per core
+ */
+void compressImage( const Image& image,
+                    BlockFormat format,
+                    std::vector<unsigned char> * pOutput,
+                    size_t threadCount )
+{
+    assert( pOutput != NULL );
+
+    int blocksX      = ( image.width + 3 ) / 4;
+    int blocksY      = ( image.height + 3 ) / 4;
+    size_t pixelSize = bytesPerPixel( image.format );
+    size_t pitch     = image.width * pixelSize;
+    size_t rowSize   = blocksX * blockSize( format );
+
+    pOutput->resize( compressedImageSize( format, image.width, image.height ) );
+
+    const unsigned char * pPixels = image.pixels();
+    unsigned char * pBlocks       = pOutput->empty() ? NULL : &(*pOutput)[0];
+
+    if ( threadCount == 0 )
+    {
+        threadCount = hardwareThreadCount();
+    }
+
+    parallelFor( blocksY, threadCount, [&]( size_t blockY )
+    {
+        unsigned char texels[BLOCK_TEXELS * 4];
+
+        for ( int blockX = 0; blockX < blocksX; ++blockX )
+        {
+            for ( int i = 0; i < BLOCK_TEXELS; ++i )
+            {
+                int x = std::min( blockX * 4 + ( i % 4 ), image.width - 1 );
+                int y = std::min( static_cast<int>( blockY ) * 4 + ( i / 4 ), image.height - 1 );
+                const unsigned char * pTexel = pPixels + y * pitch + x * pixelSize;
+
+                texels[i * 4 + 0] = pTexel[0];
+                texels[i * 4 + 1] = pTexel[1];
+                texels[i * 4 + 2] = pTexel[2];
+                texels[i * 4 + 3] = ( image.format == PIXEL_FORMAT_BGRA8 ? pTexel[3] : 255 );
+            }
+
+            encodeBlock( format, texels, pBlocks + blockY * rowSize + blockX * blockSize( format ) );
+        }
+    });
+}
+
+/**
+ * Decompresses a whole image
+ *
+ * \param  pData   Blocks, as written by compressImage
+ * \param  format  Format of the blocks
+ * \param  width   Width of the image in texels
+ * \param  height  Height of the image in texels
+ * \param  pBgra   Receives tightly packed BGRA rows
+ */
+void decompressImage( const unsigned char * pData,
+                      BlockFormat format,
+                      int width,
+                      int height,
+                      std::vector<unsigned char> * pBgra )
+{
+    assert( pBgra != NULL );
+
+    int blocksX = ( width + 3 ) / 4;
+    int blocksY = ( height + 3 ) / 4;
+
+    pBgra->resize( static_cast<size_t>( width ) * height * 4 );
+
+    unsigned char texels[BLOCK_TEXELS * 4];
+
+    for ( int blockY = 0; blockY < blocksY; ++blockY )
+    {
+        for ( int blockX = 0; blockX < blocksX; ++blockX )
+        {
+            decodeBlock( format, pData, texels );
+            pData += blockSize( format );
+
+            for ( int i = 0; i < BLOCK_TEXELS; ++i )
+            {
+                int x = blockX * 4 + ( i % 4 );
+                int y = blockY * 4 + ( i / 4 );
+
+                if ( x < width && y < height )
+                {
+                    memcpy( &(*pBgra)[ ( static_cast<size_t>( y ) * width + x ) * 4 ],
+                            texels + i * 4,
+                            4 );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_BLOCKCOMPRESS_H
+#define SCOTT_GFXSANDBOX_BLOCKCOMPRESS_H
+
+#include "tga.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * Block compressed texture formats. Both store 4x4 texel blocks
+ */
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1,           // DXT1, 8 bytes per block, opaque color
+    BLOCK_FORMAT_BC3            // DXT5, 16 bytes per block, color and alpha
+};
+
+// Size of one 4x4 block in bytes
+size_t blockSize( BlockFormat format );
+
+// Size of a compressed image, counting partial blocks at the edges
+size_t compressedImageSize( BlockFormat format, int width, int height );
+
+// Compress 16 texels given as BGRA, row by row
+void encodeBlock( BlockFormat format, const unsigned char * pBgra, unsigned char * pBlock );
+
+// Decompress one block into 16 BGRA texels, row by row
+void decodeBlock( BlockFormat format, const unsigned char * pBlock, unsigned char * pBgra );
+
+// Compress an image, splitting the block rows over threads
+void compressImage( const Image& image,
+                    BlockFormat format,
+                    std::vector<unsigned char> * pOutput,
+                    size_t threadCount = 0 );
+
+// Decompress an image into tightly packed BGRA rows
+void decompressImage( const unsigned char * pData,
+                      BlockFormat format,
+                      int width,
+                      int height,
+                      std::vector<unsigned char> * pBgra );
+
+// Name of the block search the encoder was built with
+const char * blockSearchKernelName();
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bufferarena.h"
+#include "glutil.h"
+#include "glstate.h"
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+BufferArenaPool GBufferArenas;
+
+/**
+ * Rounds a value up to a multiple of a power of two
+ */
+static size_t alignUp( size_t value, size_t alignment )
+{
+    return ( value + alignment - 1 ) & ~( alignment - 1 );
+}
+
+/**
+ * Orders ranges by where they are in their arena
+ */
+static bool rangeOffsetLess( const BufferRange * pA, const BufferRange * pB )
+{
+    return pA->offset < pB->offset;
+}
+
+BufferArenaPool::BufferArenaPool()
+    : mArenas()
+{
+}
+
+BufferArenaPool::~BufferArenaPool()
+{
+    // The buffers go away with the context, which is usually gone by the time
+    // globals are destroyed. Nothing to do here
+}
+
+/**
+ * Creates a new arena buffer with all of its space free
+ *
+ * \param  target    Buffer target the arena holds data for
+ * \param  capacity  Size of the arena in bytes
+ * \return           True if the buffer was created
+ */
+bool BufferArenaPool::createArena( GLenum target, size_t capacity )
+{
+    std::unique_ptr<Arena> pArena( new Arena );
+
+    pArena->buffer    = 0;
+    pArena->target    = target;
+    pArena->capacity  = capacity;
+    pArena->usedBytes = 0;
+    pArena->freeBlocks[0] = capacity;
+
+    glGenBuffers( 1, &pArena->buffer );
+    GStateCache.bindBuffer( target, pArena->buffer );
+    glBufferData( target, capacity, NULL, GL_STATIC_DRAW );
+
+    if ( checkGlFailure( "Creating buffer arena" ) )
+    {
+        glDeleteBuffers( 1, &pArena->buffer );
+        GStateCache.invalidate();
+        return false;
+    }
+
+    mArenas.push_back( std::move( pArena ) );
+    return true;
+}
+
+/**
+ * Finds the first free block that can hold an aligned allocation and carves
+ * the allocation out of it. Padding in front of the allocation stays free
+ *
+ * \return  True if the arena had room
+ */
+bool BufferArenaPool::allocateFrom( Arena * pArena,
+                                    size_t size,
+                                    size_t alignment,
+                                    size_t * pOffset )
+{
+    std::map<size_t, size_t>& blocks = pArena->freeBlocks;
+
+    for ( std::map<size_t, size_t>::iterator itr = blocks.begin();
+          itr != blocks.end();
+          ++itr )
+    {
+        size_t blockStart = itr->first;
+        size_t blockEnd   = itr->first + itr->second;
+        size_t start      = alignUp( blockStart, alignment );
+
+        if ( start + size > blockEnd )
+        {
+            continue;
+        }
+
+        blocks.erase( itr );
+
+        if ( start > blockStart )
+        {
+            blocks[blockStart] = start - blockStart;
+        }
+
+        if ( start + size < blockEnd )
+        {
+            blocks[start + size] = blockEnd - ( start + size );
+        }
+
+        Allocation allocation;
+        allocation.size      = size;
+        allocation.alignment = alignment;
+
+        pArena->allocations[start] = allocation;
+        pArena->usedBytes += size;
+
+        *pOffset = start;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Frees an allocation and merges the space with free blocks on either side
+ */
+void BufferArenaPool::releaseTo( Arena * pArena, size_t offset )
+{
+    std::map<size_t, Allocation>::iterator allocation =
+        pArena->allocations.find( offset );
+
+    assert( allocation != pArena->allocations.end() && "Freeing unknown range" );
+
+    size_t start = offset;
+    size_t end   = offset + allocation->second.size;
+
+    pArena->usedBytes -= allocation->second.size;
+    pArena->allocations.erase( allocation );
+
+    std::map<size_t, size_t>& blocks = pArena->freeBlocks;
+    std::map<size_t, size_t>::iterator next = blocks.lower_bound( start );
+
+    if ( next != blocks.end() && next->first == end )
+    {
+        end = next->first + next->second;
+        next = blocks.erase( next );
+    }
+
+    if ( next != blocks.begin() )
+    {
+        std::map<size_t, size_t>::iterator previous = next;
+        --previous;
+
+        if ( previous->first + previous->second == start )
+        {
+            start = previous->first;
+            blocks.erase( previous );
+        }
+    }
+
+    blocks[start] = end - start;
+}
+
+/**
+ * Copies data into the first arena for the target with room for it. A new
+ * arena is created when none of them have room
+ *
+ * \param  target     Buffer target the data is for, eg GL_ARRAY_BUFFER
+ * \param  pData      Data to copy
+ * \param  size       Number of bytes to copy
+ * \param  alignment  Alignment of the offset, must be a power of two
+ * \return            Handle to the data, invalid if it could not be stored
+ */
+BufferRange BufferArenaPool::allocate( GLenum target,
+                                       const void * pData,
+                                       size_t size,
+                                       size_t alignment )
+{
+    assert( pData != NULL && "Cannot upload if data pointer is null" );
+    assert( size > 0 && "Cannot upload if there is no data to upload" );
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+
+    BufferRange range;
+
+    for ( size_t i = 0; i < mArenas.size() && !range.isValid(); ++i )
+    {
+        if ( mArenas[i]->target == target &&
+             allocateFrom( mArenas[i].get(), size, alignment, &range.offset ) )
+        {
+            range.arena = static_cast<int>( i );
+        }
+    }
+
+    if (! range.isValid() )
+    {
+        size_t capacity = DEFAULT_ARENA_SIZE;
+
+        if ( size > capacity )
+        {
+            capacity = alignUp( size, DEFAULT_ARENA_SIZE );
+        }
+
+        if (! createArena( target, capacity ) )
+        {
+            return BufferRange();
+        }
+
+        range.arena = static_cast<int>( mArenas.size() - 1 );
+        allocateFrom( mArenas.back().get(), size, alignment, &range.offset );
+    }
+
+    range.size = size;
+
+    Arena * pArena = mArenas[range.arena].get();
+    GStateCache.bindBuffer( target, pArena->buffer );
+    glBufferSubData( target, range.offset, size, pData );
+
+    if ( checkGlFailure( "Uploading to buffer arena" ) )
+    {
+        free( &range );
+    }
+
+    return range;
+}
+
+/**
+ * Gives a range back to its arena. The handle is reset so it can't be freed
+ * twice
+ */
+void BufferArenaPool::free( BufferRange * pRange )
+{
+    assert( pRange != NULL );
+
+    if (! pRange->isValid() )
+    {
+        return;
+    }
+
+    assert( static_cast<size_t>( pRange->arena ) < mArenas.size() );
+    releaseTo( mArenas[pRange->arena].get(), pRange->offset );
+
+    *pRange = BufferRange();
+}
+
+/**
+ * Packs the live ranges of each arena that any of the given ranges are in,
+ * closing the holes left by freed ranges. Every live range in those arenas
+ * must be passed in, since their offsets change.
+ *
+ * \param  liveRanges  Handles to update
+ * \return             Bytes of holes that were merged into one free block
+ */
+size_t BufferArenaPool::compact( const std::vector<BufferRange*>& liveRanges )
+{
+    std::vector< std::vector<BufferRange*> > byArena( mArenas.size() );
+
+    for ( size_t i = 0; i < liveRanges.size(); ++i )
+    {
+        if ( liveRanges[i]->isValid() )
+        {
+            byArena[ liveRanges[i]->arena ].push_back( liveRanges[i] );
+        }
+    }
+
+    size_t reclaimed = 0;
+
+    for ( size_t i = 0; i < byArena.size(); ++i )
+    {
+        if (! byArena[i].empty() )
+        {
+            reclaimed += compactArena( static_cast<int>( i ), byArena[i] );
+        }
+    }
+
+    return reclaimed;
+}
+
+/**
+ * Copies the live ranges of one arena to the front of a new buffer, in their
+ * current order, and replaces the arena's buffer with it. Copying into a new
+ * buffer avoids overlapping source and destination ranges, which
+ * glCopyBufferSubData does not allow.
+ *
+ * \return  Bytes of holes that were closed
+ */
+size_t BufferArenaPool::compactArena( int index, std::vector<BufferRange*>& ranges )
+{
+    Arena * pArena = mArenas[index].get();
+
+    assert( ranges.size() == pArena->allocations.size() &&
+            "Compaction needs every live range in the arena" );
+
+    std::sort( ranges.begin(), ranges.end(), rangeOffsetLess );
+
+    // Free space that was already at the end doesn't move
+    size_t tailFree = 0;
+
+    if (! pArena->freeBlocks.empty() )
+    {
+        std::map<size_t, size_t>::const_reverse_iterator last =
+            pArena->freeBlocks.rbegin();
+
+        if ( last->first + last->second == pArena->capacity )
+        {
+            tailFree = last->second;
+        }
+    }
+
+    GLuint buffer = 0;
+    glGenBuffers( 1, &buffer );
+    GStateCache.bindBuffer( pArena->target, buffer );
+    glBufferData( pArena->target, pArena->capacity, NULL, GL_STATIC_DRAW );
+
+    bool gpuCopy = GLEW_VERSION_3_1 || GLEW_ARB_copy_buffer;
+    std::vector<unsigned char> staging;
+
+    if ( gpuCopy )
+    {
+        GStateCache.bindBuffer( GL_COPY_READ_BUFFER, pArena->buffer );
+        GStateCache.bindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+    }
+
+    std::map<size_t, Allocation> allocations;
+    std::map<size_t, size_t> freeBlocks;
+    size_t end = 0;
+
+    for ( size_t i = 0; i < ranges.size(); ++i )
+    {
+        BufferRange * pRange = ranges[i];
+        const Allocation& allocation = pArena->allocations[pRange->offset];
+
+        size_t offset = alignUp( end, allocation.alignment );
+
+        if ( offset > end )
+        {
+            freeBlocks[end] = offset - end;
+        }
+
+        if ( gpuCopy )
+        {
+            glCopyBufferSubData( GL_COPY_READ_BUFFER,
+                                 GL_COPY_WRITE_BUFFER,
+                                 pRange->offset,
+                                 offset,
+                                 pRange->size );
+        }
+        else
+        {
+            // Without copy buffers the data has to make a round trip
+            staging.resize( pRange->size );
+
+            GStateCache.bindBuffer( pArena->target, pArena->buffer );
+            glGetBufferSubData( pArena->target, pRange->offset,
+                                pRange->size, &staging[0] );
+
+            GStateCache.bindBuffer( pArena->target, buffer );
+            glBufferSubData( pArena->target, offset, pRange->size, &staging[0] );
+        }
+
+        allocations[offset] = allocation;
+        pRange->offset      = offset;
+        end                 = offset + pRange->size;
+    }
+
+    glDeleteBuffers( 1, &pArena->buffer );
+
+    // The old name may still be cached as bound, and GL reuses names
+    GStateCache.invalidate();
+
+    pArena->buffer = buffer;
+    pArena->allocations.swap( allocations );
+    pArena->freeBlocks.swap( freeBlocks );
+
+    if ( end < pArena->capacity )
+    {
+        pArena->freeBlocks[end] = pArena->capacity - end;
+    }
+
+    errorCheck( "Compacting buffer arena" );
+
+    size_t freeAfter = pArena->capacity - end;
+    return freeAfter > tailFree ? freeAfter - tailFree : 0;
+}
+
+/**
+ * Returns the buffer object holding a range
+ */
+GLuint BufferArenaPool::bufferName( const BufferRange& range ) const
+{
+    assert( range.isValid() && static_cast<size_t>( range.arena ) < mArenas.size() );
+    return mArenas[range.arena]->buffer;
+}
+
+/**
+ * Deletes every arena. Call this while the context is still current
+ */
+void BufferArenaPool::releaseGpuResources()
+{
+    for ( size_t i = 0; i < mArenas.size(); ++i )
+    {
+        glDeleteBuffers( 1, &mArenas[i]->buffer );
+    }
+
+    mArenas.clear();
+    GStateCache.invalidate();
+}
+
+BufferArenaStats BufferArenaPool::stats() const
+{
+    BufferArenaStats stats;
+    stats.arenaCount = mArenas.size();
+
+    for ( size_t i = 0; i < mArenas.size(); ++i )
+    {
+        const Arena& arena = *mArenas[i];
+
+        stats.allocationCount += arena.allocations.size();
+        stats.capacity        += arena.capacity;
+        stats.usedBytes       += arena.usedBytes;
+        stats.freeBlockCount  += arena.freeBlocks.size();
+
+        for ( std::map<size_t, size_t>::const_iterator itr = arena.freeBlocks.begin();
+              itr != arena.freeBlocks.end();
+              ++itr )
+        {
+            stats.largestFreeBlock = std::max( stats.largestFreeBlock, itr->second );
+        }
+    }
+
+    return stats;
+}
+
+/**
+ * Prints how many arenas there are and how full they are
+ */
+void BufferArenaPool::printStats() const
+{
+    BufferArenaStats s = stats();
+
+    printf( "Buffer arenas: %zu arenas, %zu allocations, %zu of %zu bytes used, "
+            "%zu free blocks (largest %zu bytes)\n",
+            s.arenaCount,
+            s.allocationCount,
+            s.usedBytes,
+            s.capacity,
+            s.freeBlockCount,
+            s.largestFreeBlock );
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_BUFFERARENA_H
+#define SCOTT_GFXSANDBOX_BUFFERARENA_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <vector>
+
+/**
+ * Handle to static data that was placed in one of the pool's arenas. Draws
+ * use bufferName() to bind the arena and the offset to find the data in it.
+ * Ranges in the same arena share a binding, so the state cache drops the
+ * rebinds between them.
+ */
+struct BufferRange
+{
+    BufferRange()
+        : arena( -1 ),
+          offset( 0 ),
+          size( 0 )
+    {
+    }
+
+    int arena;          // index of the arena, -1 if nothing is allocated
+    size_t offset;      // in bytes from the start of the arena's buffer
+    size_t size;        // in bytes
+
+    bool isValid() const { return arena >= 0; }
+
+    // Offset as the pointer argument that glVertexAttribPointer and
+    // glDrawElements expect when a buffer is bound
+    const void * pointer() const { return reinterpret_cast<const void*>( offset ); }
+};
+
+/**
+ * Summary of how full the arenas are
+ */
+struct BufferArenaStats
+{
+    BufferArenaStats()
+        : arenaCount( 0 ),
+          allocationCount( 0 ),
+          capacity( 0 ),
+          usedBytes( 0 ),
+          largestFreeBlock( 0 ),
+          freeBlockCount( 0 )
+    {
+    }
+
+    size_t arenaCount;
+    size_t allocationCount;
+    size_t capacity;            // total size of all arena buffers
+    size_t usedBytes;           // in live allocations
+    size_t largestFreeBlock;
+    size_t freeBlockCount;      // more blocks for the same space is worse
+};
+
+/**
+ * Places static vertex and index data into a small number of large buffer
+ * objects instead of creating one buffer per mesh. Each arena hands out
+ * aligned ranges first fit from an offset ordered free list, and freed ranges
+ * are merged with their free neighbours so space doesn't splinter.
+ *
+ * Freeing can still leave holes between live ranges. compact() packs every
+ * live range to the front of a fresh buffer, copying on the GPU with
+ * glCopyBufferSubData where possible. It needs every live handle in the
+ * compacted arenas so it can update their offsets.
+ *
+ * Arenas only hold data for one buffer target, and all methods must be called
+ * on the GL thread.
+ */
+class BufferArenaPool
+{
+public:
+    // Size of a new arena, unless the allocation needs a bigger one
+    static const size_t DEFAULT_ARENA_SIZE = 4 * 1024 * 1024;
+
+    BufferArenaPool();
+    ~BufferArenaPool();
+
+    // Copy data into a range of an arena, creating an arena if none has room
+    BufferRange allocate( GLenum target,
+                          const void * pData,
+                          size_t size,
+                          size_t alignment = 16 );
+
+    // Return a range to its arena and invalidate the handle
+    void free( BufferRange * pRange );
+
+    // Pack the live ranges of the arenas they are in. Returns bytes reclaimed
+    size_t compact( const std::vector<BufferRange*>& liveRanges );
+
+    // Buffer object of the arena a range is in
+    GLuint bufferName( const BufferRange& range ) const;
+
+    // Delete every arena's buffer. Outstanding handles become invalid
+    void releaseGpuResources();
+
+    BufferArenaStats stats() const;
+    void printStats() const;
+
+private:
+    BufferArenaPool( const BufferArenaPool& );
+    BufferArenaPool& operator = ( const BufferArenaPool& );
+
+    struct Allocation
+    {
+        size_t size;
+        size_t alignment;   // kept so compaction can honour it
+    };
+
+    struct Arena
+    {
+        GLuint buffer;
+        GLenum target;
+        size_t capacity;
+        size_t usedBytes;
+        std::map<size_t, size_t> freeBlocks;        // offset -> size
+        std::map<size_t, Allocation> allocations;   // offset -> allocation
+    };
+
+    bool createArena( GLenum target, size_t capacity );
+    static bool allocateFrom( Arena * pArena,
+                              size_t size,
+                              size_t alignment,
+                              size_t * pOffset );
+    static void releaseTo( Arena * pArena, size_t offset );
+    size_t compactArena( int index, std::vector<BufferRange*>& ranges );
+
+private:
+    std::vector< std::unique_ptr<Arena> > mArenas;
+};
+
+// Arenas for the thread that owns the OpenGL context
+extern BufferArenaPool GBufferArenas;
+
+#endif
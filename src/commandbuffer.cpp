@@ -0,0 +1,333 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "commandbuffer.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "timing.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/**
+ * Creates a packet that draws nothing
+ */
+DrawPacket::DrawPacket()
+    : program( 0 ),
+      textureTarget( GL_TEXTURE_2D ),
+      textureCount( 0 ),
+      samplerCount( 0 ),
+      uniformCount( 0 ),
+      pUniforms( NULL ),
+      vertexBuffer( 0 ),
+      vertexOffset( NULL ),
+      positionAttribute( -1 ),
+      positionComponents( 2 ),
+      vertexStride( 0 ),
+      elementBuffer( 0 ),
+      elementOffset( NULL ),
+      mode( GL_TRIANGLES ),
+      elementCount( 0 ),
+      elementType( GL_UNSIGNED_SHORT )
+{
+    for ( unsigned int i = 0; i < MAX_PACKET_TEXTURES; ++i )
+    {
+        textures[i] = 0;
+    }
+
+    for ( unsigned int i = 0; i < MAX_PACKET_SAMPLERS; ++i )
+    {
+        samplerLocations[i] = -1;
+        samplerUnits[i]     = 0;
+    }
+}
+
+CommandBuffer::CommandBuffer()
+    : mAllocator(),
+      mPackets()
+{
+}
+
+/**
+ * Adds a packet to the buffer. The packet is default constructed and lives
+ * until the buffer is reset
+ *
+ * \param  key  Where the packet goes in the submission order, see makeSortKey
+ * \return      The packet, for the caller to fill in
+ */
+DrawPacket * CommandBuffer::addDraw( uint64_t key )
+{
+    DrawPacket * pPacket = mAllocator.allocateArray<DrawPacket>( 1 );
+
+    SortedPacket sorted;
+    sorted.key     = key;
+    sorted.pPacket = pPacket;
+    mPackets.push_back( sorted );
+
+    return pPacket;
+}
+
+/**
+ * Copies uniforms, and the values they point at, into the buffer so that the
+ * caller's copies don't have to outlive the frame
+ *
+ * \param  pUniforms  Uniforms to copy
+ * \param  count      Number of uniforms
+ * \return            The copies, valid until the buffer is reset
+ */
+const PacketUniform * CommandBuffer::addUniforms( const PacketUniform * pUniforms, size_t count )
+{
+    PacketUniform * pCopies = mAllocator.allocateArray<PacketUniform>( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        size_t valueCount = static_cast<size_t>( pUniforms[i].components ) * pUniforms[i].count;
+        GLfloat * pValues = static_cast<GLfloat*>(
+            mAllocator.allocate( sizeof( GLfloat ) * valueCount, alignof( GLfloat ) ) );
+
+        memcpy( pValues, pUniforms[i].pValues, sizeof( GLfloat ) * valueCount );
+
+        pCopies[i]         = pUniforms[i];
+        pCopies[i].pValues = pValues;
+    }
+
+    return pCopies;
+}
+
+/**
+ * Throws away every packet. The memory they used is kept for the next frame
+ */
+void CommandBuffer::reset()
+{
+    mAllocator.reset();
+    mPackets.clear();
+}
+
+/**
+ * Creates a queue with a buffer for each thread that will record into it
+ */
+CommandQueue::CommandQueue( size_t bufferCount )
+    : mBuffers(),
+      mMerged(),
+      mScratch(),
+      mSortEnabled( true ),
+      mStats()
+{
+    assert( bufferCount > 0 );
+
+    for ( size_t i = 0; i < bufferCount; ++i )
+    {
+        mBuffers.push_back( std::unique_ptr<CommandBuffer>( new CommandBuffer ) );
+    }
+}
+
+/**
+ * Draws everything recorded into the queue's buffers, in key order, and then
+ * resets the buffers. Every thread must have finished recording before this
+ * is called
+ */
+void CommandQueue::submit()
+{
+    ProfileScope scope( "submit commands" );
+    double start = currentTimeMs();
+
+    mMerged.clear();
+
+    for ( size_t i = 0; i < mBuffers.size(); ++i )
+    {
+        const std::vector<SortedPacket>& packets = mBuffers[i]->packets();
+        mMerged.insert( mMerged.end(), packets.begin(), packets.end() );
+    }
+
+    if ( mSortEnabled && mMerged.size() > 1 )
+    {
+        mScratch.resize( mMerged.size() );
+        radixSortPackets( &mMerged[0], &mScratch[0], mMerged.size() );
+    }
+
+    double sorted = currentTimeMs();
+    const DrawPacket * pPrevious = NULL;
+
+    for ( size_t i = 0; i < mMerged.size(); ++i )
+    {
+        execute( *mMerged[i].pPacket, pPrevious );
+        pPrevious = mMerged[i].pPacket;
+    }
+
+    for ( size_t i = 0; i < mBuffers.size(); ++i )
+    {
+        mBuffers[i]->reset();
+    }
+
+    mStats.packetCount = mMerged.size();
+    mStats.sortMs      = sorted - start;
+    mStats.submitMs    = currentTimeMs() - sorted;
+}
+
+/**
+ * Issues the GL calls for one packet. State goes through the state cache, so
+ * anything the previous packet already set is skipped
+ *
+ * \param  packet     Packet to draw
+ * \param  pPrevious  Packet drawn just before this one, or NULL
+ */
+void CommandQueue::execute( const DrawPacket& packet, const DrawPacket * pPrevious )
+{
+    GStateCache.useProgram( packet.program );
+
+    for ( unsigned int i = 0; i < packet.textureCount; ++i )
+    {
+        GStateCache.bindTexture( i, packet.textureTarget, packet.textures[i] );
+    }
+
+    for ( unsigned int i = 0; i < packet.samplerCount; ++i )
+    {
+        GStateCache.uniform1i( packet.samplerLocations[i], packet.samplerUnits[i] );
+    }
+
+    for ( unsigned int i = 0; i < packet.uniformCount; ++i )
+    {
+        const PacketUniform& uniform = packet.pUniforms[i];
+
+        if ( uniform.components == 4 )
+        {
+            glUniform4fv( uniform.location, uniform.count, uniform.pValues );
+        }
+        else
+        {
+            glUniform1fv( uniform.location, uniform.count, uniform.pValues );
+        }
+    }
+
+    GStateCache.bindBuffer( GL_ARRAY_BUFFER, packet.vertexBuffer );
+
+    // The state cache doesn't track attribute pointers, so only set them when
+    // they differ from the previous packet's
+    if ( pPrevious == NULL ||
+         pPrevious->vertexBuffer != packet.vertexBuffer ||
+         pPrevious->vertexOffset != packet.vertexOffset ||
+         pPrevious->positionAttribute != packet.positionAttribute ||
+         pPrevious->positionComponents != packet.positionComponents ||
+         pPrevious->vertexStride != packet.vertexStride )
+    {
+        glVertexAttribPointer( packet.positionAttribute,
+                               packet.positionComponents,
+                               GL_FLOAT,
+                               GL_FALSE,
+                               packet.vertexStride,
+                               packet.vertexOffset );
+
+        GStateCache.enableVertexAttribArray( packet.positionAttribute );
+    }
+
+    GStateCache.bindBuffer( GL_ELEMENT_ARRAY_BUFFER, packet.elementBuffer );
+    glDrawElements( packet.mode,
+                    packet.elementCount,
+                    packet.elementType,
+                    packet.elementOffset );
+}
+
+/**
+ * Builds a packet's sort key. Only the low 12 bits of the program and
+ * texture names fit in the key. GL hands out small names so they rarely
+ * collide, and a collision only makes the sort a little less effective
+ *
+ * \param  layer    Drawn in increasing order, 0 to 255
+ * \param  program  Program the packet draws with
+ * \param  texture  The packet's first texture
+ * \param  depth    Distance from the viewer, nearest drawn first
+ * \return          Key for CommandBuffer::addDraw
+ */
+uint64_t makeSortKey( unsigned int layer, GLuint program, GLuint texture, float depth )
+{
+    uint32_t bits;
+    memcpy( &bits, &depth, sizeof( bits ) );
+
+    // Flip the bits so that comparing them as unsigned integers orders the
+    // floats correctly, negative numbers included
+    bits = ( bits & 0x80000000u ) ? ~bits : ( bits | 0x80000000u );
+
+    return ( static_cast<uint64_t>( layer & 0xff ) << SORT_KEY_LAYER_SHIFT ) |
+           ( static_cast<uint64_t>( program & 0xfff ) << SORT_KEY_PROGRAM_SHIFT ) |
+           ( static_cast<uint64_t>( texture & 0xfff ) << SORT_KEY_TEXTURE_SHIFT ) |
+           ( static_cast<uint64_t>( bits ) << SORT_KEY_DEPTH_SHIFT );
+}
+
+/**
+ * Sorts packets by key, a byte at a time from the least significant end.
+ * Histograms for every byte are built in one pass up front, and bytes that
+ * are the same in every key are skipped, which in a typical frame is most of
+ * them (few layers, programs and textures).
+ *
+ * \param  pPackets  Packets to sort, sorted in place
+ * \param  pScratch  Space for count packets
+ * \param  count     Number of packets
+ */
+void radixSortPackets( SortedPacket * pPackets, SortedPacket * pScratch, size_t count )
+{
+    if ( count < 2 )
+    {
+        return;
+    }
+
+    const size_t BYTE_COUNT = sizeof( uint64_t );
+    size_t histograms[BYTE_COUNT][256];
+    memset( histograms, 0, sizeof( histograms ) );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint64_t key = pPackets[i].key;
+
+        for ( size_t b = 0; b < BYTE_COUNT; ++b )
+        {
+            histograms[b][( key >> ( b * 8 ) ) & 0xff]++;
+        }
+    }
+
+    SortedPacket * pSource      = pPackets;
+    SortedPacket * pDestination = pScratch;
+
+    for ( size_t b = 0; b < BYTE_COUNT; ++b )
+    {
+        size_t * pCounts = histograms[b];
+
+        if ( pCounts[( pSource[0].key >> ( b * 8 ) ) & 0xff] == count )
+        {
+            continue;
+        }
+
+        size_t offsets[256];
+        size_t total = 0;
+
+        for ( size_t i = 0; i < 256; ++i )
+        {
+            offsets[i] = total;
+            total     += pCounts[i];
+        }
+
+        for ( size_t i = 0; i < count; ++i )
+        {
+            size_t digit = ( pSource[i].key >> ( b * 8 ) ) & 0xff;
+            pDestination[offsets[digit]++] = pSource[i];
+        }
+
+        std::swap( pSource, pDestination );
+    }
+
+    if ( pSource != pPackets )
+    {
+        memcpy( pPackets, pSource, sizeof( SortedPacket ) * count );
+    }
+}
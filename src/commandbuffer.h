@@ -0,0 +1,197 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_COMMANDBUFFER_H
+#define SCOTT_GFXSANDBOX_COMMANDBUFFER_H
+
+#include "linearallocator.h"
+#include <GL/glew.h>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// Most textures a single draw packet can bind
+const unsigned int MAX_PACKET_TEXTURES = 2;
+
+// Most samplers a single draw packet can point at its textures
+const unsigned int MAX_PACKET_SAMPLERS = 2;
+
+/**
+ * Layout of a draw packet's 64-bit sort key, from the most significant bit
+ * down. Packets are submitted in increasing key order, so everything in a
+ * lower layer is drawn first, and within a layer draws that share a program
+ * and then a texture end up next to each other
+ */
+const unsigned int SORT_KEY_LAYER_SHIFT   = 56;    // 8 bits
+const unsigned int SORT_KEY_PROGRAM_SHIFT = 44;    // 12 bits
+const unsigned int SORT_KEY_TEXTURE_SHIFT = 32;    // 12 bits
+const unsigned int SORT_KEY_DEPTH_SHIFT   = 0;     // 32 bits
+
+/**
+ * A float uniform set just before a packet is drawn. The values live in the
+ * same command buffer as the packet
+ */
+struct PacketUniform
+{
+    GLint location;
+    GLint components;           // 1 for float, 4 for vec4
+    GLsizei count;              // number of array elements
+    const GLfloat * pValues;
+};
+
+/**
+ * Everything needed to issue one indexed draw. Packets only hold GL names
+ * and plain values, so any thread can fill one in. Textures are bound to
+ * units 0 and up, and each sampler uniform is pointed at a unit
+ */
+struct DrawPacket
+{
+    DrawPacket();
+
+    GLuint program;
+
+    GLenum textureTarget;
+    unsigned int textureCount;
+    GLuint textures[MAX_PACKET_TEXTURES];
+
+    unsigned int samplerCount;
+    GLint samplerLocations[MAX_PACKET_SAMPLERS];
+    GLint samplerUnits[MAX_PACKET_SAMPLERS];
+
+    unsigned int uniformCount;
+    const PacketUniform * pUniforms;
+
+    GLuint vertexBuffer;
+    const void * vertexOffset;
+    GLint positionAttribute;
+    GLint positionComponents;
+    GLsizei vertexStride;
+
+    GLuint elementBuffer;
+    const void * elementOffset;
+    GLenum mode;
+    GLsizei elementCount;
+    GLenum elementType;
+};
+
+/**
+ * A packet's place in the submission order
+ */
+struct SortedPacket
+{
+    uint64_t key;
+    const DrawPacket * pPacket;
+};
+
+/**
+ * Draw packets recorded by one thread. Packets and everything they point to
+ * are carved out of the buffer's own linear allocator, so recording never
+ * takes a lock and, once the buffer has warmed up, never allocates.
+ */
+class CommandBuffer
+{
+public:
+    CommandBuffer();
+
+    // Add a packet to the buffer and return it to be filled in
+    DrawPacket * addDraw( uint64_t key );
+
+    // Copy uniform values into the buffer for a packet to point at
+    const PacketUniform * addUniforms( const PacketUniform * pUniforms, size_t count );
+
+    // Throw away every packet
+    void reset();
+
+    size_t packetCount() const { return mPackets.size(); }
+
+    const std::vector<SortedPacket>& packets() const { return mPackets; }
+
+    // Bytes of packet and uniform data recorded since the last reset
+    size_t usedBytes() const { return mAllocator.usedBytes(); }
+
+private:
+    CommandBuffer( const CommandBuffer& );
+    CommandBuffer& operator = ( const CommandBuffer& );
+
+    LinearAllocator mAllocator;
+    std::vector<SortedPacket> mPackets;
+};
+
+/**
+ * Timings and counts from the last submit
+ */
+struct CommandQueueStats
+{
+    CommandQueueStats()
+        : packetCount( 0 ),
+          sortMs( 0.0 ),
+          submitMs( 0.0 )
+    {
+    }
+
+    size_t packetCount;
+    double sortMs;              // merging and sorting the buffers
+    double submitMs;            // issuing the GL calls
+};
+
+/**
+ * A set of command buffers that are recorded in parallel and submitted
+ * together. Each recording thread (or task) writes to its own buffer. Once
+ * every buffer has been recorded the GL thread calls submit(), which merges
+ * the packets, radix sorts them by key and issues them through the state
+ * cache, so packets that share state don't set it again.
+ *
+ * Packets with equal keys are drawn in buffer order, then in the order they
+ * were recorded, so a frame always draws the same way.
+ */
+class CommandQueue
+{
+public:
+    explicit CommandQueue( size_t bufferCount = 1 );
+
+    size_t bufferCount() const { return mBuffers.size(); }
+
+    // Buffer for one recording thread to write into
+    CommandBuffer& buffer( size_t index ) { return *mBuffers[index]; }
+
+    // Sort and draw every recorded packet, then reset the buffers. GL thread only
+    void submit();
+
+    // Submit in recording order instead of key order, for comparisons
+    void setSortEnabled( bool isEnabled ) { mSortEnabled = isEnabled; }
+
+    const CommandQueueStats& stats() const { return mStats; }
+
+private:
+    CommandQueue( const CommandQueue& );
+    CommandQueue& operator = ( const CommandQueue& );
+
+    void execute( const DrawPacket& packet, const DrawPacket * pPrevious );
+
+    std::vector<std::unique_ptr<CommandBuffer> > mBuffers;
+    std::vector<SortedPacket> mMerged;
+    std::vector<SortedPacket> mScratch;
+    bool mSortEnabled;
+    CommandQueueStats mStats;
+};
+
+// Build a sort key. Depth sorts front to back, pass -depth for back to front
+uint64_t makeSortKey( unsigned int layer, GLuint program, GLuint texture, float depth );
+
+// Stable LSD radix sort on the keys, pScratch must hold count entries
+void radixSortPackets( SortedPacket * pPackets, SortedPacket * pScratch, size_t count );
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "crossfade.h"
+#include <cassert>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GFXSANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+// The kernels all blend with an 8.8 fixed point weight. Computing
+// a + (b - a) * t with t rounded to 1/256 is off by less than half a unit
+// from the float math the shader does, so after rounding the result is never
+// more than 1 away from what the GPU writes. Every kernel uses exactly the
+// same arithmetic so they all produce identical output.
+const int CROSSFADE_WEIGHT_ONE = 256;
+
+/**
+ * Converts a fade factor into a fixed point blend weight in [0, 256]
+ */
+static int fadeWeight( float fadeFactor )
+{
+    if (! ( fadeFactor > 0.0f ) )
+    {
+        return 0;       // also catches NaN
+    }
+    else if ( fadeFactor >= 1.0f )
+    {
+        return CROSSFADE_WEIGHT_ONE;
+    }
+
+    return static_cast<int>( floorf( fadeFactor * CROSSFADE_WEIGHT_ONE + 0.5f ) );
+}
+
+/**
+ * Portable version of the kernel, also used to finish off the bytes left over
+ * by the vectorized kernels
+ */
+static void crossfadeScalar( const unsigned char * pFirst,
+                             const unsigned char * pSecond,
+                             unsigned char * pOutput,
+                             size_t byteCount,
+                             int weight )
+{
+    const unsigned int inverse = CROSSFADE_WEIGHT_ONE - weight;
+
+    for ( size_t i = 0; i < byteCount; ++i )
+    {
+        pOutput[i] = static_cast<unsigned char>(
+            ( pFirst[i] * inverse + pSecond[i] * weight + 128 ) >> 8 );
+    }
+}
+
+#ifdef GFXSANDBOX_X86
+/**
+ * SSE2 kernel, blends 16 channels per iteration. Products are at most
+ * 255 * 256 so the sums fit in an unsigned 16 bit lane
+ */
+__attribute__(( target( "sse2" ) ))
+static void crossfadeSse2( const unsigned char * pFirst,
+                           const unsigned char * pSecond,
+                           unsigned char * pOutput,
+                           size_t byteCount,
+                           int weight )
+{
+    const __m128i zero    = _mm_setzero_si128();
+    const __m128i round   = _mm_set1_epi16( 128 );
+    const __m128i wSecond = _mm_set1_epi16( static_cast<short>( weight ) );
+    const __m128i wFirst  =
+        _mm_set1_epi16( static_cast<short>( CROSSFADE_WEIGHT_ONE - weight ) );
+
+    size_t i = 0;
+
+    for ( ; i + 16 <= byteCount; i += 16 )
+    {
+        __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pFirst + i ) );
+        __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSecond + i ) );
+
+        __m128i lo = _mm_add_epi16(
+            _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( a, zero ), wFirst ),
+                           _mm_mullo_epi16( _mm_unpacklo_epi8( b, zero ), wSecond ) ),
+            round );
+        __m128i hi = _mm_add_epi16(
+            _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( a, zero ), wFirst ),
+                           _mm_mullo_epi16( _mm_unpackhi_epi8( b, zero ), wSecond ) ),
+            round );
+
+        __m128i result = _mm_packus_epi16( _mm_srli_epi16( lo, 8 ),
+                                           _mm_srli_epi16( hi, 8 ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( pOutput + i ), result );
+    }
+
+    crossfadeScalar( pFirst + i, pSecond + i, pOutput + i, byteCount - i, weight );
+}
+
+/**
+ * AVX2 kernel, blends 32 channels per iteration. The unpack and pack
+ * instructions both work within 128 bit lanes so the output stays in order
+ */
+__attribute__(( target( "avx2" ) ))
+static void crossfadeAvx2( const unsigned char * pFirst,
+                           const unsigned char * pSecond,
+                           unsigned char * pOutput,
+                           size_t byteCount,
+                           int weight )
+{
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i round   = _mm256_set1_epi16( 128 );
+    const __m256i wSecond = _mm256_set1_epi16( static_cast<short>( weight ) );
+    const __m256i wFirst  =
+        _mm256_set1_epi16( static_cast<short>( CROSSFADE_WEIGHT_ONE - weight ) );
+
+    size_t i = 0;
+
+    for ( ; i + 32 <= byteCount; i += 32 )
+    {
+        __m256i a = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pFirst + i ) );
+        __m256i b = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSecond + i ) );
+
+        __m256i lo = _mm256_add_epi16(
+            _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( a, zero ), wFirst ),
+                              _mm256_mullo_epi16( _mm256_unpacklo_epi8( b, zero ), wSecond ) ),
+            round );
+        __m256i hi = _mm256_add_epi16(
+            _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( a, zero ), wFirst ),
+                              _mm256_mullo_epi16( _mm256_unpackhi_epi8( b, zero ), wSecond ) ),
+            round );
+
+        __m256i result = _mm256_packus_epi16( _mm256_srli_epi16( lo, 8 ),
+                                              _mm256_srli_epi16( hi, 8 ) );
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( pOutput + i ), result );
+    }
+
+    crossfadeScalar( pFirst + i, pSecond + i, pOutput + i, byteCount - i, weight );
+}
+#endif
+
+/**
+ * Checks if the CPU we are running on supports a kernel
+ */
+bool isCrossfadeKernelSupported( CrossfadeKernel kernel )
+{
+    switch ( kernel )
+    {
+        case CROSSFADE_SCALAR:
+            return true;
+
+#ifdef GFXSANDBOX_X86
+        case CROSSFADE_SSE2:
+            return __builtin_cpu_supports( "sse2" );
+
+        case CROSSFADE_AVX2:
+            return __builtin_cpu_supports( "avx2" );
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Picks the widest kernel the CPU supports. This is only worked out once
+ */
+CrossfadeKernel bestCrossfadeKernel()
+{
+    static const CrossfadeKernel best =
+        isCrossfadeKernelSupported( CROSSFADE_AVX2 ) ? CROSSFADE_AVX2 :
+        isCrossfadeKernelSupported( CROSSFADE_SSE2 ) ? CROSSFADE_SSE2 :
+                                                       CROSSFADE_SCALAR;
+    return best;
+}
+
+const char * crossfadeKernelName( CrossfadeKernel kernel )
+{
+    switch ( kernel )
+    {
+        case CROSSFADE_SCALAR:  return "scalar";
+        case CROSSFADE_SSE2:    return "sse2";
+        case CROSSFADE_AVX2:    return "avx2";
+        default:                return "unknown";
+    }
+}
+
+/**
+ * Blends two images together, channel by channel. This is the CPU version of
+ * hello.ps.glsl, ie mix( first, second, fadeFactor ), and matches what the GPU
+ * writes to within one unit per channel.
+ *
+ * \param  pFirst      Pixels of the first image (shown when fade is 0)
+ * \param  pSecond     Pixels of the second image (shown when fade is 1)
+ * \param  pOutput     Receives the blended pixels, may alias either input
+ * \param  byteCount   Number of 8-bit channels in each buffer
+ * \param  fadeFactor  How far to fade from the first to the second image
+ */
+void crossfade( const unsigned char * pFirst,
+                const unsigned char * pSecond,
+                unsigned char * pOutput,
+                size_t byteCount,
+                float fadeFactor )
+{
+    crossfadeWith( bestCrossfadeKernel(),
+                   pFirst,
+                   pSecond,
+                   pOutput,
+                   byteCount,
+                   fadeFactor );
+}
+
+/**
+ * Blends two images together using a specific kernel. The kernel must be
+ * supported by the CPU
+ */
+void crossfadeWith( CrossfadeKernel kernel,
+                    const unsigned char * pFirst,
+                    const unsigned char * pSecond,
+                    unsigned char * pOutput,
+                    size_t byteCount,
+                    float fadeFactor )
+{
+    assert( pFirst != NULL && pSecond != NULL && pOutput != NULL );
+    assert( isCrossfadeKernelSupported( kernel ) );
+
+    int weight = fadeWeight( fadeFactor );
+
+    switch ( kernel )
+    {
+#ifdef GFXSANDBOX_X86
+        case CROSSFADE_AVX2:
+            crossfadeAvx2( pFirst, pSecond, pOutput, byteCount, weight );
+            break;
+
+        case CROSSFADE_SSE2:
+            crossfadeSse2( pFirst, pSecond, pOutput, byteCount, weight );
+            break;
+#endif
+
+        default:
+            crossfadeScalar( pFirst, pSecond, pOutput, byteCount, weight );
+            break;
+    }
+}
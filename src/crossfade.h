@@ -0,0 +1,56 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_CROSSFADE_H
+#define SCOTT_GFXSANDBOX_CROSSFADE_H
+
+#include <cstddef>
+
+/**
+ * Implementations of the crossfade kernel. The best one supported by the CPU
+ * is picked at runtime, but benchmarks can ask for a specific one
+ */
+enum CrossfadeKernel
+{
+    CROSSFADE_SCALAR,
+    CROSSFADE_SSE2,
+    CROSSFADE_AVX2
+};
+
+// Blend two 8-bit images the same way hello.ps.glsl does on the GPU
+void crossfade( const unsigned char * pFirst,
+                const unsigned char * pSecond,
+                unsigned char * pOutput,
+                size_t byteCount,
+                float fadeFactor );
+
+// Blend two 8-bit images with a specific kernel
+void crossfadeWith( CrossfadeKernel kernel,
+                    const unsigned char * pFirst,
+                    const unsigned char * pSecond,
+                    unsigned char * pOutput,
+                    size_t byteCount,
+                    float fadeFactor );
+
+// Returns the fastest kernel supported by this CPU
+CrossfadeKernel bestCrossfadeKernel();
+
+// Returns true if the CPU can run the given kernel
+bool isCrossfadeKernelSupported( CrossfadeKernel kernel );
+
+// Returns a printable name for the kernel
+const char * crossfadeKernelName( CrossfadeKernel kernel );
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "dds.h"
+#include "assetpack.h"
+#include "util.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// The parts of the DirectDraw Surface format we read and write. Blocks are
+// stored with the bottom row of the image first, which is what
+// glCompressedTexImage2D expects, rather than the top row first like D3D
+// tools do. The pixel data follows the header directly, largest level first
+const uint32_t DDS_MAGIC              = 0x20534444;     // "DDS "
+const uint32_t DDS_HEADER_SIZE        = 124;
+const uint32_t DDS_PIXEL_FORMAT_SIZE  = 32;
+
+const uint32_t DDSD_CAPS              = 0x1;
+const uint32_t DDSD_HEIGHT            = 0x2;
+const uint32_t DDSD_WIDTH             = 0x4;
+const uint32_t DDSD_PIXELFORMAT       = 0x1000;
+const uint32_t DDSD_MIPMAPCOUNT       = 0x20000;
+const uint32_t DDSD_LINEARSIZE        = 0x80000;
+const uint32_t DDPF_FOURCC            = 0x4;
+const uint32_t DDSCAPS_COMPLEX        = 0x8;
+const uint32_t DDSCAPS_TEXTURE        = 0x1000;
+const uint32_t DDSCAPS_MIPMAP         = 0x400000;
+
+const uint32_t FOURCC_DXT1            = 0x31545844;     // "DXT1"
+const uint32_t FOURCC_DXT5            = 0x35545844;     // "DXT5"
+
+struct DdsPixelFormat
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t rMask;
+    uint32_t gMask;
+    uint32_t bMask;
+    uint32_t aMask;
+};
+
+struct DdsHeader
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    DdsPixelFormat pixelFormat;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+
+/**
+ * Returns a pointer to the blocks of one mip level
+ */
+const unsigned char * CompressedImage::levelData( size_t level ) const
+{
+    assert( level < levels.size() );
+
+    if ( mapping )
+    {
+        return mapping->data() + levels[level].offset;
+    }
+    else
+    {
+        return buffer.empty() ? NULL : &buffer[ levels[level].offset ];
+    }
+}
+
+/**
+ * Returns the size of every level put together
+ */
+size_t CompressedImage::size() const
+{
+    size_t total = 0;
+
+    for ( size_t i = 0; i < levels.size(); ++i )
+    {
+        total += levels[i].size;
+    }
+
+    return total;
+}
+
+/**
+ * Reads a dds header and works out where each mip level is
+ *
+ * \param  pData       Start of the dds file
+ * \param  size        Size of the dds file in bytes
+ * \param  baseOffset  Offset of the file within the image's storage
+ * \param  name        Name of the file, used when printing errors
+ * \param  pImage      Receives the format and levels
+ * \return             True if the file holds a complete DXT1 or DXT5 image
+ */
+static bool parseDds( const unsigned char * pData,
+                      size_t size,
+                      size_t baseOffset,
+                      const char * name,
+                      CompressedImage * pImage )
+{
+    uint32_t magic = 0;
+    DdsHeader header;
+
+    if ( size < sizeof( magic ) + sizeof( header ) )
+    {
+        fprintf( stderr, "%s is too small to be a dds file\n", name );
+        return false;
+    }
+
+    memcpy( &magic, pData, sizeof( magic ) );
+    memcpy( &header, pData + sizeof( magic ), sizeof( header ) );
+
+    if ( magic != DDS_MAGIC || header.size != DDS_HEADER_SIZE )
+    {
+        fprintf( stderr, "%s is not a dds file\n", name );
+        return false;
+    }
+
+    if (! ( header.pixelFormat.flags & DDPF_FOURCC ) ||
+        ( header.pixelFormat.fourCC != FOURCC_DXT1 &&
+          header.pixelFormat.fourCC != FOURCC_DXT5 ) )
+    {
+        fprintf( stderr, "%s is not DXT1 or DXT5 compressed\n", name );
+        return false;
+    }
+
+    if ( header.width == 0 || header.height == 0 ||
+         header.width > 65536 || header.height > 65536 )
+    {
+        fprintf( stderr, "%s has an invalid size\n", name );
+        return false;
+    }
+
+    pImage->format = ( header.pixelFormat.fourCC == FOURCC_DXT1 ? BLOCK_FORMAT_BC1
+                                                                : BLOCK_FORMAT_BC3 );
+
+    uint32_t levelCount = ( header.flags & DDSD_MIPMAPCOUNT ) ? header.mipMapCount : 1;
+    levelCount          = std::max( levelCount, 1u );
+
+    size_t offset = sizeof( magic ) + sizeof( header );
+    int width     = static_cast<int>( header.width );
+    int height    = static_cast<int>( header.height );
+
+    pImage->levels.clear();
+
+    for ( uint32_t i = 0; i < levelCount; ++i )
+    {
+        CompressedLevel level;
+        level.width  = width;
+        level.height = height;
+        level.offset = baseOffset + offset;
+        level.size   = compressedImageSize( pImage->format, width, height );
+
+        if ( level.size > size - offset )
+        {
+            fprintf( stderr, "%s is missing mip level %u\n", name, i );
+            return false;
+        }
+
+        pImage->levels.push_back( level );
+        offset += level.size;
+
+        if ( width == 1 && height == 1 )
+        {
+            break;
+        }
+
+        width  = std::max( width / 2, 1 );
+        height = std::max( height / 2, 1 );
+    }
+
+    return true;
+}
+
+/**
+ * Loads a dds file. The blocks point straight into the memory mapped file (or
+ * the asset pack, if the file is in it), so nothing is copied until upload
+ *
+ * \param  filename  Path to the dds file
+ * \param  pImage    Receives the image
+ * \return           True if the image was loaded
+ */
+bool loadDds( const std::string& filename, CompressedImage * pImage )
+{
+    assert( pImage != NULL );
+
+    const PackEntry * pEntry = GAssetPack.find( filename );
+
+    if ( pEntry != NULL && pEntry->type == PACK_ENTRY_DATA )
+    {
+        pImage->mapping = GAssetPack.mappedFile();
+        pImage->buffer.clear();
+
+        return parseDds( GAssetPack.entryData( *pEntry ),
+                         static_cast<size_t>( pEntry->size ),
+                         static_cast<size_t>( pEntry->offset ),
+                         filename.c_str(),
+                         pImage );
+    }
+
+    std::shared_ptr<MappedFile> file( new MappedFile );
+
+    if (! file->open( filename ) )
+    {
+        fprintf( stderr, "Unable to open %s for reading\n", filename.c_str() );
+        return false;
+    }
+
+    pImage->mapping = file;
+    pImage->buffer.clear();
+
+    return parseDds( file->data(), file->size(), 0, filename.c_str(), pImage );
+}
+
+/**
+ * Writes an image whose levels are stored back to back in its buffer
+ *
+ * \param  filename  Path to write the dds file to
+ * \param  image     Image to write, with at least one level
+ * \return           True if the file was written
+ */
+bool writeDds( const std::string& filename, const CompressedImage& image )
+{
+    assert( !image.levels.empty() && !image.mapping );
+
+    DdsHeader header;
+    memset( &header, 0, sizeof( header ) );
+
+    header.size              = DDS_HEADER_SIZE;
+    header.flags             = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT |
+                               DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height            = image.levels[0].height;
+    header.width             = image.levels[0].width;
+    header.pitchOrLinearSize = static_cast<uint32_t>( image.levels[0].size );
+    header.mipMapCount       = static_cast<uint32_t>( image.levels.size() );
+    header.pixelFormat.size  = DDS_PIXEL_FORMAT_SIZE;
+    header.pixelFormat.flags = DDPF_FOURCC;
+    header.pixelFormat.fourCC =
+        ( image.format == BLOCK_FORMAT_BC1 ? FOURCC_DXT1 : FOURCC_DXT5 );
+    header.caps              = DDSCAPS_TEXTURE;
+
+    if ( image.levels.size() > 1 )
+    {
+        header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    }
+
+    FILE * pFile = fopen( filename.c_str(), "wb" );
+
+    if ( pFile == NULL )
+    {
+        fprintf( stderr, "Unable to open %s for writing\n", filename.c_str() );
+        return false;
+    }
+
+    bool ok = fwrite( &DDS_MAGIC, sizeof( DDS_MAGIC ), 1, pFile ) == 1 &&
+              fwrite( &header, sizeof( header ), 1, pFile ) == 1;
+
+    for ( size_t i = 0; ok && i < image.levels.size(); ++i )
+    {
+        ok = fwrite( image.levelData( i ), 1, image.levels[i].size, pFile ) ==
+             image.levels[i].size;
+    }
+
+    ok = ( fclose( pFile ) == 0 ) && ok;
+
+    if (! ok )
+    {
+        fprintf( stderr, "Failed to write %s\n", filename.c_str() );
+        remove( filename.c_str() );
+    }
+
+    return ok;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_DDS_H
+#define SCOTT_GFXSANDBOX_DDS_H
+
+#include "blockcompress.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+/**
+ * Where one mip level of a compressed image lives
+ */
+struct CompressedLevel
+{
+    int width;
+    int height;
+    size_t offset;          // from the start of the image's storage
+    size_t size;
+};
+
+/**
+ * A block compressed image and its mip chain. Like Image, the blocks either
+ * live in the image's own buffer or point into a memory mapped file
+ */
+struct CompressedImage
+{
+    CompressedImage()
+        : format( BLOCK_FORMAT_BC1 ),
+          levels(),
+          mapping(),
+          buffer()
+    {
+    }
+
+    const unsigned char * levelData( size_t level ) const;
+    size_t size() const;
+
+    BlockFormat format;
+    std::vector<CompressedLevel> levels;    // largest first
+
+    std::shared_ptr<MappedFile> mapping;
+    std::vector<unsigned char> buffer;
+};
+
+// Load a DXT1 or DXT5 dds file, without copying its blocks
+bool loadDds( const std::string& filename, CompressedImage * pImage );
+
+// Write a compressed image held in its buffer as a dds file
+bool writeDds( const std::string& filename, const CompressedImage& image );
+
+#endif
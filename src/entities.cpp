@@ -0,0 +1,469 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "entities.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GFXSANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+// 2pi split so that k * TWO_PI_HI is exact for any k below 2^16, which keeps
+// the range reduction accurate for a few hours of animation
+const float TWO_PI_HI  = 6.28125f;
+const float TWO_PI_LO  = 0.0019353071795864769f;
+const float INV_TWO_PI = 0.15915494309189535f;
+const float PI         = 3.14159265358979324f;
+
+// Taylor series of sin( x ) / x - 1 in x^2, good to 6e-8 over [-pi/2, pi/2]
+const float SIN_C3  = -1.6666667e-1f;
+const float SIN_C5  =  8.3333333e-3f;
+const float SIN_C7  = -1.9841270e-4f;
+const float SIN_C9  =  2.7557319e-6f;
+const float SIN_C11 = -2.5052108e-8f;
+
+/**
+ * Raw pointers to the arrays of a range of entities, so the kernels don't
+ * depend on how the store keeps them
+ */
+struct EntityArrays
+{
+    const float * originX;
+    const float * originY;
+    const float * velocityX;
+    const float * velocityY;
+    const float * baseScale;
+    const float * fadePhase;
+    const float * fadeRate;
+    const uint32_t * texture;
+    float * positionX;
+    float * positionY;
+    float * scale;
+    float * fade;
+};
+
+/**
+ * Sine with plain float operations, in the order the vectorized kernels use.
+ * The angle is reduced to [-pi, pi] by subtracting the nearest multiple of
+ * 2pi, folded into [-pi/2, pi/2] using sin( x ) = sin( pi - x ), and then the
+ * Taylor series is evaluated
+ */
+float entitySin( float radians )
+{
+    float k = static_cast<float>( lrintf( radians * INV_TWO_PI ) );
+    float r = radians - k * TWO_PI_HI;
+    r       = r - k * TWO_PI_LO;
+    r       = std::max( std::min( r, PI - r ), -PI - r );
+
+    float r2 = r * r;
+    float p  = SIN_C11;
+    p        = p * r2 + SIN_C9;
+    p        = p * r2 + SIN_C7;
+    p        = p * r2 + SIN_C5;
+    p        = p * r2 + SIN_C3;
+    p        = p * r2;
+
+    return r + r * p;
+}
+
+/**
+ * Moves a coordinate back into [-1, 1) by a multiple of the width of clip
+ * space
+ */
+static inline float wrapClipSpace( float p )
+{
+    return p - floorf( ( p + 1.0f ) * 0.5f ) * 2.0f;
+}
+
+/**
+ * Portable version of the update, also used to finish off the entities left
+ * over by the vectorized kernels
+ */
+static void updateScalar( const EntityArrays& a, float seconds, size_t begin, size_t end )
+{
+    for ( size_t i = begin; i < end; ++i )
+    {
+        float fade = entitySin( seconds * a.fadeRate[i] + a.fadePhase[i] ) * 0.5f + 0.5f;
+
+        if ( a.texture[i] == 1 )
+        {
+            fade = 1.0f - fade;
+        }
+
+        a.positionX[i] = wrapClipSpace( a.originX[i] + a.velocityX[i] * seconds );
+        a.positionY[i] = wrapClipSpace( a.originY[i] + a.velocityY[i] * seconds );
+        a.scale[i]     = a.baseScale[i] * ( 0.75f + 0.5f * fade );
+        a.fade[i]      = fade;
+    }
+}
+
+#ifdef GFXSANDBOX_X86
+/**
+ * SSE2 version of entitySin(). There is no rounding instruction before
+ * SSE4.1, so the nearest integer goes through a conversion just like lrintf
+ */
+static inline __m128 sinSse2( __m128 x )
+{
+    __m128 k = _mm_cvtepi32_ps( _mm_cvtps_epi32( _mm_mul_ps( x, _mm_set1_ps( INV_TWO_PI ) ) ) );
+    __m128 r = _mm_sub_ps( x, _mm_mul_ps( k, _mm_set1_ps( TWO_PI_HI ) ) );
+    r        = _mm_sub_ps( r, _mm_mul_ps( k, _mm_set1_ps( TWO_PI_LO ) ) );
+
+    __m128 pi = _mm_set1_ps( PI );
+    r = _mm_max_ps( _mm_min_ps( r, _mm_sub_ps( pi, r ) ),
+                    _mm_sub_ps( _mm_sub_ps( _mm_setzero_ps(), pi ), r ) );
+
+    __m128 r2 = _mm_mul_ps( r, r );
+    __m128 p  = _mm_set1_ps( SIN_C11 );
+    p         = _mm_add_ps( _mm_mul_ps( p, r2 ), _mm_set1_ps( SIN_C9 ) );
+    p         = _mm_add_ps( _mm_mul_ps( p, r2 ), _mm_set1_ps( SIN_C7 ) );
+    p         = _mm_add_ps( _mm_mul_ps( p, r2 ), _mm_set1_ps( SIN_C5 ) );
+    p         = _mm_add_ps( _mm_mul_ps( p, r2 ), _mm_set1_ps( SIN_C3 ) );
+    p         = _mm_mul_ps( p, r2 );
+
+    return _mm_add_ps( r, _mm_mul_ps( r, p ) );
+}
+
+/**
+ * SSE2 version of wrapClipSpace(). Floor is the nearest integer, less one
+ * wherever that rounded up
+ */
+static inline __m128 wrapSse2( __m128 p )
+{
+    __m128 h = _mm_mul_ps( _mm_add_ps( p, _mm_set1_ps( 1.0f ) ), _mm_set1_ps( 0.5f ) );
+    __m128 f = _mm_cvtepi32_ps( _mm_cvtps_epi32( h ) );
+    f        = _mm_sub_ps( f, _mm_and_ps( _mm_cmpgt_ps( f, h ), _mm_set1_ps( 1.0f ) ) );
+
+    return _mm_sub_ps( p, _mm_mul_ps( f, _mm_set1_ps( 2.0f ) ) );
+}
+
+/**
+ * SSE2 kernel, updates four entities per iteration
+ */
+static void updateSse2( const EntityArrays& a, float seconds, size_t begin, size_t end )
+{
+    const __m128 t    = _mm_set1_ps( seconds );
+    const __m128 half = _mm_set1_ps( 0.5f );
+    const __m128 one  = _mm_set1_ps( 1.0f );
+
+    size_t i = begin;
+
+    for ( ; i + 4 <= end; i += 4 )
+    {
+        __m128 angle = _mm_add_ps( _mm_mul_ps( t, _mm_loadu_ps( a.fadeRate + i ) ),
+                                   _mm_loadu_ps( a.fadePhase + i ) );
+        __m128 fade  = _mm_add_ps( _mm_mul_ps( sinSse2( angle ), half ), half );
+
+        __m128i texture = _mm_loadu_si128( reinterpret_cast<const __m128i*>( a.texture + i ) );
+        __m128 swap     = _mm_castsi128_ps( _mm_cmpeq_epi32( texture, _mm_set1_epi32( 1 ) ) );
+        fade            = _mm_or_ps( _mm_and_ps( swap, _mm_sub_ps( one, fade ) ),
+                                     _mm_andnot_ps( swap, fade ) );
+
+        __m128 x = _mm_add_ps( _mm_loadu_ps( a.originX + i ),
+                               _mm_mul_ps( _mm_loadu_ps( a.velocityX + i ), t ) );
+        __m128 y = _mm_add_ps( _mm_loadu_ps( a.originY + i ),
+                               _mm_mul_ps( _mm_loadu_ps( a.velocityY + i ), t ) );
+
+        __m128 pulse = _mm_add_ps( _mm_set1_ps( 0.75f ), _mm_mul_ps( half, fade ) );
+
+        _mm_storeu_ps( a.positionX + i, wrapSse2( x ) );
+        _mm_storeu_ps( a.positionY + i, wrapSse2( y ) );
+        _mm_storeu_ps( a.scale + i, _mm_mul_ps( _mm_loadu_ps( a.baseScale + i ), pulse ) );
+        _mm_storeu_ps( a.fade + i, fade );
+    }
+
+    updateScalar( a, seconds, i, end );
+}
+
+/**
+ * AVX2 version of entitySin(). Fused multiply adds are deliberately not used
+ * so that the results match the other kernels exactly
+ */
+__attribute__(( target( "avx2" ) ))
+static inline __m256 sinAvx2( __m256 x )
+{
+    __m256 k = _mm256_round_ps( _mm256_mul_ps( x, _mm256_set1_ps( INV_TWO_PI ) ),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+    __m256 r = _mm256_sub_ps( x, _mm256_mul_ps( k, _mm256_set1_ps( TWO_PI_HI ) ) );
+    r        = _mm256_sub_ps( r, _mm256_mul_ps( k, _mm256_set1_ps( TWO_PI_LO ) ) );
+
+    __m256 pi = _mm256_set1_ps( PI );
+    r = _mm256_max_ps( _mm256_min_ps( r, _mm256_sub_ps( pi, r ) ),
+                       _mm256_sub_ps( _mm256_sub_ps( _mm256_setzero_ps(), pi ), r ) );
+
+    __m256 r2 = _mm256_mul_ps( r, r );
+    __m256 p  = _mm256_set1_ps( SIN_C11 );
+    p         = _mm256_add_ps( _mm256_mul_ps( p, r2 ), _mm256_set1_ps( SIN_C9 ) );
+    p         = _mm256_add_ps( _mm256_mul_ps( p, r2 ), _mm256_set1_ps( SIN_C7 ) );
+    p         = _mm256_add_ps( _mm256_mul_ps( p, r2 ), _mm256_set1_ps( SIN_C5 ) );
+    p         = _mm256_add_ps( _mm256_mul_ps( p, r2 ), _mm256_set1_ps( SIN_C3 ) );
+    p         = _mm256_mul_ps( p, r2 );
+
+    return _mm256_add_ps( r, _mm256_mul_ps( r, p ) );
+}
+
+/**
+ * AVX2 version of wrapClipSpace()
+ */
+__attribute__(( target( "avx2" ) ))
+static inline __m256 wrapAvx2( __m256 p )
+{
+    __m256 h = _mm256_mul_ps( _mm256_add_ps( p, _mm256_set1_ps( 1.0f ) ),
+                              _mm256_set1_ps( 0.5f ) );
+
+    return _mm256_sub_ps( p, _mm256_mul_ps( _mm256_floor_ps( h ), _mm256_set1_ps( 2.0f ) ) );
+}
+
+/**
+ * AVX2 kernel, updates eight entities per iteration
+ */
+__attribute__(( target( "avx2" ) ))
+static void updateAvx2( const EntityArrays& a, float seconds, size_t begin, size_t end )
+{
+    const __m256 t    = _mm256_set1_ps( seconds );
+    const __m256 half = _mm256_set1_ps( 0.5f );
+    const __m256 one  = _mm256_set1_ps( 1.0f );
+
+    size_t i = begin;
+
+    for ( ; i + 8 <= end; i += 8 )
+    {
+        __m256 angle = _mm256_add_ps( _mm256_mul_ps( t, _mm256_loadu_ps( a.fadeRate + i ) ),
+                                      _mm256_loadu_ps( a.fadePhase + i ) );
+        __m256 fade  = _mm256_add_ps( _mm256_mul_ps( sinAvx2( angle ), half ), half );
+
+        __m256i texture = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a.texture + i ) );
+        __m256 swap     = _mm256_castsi256_ps(
+            _mm256_cmpeq_epi32( texture, _mm256_set1_epi32( 1 ) ) );
+        fade            = _mm256_blendv_ps( fade, _mm256_sub_ps( one, fade ), swap );
+
+        __m256 x = _mm256_add_ps( _mm256_loadu_ps( a.originX + i ),
+                                  _mm256_mul_ps( _mm256_loadu_ps( a.velocityX + i ), t ) );
+        __m256 y = _mm256_add_ps( _mm256_loadu_ps( a.originY + i ),
+                                  _mm256_mul_ps( _mm256_loadu_ps( a.velocityY + i ), t ) );
+
+        __m256 pulse = _mm256_add_ps( _mm256_set1_ps( 0.75f ), _mm256_mul_ps( half, fade ) );
+
+        _mm256_storeu_ps( a.positionX + i, wrapAvx2( x ) );
+        _mm256_storeu_ps( a.positionY + i, wrapAvx2( y ) );
+        _mm256_storeu_ps( a.scale + i, _mm256_mul_ps( _mm256_loadu_ps( a.baseScale + i ), pulse ) );
+        _mm256_storeu_ps( a.fade + i, fade );
+    }
+
+    updateScalar( a, seconds, i, end );
+}
+#endif
+
+/**
+ * Checks if the CPU we are running on supports a kernel
+ */
+bool isEntityKernelSupported( EntityKernel kernel )
+{
+    switch ( kernel )
+    {
+        case ENTITY_KERNEL_SCALAR:
+            return true;
+
+#ifdef GFXSANDBOX_X86
+        case ENTITY_KERNEL_SSE2:
+            return __builtin_cpu_supports( "sse2" );
+
+        case ENTITY_KERNEL_AVX2:
+            return __builtin_cpu_supports( "avx2" );
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Picks the widest kernel the CPU supports. This is only worked out once
+ */
+EntityKernel bestEntityKernel()
+{
+    static const EntityKernel best =
+        isEntityKernelSupported( ENTITY_KERNEL_AVX2 ) ? ENTITY_KERNEL_AVX2 :
+        isEntityKernelSupported( ENTITY_KERNEL_SSE2 ) ? ENTITY_KERNEL_SSE2 :
+                                                        ENTITY_KERNEL_SCALAR;
+    return best;
+}
+
+const char * entityKernelName( EntityKernel kernel )
+{
+    switch ( kernel )
+    {
+        case ENTITY_KERNEL_SCALAR:  return "scalar";
+        case ENTITY_KERNEL_SSE2:    return "sse2";
+        case ENTITY_KERNEL_AVX2:    return "avx2";
+        default:                    return "unknown";
+    }
+}
+
+EntityStore::EntityStore()
+    : mOriginX(), mOriginY(),
+      mVelocityX(), mVelocityY(),
+      mBaseScale(),
+      mFadePhase(), mFadeRate(),
+      mTexture(),
+      mPositionX(), mPositionY(),
+      mScale(),
+      mFade()
+{
+}
+
+void EntityStore::clear()
+{
+    mOriginX.clear();
+    mOriginY.clear();
+    mVelocityX.clear();
+    mVelocityY.clear();
+    mBaseScale.clear();
+    mFadePhase.clear();
+    mFadeRate.clear();
+    mTexture.clear();
+    mPositionX.clear();
+    mPositionY.clear();
+    mScale.clear();
+    mFade.clear();
+}
+
+/**
+ * Adds an entity. Its state is only valid after the next update()
+ *
+ * \param  desc  Starting state of the entity
+ * \return       Index of the entity in the arrays
+ */
+size_t EntityStore::add( const EntityDesc& desc )
+{
+    mOriginX.push_back( desc.x );
+    mOriginY.push_back( desc.y );
+    mVelocityX.push_back( desc.velocityX );
+    mVelocityY.push_back( desc.velocityY );
+    mBaseScale.push_back( desc.scale );
+    mFadePhase.push_back( desc.fadePhase );
+    mFadeRate.push_back( desc.fadeRate );
+    mTexture.push_back( desc.texture );
+
+    mPositionX.push_back( desc.x );
+    mPositionY.push_back( desc.y );
+    mScale.push_back( desc.scale );
+    mFade.push_back( 0.0f );
+
+    return mOriginX.size() - 1;
+}
+
+/**
+ * Replaces the entities with randomly placed ones. The same seed always
+ * gives the same entities
+ *
+ * \param  count  Number of entities to create
+ * \param  seed   Seed for the random number generator
+ */
+void EntityStore::createRandom( size_t count, unsigned int seed )
+{
+    std::mt19937 random( seed );
+    std::uniform_real_distribution<float> position( -1.0f, 1.0f );
+    std::uniform_real_distribution<float> velocity( -0.2f, 0.2f );
+    std::uniform_real_distribution<float> scale( 0.01f, 0.04f );
+    std::uniform_real_distribution<float> phase( 0.0f, 2.0f * PI );
+    std::uniform_real_distribution<float> rate( 0.5f, 2.0f );
+
+    clear();
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        EntityDesc desc;
+        desc.x         = position( random );
+        desc.y         = position( random );
+        desc.velocityX = velocity( random );
+        desc.velocityY = velocity( random );
+        desc.scale     = scale( random );
+        desc.fadePhase = phase( random );
+        desc.fadeRate  = rate( random );
+        desc.texture   = random() & 1;
+
+        add( desc );
+    }
+}
+
+/**
+ * Works out the position, size and fade of every entity at a point in time,
+ * using the fastest kernel the CPU supports
+ *
+ * \param  seconds  Time since the scene started, in seconds
+ * \param  pJobs    Threads to spread the update over, or NULL to only use
+ *                  the calling thread
+ */
+void EntityStore::update( float seconds, JobSystem * pJobs )
+{
+    updateWith( bestEntityKernel(), seconds, pJobs );
+}
+
+/**
+ * Updates every entity using a specific kernel. The kernel must be supported
+ * by the CPU
+ */
+void EntityStore::updateWith( EntityKernel kernel, float seconds, JobSystem * pJobs )
+{
+    assert( isEntityKernelSupported( kernel ) );
+
+    ProfileScope scope( "update entities" );
+
+    EntityArrays arrays;
+    arrays.originX   = mOriginX.data();
+    arrays.originY   = mOriginY.data();
+    arrays.velocityX = mVelocityX.data();
+    arrays.velocityY = mVelocityY.data();
+    arrays.baseScale = mBaseScale.data();
+    arrays.fadePhase = mFadePhase.data();
+    arrays.fadeRate  = mFadeRate.data();
+    arrays.texture   = mTexture.data();
+    arrays.positionX = mPositionX.data();
+    arrays.positionY = mPositionY.data();
+    arrays.scale     = mScale.data();
+    arrays.fade      = mFade.data();
+
+    void ( *pKernel )( const EntityArrays&, float, size_t, size_t ) = &updateScalar;
+
+#ifdef GFXSANDBOX_X86
+    if ( kernel == ENTITY_KERNEL_AVX2 )
+    {
+        pKernel = &updateAvx2;
+    }
+    else if ( kernel == ENTITY_KERNEL_SSE2 )
+    {
+        pKernel = &updateSse2;
+    }
+#endif
+
+    auto updateRange = [&]( size_t begin, size_t end )
+    {
+        pKernel( arrays, seconds, begin, end );
+    };
+
+    if ( pJobs != NULL )
+    {
+        pJobs->parallelFor( size(), ENTITY_CHUNK_SIZE, updateRange );
+    }
+    else
+    {
+        updateRange( 0, size() );
+    }
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_ENTITIES_H
+#define SCOTT_GFXSANDBOX_ENTITIES_H
+
+#include "jobsystem.h"
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+/**
+ * Allocator that starts every array on a cache line, so that chunks which
+ * are a whole number of lines long never share a line with their neighbours
+ */
+template<typename T>
+struct CacheLineAllocator
+{
+    typedef T value_type;
+
+    CacheLineAllocator() { }
+
+    template<typename U>
+    CacheLineAllocator( const CacheLineAllocator<U>& ) { }
+
+    T * allocate( size_t count )
+    {
+        void * pMemory = NULL;
+
+        if ( posix_memalign( &pMemory, CACHE_LINE_SIZE, count * sizeof( T ) ) != 0 )
+        {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>( pMemory );
+    }
+
+    void deallocate( T * pMemory, size_t )
+    {
+        free( pMemory );
+    }
+
+    template<typename U>
+    struct rebind
+    {
+        typedef CacheLineAllocator<U> other;
+    };
+};
+
+template<typename T, typename U>
+bool operator == ( const CacheLineAllocator<T>&, const CacheLineAllocator<U>& )
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator != ( const CacheLineAllocator<T>&, const CacheLineAllocator<U>& )
+{
+    return false;
+}
+
+/**
+ * Implementations of the entity update. The best one supported by the CPU is
+ * picked at runtime, but benchmarks can ask for a specific one
+ */
+enum EntityKernel
+{
+    ENTITY_KERNEL_SCALAR,
+    ENTITY_KERNEL_SSE2,
+    ENTITY_KERNEL_AVX2
+};
+
+// Entities updated by one job. Every array gets a whole number of cache lines
+const size_t ENTITY_CHUNK_SIZE = 1024;
+
+/**
+ * Starting state of one entity
+ */
+struct EntityDesc
+{
+    float x, y;                     // position at time zero, in clip space
+    float velocityX, velocityY;     // clip space units per second
+    float scale;                    // half size at the middle of the fade
+    float fadePhase;                // radians added to the fade's sine
+    float fadeRate;                 // radians per second of the fade's sine
+    uint32_t texture;               // which of the scene's images it fades from
+};
+
+/**
+ * A large number of independently animated sprites, stored as a separate
+ * array per field so that the update streams through memory and works on
+ * several entities per instruction.
+ *
+ * The animation is a pure function of time, like the scene's fade factor.
+ * Each entity drifts in a straight line, wrapping around the edges of clip
+ * space, and crossfades between the scene's two images with its own rate and
+ * phase. Its size pulses along with the fade.
+ *
+ * update() splits the entities into chunks of ENTITY_CHUNK_SIZE and runs
+ * them on a JobSystem. The vectorized kernels compute the sine with the same
+ * sequence of operations as the scalar one, so every kernel gives exactly
+ * the same results.
+ */
+class EntityStore
+{
+public:
+    typedef std::vector<float, CacheLineAllocator<float> > FloatArray;
+    typedef std::vector<uint32_t, CacheLineAllocator<uint32_t> > IndexArray;
+
+    EntityStore();
+
+    // Remove every entity
+    void clear();
+
+    // Add an entity, returns its index
+    size_t add( const EntityDesc& desc );
+
+    // Replace the entities with count randomly placed ones
+    void createRandom( size_t count, unsigned int seed );
+
+    // Number of entities
+    size_t size() const { return mOriginX.size(); }
+
+    // Work out every entity's state at a point in time
+    void update( float seconds, JobSystem * pJobs );
+
+    // Update with a specific kernel
+    void updateWith( EntityKernel kernel, float seconds, JobSystem * pJobs );
+
+    // State computed by the last update
+    const float * positionX() const { return mPositionX.data(); }
+    const float * positionY() const { return mPositionY.data(); }
+    const float * scale() const { return mScale.data(); }
+    const float * fade() const { return mFade.data(); }
+
+private:
+    // Set once when the entity is added
+    FloatArray mOriginX, mOriginY;
+    FloatArray mVelocityX, mVelocityY;
+    FloatArray mBaseScale;
+    FloatArray mFadePhase, mFadeRate;
+    IndexArray mTexture;
+
+    // Written by update()
+    FloatArray mPositionX, mPositionY;
+    FloatArray mScale;
+    FloatArray mFade;
+};
+
+// Returns the fastest kernel supported by this CPU
+EntityKernel bestEntityKernel();
+
+// Returns true if the CPU can run the given kernel
+bool isEntityKernelSupported( EntityKernel kernel );
+
+// Returns a printable name for the kernel
+const char * entityKernelName( EntityKernel kernel );
+
+// Sine computed the same way as the vectorized kernels, to within 3e-7
+float entitySin( float radians );
+
+#endif
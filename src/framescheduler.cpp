@@ -0,0 +1,191 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "framescheduler.h"
+#include "timing.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+// Sleep overshoot starts at this many milliseconds until it has been measured
+const double INITIAL_SLEEP_OVERSHOOT_MS = 1.0;
+
+// How quickly the overshoot estimate forgets a large overshoot
+const double SLEEP_OVERSHOOT_DECAY = 0.99;
+
+/**
+ * Constructor
+ *
+ * \param  simulate  Called once for each fixed simulation step
+ * \param  options   Timestep, frame rate cap and statistics settings
+ */
+FrameScheduler::FrameScheduler( SimulateFunc simulate,
+                                const FrameSchedulerOptions& options )
+    : mSimulate( simulate ),
+      mOptions( options ),
+      mSimulationTime( 0.0 ),
+      mAccumulator( 0.0 ),
+      mLastFrameMs( -1.0 ),
+      mLastStatsMs( -1.0 ),
+      mSleepOvershootMs( INITIAL_SLEEP_OVERSHOOT_MS ),
+      mFrameCount( 0 ),
+      mStepCount( 0 ),
+      mDroppedSeconds( 0.0 ),
+      mFrameTimes()
+{
+}
+
+/**
+ * Starts a new frame. If there is a frame rate cap this waits until the
+ * frame is due, then runs as many simulation steps as it takes to catch up
+ * with real time.
+ *
+ * \return  How far real time is between the last simulation step and the
+ *          next one, from 0 to 1. Render with the state interpolated by this
+ *          much from the previous step towards the latest one
+ */
+double FrameScheduler::beginFrame()
+{
+    double now = currentTimeMs();
+
+    if ( mLastFrameMs < 0.0 )
+    {
+        // First frame. Nothing to catch up on, but the renderer needs one
+        // step to interpolate towards
+        mLastFrameMs = now;
+        mLastStatsMs = now;
+
+        mSimulate( mSimulationTime, mOptions.stepSeconds );
+        mStepCount++;
+        mFrameCount++;
+
+        return 1.0;
+    }
+
+    if ( mOptions.maxFrameRate > 0.0 )
+    {
+        waitUntil( mLastFrameMs + 1000.0 / mOptions.maxFrameRate );
+        now = currentTimeMs();
+    }
+
+    double frameMs = now - mLastFrameMs;
+
+    mLastFrameMs = now;
+    mFrameTimes.push_back( frameMs );
+    mFrameCount++;
+
+    // Run fixed steps until the simulation has caught up. If it can't keep
+    // up, give up on the time it is behind by instead of falling further
+    // behind every frame
+    mAccumulator += frameMs * 0.001;
+    int steps = 0;
+
+    while ( mAccumulator >= mOptions.stepSeconds )
+    {
+        if ( steps == mOptions.maxStepsPerFrame )
+        {
+            mDroppedSeconds += mAccumulator;
+            mAccumulator     = 0.0;
+            break;
+        }
+
+        mSimulationTime += mOptions.stepSeconds;
+        mAccumulator    -= mOptions.stepSeconds;
+
+        mSimulate( mSimulationTime, mOptions.stepSeconds );
+        mStepCount++;
+        steps++;
+    }
+
+    if ( mOptions.statsIntervalSeconds > 0.0 &&
+         now - mLastStatsMs >= mOptions.statsIntervalSeconds * 1000.0 )
+    {
+        printStats();
+    }
+
+    return mAccumulator / mOptions.stepSeconds;
+}
+
+/**
+ * Sets the frame rate cap
+ *
+ * \param  framesPerSecond  Frames per second to cap at, or 0 for no cap
+ */
+void FrameScheduler::setMaxFrameRate( double framesPerSecond )
+{
+    mOptions.maxFrameRate = framesPerSecond;
+}
+
+/**
+ * Prints a summary of the frame times since the statistics were last printed
+ * and starts collecting them again
+ */
+void FrameScheduler::printStats()
+{
+    double now       = currentTimeMs();
+    double elapsedMs = now - mLastStatsMs;
+
+    if ( mFrameTimes.empty() || elapsedMs <= 0.0 )
+    {
+        return;
+    }
+
+    printSummary( "frame time (ms)", summarizeSamples( mFrameTimes ) );
+
+    std::cout << mFrameTimes.size() * 1000.0 / elapsedMs << " fps, "
+              << mStepCount << " simulation steps, "
+              << mDroppedSeconds * 1000.0 << " ms dropped, "
+              << "sleep overshoot " << mSleepOvershootMs << " ms"
+              << std::endl;
+
+    mFrameTimes.clear();
+    mStepCount      = 0;
+    mDroppedSeconds = 0.0;
+    mLastStatsMs    = now;
+}
+
+/**
+ * Blocks until the given time. Most of the wait is spent asleep, and the
+ * rest spinning so that late wake ups don't make the frame late
+ *
+ * \param  targetMs  Time to wait for, on the currentTimeMs() clock
+ */
+void FrameScheduler::waitUntil( double targetMs )
+{
+    double now = currentTimeMs();
+    double sleepMs = targetMs - now - mSleepOvershootMs;
+
+    if ( sleepMs > 0.0 )
+    {
+        std::this_thread::sleep_for(
+            std::chrono::duration<double, std::milli>( sleepMs ) );
+
+        // Keep track of the worst recent overshoot, letting it shrink again
+        // slowly if the system becomes less busy
+        double woke      = currentTimeMs();
+        double overshoot = std::max( 0.0, ( woke - now ) - sleepMs );
+
+        mSleepOvershootMs = std::max( overshoot,
+                                      mSleepOvershootMs * SLEEP_OVERSHOOT_DECAY );
+        now = woke;
+    }
+
+    while ( now < targetMs )
+    {
+        std::this_thread::yield();
+        now = currentTimeMs();
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_FRAMESCHEDULER_H
+#define SCOTT_GFXSANDBOX_FRAMESCHEDULER_H
+
+#include <vector>
+
+/**
+ * Settings for the frame scheduler
+ */
+struct FrameSchedulerOptions
+{
+    FrameSchedulerOptions()
+        : stepSeconds( 1.0 / 120.0 ),
+          maxFrameRate( 60.0 ),
+          maxStepsPerFrame( 8 ),
+          statsIntervalSeconds( 5.0 )
+    {
+    }
+
+    double stepSeconds;             // fixed simulation timestep
+    double maxFrameRate;            // frames per second, 0 for no cap
+    int maxStepsPerFrame;           // steps run before falling behind
+    double statsIntervalSeconds;    // 0 to never print frame statistics
+};
+
+/**
+ * Paces the main loop. The simulation is advanced in fixed size steps no
+ * matter how fast frames are rendered, and the renderer is handed the
+ * fraction of a step that is left over so it can interpolate between the
+ * last two simulation states.
+ *
+ * When a frame rate cap is set the scheduler sleeps until the next frame is
+ * due instead of spinning. Sleeps routinely overshoot by a little, so it
+ * wakes up early by the largest overshoot it has seen recently and spins
+ * for the remainder. With vsync on the buffer swap does the pacing and the
+ * cap should be turned off.
+ */
+class FrameScheduler
+{
+public:
+    // Advances the simulation by one step, ending at the given time
+    typedef void (*SimulateFunc)( double timeSeconds, double stepSeconds );
+
+    FrameScheduler( SimulateFunc simulate,
+                    const FrameSchedulerOptions& options = FrameSchedulerOptions() );
+
+    // Wait for the next frame and simulate up to it, returns the blend factor
+    double beginFrame();
+
+    // Change the frame rate cap, 0 to turn it off
+    void setMaxFrameRate( double framesPerSecond );
+
+    // Print statistics for the frames since the last time they were printed
+    void printStats();
+
+    // Time the simulation has advanced to, in seconds
+    double simulationTime() const { return mSimulationTime; }
+
+    // Number of frames started so far
+    unsigned long long frameCount() const { return mFrameCount; }
+
+private:
+    void waitUntil( double targetMs );
+
+private:
+    SimulateFunc mSimulate;
+    FrameSchedulerOptions mOptions;
+    double mSimulationTime;     // seconds
+    double mAccumulator;        // seconds of real time not yet simulated
+    double mLastFrameMs;        // start of the previous frame, < 0 if none
+    double mLastStatsMs;
+    double mSleepOvershootMs;   // how far sleeps have been running over
+    unsigned long long mFrameCount;
+    unsigned long long mStepCount;  // since stats were last printed
+    double mDroppedSeconds;     // time thrown away since stats were printed
+    std::vector<double> mFrameTimes;
+};
+
+#endif
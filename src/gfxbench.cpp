@@ -0,0 +1,984 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Micro benchmarks of the loaders and macro benchmarks of the renderer. Every
+// benchmark is timed as a number of samples, each sample running the body in
+// a loop long enough to be measured reliably. Results can be saved as JSON
+// and compared against a baseline with bench/compare.py
+#include "gfxsandbox.h"
+#include "commandbuffer.h"
+#include "entities.h"
+#include "glstate.h"
+#include "glutil.h"
+#include "imagecodec.h"
+#include "jobsystem.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "qoi.h"
+#include "shader.h"
+#include "shadersource.h"
+#include "spatialgrid.h"
+#include "swizzle.h"
+#include "texture.h"
+#include "tga.h"
+#include "timing.h"
+#include "util.h"
+#ifdef GFXSANDBOX_HAS_EGL
+#include "headless.h"
+#endif
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// Version of the JSON results, bumped when its layout changes
+const int BENCH_RESULTS_VERSION = 1;
+
+// Upper limit on the calibrated loop count, for bodies the optimiser empties
+const size_t MAX_BENCH_ITERATIONS = size_t( 1 ) << 24;
+
+// Files the loader benchmarks read. They are installed into the build tree
+const char * const BENCH_TGA_FILE    = "content/images/hello1.tga";
+const char * const BENCH_QOI_FILE    = "content/images/hello1.qoi";
+const char * const BENCH_SHADER_FILE = "content/shaders/hello.ps.glsl";
+const char * const BENCH_VS_FILE     = "content/shaders/hello.vs.glsl";
+
+// Size of the synthetic images used by the pixel benchmarks
+const int BENCH_IMAGE_SIZE = 512;
+
+// Draw packets recorded and sorted by the command queue benchmarks
+const size_t BENCH_PACKET_COUNT = 10000;
+
+// Entities animated by the entity update benchmarks, and culled by the
+// spatial grid benchmarks
+const size_t BENCH_ENTITY_COUNT = 1000000;
+
+// Cells along each side of the grid the cull benchmarks use, about 64
+// entities to a cell
+const unsigned int BENCH_GRID_CELLS = 125;
+
+/**
+ * Settings for a benchmark run
+ */
+struct BenchOptions
+{
+    BenchOptions()
+        : jsonFile(),
+          filter(),
+          sampleCount( 20 ),
+          minSampleMs( 5.0 ),
+          cpuOnly( false ),
+          width( 640 ),
+          height( 480 )
+    {
+    }
+
+    std::string jsonFile;       // if not empty, results are saved here
+    std::string filter;         // only run benchmarks whose name contains this
+    size_t sampleCount;         // samples taken of each benchmark
+    double minSampleMs;         // shortest time a single sample may take
+    bool cpuOnly;               // skip the benchmarks that need a GL context
+    int width;                  // size of the offscreen framebuffer
+    int height;
+};
+
+/**
+ * Timings of one benchmark. Each sample is the mean time of one iteration,
+ * in nanoseconds, over a loop of iterations
+ */
+struct BenchResult
+{
+    std::string name;
+    const char * group;         // "cpu" or "gl"
+    size_t iterations;          // iterations in each sample
+    std::vector<double> samples;
+};
+
+/**
+ * Silences standard output for as long as it exists. Loaders report what
+ * they are doing on stdout, which would drown out the results when they run
+ * thousands of times. Errors still go to stderr
+ */
+class QuietScope
+{
+public:
+    QuietScope()
+        : mpBuffer( std::cout.rdbuf( NULL ) )
+    {
+    }
+
+    ~QuietScope()
+    {
+        std::cout.rdbuf( mpBuffer );
+    }
+
+private:
+    std::streambuf * mpBuffer;
+};
+
+/**
+ * Runs benchmarks and collects their results
+ */
+class BenchSuite
+{
+public:
+    explicit BenchSuite( const BenchOptions& options )
+        : mOptions( options ),
+          mResults()
+    {
+    }
+
+    // Check if a benchmark was asked for on the command line
+    bool isSelected( const std::string& name ) const
+    {
+        return mOptions.filter.empty() || name.find( mOptions.filter ) != std::string::npos;
+    }
+
+    void run( const std::string& name, const char * group, const std::function<void()>& body );
+
+    const std::vector<BenchResult>& results() const { return mResults; }
+
+private:
+    const BenchOptions& mOptions;
+    std::vector<BenchResult> mResults;
+};
+
+/**
+ * Times a benchmark. The body is first run in a loop of doubling length
+ * until the loop takes at least the minimum sample time, which also warms
+ * up caches and the driver. Then that loop is timed once per sample
+ *
+ * \param  name   Name the benchmark is reported and compared under
+ * \param  group  "cpu" or "gl"
+ * \param  body   One iteration of the benchmark
+ */
+void BenchSuite::run( const std::string& name,
+                      const char * group,
+                      const std::function<void()>& body )
+{
+    if (! isSelected( name ) )
+    {
+        return;
+    }
+
+    BenchResult result;
+    result.name       = name;
+    result.group      = group;
+    result.iterations = 1;
+
+    {
+        QuietScope quiet;
+
+        for (;;)
+        {
+            double start = currentTimeMs();
+
+            for ( size_t i = 0; i < result.iterations; ++i )
+            {
+                body();
+            }
+
+            if ( currentTimeMs() - start >= mOptions.minSampleMs ||
+                 result.iterations >= MAX_BENCH_ITERATIONS )
+            {
+                break;
+            }
+
+            result.iterations *= 2;
+        }
+
+        for ( size_t sample = 0; sample < mOptions.sampleCount; ++sample )
+        {
+            double start = currentTimeMs();
+
+            for ( size_t i = 0; i < result.iterations; ++i )
+            {
+                body();
+            }
+
+            double elapsedNs = ( currentTimeMs() - start ) * 1000000.0;
+            result.samples.push_back( elapsedNs / static_cast<double>( result.iterations ) );
+        }
+    }
+
+    SampleSummary summary = summarizeSamples( result.samples );
+    double variance       = 0.0;
+
+    for ( size_t i = 0; i < result.samples.size(); ++i )
+    {
+        double delta = result.samples[i] - summary.mean;
+        variance    += delta * delta;
+    }
+
+    double stddev = sqrt( variance / std::max<double>( 1.0, result.samples.size() - 1.0 ) );
+
+    printf( "%-40s %14.1f ns  median %14.1f ns  +/- %5.1f%%  (%zu x %zu)\n",
+            name.c_str(),
+            summary.mean,
+            summary.median,
+            100.0 * stddev / std::max( summary.mean, 1e-9 ),
+            result.samples.size(),
+            result.iterations );
+
+    mResults.push_back( result );
+}
+
+/**
+ * Escapes a string for use inside a JSON string literal
+ */
+static std::string jsonEscape( const std::string& text )
+{
+    std::string escaped;
+
+    for ( size_t i = 0; i < text.size(); ++i )
+    {
+        unsigned char c = static_cast<unsigned char>( text[i] );
+
+        if ( c == '"' || c == '\\' )
+        {
+            escaped.push_back( '\\' );
+            escaped.push_back( text[i] );
+        }
+        else if ( c < 0x20 )
+        {
+            char code[8];
+            snprintf( code, sizeof( code ), "\\u%04x", c );
+            escaped += code;
+        }
+        else
+        {
+            escaped.push_back( text[i] );
+        }
+    }
+
+    return escaped;
+}
+
+/**
+ * Saves benchmark results as JSON. Along with the raw samples the file
+ * records what the results were measured on, since results from different
+ * machines or drivers can't be compared
+ *
+ * \param  filename  Path to write the results to
+ * \param  renderer  GL renderer string, or empty if no GL benchmarks ran
+ * \param  results   Results to save
+ * \return           True if the file was written
+ */
+static bool writeBenchResults( const std::string& filename,
+                               const std::string& renderer,
+                               const std::vector<BenchResult>& results )
+{
+    FILE * pFile = fopen( filename.c_str(), "w" );
+
+    if ( pFile == NULL )
+    {
+        std::cerr << "Failed to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    fprintf( pFile, "{\n" );
+    fprintf( pFile, "  \"suite\": \"gfxsandbox_bench\",\n" );
+    fprintf( pFile, "  \"version\": %d,\n", BENCH_RESULTS_VERSION );
+    fprintf( pFile, "  \"context\": {\n" );
+    fprintf( pFile, "    \"renderer\": \"%s\",\n", jsonEscape( renderer ).c_str() );
+    fprintf( pFile, "    \"threads\": %zu,\n", hardwareThreadCount() );
+    fprintf( pFile, "    \"swizzle_kernel\": \"%s\",\n", swizzleKernelName( bestSwizzleKernel() ) );
+    fprintf( pFile, "    \"mip_kernel\": \"%s\",\n", mipKernelName( bestMipKernel() ) );
+    fprintf( pFile, "    \"entity_kernel\": \"%s\",\n", entityKernelName( bestEntityKernel() ) );
+    fprintf( pFile, "    \"cull_kernel\": \"%s\"\n", cullKernelName( bestCullKernel() ) );
+    fprintf( pFile, "  },\n" );
+    fprintf( pFile, "  \"benchmarks\": [\n" );
+
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const BenchResult& result = results[i];
+        SampleSummary summary     = summarizeSamples( result.samples );
+
+        fprintf( pFile, "    {\n" );
+        fprintf( pFile, "      \"name\": \"%s\",\n", jsonEscape( result.name ).c_str() );
+        fprintf( pFile, "      \"group\": \"%s\",\n", result.group );
+        fprintf( pFile, "      \"unit\": \"ns\",\n" );
+        fprintf( pFile, "      \"iterations\": %zu,\n", result.iterations );
+        fprintf( pFile, "      \"mean\": %.3f,\n", summary.mean );
+        fprintf( pFile, "      \"median\": %.3f,\n", summary.median );
+        fprintf( pFile, "      \"min\": %.3f,\n", summary.min );
+        fprintf( pFile, "      \"max\": %.3f,\n", summary.max );
+        fprintf( pFile, "      \"samples\": [" );
+
+        for ( size_t j = 0; j < result.samples.size(); ++j )
+        {
+            fprintf( pFile, "%s%.3f", j > 0 ? ", " : "", result.samples[j] );
+        }
+
+        fprintf( pFile, "]\n    }%s\n", i + 1 < results.size() ? "," : "" );
+    }
+
+    fprintf( pFile, "  ]\n}\n" );
+
+    bool ok = ( ferror( pFile ) == 0 );
+    ok      = ( fclose( pFile ) == 0 ) && ok;
+
+    if (! ok )
+    {
+        std::cerr << "Failed to write " << filename << std::endl;
+    }
+
+    return ok;
+}
+
+/**
+ * Fills an image with noise. Benchmarks use a fixed seed so every run works
+ * on the same pixels
+ */
+static Image makeNoiseImage( int width, int height, PixelFormat format )
+{
+    Image image;
+    image.width  = width;
+    image.height = height;
+    image.format = format;
+    image.buffer.resize( static_cast<size_t>( width ) * height * bytesPerPixel( format ) );
+
+    std::mt19937 random( 1234 );
+
+    for ( size_t i = 0; i < image.buffer.size(); ++i )
+    {
+        image.buffer[i] = static_cast<unsigned char>( random() );
+    }
+
+    return image;
+}
+
+/**
+ * Times the entity update at 1M entities, with each kernel on one thread and
+ * then with the best kernel on a growing number of threads, up to one per
+ * core. The time at one thread over the time at each count is the speedup
+ * from spreading the chunks over the job system
+ */
+static void runEntityBenchmarks( BenchSuite * pSuite )
+{
+    EntityStore entities;
+    entities.createRandom( BENCH_ENTITY_COUNT, 1234 );
+
+    float seconds = 0.0f;
+
+    for ( int kernel = ENTITY_KERNEL_SCALAR; kernel <= ENTITY_KERNEL_AVX2; ++kernel )
+    {
+        EntityKernel entityKernel = static_cast<EntityKernel>( kernel );
+
+        if (! isEntityKernelSupported( entityKernel ) )
+        {
+            continue;
+        }
+
+        pSuite->run( std::string( "updateEntities 1M " ) + entityKernelName( entityKernel ),
+                     "cpu",
+                     [&entities, &seconds, entityKernel]()
+        {
+            seconds += 1.0f / 60.0f;
+            entities.updateWith( entityKernel, seconds, NULL );
+        } );
+    }
+
+    std::vector<size_t> threadCounts;
+
+    for ( size_t threads = 1; threads < hardwareThreadCount(); threads *= 2 )
+    {
+        threadCounts.push_back( threads );
+    }
+
+    threadCounts.push_back( hardwareThreadCount() );
+
+    double singleThreadNs = 0.0;
+
+    for ( size_t i = 0; i < threadCounts.size(); ++i )
+    {
+        char name[64];
+        snprintf( name, sizeof( name ), "updateEntities 1M x%zu", threadCounts[i] );
+
+        JobSystem jobs( threadCounts[i] );
+        size_t resultCount = pSuite->results().size();
+
+        pSuite->run( name, "cpu", [&entities, &seconds, &jobs]()
+        {
+            seconds += 1.0f / 60.0f;
+            entities.update( seconds, &jobs );
+        } );
+
+        if ( pSuite->results().size() == resultCount )
+        {
+            continue;
+        }
+
+        double medianNs = summarizeSamples( pSuite->results().back().samples ).median;
+
+        if ( threadCounts[i] == 1 )
+        {
+            singleThreadNs = medianNs;
+        }
+        else if ( singleThreadNs > 0.0 )
+        {
+            printf( "%-40s %.2fx on %zu threads (%.0f%% efficiency), %llu steals\n",
+                    "  speedup",
+                    singleThreadNs / medianNs,
+                    threadCounts[i],
+                    100.0 * singleThreadNs / medianNs / threadCounts[i],
+                    static_cast<unsigned long long>( jobs.stealCount() ) );
+        }
+    }
+}
+
+/**
+ * Times keeping a grid of 1M entities up to date and culling it. The update
+ * flips between the entities' positions on two consecutive 60hz frames, so
+ * each run moves as many entities between cells as a real frame would. The
+ * view covers the middle sixteenth of the world, and is also culled with a
+ * single cell grid, which tests every entity, to show what the grid saves
+ */
+static void runCullBenchmarks( BenchSuite * pSuite )
+{
+    EntityStore entities;
+    entities.createRandom( BENCH_ENTITY_COUNT, 1234 );
+
+    // Copies of the entities at two points in time
+    std::vector<float> x[2], y[2], halfSize[2];
+
+    for ( int frame = 0; frame < 2; ++frame )
+    {
+        entities.update( 10.0f + frame / 60.0f, NULL );
+
+        x[frame].assign( entities.positionX(), entities.positionX() + entities.size() );
+        y[frame].assign( entities.positionY(), entities.positionY() + entities.size() );
+        halfSize[frame].assign( entities.scale(), entities.scale() + entities.size() );
+    }
+
+    CullRect world = { -1.0f, -1.0f, 1.0f, 1.0f };
+    CullRect view  = { -0.25f, -0.25f, 0.25f, 0.25f };
+
+    SpatialGrid grid;
+    grid.create( world, BENCH_GRID_CELLS, BENCH_GRID_CELLS );
+    grid.update( entities.size(), &x[0][0], &y[0][0], &halfSize[0][0], NULL );
+
+    JobSystem jobs;
+    int frame = 0;
+
+    pSuite->run( "SpatialGrid update 1M", "cpu", [&]()
+    {
+        frame = 1 - frame;
+        grid.update( entities.size(), &x[frame][0], &y[frame][0], &halfSize[frame][0], &jobs );
+    } );
+
+    if ( pSuite->isSelected( "SpatialGrid update 1M" ) )
+    {
+        printf( "%-40s %zu of %zu entities changed cells\n",
+                "  moved", grid.movedCount(), grid.size() );
+    }
+
+    // Cull whichever frame the grid was last updated with
+    const float * pX    = &x[frame][0];
+    const float * pY    = &y[frame][0];
+    const float * pHalf = &halfSize[frame][0];
+
+    SpatialGrid flat;
+    flat.create( world, 1, 1 );
+    flat.update( entities.size(), pX, pY, pHalf, NULL );
+
+    std::vector<uint32_t> visible;
+    visible.reserve( entities.size() );
+
+    for ( int kernel = CULL_KERNEL_SCALAR; kernel <= CULL_KERNEL_AVX2; ++kernel )
+    {
+        CullKernel cullKernel = static_cast<CullKernel>( kernel );
+
+        if (! isCullKernelSupported( cullKernel ) )
+        {
+            continue;
+        }
+
+        std::string name = std::string( "SpatialGrid cull 1M " ) + cullKernelName( cullKernel );
+        CullStats stats;
+
+        pSuite->run( name, "cpu", [&]()
+        {
+            grid.cullWith( cullKernel, view, pX, pY, pHalf, &visible, &stats );
+        } );
+
+        if ( pSuite->isSelected( name ) )
+        {
+            printf( "%-40s %zu drawn, %zu culled, %zu of %zu cells accepted, %zu tested\n",
+                    "  stats",
+                    stats.visibleCount,
+                    stats.culledCount,
+                    stats.cellsAccepted,
+                    stats.cellsVisited,
+                    stats.objectsTested );
+        }
+
+        pSuite->run( std::string( "cull 1M without grid " ) + cullKernelName( cullKernel ),
+                     "cpu",
+                     [&]()
+        {
+            flat.cullWith( cullKernel, view, pX, pY, pHalf, &visible, NULL );
+        } );
+    }
+}
+
+/**
+ * Benchmarks that only need the CPU: file loading, image decoding and the
+ * pixel kernels
+ *
+ * \param  pSuite  Suite to run the benchmarks in
+ * \return         True if every input the benchmarks need could be loaded
+ */
+static bool runCpuBenchmarks( BenchSuite * pSuite )
+{
+    Image tga;
+    Image qoi;
+
+    if (! loadImageFile( BENCH_TGA_FILE, &tga ) || ! loadImageFile( BENCH_QOI_FILE, &qoi ) )
+    {
+        std::cerr << "Benchmark images are missing, run from the build directory"
+                  << std::endl;
+        return false;
+    }
+
+    pSuite->run( "read_tga hello1.tga", "cpu", []()
+    {
+        int width  = 0;
+        int height = 0;
+        free( read_tga( BENCH_TGA_FILE, &width, &height ) );
+    } );
+
+    pSuite->run( "loadTga hello1.tga", "cpu", []()
+    {
+        Image image;
+        loadTga( BENCH_TGA_FILE, &image );
+    } );
+
+    pSuite->run( "loadImageFile hello1.qoi", "cpu", []()
+    {
+        Image image;
+        loadImageFile( BENCH_QOI_FILE, &image );
+    } );
+
+    pSuite->run( "encodeQoi hello1", "cpu", [&qoi]()
+    {
+        std::vector<unsigned char> encoded;
+        encodeQoi( qoi, &encoded );
+    } );
+
+    pSuite->run( "loadTextFile hello.ps.glsl", "cpu", []()
+    {
+        loadTextFile( BENCH_SHADER_FILE );
+    } );
+
+    std::vector<std::string> defines( 1, "TEXTURE_ARRAY" );
+
+    pSuite->run( "loadShaderSource uncached", "cpu", [&defines]()
+    {
+        ShaderSource source;
+        std::string error;
+
+        clearShaderSourceCache();
+        loadShaderSource( BENCH_SHADER_FILE, defines, &source, &error );
+    } );
+
+    pSuite->run( "loadShaderSource cached", "cpu", [&defines]()
+    {
+        ShaderSource source;
+        std::string error;
+        loadShaderSource( BENCH_SHADER_FILE, defines, &source, &error );
+    } );
+
+    std::vector<unsigned char> hashInput( 1024 * 1024, 0x5a );
+    volatile uint64_t hashSink = 0;
+
+    pSuite->run( "hashData 1 MiB", "cpu", [&hashInput, &hashSink]()
+    {
+        hashSink = hashData( &hashInput[0], hashInput.size() );
+    } );
+
+    Image bgr = makeNoiseImage( BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE, PIXEL_FORMAT_BGR8 );
+    std::vector<unsigned char> bgra( bgr.buffer.size() / 3 * 4 );
+
+    pSuite->run( "expandBgrToBgra 512x512", "cpu", [&bgr, &bgra]()
+    {
+        expandBgrToBgra( &bgr.buffer[0], &bgra[0], bgra.size() / 4 );
+    } );
+
+    std::vector<SortedPacket> packets( BENCH_PACKET_COUNT * 10 );
+    std::vector<SortedPacket> sorted( packets.size() );
+    std::vector<SortedPacket> scratch( packets.size() );
+    std::mt19937_64 random( 1234 );
+
+    for ( size_t i = 0; i < packets.size(); ++i )
+    {
+        packets[i].key     = random();
+        packets[i].pPacket = NULL;
+    }
+
+    // Random keys, so no byte can be skipped. Includes copying the input
+    pSuite->run( "radixSortPackets 100k", "cpu", [&packets, &sorted, &scratch]()
+    {
+        sorted = packets;
+        radixSortPackets( &sorted[0], &scratch[0], sorted.size() );
+    } );
+
+    runEntityBenchmarks( pSuite );
+    runCullBenchmarks( pSuite );
+
+    Image mipSource = makeNoiseImage( BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE, PIXEL_FORMAT_BGRA8 );
+
+    pSuite->run( "generateMipChain 512x512 box", "cpu", [&mipSource]()
+    {
+        std::vector<Image> levels;
+        generateMipChain( mipSource, MIP_FILTER_BOX, &levels );
+    } );
+
+    pSuite->run( "generateMipChain 512x512 kaiser", "cpu", [&mipSource]()
+    {
+        std::vector<Image> levels;
+        generateMipChain( mipSource, MIP_FILTER_KAISER, &levels );
+    } );
+
+    return true;
+}
+
+#ifdef GFXSANDBOX_HAS_EGL
+/**
+ * Records copies of the scene's quad into every buffer of a queue at once,
+ * one thread per buffer. The quads are spread over a few layers and depths
+ * and half of them swap the images, so there is something to sort
+ */
+static void recordBenchPackets( CommandQueue * pQueue, float fadeFactor )
+{
+    size_t bufferCount = pQueue->bufferCount();
+
+    parallelFor( bufferCount, bufferCount, [=]( size_t b )
+    {
+        CommandBuffer& buffer = pQueue->buffer( b );
+        size_t begin          = BENCH_PACKET_COUNT * b / bufferCount;
+        size_t end            = BENCH_PACKET_COUNT * ( b + 1 ) / bufferCount;
+
+        for ( size_t i = begin; i < end; ++i )
+        {
+            uint32_t hash = static_cast<uint32_t>( i ) * 2654435761u;
+
+            recordSceneQuad( &buffer,
+                             fadeFactor,
+                             ( hash >> 16 ) & 1,
+                             ( hash >> 17 ) & 3,
+                             static_cast<float>( hash >> 24 ) );
+        }
+    } );
+}
+
+/**
+ * Times recording the scene's quad many times over on every core, and then
+ * submitting the packets with and without sorting them. The quads are drawn
+ * into a tiny viewport, since this measures submission rather than fill rate
+ *
+ * \param  pSuite  Suite to run the benchmarks in
+ */
+static void runCommandQueueBenchmarks( BenchSuite * pSuite )
+{
+    CommandQueue queue( hardwareThreadCount() );
+
+    pSuite->run( "record 10k packets", "gl", [&queue]()
+    {
+        recordBenchPackets( &queue, 0.5f );
+
+        for ( size_t b = 0; b < queue.bufferCount(); ++b )
+        {
+            queue.buffer( b ).reset();
+        }
+    } );
+
+    GLint viewport[4];
+    glGetIntegerv( GL_VIEWPORT, viewport );
+    glViewport( 0, 0, 8, 8 );
+
+    const bool SORTED[] = { true, false };
+
+    for ( size_t i = 0; i < 2; ++i )
+    {
+        queue.setSortEnabled( SORTED[i] );
+
+        pSuite->run( SORTED[i] ? "submit 10k packets sorted" : "submit 10k packets unsorted",
+                     "gl",
+                     [&queue]()
+        {
+            recordBenchPackets( &queue, 0.5f );
+            queue.submit();
+            glFinish();
+        } );
+
+        // One more frame to count the state changes that got through
+        if ( pSuite->isSelected( SORTED[i] ? "submit 10k packets sorted" :
+                                             "submit 10k packets unsorted" ) )
+        {
+            GStateCache.resetCounters();
+            recordBenchPackets( &queue, 0.5f );
+            queue.submit();
+
+            printf( "  %s: %llu texture binds, %llu program changes for %zu packets, "
+                    "sorted in %.3f ms\n",
+                    SORTED[i] ? "sorted" : "unsorted",
+                    static_cast<unsigned long long>(
+                        GStateCache.issuedCount( STATE_CALL_BIND_TEXTURE ) ),
+                    static_cast<unsigned long long>(
+                        GStateCache.issuedCount( STATE_CALL_USE_PROGRAM ) ),
+                    queue.stats().packetCount,
+                    queue.stats().sortMs );
+        }
+    }
+
+    glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+}
+
+/**
+ * Benchmarks that need a GL context: buffer and texture creation, building
+ * shader programs and rendering whole frames of the scene. Each iteration
+ * waits for the GL to finish, so the time includes the driver's work and not
+ * just the cost of submitting it
+ *
+ * \param  options    Settings for the run
+ * \param  pSuite     Suite to run the benchmarks in
+ * \param  pRenderer  Receives the GL renderer string
+ * \return            True if the context and scene could be created
+ */
+static bool runGlBenchmarks( const BenchOptions& options,
+                             BenchSuite * pSuite,
+                             std::string * pRenderer )
+{
+    HeadlessContext context;
+
+    if (! createHeadlessContext( options.width, options.height, &context ) )
+    {
+        return false;
+    }
+
+    *pRenderer = reinterpret_cast<const char*>( glGetString( GL_RENDERER ) );
+    std::cout << "Renderer: " << *pRenderer << std::endl;
+
+    bool ok = GLEW_VERSION_2_0;
+
+    if (! ok )
+    {
+        std::cerr << "OpenGL 2.0 not available" << std::endl;
+    }
+
+    if ( ok )
+    {
+        QuietScope quiet;
+        ok = loadResources( SCENE_TEXTURES_SEPARATE );
+
+        if ( ok )
+        {
+            finishLoadingResources();
+        }
+    }
+
+    if ( ok )
+    {
+        std::vector<unsigned char> bufferData( 64 * 1024, 0 );
+
+        pSuite->run( "createBuffer 64 KiB", "gl", [&bufferData]()
+        {
+            GLuint buffer = createBuffer( GL_ARRAY_BUFFER,
+                                          &bufferData[0],
+                                          static_cast<GLsizei>( bufferData.size() ) );
+
+            // Unbind through the cache so it doesn't hold on to a dead name
+            GStateCache.bindBuffer( GL_ARRAY_BUFFER, 0 );
+            glDeleteBuffers( 1, &buffer );
+            glFinish();
+        } );
+
+        Image image = makeNoiseImage( BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE, PIXEL_FORMAT_BGRA8 );
+        GLuint texture;
+        glGenTextures( 1, &texture );
+
+        pSuite->run( "uploadTexture 512x512 bgra", "gl", [texture, &image]()
+        {
+            uploadTexture( texture, image );
+            glFinish();
+        } );
+
+        glDeleteTextures( 1, &texture );
+
+        // GL reuses names, so the cache must not think it is still bound
+        GStateCache.invalidate();
+
+        // Compiling from scratch, with the source and program binary caches
+        // out of the way, and then again as a normal load that hits both
+        auto buildProgram = []( bool cold )
+        {
+            if ( cold )
+            {
+                setShaderCacheDirectory( "" );
+                clearShaderSourceCache();
+            }
+
+            Shader shader = loadShaderProgram( BENCH_VS_FILE, BENCH_SHADER_FILE );
+
+            GStateCache.useProgram( 0 );
+            glDeleteProgram( shader.program );
+            glDeleteShader( shader.vertexShader );
+            glDeleteShader( shader.fragmentShader );
+            glFinish();
+
+            setShaderCacheDirectory( "shadercache" );
+        };
+
+        pSuite->run( "loadShaderProgram uncached", "gl", [&buildProgram]()
+        {
+            buildProgram( true );
+        } );
+
+        pSuite->run( "loadShaderProgram cached", "gl", [&buildProgram]()
+        {
+            buildProgram( false );
+        } );
+
+        int frame = 0;
+
+        pSuite->run( "render frame", "gl", [&frame]()
+        {
+            updateScene( static_cast<float>( frame++ ) / 60.0f );
+            drawScene();
+            glFinish();
+            GProfiler.endFrame();
+        } );
+
+        runCommandQueueBenchmarks( pSuite );
+
+        ok = !checkGlFailure( "after benchmarks" );
+    }
+
+    releaseResources();
+    GBufferArenas.releaseGpuResources();
+    GProfiler.releaseGpuResources();
+    destroyHeadlessContext( &context );
+
+    return ok;
+}
+#endif
+
+/**
+ * Parses the benchmark's command line. Arguments that are not understood
+ * cause this method to fail
+ */
+static bool parseBenchOptions( int argc, char** argv, BenchOptions * pOptions )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg = argv[i];
+        bool hasValue   = ( i + 1 < argc );
+
+        if ( arg == "--json" && hasValue )
+        {
+            pOptions->jsonFile = argv[++i];
+        }
+        else if ( arg == "--filter" && hasValue )
+        {
+            pOptions->filter = argv[++i];
+        }
+        else if ( arg == "--samples" && hasValue )
+        {
+            pOptions->sampleCount = static_cast<size_t>( atoi( argv[++i] ) );
+        }
+        else if ( arg == "--min-sample-ms" && hasValue )
+        {
+            pOptions->minSampleMs = atof( argv[++i] );
+        }
+        else if ( arg == "--size" && hasValue )
+        {
+            if ( sscanf( argv[++i], "%dx%d",
+                         &pOptions->width, &pOptions->height ) != 2 )
+            {
+                return false;
+            }
+        }
+        else if ( arg == "--cpu-only" )
+        {
+            pOptions->cpuOnly = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Welch's test in compare.py needs at least two samples on each side
+    return pOptions->sampleCount >= 2 && pOptions->minSampleMs >= 0.0 &&
+           pOptions->width > 0 && pOptions->height > 0;
+}
+
+int main( int argc, char** argv )
+{
+    BenchOptions options;
+
+    if (! parseBenchOptions( argc, argv, &options ) )
+    {
+        std::cerr << "Usage: " << argv[0] << " [--json results.json] "
+                  << "[--filter TEXT] [--samples N] [--min-sample-ms MS] "
+                  << "[--size WIDTHxHEIGHT] [--cpu-only]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#ifndef NDEBUG
+    std::cout << "Assertions are enabled, timings from this build won't match "
+              << "a release build" << std::endl;
+#endif
+
+    BenchSuite suite( options );
+    std::string renderer;
+    bool ok = runCpuBenchmarks( &suite );
+
+    if (! options.cpuOnly )
+    {
+#ifdef GFXSANDBOX_HAS_EGL
+        if (! runGlBenchmarks( options, &suite, &renderer ) )
+        {
+            std::cerr << "GL benchmarks failed, pass --cpu-only to skip them"
+                      << std::endl;
+            ok = false;
+        }
+#else
+        std::cout << "Built without EGL, skipping the GL benchmarks" << std::endl;
+#endif
+    }
+
+    if ( ok && !options.jsonFile.empty() )
+    {
+        ok = writeBenchResults( options.jsonFile, renderer, suite.results() );
+
+        if ( ok )
+        {
+            std::cout << "Wrote " << suite.results().size() << " results to "
+                      << options.jsonFile << std::endl;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
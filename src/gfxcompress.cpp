@@ -0,0 +1,192 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "blockcompress.h"
+#include "dds.h"
+#include "imagecodec.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "tga.h"
+#include "timing.h"
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+/**
+ * Measures how closely a compressed level reproduces its source, as the peak
+ * signal to noise ratio over the color channels (and alpha, for images that
+ * have it)
+ */
+static double levelPsnr( const Image& source, const std::vector<unsigned char>& decoded )
+{
+    size_t pixelSize = bytesPerPixel( source.format );
+    size_t count     = static_cast<size_t>( source.width ) * source.height;
+    const unsigned char * pSource = source.pixels();
+
+    double squaredError = 0.0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        for ( size_t c = 0; c < pixelSize; ++c )
+        {
+            double error  = static_cast<double>( pSource[i * pixelSize + c] ) - decoded[i * 4 + c];
+            squaredError += error * error;
+        }
+    }
+
+    double mse = squaredError / static_cast<double>( count * pixelSize );
+    return mse > 0.0 ? 10.0 * log10( 255.0 * 255.0 / mse ) : INFINITY;
+}
+
+/**
+ * Compresses a tga or qoi image into a BC1 or BC3 dds file with a full mip chain.
+ * Images with alpha default to BC3, everything else to BC1. Each level is
+ * decoded again afterwards to report how much quality was lost
+ */
+int main( int argc, char** argv )
+{
+    bool hasFormat     = false;
+    BlockFormat format = BLOCK_FORMAT_BC1;
+    bool makeMips      = true;
+    size_t threadCount = hardwareThreadCount();
+    std::string input, output;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg = argv[i];
+
+        if ( arg == "--bc1" || arg == "--bc3" )
+        {
+            hasFormat = true;
+            format    = ( arg == "--bc1" ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC3 );
+        }
+        else if ( arg == "--no-mips" )
+        {
+            makeMips = false;
+        }
+        else if ( arg == "--threads" && i + 1 < argc )
+        {
+            threadCount = std::max( atoi( argv[++i] ), 1 );
+        }
+        else if ( input.empty() )
+        {
+            input = arg;
+        }
+        else if ( output.empty() )
+        {
+            output = arg;
+        }
+        else
+        {
+            input.clear();
+            break;
+        }
+    }
+
+    if ( input.empty() || output.empty() )
+    {
+        std::cerr << "Usage: " << argv[0] << " [--bc1 | --bc3] [--no-mips] "
+                  << "[--threads N] input.tga|qoi output.dds" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Image> levels( 1 );
+
+    if (! loadImageFile( input, &levels[0] ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (! hasFormat )
+    {
+        format = ( levels[0].format == PIXEL_FORMAT_BGRA8 ? BLOCK_FORMAT_BC3 : BLOCK_FORMAT_BC1 );
+    }
+
+    CompressedImage compressed;
+    compressed.format = format;
+
+    size_t rawSize    = 0;
+    double encodeTime = 0.0;
+
+    if ( makeMips )
+    {
+        std::vector<Image> mips;
+
+        double start = currentTimeMs();
+        generateMipChain( levels[0], MIP_FILTER_KAISER, &mips, threadCount );
+
+        printf( "  mips built in %.1f ms with %s kernels\n",
+                currentTimeMs() - start,
+                mipKernelName( bestMipKernel() ) );
+
+        for ( size_t i = 0; i < mips.size(); ++i )
+        {
+            levels.push_back( Image() );
+            std::swap( levels.back(), mips[i] );
+        }
+    }
+
+    for ( size_t i = 0; i < levels.size(); ++i )
+    {
+        const Image& level = levels[i];
+        std::vector<unsigned char> blocks;
+
+        double start = currentTimeMs();
+        compressImage( level, format, &blocks, threadCount );
+        encodeTime += currentTimeMs() - start;
+
+        std::vector<unsigned char> decoded;
+        decompressImage( &blocks[0], format, level.width, level.height, &decoded );
+
+        CompressedLevel info;
+        info.width  = level.width;
+        info.height = level.height;
+        info.offset = compressed.buffer.size();
+        info.size   = blocks.size();
+
+        printf( "  level %zu: %4dx%-4d %8zu bytes, PSNR %.2f dB\n",
+                compressed.levels.size(),
+                level.width,
+                level.height,
+                blocks.size(),
+                levelPsnr( level, decoded ) );
+
+        compressed.levels.push_back( info );
+        compressed.buffer.insert( compressed.buffer.end(), blocks.begin(), blocks.end() );
+        rawSize += level.size();
+    }
+
+    if (! writeDds( output, compressed ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf( "%s -> %s: %s, %zu levels, %zu bytes (%zu uncompressed, %.1fx smaller), "
+            "encoded in %.1f ms on %zu threads with %s block search\n",
+            input.c_str(),
+            output.c_str(),
+            format == BLOCK_FORMAT_BC1 ? "BC1" : "BC3",
+            compressed.levels.size(),
+            compressed.size(),
+            rawSize,
+            static_cast<double>( rawSize ) / compressed.size(),
+            encodeTime,
+            threadCount,
+            blockSearchKernelName() );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "assetpack.h"
+#include "imagecodec.h"
+#include "tga.h"
+#include "util.h"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+/**
+ * Builds a pack file out of loose content files. Entries are named with the
+ * paths given on the command line, which should be the paths the program
+ * would otherwise open (eg content/images/hello1.tga), so run this from the
+ * directory those paths are relative to.
+ *
+ * Images are decoded here so that the program can upload them without any
+ * further work. Everything else is stored as is.
+ */
+int main( int argc, char** argv )
+{
+    if ( argc < 3 )
+    {
+        std::cerr << "Usage: " << argv[0] << " output.pack file [file...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    AssetPackWriter writer;
+    size_t imageCount = 0;
+
+    for ( int i = 2; i < argc; ++i )
+    {
+        std::string path = argv[i];
+        bool ok          = false;
+
+        if ( hasExtension( path, ".tga" ) || hasExtension( path, ".qoi" ) )
+        {
+            Image image;
+            ok = loadImageFile( path, &image ) && writer.addImage( path, image );
+            imageCount++;
+        }
+        else
+        {
+            MappedFile file;
+            ok = file.open( path ) && writer.addData( path, file.data(), file.size() );
+        }
+
+        if (! ok )
+        {
+            std::cerr << "Failed to pack " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (! writer.write( argv[1] ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Packed " << writer.entryCount() << " entries ("
+              << imageCount << " images) into " << argv[1] << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "imagecodec.h"
+#include "qoi.h"
+#include "timing.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+ * Times loading an image the way the texture loader does: map the file, find
+ * its codec and decode every pixel into a staging sized buffer
+ *
+ * \param  filename    Path to the image
+ * \param  runs        Number of times to load it
+ * \param  pFileSize   Receives the size of the file
+ * \param  pSummary    Receives the load times in milliseconds
+ * \return             True if every load worked
+ */
+static bool timeLoads( const std::string& filename,
+                       int runs,
+                       size_t * pFileSize,
+                       SampleSummary * pSummary )
+{
+    std::vector<unsigned char> staging;
+    std::vector<double> times;
+
+    for ( int i = 0; i < runs; ++i )
+    {
+        double start = currentTimeMs();
+
+        MappedFile file;
+        const ImageCodec * pCodec = NULL;
+        ImageHeader header;
+
+        if (! openImageFile( filename, &file, &pCodec, &header ) )
+        {
+            return false;
+        }
+
+        staging.resize( static_cast<size_t>( header.width ) * header.height *
+                        bytesPerPixel( header.format ) );
+
+        if (! pCodec->decodePixels( file.data(), file.size(), header,
+                                    header.format, &staging[0] ) )
+        {
+            return false;
+        }
+
+        times.push_back( currentTimeMs() - start );
+        *pFileSize = file.size();
+    }
+
+    *pSummary = summarizeSamples( times );
+    return true;
+}
+
+/**
+ * Converts an image in any format with a codec (eg tga) into a qoi file. With
+ * --bench, both files are then loaded a number of times and the load times
+ * and file sizes are compared
+ */
+int main( int argc, char** argv )
+{
+    int benchRuns = 0;
+    std::string input, output;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg = argv[i];
+
+        if ( arg == "--bench" && i + 1 < argc )
+        {
+            benchRuns = std::max( atoi( argv[++i] ), 1 );
+        }
+        else if ( input.empty() )
+        {
+            input = arg;
+        }
+        else if ( output.empty() )
+        {
+            output = arg;
+        }
+        else
+        {
+            input.clear();
+            break;
+        }
+    }
+
+    if ( input.empty() || output.empty() )
+    {
+        std::cerr << "Usage: " << argv[0] << " [--bench RUNS] input.tga output.qoi"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Image image;
+
+    if (! loadImageFile( input, &image ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    double start = currentTimeMs();
+
+    std::vector<unsigned char> encoded;
+    encodeQoi( image, &encoded );
+
+    double encodeTime = currentTimeMs() - start;
+
+    if (! writeQoi( output, image ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf( "%s -> %s: %dx%d, %zu bytes (%.1f%% of raw), encoded in %.2f ms\n",
+            input.c_str(),
+            output.c_str(),
+            image.width,
+            image.height,
+            encoded.size(),
+            100.0 * encoded.size() / image.size(),
+            encodeTime );
+
+    if ( benchRuns > 0 )
+    {
+        size_t inputSize = 0, outputSize = 0;
+        SampleSummary inputTimes, outputTimes;
+
+        if (! timeLoads( input, benchRuns, &inputSize, &inputTimes ) ||
+            ! timeLoads( output, benchRuns, &outputSize, &outputTimes ) )
+        {
+            return EXIT_FAILURE;
+        }
+
+        printSummary( "load " + input + " (ms)", inputTimes );
+        printSummary( "load " + output + " (ms)", outputTimes );
+
+        printf( "qoi is %.2fx the size and loads in %.2fx the time "
+                "(%.0f MB/s of pixels)\n",
+                static_cast<double>( outputSize ) / inputSize,
+                outputTimes.median / std::max( inputTimes.median, 1e-6 ),
+                image.size() / ( outputTimes.median * 1000.0 ) );
+    }
+
+    return EXIT_SUCCESS;
+}
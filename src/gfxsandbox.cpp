@@ -15,12 +15,27 @@
  */
 #include "gfxsandbox.h"
 #include <iostream>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
 #include "util.h"
 #include "texture.h"
 #include "glutil.h"
+#include "glstate.h"
 #include "shader.h"
+#include "textureloader.h"
+#include "profiler.h"
+#include "framescheduler.h"
+#include "spritebatch.h"
+#include "atlas.h"
+#include "commandbuffer.h"
+#include "entities.h"
+#include "jobsystem.h"
+#include "spatialgrid.h"
+#include "assetpack.h"
 #include <GL/glew.h>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -30,14 +45,27 @@
 
 struct Scene
 {
-    GLuint vertexBuffer, elementBuffer;
+    BufferRange vertexBuffer, elementBuffer;
     Shader shader;
+    SceneTextureMode textureMode;
     GLuint textures[2];
+    std::unique_ptr<TextureLoader> textureLoader;
+    TextureAtlas atlas;
+    CommandQueue commands;
+    EntityStore entities;
+    std::unique_ptr<JobSystem> jobs;
+    SpriteBatch entitySprites;
+    SpatialGrid entityGrid;
+    std::vector<uint32_t> visibleEntities;
+    CullStats entityCullStats;      // from the last frame drawn
+    float entityZoom;               // zero is the same as one
 
     struct
     {
         GLint fadeFactor;
         GLint textures[2];
+        GLint uvRects;
+        GLint layers;
     } uniforms;
 
     struct
@@ -45,9 +73,44 @@ struct Scene
         GLint position;
     } attributes;
 
-    GLfloat fadeFactor;
+    GLfloat fadeFactor;             // what gets drawn
+    GLfloat previousFadeFactor;     // at the second to last simulation step
+    GLfloat latestFadeFactor;       // at the last simulation step
+    float previousSeconds;          // time of the second to last step
+    float latestSeconds;            // time of the last simulation step
 } GScene;
 
+// Seed for the scene's random entities, so every run animates the same way
+const unsigned int SCENE_ENTITY_SEED = 1234;
+
+// Entities the grid aims to put in each cell, and the most cells per axis
+const size_t SCENE_ENTITIES_PER_CELL = 64;
+const unsigned int SCENE_MAX_GRID_CELLS = 256;
+
+// Runs the simulation at a fixed rate and paces rendering in windowed mode
+FrameScheduler GFrameScheduler( &simulateScene );
+
+const char * const SCENE_TEXTURE_FILES[2] =
+{
+    "content/images/hello1.tga",
+    "content/images/hello2.tga"
+};
+
+const char * const SCENE_COMPRESSED_TEXTURE_FILES[2] =
+{
+    "content/images/hello1.dds",
+    "content/images/hello2.dds"
+};
+
+const char * const SCENE_QOI_TEXTURE_FILES[2] =
+{
+    "content/images/hello1.qoi",
+    "content/images/hello2.qoi"
+};
+
+// Time each frame may spend uploading textures that finished loading
+const double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
+
 const size_t SQUARE_VERTEX_COUNT = 8;
 const GLfloat SQUARE_VERTEX_BUFFER_DATA[ SQUARE_VERTEX_COUNT ] =
 {
@@ -63,38 +126,58 @@ const GLushort SQUARE_ELEMENT_BUFFER_DATA[SQUARE_ELEMENT_COUNT] =
     0, 1, 2, 3
 };
 
-int main( int argc, char** argv )
+/**
+ * Checks if a texture mode packs both images into one texture
+ */
+static bool usesAtlas( SceneTextureMode textureMode )
 {
-    glutInit( &argc, argv );
-    glutInitDisplayMode( GLUT_RGB | GLUT_DOUBLE );
-    glutInitWindowSize( 640, 480 );
-    glutCreateWindow( "Render Window" );
-    glutDisplayFunc( &render );
-    glutIdleFunc( &update );
+    return textureMode == SCENE_TEXTURES_ATLAS || textureMode == SCENE_TEXTURES_ARRAY;
+}
 
-    glewInit();
+/**
+ * Loads the scene's shaders, buffers and textures
+ *
+ * \param  textureMode  How to store the scene's images
+ * \return              True if everything was loaded or queued for loading
+ */
+bool loadResources( SceneTextureMode textureMode )
+{
+    ProfileScope loadScope( "loadResources" );
 
-    if (! GLEW_VERSION_2_0 )
+    if ( textureMode == SCENE_TEXTURES_ARRAY && !TextureAtlas::isArraySupported() )
     {
-        std::cerr << "OpenGL 2.0 not available" << std::endl;
-        return EXIT_FAILURE;
+        std::cerr << "Array textures are not supported" << std::endl;
+        return false;
     }
 
-    if (! loadResources() )
+    GScene.textureMode = textureMode;
+
+    // Content comes from the pack when the build made one, which costs a
+    // single open instead of one per file. Loose files are the fallback
+    if ( GAssetPack.isOpen() || GAssetPack.open( ASSET_PACK_FILE ) )
     {
-        std::cerr << "Failed to load resources" << std::endl;
-        return EXIT_FAILURE;
+        std::cout << "Loading content from " << ASSET_PACK_FILE << " ("
+                  << GAssetPack.entryCount() << " entries)" << std::endl;
     }
 
-    glutMainLoop();
-    return EXIT_SUCCESS;
-}
+    {
+        ProfileScope scope( "load shaders" );
+        std::vector<std::string> defines;
 
-bool loadResources()
-{
-    GScene.shader =
-        loadShaderProgram( "content/shaders/hello.vs.glsl",
-                           "content/shaders/hello.ps.glsl" );
+        if ( textureMode == SCENE_TEXTURES_ARRAY )
+        {
+            defines.push_back( "TEXTURE_ARRAY" );
+        }
+
+        GScene.shader = loadShaderProgram( "content/shaders/hello.vs.glsl",
+                                           "content/shaders/hello.ps.glsl",
+                                           defines );
+    }
+
+    ShaderCacheStats cacheStats = shaderCacheStats();
+    std::cout << "Shader cache: " << cacheStats.hits << " hits, "
+              << cacheStats.misses << " misses, "
+              << cacheStats.rejected << " rejected" << std::endl;
 
     GScene.uniforms.fadeFactor =
         glGetUniformLocation( GScene.shader.program, "fade_factor" );
@@ -102,23 +185,122 @@ bool loadResources()
         glGetUniformLocation( GScene.shader.program, "textures[0]" );
     GScene.uniforms.textures[1] =
         glGetUniformLocation( GScene.shader.program, "textures[1]" );
+    GScene.uniforms.uvRects =
+        glGetUniformLocation( GScene.shader.program, "uv_rects" );
+    GScene.uniforms.layers =
+        glGetUniformLocation( GScene.shader.program, "layers" );
+
+    // The array shader has a single sampler
+    if ( textureMode == SCENE_TEXTURES_ARRAY )
+    {
+        GScene.uniforms.textures[0] =
+            glGetUniformLocation( GScene.shader.program, "textures" );
+        GScene.uniforms.textures[1] = GScene.uniforms.textures[0];
+    }
     GScene.attributes.position =
         glGetAttribLocation( GScene.shader.program, "position" );
 
-    GScene.vertexBuffer =
-        createBufferT<GLfloat>( GL_ARRAY_BUFFER,
-                                SQUARE_VERTEX_BUFFER_DATA,
-                                sizeof( SQUARE_VERTEX_BUFFER_DATA ) );
+    {
+        ProfileScope scope( "create buffers" );
+
+        GScene.vertexBuffer =
+            createBufferT<GLfloat>( GL_ARRAY_BUFFER,
+                                    SQUARE_VERTEX_BUFFER_DATA,
+                                    SQUARE_VERTEX_COUNT );
+
+        GScene.elementBuffer =
+            createBufferT<GLushort> ( GL_ELEMENT_ARRAY_BUFFER,
+                                      SQUARE_ELEMENT_BUFFER_DATA,
+                                      SQUARE_ELEMENT_COUNT );
+
+        if (! GScene.vertexBuffer.isValid() || ! GScene.elementBuffer.isValid() )
+        {
+            return false;
+        }
+    }
+
+    GLfloat uvRects[2][4] =
+    {
+        { 0.0f, 0.0f, 1.0f, 1.0f },
+        { 0.0f, 0.0f, 1.0f, 1.0f }
+    };
+
+    if (! usesAtlas( textureMode ) )
+    {
+        // Images are decoded in the background, and the textures show a
+        // placeholder until drawScene() uploads them
+        ProfileScope scope( "queue textures" );
+
+        const char * const * pFiles = SCENE_TEXTURE_FILES;
+
+        if ( textureMode == SCENE_TEXTURES_COMPRESSED )
+        {
+            pFiles = SCENE_COMPRESSED_TEXTURE_FILES;
+        }
+        else if ( textureMode == SCENE_TEXTURES_QOI )
+        {
+            pFiles = SCENE_QOI_TEXTURE_FILES;
+        }
+
+        // The quad shrinks with the window, so build mips for the loose
+        // images. Compressed images bring their own
+        TextureFilter filter = ( textureMode == SCENE_TEXTURES_COMPRESSED ?
+                                 TEXTURE_FILTER_LINEAR :
+                                 TEXTURE_FILTER_TRILINEAR );
+
+        GScene.textureLoader.reset( new TextureLoader );
+        GScene.textures[0] = GScene.textureLoader->load( pFiles[0], filter );
+        GScene.textures[1] = GScene.textureLoader->load( pFiles[1], filter );
+    }
+    else
+    {
+        // Both images share one texture, so the scene needs a single binding
+        ProfileScope scope( "build atlas" );
+
+        std::vector<std::string> files( SCENE_TEXTURE_FILES,
+                                        SCENE_TEXTURE_FILES + 2 );
+
+        if (! GScene.atlas.build( files,
+                                  textureMode == SCENE_TEXTURES_ARRAY ?
+                                      ATLAS_LAYOUT_ARRAY : ATLAS_LAYOUT_2D ) )
+        {
+            return false;
+        }
+
+        GScene.atlas.printStats();
+
+        for ( size_t i = 0; i < 2; ++i )
+        {
+            const AtlasRegion& region = GScene.atlas.region( i );
+
+            GScene.textures[i] = GScene.atlas.texture();
+            uvRects[i][0]      = region.u0;
+            uvRects[i][1]      = region.v0;
+            uvRects[i][2]      = region.u1;
+            uvRects[i][3]      = region.v1;
+        }
+    }
 
-    GScene.elementBuffer =
-        createBufferT<GLushort> ( GL_ELEMENT_ARRAY_BUFFER,
-                                  SQUARE_ELEMENT_BUFFER_DATA,
-                                  sizeof(SQUARE_ELEMENT_BUFFER_DATA) );
+    // These never change, so they are set once here rather than every frame
+    GStateCache.useProgram( GScene.shader.program );
 
-    GScene.textures[0] = loadTexture( "content/images/hello1.tga" );
-    GScene.textures[1] = loadTexture( "content/images/hello2.tga" );
+    if ( GScene.uniforms.uvRects >= 0 )
+    {
+        glUniform4fv( GScene.uniforms.uvRects, 2, &uvRects[0][0] );
+    }
+
+    if ( GScene.uniforms.layers >= 0 )
+    {
+        GLfloat layers[2] =
+        {
+            static_cast<GLfloat>( GScene.atlas.region( 0 ).layer ),
+            static_cast<GLfloat>( GScene.atlas.region( 1 ).layer )
+        };
+
+        glUniform1fv( GScene.uniforms.layers, 2, layers );
+    }
 
-    GScene.fadeFactor  = 0.75f;
+    updateScene( 0.0f );
 
     errorCheck( "after loading resources" );
 
@@ -126,64 +308,387 @@ bool loadResources()
 }
 
 /**
- * Called whenever the game loop has nothing to do
+ * Blocks until every resource that is loading in the background is ready
+ */
+void finishLoadingResources()
+{
+    ProfileScope scope( "finish loading" );
+
+    if ( GScene.textureLoader )
+    {
+        GScene.textureLoader->finish();
+    }
+
+    errorCheck( "after finishing resource loading" );
+}
+
+/**
+ * Releases GPU resources that aren't cleaned up along with the context. Must
+ * be called while the context is still current
+ */
+void releaseResources()
+{
+    GScene.entitySprites.destroy();
+    GScene.entities.clear();
+    GScene.entityGrid.clear();
+    GScene.textureLoader.reset();
+    GScene.atlas.destroy();
+}
+
+/**
+ * Called whenever the game loop has nothing to do. Waits for the next frame
+ * to be due, catches the simulation up and asks GLUT to draw it
  */
 void update()
 {
-    int msecs = glutGet( GLUT_ELAPSED_TIME );   // in milliseconds
-    GScene.fadeFactor = sinf( (float) msecs * 0.001f ) * 0.5f + 0.5f;
+    double alpha = GFrameScheduler.beginFrame();
+
+    ProfileScope scope( "update" );
+    interpolateScene( static_cast<float>( alpha ) );
     glutPostRedisplay();
 }
 
+/**
+ * Advances the simulation by one fixed step
+ *
+ * \param  timeSeconds  Simulation time at the end of the step, in seconds
+ * \param  stepSeconds  Length of the step, in seconds
+ */
+void simulateScene( double timeSeconds, double /* stepSeconds */ )
+{
+    GScene.previousFadeFactor = GScene.latestFadeFactor;
+    GScene.latestFadeFactor   = fadeFactorAt( static_cast<float>( timeSeconds ) );
+    GScene.previousSeconds    = GScene.latestSeconds;
+    GScene.latestSeconds      = static_cast<float>( timeSeconds );
+}
+
+/**
+ * Blends the last two simulation steps into the state that gets drawn
+ *
+ * \param  alpha  0 draws the second to last step, 1 draws the last one
+ */
+void interpolateScene( float alpha )
+{
+    GScene.fadeFactor = GScene.previousFadeFactor +
+        ( GScene.latestFadeFactor - GScene.previousFadeFactor ) * alpha;
+
+    // Entities only depend on time, so rather than keeping two copies of
+    // their state to blend they are updated once per drawn frame
+    if ( GScene.entities.size() > 0 )
+    {
+        float seconds = GScene.previousSeconds +
+            ( GScene.latestSeconds - GScene.previousSeconds ) * alpha;
+        updateSceneEntities( seconds );
+    }
+}
+
+/**
+ * Jumps the scene straight to the given point in time. This only depends on
+ * the time passed in, so a fixed sequence of times always animates
+ * identically
+ *
+ * \param  seconds  Time since the program started, in seconds
+ */
+void updateScene( float seconds )
+{
+    GScene.fadeFactor         = fadeFactorAt( seconds );
+    GScene.previousFadeFactor = GScene.fadeFactor;
+    GScene.latestFadeFactor   = GScene.fadeFactor;
+    GScene.previousSeconds    = seconds;
+    GScene.latestSeconds      = seconds;
+
+    if ( GScene.entities.size() > 0 )
+    {
+        updateSceneEntities( seconds );
+    }
+}
+
+/**
+ * Moves the scene's entities to a point in time, and refiles the ones that
+ * crossed into a different cell of the grid
+ */
+void updateSceneEntities( float seconds )
+{
+    EntityStore& entities = GScene.entities;
+
+    entities.update( seconds, GScene.jobs.get() );
+    GScene.entityGrid.update( entities.size(),
+                              entities.positionX(),
+                              entities.positionY(),
+                              entities.scale(),
+                              GScene.jobs.get() );
+}
+
+/**
+ * Returns the fade factor the scene uses at a given point in time
+ */
+float fadeFactorAt( float seconds )
+{
+    return sinf( seconds ) * 0.5f + 0.5f;
+}
+
 /**
  * Called by the game loop to render the current frame
  */
 void render()
 {
+    drawScene();
+
+    {
+        ProfileScope scope( "swap buffers" );
+        glutSwapBuffers();
+    }
+
+    errorCheck( "after render" );
+    GProfiler.endFrame();
+}
+
+/**
+ * Draws the scene into the currently bound framebuffer
+ */
+void drawScene()
+{
+    ProfileScope scope( "drawScene" );
     errorCheck( "About to render" );
 
+    // Swap in any textures that have finished loading since the last frame
+    if ( GScene.textureLoader )
+    {
+        GScene.textureLoader->uploadPending( TEXTURE_UPLOAD_BUDGET_MS );
+    }
+
+    GpuProfileScope gpuScope( "drawScene" );
+
     glClearColor( 1.0f, 1.0f, 1.0f, 1.0f );
     glClear( GL_COLOR_BUFFER_BIT );
 
-    glUseProgram( GScene.shader.program );
-    errorCheck( "Using shader in render" );
+    // The scene is a single quad, but it is drawn through the command queue
+    // like everything else so that its state goes through the same path
+    recordSceneQuad( &GScene.commands.buffer( 0 ), GScene.fadeFactor, false, 0, 0.0f );
+    GScene.commands.submit();
 
-    glUniform1f( GScene.uniforms.fadeFactor, GScene.fadeFactor );
+    if ( GScene.entities.size() > 0 )
+    {
+        drawSceneEntities();
+    }
 
-    glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D, GScene.textures[0] );
-    glUniform1i( GScene.uniforms.textures[0], 0 );
+    errorCheck( "Drawing the scene" );
+}
 
-    glActiveTexture( GL_TEXTURE1 );
-    glBindTexture( GL_TEXTURE_2D, GScene.textures[1] );
-    glUniform1i( GScene.uniforms.textures[1], 1 );
+/**
+ * Draws the scene's entities on top of its quad, as one sprite batch. Only
+ * the entities the grid finds inside the view are handed to the batch, and
+ * they are scaled up by the zoom on the way
+ */
+void drawSceneEntities()
+{
+    const EntityStore& entities = GScene.entities;
+    SpriteBatch& batch          = GScene.entitySprites;
 
-    errorCheck( "Assign attributes and uniforms in render" );
+    const float * pX     = entities.positionX();
+    const float * pY     = entities.positionY();
+    const float * pScale = entities.scale();
+    const float * pFade  = entities.fade();
 
-    glBindBuffer( GL_ARRAY_BUFFER, GScene.vertexBuffer );
-    glVertexAttribPointer(
-            GScene.attributes.position,
-            2,                      // two elements (x,y)
-            GL_FLOAT,               // of type float
-            GL_FALSE,               // normalized? (values mapped into range)
-            sizeof(GLfloat) * 2,    // vertex stride
-            (void*) 0               // array buffer offset, pointer type is historic
-    );
-    glEnableVertexAttribArray( GScene.attributes.position );
-    errorCheck( "Assigning vertex buffer attribute" );
+    float zoom    = ( GScene.entityZoom > 0.0f ) ? GScene.entityZoom : 1.0f;
+    CullRect view = { -1.0f / zoom, -1.0f / zoom, 1.0f / zoom, 1.0f / zoom };
 
-    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, GScene.elementBuffer );
-    glDrawElements( GL_TRIANGLE_STRIP,  // mode
-                    4,                  // num vertices
-                    GL_UNSIGNED_SHORT,  // data type
-                    (void*) 0           // array buffer offset
-    );
+    GScene.entityGrid.cull( view, pX, pY, pScale,
+                            &GScene.visibleEntities,
+                            &GScene.entityCullStats );
 
-    errorCheck( "Binding the element buffer" );
-    glDisableVertexAttribArray( GScene.attributes.position );
+    const std::vector<uint32_t>& visible = GScene.visibleEntities;
 
-    glutSwapBuffers();
-    errorCheck( "after render" );
+    batch.begin();
+
+    for ( size_t v = 0; v < visible.size(); ++v )
+    {
+        uint32_t i = visible[v];
+
+        Sprite sprite;
+        sprite.x          = pX[i] * zoom;
+        sprite.y          = pY[i] * zoom;
+        sprite.halfWidth  = pScale[i] * zoom;
+        sprite.halfHeight = pScale[i] * zoom;
+        sprite.rotation   = 0.0f;
+        sprite.u0         = 0.0f;
+        sprite.v0         = 0.0f;
+        sprite.u1         = 1.0f;
+        sprite.v1         = 1.0f;
+        sprite.fade       = pFade[i];
+
+        batch.add( sprite );
+    }
+
+    drawSpriteBatch( &batch );
+    batch.endFrame();
+}
+
+/**
+ * Fills the scene with randomly placed, independently animated sprites. The
+ * entities are updated across every core each frame and drawn on top of the
+ * scene's quad. Must be called after loadResources()
+ *
+ * \param  count  Number of entities, zero removes them all
+ * \return        True if the entities were created
+ */
+bool createSceneEntities( size_t count )
+{
+    // Sprites sample the two images as separate 2D textures
+    if ( count > 0 && usesAtlas( GScene.textureMode ) )
+    {
+        std::cerr << "Entities can't be drawn from an atlas or texture array"
+                  << std::endl;
+        return false;
+    }
+
+    if ( count > 0 && !GScene.entitySprites.isCreated() &&
+         !createSpriteBatch( &GScene.entitySprites, true ) )
+    {
+        std::cerr << "Failed to create the entity sprite batch" << std::endl;
+        return false;
+    }
+
+    if (! GScene.jobs )
+    {
+        GScene.jobs.reset( new JobSystem() );
+    }
+
+    GScene.entities.createRandom( count, SCENE_ENTITY_SEED );
+
+    // Entities drift around clip space, wrapping at its edges
+    unsigned int cells = static_cast<unsigned int>( sqrt( count / SCENE_ENTITIES_PER_CELL ) );
+    cells              = std::max( 1u, std::min( cells, SCENE_MAX_GRID_CELLS ) );
+
+    CullRect bounds = { -1.0f, -1.0f, 1.0f, 1.0f };
+    GScene.entityGrid.create( bounds, cells, cells );
+
+    if ( count > 0 )
+    {
+        updateSceneEntities( GScene.latestSeconds );
+    }
+
+    std::cout << "Created " << count << " entities, updated on "
+              << GScene.jobs->threadCount() << " threads ("
+              << entityKernelName( bestEntityKernel() ) << "), culled with a "
+              << cells << "x" << cells << " grid ("
+              << cullKernelName( bestCullKernel() ) << ")" << std::endl;
+
+    return true;
+}
+
+/**
+ * Zooms the view of the entities in on the middle of clip space. Entities
+ * that end up off screen are culled before they reach the sprite batch
+ *
+ * \param  zoom  1 shows every entity, 2 shows the middle quarter and so on
+ */
+void setSceneZoom( float zoom )
+{
+    assert( zoom > 0.0f );
+    GScene.entityZoom = zoom;
+}
+
+/**
+ * Returns what culling the entities did in the last frame drawn
+ */
+const CullStats& sceneCullStats()
+{
+    return GScene.entityCullStats;
+}
+
+/**
+ * Records a draw of the scene's quad into a command buffer. Only reads the
+ * scene, so any thread can record while the scene isn't being loaded
+ *
+ * \param  pBuffer      Buffer to record into
+ * \param  fadeFactor   How far to crossfade from the first image to the second
+ * \param  swapImages   True to crossfade from the second image to the first
+ * \param  layer        Sort layer of the draw, 0 to 255
+ * \param  depth        Sort depth of the draw within its layer
+ */
+void recordSceneQuad( CommandBuffer * pBuffer,
+                      float fadeFactor,
+                      bool swapImages,
+                      unsigned int layer,
+                      float depth )
+{
+    assert( pBuffer != NULL );
+
+    GLuint first  = GScene.textures[ swapImages ? 1 : 0 ];
+    GLuint second = GScene.textures[ swapImages ? 0 : 1 ];
+    uint64_t key  = makeSortKey( layer, GScene.shader.program, first, depth );
+
+    DrawPacket * pPacket = pBuffer->addDraw( key );
+    pPacket->program     = GScene.shader.program;
+
+    if (! usesAtlas( GScene.textureMode ) )
+    {
+        pPacket->textureCount = 2;
+        pPacket->textures[0]  = first;
+        pPacket->textures[1]  = second;
+    }
+    else
+    {
+        // Both samplers read the atlas, through the same unit. Swapping only
+        // makes sense with separate textures
+        pPacket->textureTarget = GScene.atlas.target();
+        pPacket->textureCount  = 1;
+        pPacket->textures[0]   = GScene.atlas.texture();
+    }
+
+    pPacket->samplerCount        = 2;
+    pPacket->samplerLocations[0] = GScene.uniforms.textures[0];
+    pPacket->samplerLocations[1] = GScene.uniforms.textures[1];
+    pPacket->samplerUnits[0]     = 0;
+    pPacket->samplerUnits[1]     = ( pPacket->textureCount == 2 ) ? 1 : 0;
+
+    PacketUniform fade;
+    fade.location   = GScene.uniforms.fadeFactor;
+    fade.components = 1;
+    fade.count      = 1;
+    fade.pValues    = &fadeFactor;
+
+    pPacket->uniformCount = 1;
+    pPacket->pUniforms    = pBuffer->addUniforms( &fade, 1 );
+
+    pPacket->vertexBuffer       = GBufferArenas.bufferName( GScene.vertexBuffer );
+    pPacket->vertexOffset       = GScene.vertexBuffer.pointer();
+    pPacket->positionAttribute  = GScene.attributes.position;
+    pPacket->positionComponents = 2;                    // x, y
+    pPacket->vertexStride       = sizeof( GLfloat ) * 2;
+
+    pPacket->elementBuffer = GBufferArenas.bufferName( GScene.elementBuffer );
+    pPacket->elementOffset = GScene.elementBuffer.pointer();
+    pPacket->mode          = GL_TRIANGLE_STRIP;
+    pPacket->elementCount  = 4;
+    pPacket->elementType   = GL_UNSIGNED_SHORT;
+}
+
+/**
+ * Creates a sprite batch that draws instances of the scene's unit quad
+ *
+ * \param  pBatch           Batch to create
+ * \param  allowInstancing  False to force sprites to be expanded on the CPU
+ * \return                  True if the batch was created
+ */
+bool createSpriteBatch( SpriteBatch * pBatch, bool allowInstancing )
+{
+    assert( pBatch != NULL );
+    return pBatch->create( GScene.vertexBuffer,
+                           GScene.elementBuffer,
+                           allowInstancing );
+}
+
+/**
+ * Draws a sprite batch crossfading between the scene's two textures
+ */
+void drawSpriteBatch( SpriteBatch * pBatch )
+{
+    assert( pBatch != NULL );
+
+    ProfileScope scope( "drawSpriteBatch" );
+    pBatch->draw( GScene.textures[0], GScene.textures[1] );
 }
 
 
@@ -1,8 +1,58 @@
 #ifndef SCOTT_GFXSANDBOX_H
 #define SCOTT_GFXSANDBOX_H
 
-bool loadResources();
+#include <cstddef>
+
+// Images that the scene crossfades between
+extern const char * const SCENE_TEXTURE_FILES[2];
+
+// The same images block compressed by the build
+extern const char * const SCENE_COMPRESSED_TEXTURE_FILES[2];
+
+// The same images converted to qoi by the build
+extern const char * const SCENE_QOI_TEXTURE_FILES[2];
+
+class CommandBuffer;
+struct CullStats;
+class FrameScheduler;
+class SpriteBatch;
+
+/**
+ * How the scene's images are stored on the GPU
+ */
+enum SceneTextureMode
+{
+    SCENE_TEXTURES_SEPARATE,    // a texture per image, loaded in the background
+    SCENE_TEXTURES_ATLAS,       // packed side by side in a 2D atlas
+    SCENE_TEXTURES_ARRAY,       // layers of an array texture
+    SCENE_TEXTURES_COMPRESSED,  // like separate, but loaded from BC1 dds files
+    SCENE_TEXTURES_QOI          // like separate, but decoded from qoi files
+};
+
+bool loadResources( SceneTextureMode textureMode = SCENE_TEXTURES_SEPARATE );
+void releaseResources();
+void finishLoadingResources();
 void update();
+void simulateScene( double timeSeconds, double stepSeconds );
+void interpolateScene( float alpha );
+void updateScene( float seconds );
+float fadeFactorAt( float seconds );
 void render();
+void drawScene();
+void updateSceneEntities( float seconds );
+void drawSceneEntities();
+bool createSceneEntities( size_t count );
+void setSceneZoom( float zoom );
+const CullStats& sceneCullStats();
+void recordSceneQuad( CommandBuffer * pBuffer,
+                      float fadeFactor,
+                      bool swapImages,
+                      unsigned int layer,
+                      float depth );
+bool createSpriteBatch( SpriteBatch * pBatch, bool allowInstancing );
+void drawSpriteBatch( SpriteBatch * pBatch );
+
+// Runs the simulation at a fixed rate and paces rendering in windowed mode
+extern FrameScheduler GFrameScheduler;
 
 #endif
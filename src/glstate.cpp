@@ -0,0 +1,261 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "glstate.h"
+#include <cassert>
+#include <cstdio>
+
+GLStateCache GStateCache;
+
+// Value that never matches a real object name, used for state we don't know
+const GLuint UNKNOWN_NAME = 0xFFFFFFFF;
+
+// Value used for attribute enables that we don't know
+const int UNKNOWN_ENABLE = -1;
+
+static const char * STATE_CALL_NAMES[STATE_CALL_COUNT] =
+{
+    "glUseProgram",
+    "glActiveTexture",
+    "glBindTexture",
+    "glBindBuffer",
+    "glUniform",
+    "glEnable/DisableVertexAttribArray"
+};
+
+/**
+ * Maps a texture target onto the cache's table of targets. Returns -1 for
+ * targets that aren't cached
+ */
+int GLStateCache::textureTargetIndex( GLenum target )
+{
+    switch ( target )
+    {
+        case GL_TEXTURE_2D:         return TEXTURE_TARGET_2D;
+        case GL_TEXTURE_2D_ARRAY:   return TEXTURE_TARGET_2D_ARRAY;
+        default:                    return -1;
+    }
+}
+
+/**
+ * Maps a buffer target onto the cache's table of targets. Returns -1 for
+ * targets that aren't cached
+ */
+int GLStateCache::bufferTargetIndex( GLenum target )
+{
+    switch ( target )
+    {
+        case GL_ARRAY_BUFFER:           return BUFFER_TARGET_ARRAY;
+        case GL_ELEMENT_ARRAY_BUFFER:   return BUFFER_TARGET_ELEMENT_ARRAY;
+        case GL_PIXEL_UNPACK_BUFFER:    return BUFFER_TARGET_PIXEL_UNPACK;
+        case GL_COPY_READ_BUFFER:       return BUFFER_TARGET_COPY_READ;
+        case GL_COPY_WRITE_BUFFER:      return BUFFER_TARGET_COPY_WRITE;
+        default:                        return -1;
+    }
+}
+
+GLStateCache::GLStateCache()
+{
+    invalidate();
+    resetCounters();
+}
+
+/**
+ * Forgets all of the shadowed state. Call this after anything changes GL
+ * state behind the cache's back
+ */
+void GLStateCache::invalidate()
+{
+    mProgram    = UNKNOWN_NAME;
+    mActiveUnit = UNKNOWN_NAME;
+
+    for ( unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; ++unit )
+    {
+        for ( int target = 0; target < TEXTURE_TARGET_COUNT; ++target )
+        {
+            mTextures[unit][target] = UNKNOWN_NAME;
+        }
+    }
+
+    for ( int target = 0; target < BUFFER_TARGET_COUNT; ++target )
+    {
+        mBuffers[target] = UNKNOWN_NAME;
+    }
+
+    for ( unsigned int index = 0; index < MAX_VERTEX_ATTRIBS; ++index )
+    {
+        mAttribEnabled[index] = UNKNOWN_ENABLE;
+    }
+
+    mUniforms.clear();
+}
+
+void GLStateCache::resetCounters()
+{
+    for ( int call = 0; call < STATE_CALL_COUNT; ++call )
+    {
+        mIssued[call]  = 0;
+        mSkipped[call] = 0;
+    }
+}
+
+/**
+ * Prints how many calls of each kind were issued and skipped
+ */
+void GLStateCache::printCounters() const
+{
+    for ( int call = 0; call < STATE_CALL_COUNT; ++call )
+    {
+        printf( "%-34s issued=%-10llu skipped=%llu\n",
+                STATE_CALL_NAMES[call],
+                static_cast<unsigned long long>( mIssued[call] ),
+                static_cast<unsigned long long>( mSkipped[call] ) );
+    }
+}
+
+/**
+ * Counts a call, and returns true if it needs to be passed on to the driver
+ */
+bool GLStateCache::shouldIssue( GLStateCall call, bool changed )
+{
+    if ( changed )
+    {
+        mIssued[call]++;
+    }
+    else
+    {
+        mSkipped[call]++;
+    }
+
+    return changed;
+}
+
+void GLStateCache::useProgram( GLuint program )
+{
+    if ( shouldIssue( STATE_CALL_USE_PROGRAM, program != mProgram ) )
+    {
+        glUseProgram( program );
+        mProgram = program;
+    }
+}
+
+/**
+ * Selects the active texture unit
+ *
+ * \param  unit  Index of the unit, ie 0 for GL_TEXTURE0
+ */
+void GLStateCache::activeTexture( unsigned int unit )
+{
+    if ( shouldIssue( STATE_CALL_ACTIVE_TEXTURE, unit != mActiveUnit ) )
+    {
+        glActiveTexture( GL_TEXTURE0 + unit );
+        mActiveUnit = unit;
+    }
+}
+
+/**
+ * Binds a texture to a texture unit, switching the active unit only if the
+ * binding actually has to change
+ *
+ * \param  unit     Index of the texture unit, ie 0 for GL_TEXTURE0
+ * \param  target   Texture target to bind to
+ * \param  texture  Texture to bind
+ */
+void GLStateCache::bindTexture( unsigned int unit, GLenum target, GLuint texture )
+{
+    int index = textureTargetIndex( target );
+
+    if ( index < 0 || unit >= MAX_TEXTURE_UNITS )
+    {
+        activeTexture( unit );
+        shouldIssue( STATE_CALL_BIND_TEXTURE, true );
+        glBindTexture( target, texture );
+        return;
+    }
+
+    if ( shouldIssue( STATE_CALL_BIND_TEXTURE, mTextures[unit][index] != texture ) )
+    {
+        activeTexture( unit );
+        glBindTexture( target, texture );
+        mTextures[unit][index] = texture;
+    }
+}
+
+void GLStateCache::bindBuffer( GLenum target, GLuint buffer )
+{
+    int index = bufferTargetIndex( target );
+
+    if ( index < 0 )
+    {
+        shouldIssue( STATE_CALL_BIND_BUFFER, true );
+        glBindBuffer( target, buffer );
+    }
+    else if ( shouldIssue( STATE_CALL_BIND_BUFFER, mBuffers[index] != buffer ) )
+    {
+        glBindBuffer( target, buffer );
+        mBuffers[index] = buffer;
+    }
+}
+
+/**
+ * Sets an integer uniform on the current program. Values are remembered per
+ * program, since uniforms are program state
+ */
+void GLStateCache::uniform1i( GLint location, GLint value )
+{
+    assert( mProgram != UNKNOWN_NAME && "Uniform set without a known program" );
+
+    uint64_t key = ( static_cast<uint64_t>( mProgram ) << 32 ) |
+                   static_cast<uint32_t>( location );
+
+    std::unordered_map<uint64_t, GLint>::iterator itr = mUniforms.find( key );
+    bool changed = ( itr == mUniforms.end() || itr->second != value );
+
+    if ( shouldIssue( STATE_CALL_UNIFORM, changed ) )
+    {
+        glUniform1i( location, value );
+        mUniforms[key] = value;
+    }
+}
+
+void GLStateCache::enableVertexAttribArray( GLuint index )
+{
+    bool changed = ( index >= MAX_VERTEX_ATTRIBS || mAttribEnabled[index] != 1 );
+
+    if ( shouldIssue( STATE_CALL_VERTEX_ATTRIB_ARRAY, changed ) )
+    {
+        glEnableVertexAttribArray( index );
+
+        if ( index < MAX_VERTEX_ATTRIBS )
+        {
+            mAttribEnabled[index] = 1;
+        }
+    }
+}
+
+void GLStateCache::disableVertexAttribArray( GLuint index )
+{
+    bool changed = ( index >= MAX_VERTEX_ATTRIBS || mAttribEnabled[index] != 0 );
+
+    if ( shouldIssue( STATE_CALL_VERTEX_ATTRIB_ARRAY, changed ) )
+    {
+        glDisableVertexAttribArray( index );
+
+        if ( index < MAX_VERTEX_ATTRIBS )
+        {
+            mAttribEnabled[index] = 0;
+        }
+    }
+}
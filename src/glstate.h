@@ -0,0 +1,117 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_GLSTATE_H
+#define SCOTT_GFXSANDBOX_GLSTATE_H
+
+#include <GL/glew.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Kinds of GL calls that go through the state cache, used to index counters
+ */
+enum GLStateCall
+{
+    STATE_CALL_USE_PROGRAM,
+    STATE_CALL_ACTIVE_TEXTURE,
+    STATE_CALL_BIND_TEXTURE,
+    STATE_CALL_BIND_BUFFER,
+    STATE_CALL_UNIFORM,
+    STATE_CALL_VERTEX_ATTRIB_ARRAY,
+    STATE_CALL_COUNT
+};
+
+/**
+ * Shadows the parts of OpenGL's state that the renderer changes every frame,
+ * and drops calls that would set state to the value it already has. Each call
+ * is counted as either issued to the driver or skipped.
+ *
+ * Anything that changes this state without going through the cache must call
+ * invalidate() afterwards, otherwise the cache may skip calls it shouldn't.
+ */
+class GLStateCache
+{
+public:
+    // Maximum number of texture units that are tracked
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+    // Maximum number of vertex attributes that are tracked
+    static const unsigned int MAX_VERTEX_ATTRIBS = 16;
+
+    GLStateCache();
+
+    void useProgram( GLuint program );
+    void activeTexture( unsigned int unit );
+    void bindTexture( unsigned int unit, GLenum target, GLuint texture );
+    void bindBuffer( GLenum target, GLuint buffer );
+    void uniform1i( GLint location, GLint value );
+    void enableVertexAttribArray( GLuint index );
+    void disableVertexAttribArray( GLuint index );
+
+    // Forget everything, so the next call of each kind is always issued
+    void invalidate();
+
+    // Number of calls of a kind that were passed on to the driver
+    uint64_t issuedCount( GLStateCall call ) const { return mIssued[call]; }
+
+    // Number of calls of a kind that were dropped as redundant
+    uint64_t skippedCount( GLStateCall call ) const { return mSkipped[call]; }
+
+    // Reset the issued and skipped counters to zero
+    void resetCounters();
+
+    // Print the issued and skipped counters
+    void printCounters() const;
+
+private:
+    enum TextureTarget
+    {
+        TEXTURE_TARGET_2D,
+        TEXTURE_TARGET_2D_ARRAY,
+        TEXTURE_TARGET_COUNT
+    };
+
+    enum BufferTarget
+    {
+        BUFFER_TARGET_ARRAY,
+        BUFFER_TARGET_ELEMENT_ARRAY,
+        BUFFER_TARGET_PIXEL_UNPACK,
+        BUFFER_TARGET_COPY_READ,
+        BUFFER_TARGET_COPY_WRITE,
+        BUFFER_TARGET_COUNT
+    };
+
+    static int textureTargetIndex( GLenum target );
+    static int bufferTargetIndex( GLenum target );
+
+    bool shouldIssue( GLStateCall call, bool changed );
+
+    GLuint mProgram;
+    unsigned int mActiveUnit;
+    GLuint mTextures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+    GLuint mBuffers[BUFFER_TARGET_COUNT];
+    int mAttribEnabled[MAX_VERTEX_ATTRIBS];
+    std::unordered_map<uint64_t, GLint> mUniforms;
+
+    uint64_t mIssued[STATE_CALL_COUNT];
+    uint64_t mSkipped[STATE_CALL_COUNT];
+};
+
+// State cache for the thread that owns the OpenGL context
+extern GLStateCache GStateCache;
+
+#endif
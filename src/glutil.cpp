@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "glutil.h"
+#include "glstate.h"
 #include <iostream>
 #include <cassert>
 #include <vector>
@@ -22,6 +23,7 @@
 #ifdef __APPLE__
 #include <GLUT/glut.h>
 #else
+#include <GL/glxew.h>
 #include <GL/glut.h>
 #endif
 
@@ -45,11 +47,11 @@ GLuint createBuffer( GLenum target,
     // Request a new hardware buffer id, bind to it and then upload all of the
     // data we were given
     glGenBuffers( 1, &id );
-    glBindBuffer( target, id );
+    GStateCache.bindBuffer( target, id );
     glBufferData( target, bufferSize, pData, GL_STATIC_DRAW );
 
     // Verify that the buffer creation succeeded
-    bool ok = errorCheck( "Creating data buffer", false );
+    bool ok = !checkGlFailure( "Creating data buffer" );
 
     if ( pOk != NULL )
     {
@@ -83,6 +85,163 @@ std::string showInfoLog( GLuint object,
     return std::string( &buffer[0] );
 }
 
+/**
+ * Sets the number of vertical blanks the current context waits for before
+ * swapping buffers. Only GLX is handled; elsewhere the platform default
+ * (usually vsync on) is left alone.
+ *
+ * \param  interval  Number of vertical blanks, 0 to swap immediately
+ * \return           True if the swap interval was set
+ */
+bool setSwapInterval( int interval )
+{
+#ifdef __APPLE__
+    (void) interval;
+    return false;
+#else
+    if ( GLXEW_EXT_swap_control )
+    {
+        glXSwapIntervalEXT( glXGetCurrentDisplay(),
+                            glXGetCurrentDrawable(),
+                            interval );
+        return true;
+    }
+    else if ( GLXEW_MESA_swap_control )
+    {
+        return glXSwapIntervalMESA( interval ) == 0;
+    }
+    else if ( GLXEW_SGI_swap_control && interval > 0 )
+    {
+        // The SGI extension can't turn vsync off
+        return glXSwapIntervalSGI( interval ) == 0;
+    }
+
+    return false;
+#endif
+}
+
+/**
+ * Describes an error code returned by glGetError
+ */
+static std::string errorDescription( GLenum error )
+{
+    switch ( error )
+    {
+        case GL_INVALID_ENUM:
+            return "GLenum argument out of range";
+
+        case GL_INVALID_VALUE:
+            return "Numeric argument out of range";
+
+        case GL_INVALID_OPERATION:
+            return "Operation illegal in current state";
+
+        case GL_STACK_OVERFLOW:
+            return "Command would cause stack overflow";
+
+        case GL_STACK_UNDERFLOW:
+            return "Command would cause stack underflow";
+
+        case GL_OUT_OF_MEMORY:
+            return "Not enough memory left to execute command";
+
+        default:
+        {
+            std::ostringstream ss;
+            ss << "Unknown error code returned '" << error << "'";
+            return ss.str();
+        }
+    }
+}
+
+#ifdef GFXSANDBOX_GL_ERROR_CHECKS
+// True once a debug message callback has been registered
+static bool GDebugOutputEnabled = false;
+
+// Set by the debug callback when the driver reports an error
+static bool GDebugErrorRaised = false;
+
+// Description passed to the most recent errorCheck, so that debug messages
+// can say roughly where in the program they came from
+static const char * GLastCallSite = "startup";
+
+/**
+ * Receives messages from the driver when KHR_debug output is enabled. Output
+ * is synchronous, so this runs inside the GL call that caused the message
+ */
+static void GLAPIENTRY debugMessageCallback( GLenum /* source */,
+                                             GLenum type,
+                                             GLuint /* id */,
+                                             GLenum severity,
+                                             GLsizei /* length */,
+                                             const GLchar * message,
+                                             const void * /* userParam */ )
+{
+    if ( severity == GL_DEBUG_SEVERITY_NOTIFICATION )
+    {
+        return;
+    }
+
+    if ( type == GL_DEBUG_TYPE_ERROR )
+    {
+        GDebugErrorRaised = true;
+    }
+
+    std::cerr << "OpenGL "
+              << ( type == GL_DEBUG_TYPE_ERROR ? "error" : "message" )
+              << " after " << GLastCallSite << ": " << message << std::endl;
+}
+
+/**
+ * Registers a KHR_debug (or ARB_debug_output) message callback. Once enabled,
+ * errorCheck stops calling glGetError, which forces a pipeline sync on many
+ * drivers. Instead it records the call site for the callback to print, and
+ * reports any error the callback saw since the previous check.
+ *
+ * Drivers are allowed to send little or nothing to a context that wasn't
+ * created as a debug context, so without one errorCheck keeps using
+ * glGetError.
+ *
+ * \return  True if debug output is available and was enabled
+ */
+bool enableDebugOutput()
+{
+    GLint contextFlags = 0;
+
+    if ( GLEW_VERSION_3_0 )
+    {
+        glGetIntegerv( GL_CONTEXT_FLAGS, &contextFlags );
+    }
+
+    if (! ( contextFlags & GL_CONTEXT_FLAG_DEBUG_BIT ) )
+    {
+        return false;
+    }
+
+    if ( GLEW_VERSION_4_3 || GLEW_KHR_debug )
+    {
+        glEnable( GL_DEBUG_OUTPUT );
+        glEnable( GL_DEBUG_OUTPUT_SYNCHRONOUS );
+        glDebugMessageCallback( &debugMessageCallback, NULL );
+    }
+    else if ( GLEW_ARB_debug_output )
+    {
+        glEnable( GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB );
+        glDebugMessageCallbackARB( &debugMessageCallback, NULL );
+    }
+    else
+    {
+        return false;
+    }
+
+    // Errors raised before now never reached the callback, so report them
+    // the old way one last time
+    errorCheck( "enabling debug output", false );
+    GDebugOutputEnabled = true;
+
+    return true;
+}
+
 /**
  * Checks if there are any active OpenGL errors. This method will print out 
  * details of any error conditions that exist. Additionally, this method can
@@ -94,6 +253,21 @@ std::string showInfoLog( GLuint object,
  */
 bool errorCheck( const char* state, bool dieOnError )
 {
+    if ( GDebugOutputEnabled )
+    {
+        bool hasErrors    = GDebugErrorRaised;
+        GDebugErrorRaised = false;
+        GLastCallSite     = ( state != NULL ? state : "unnamed error check" );
+
+        if ( hasErrors && dieOnError )
+        {
+            std::cerr << "Exiting after OpenGL error in " << GLastCallSite << std::endl;
+            exit( 1 );
+        }
+
+        return hasErrors;
+    }
+
     GLenum error   = glGetError();
     bool hasErrors = true;
     
@@ -118,45 +292,75 @@ bool errorCheck( const char* state, bool dieOnError )
             ss << ": ";
         }
 
-        switch ( error )
-        {
-            case GL_INVALID_ENUM:
-                ss << "GLenum argument out of range";
-                break;
+        ss << errorDescription( error );
 
-            case GL_INVALID_VALUE:
-                ss << "Numeric argument out of range";
-                break;
+        std::cerr << ss.str() << std::endl;
 
-            case GL_INVALID_OPERATION:
-                ss << "Operation illegal in current state";
-                break;
+        // Should we exit on an error?
+        if ( dieOnError )
+        {
+            exit( 1 );
+        }
+    }
 
-            case GL_STACK_OVERFLOW:
-                ss << "Command would cause stack overflow";
-                break;
+    return hasErrors;
+}
+#endif
 
-            case GL_STACK_UNDERFLOW:
-                ss << "Command would cause stack underflow";
-                break;
+/**
+ * Checks if an operation that has to work, like creating a resource, raised
+ * an OpenGL error. Unlike errorCheck this is always compiled in, so it
+ * should only be used away from the per frame paths, where the sync that
+ * glGetError can force doesn't matter
+ *
+ * \param  state  Description of the operation that was just issued
+ * \return        True if there was an error, false otherwise
+ */
+bool checkGlFailure( const char* state )
+{
+    // Several error flags can be set at once. Take them all so that none of
+    // them is blamed on a later check, but stop eventually since glGetError
+    // keeps failing without a current context
+    GLenum firstError = GL_NO_ERROR;
 
-            case GL_OUT_OF_MEMORY:
-                ss << "Not enough memory left to execute command";
-                break;
+    for ( int i = 0; i < 8; ++i )
+    {
+        GLenum error = glGetError();
 
-            default:
-                ss << "Unknown error code returned '" << error << "'";
-                break;
+        if ( error == GL_NO_ERROR )
+        {
+            break;
         }
 
-        std::cerr << ss.str() << std::endl;
+        if ( firstError == GL_NO_ERROR )
+        {
+            firstError = error;
+        }
+    }
 
-        // Should we exit on an error?
-        if ( dieOnError )
+    bool hasErrors = ( firstError != GL_NO_ERROR );
+
+#ifdef GFXSANDBOX_GL_ERROR_CHECKS
+    if ( GDebugOutputEnabled )
+    {
+        // The debug callback has already printed anything it saw, so only
+        // mark the call site and take the error so errorCheck won't repeat it
+        bool reported     = GDebugErrorRaised;
+        GDebugErrorRaised = false;
+        GLastCallSite     = state;
+
+        if ( reported )
         {
-            exit( 1 );
+            return true;
         }
     }
+#endif
+
+    if ( hasErrors )
+    {
+        std::cerr << "OpenGL error occurred in " << state << ": "
+                  << errorDescription( firstError ) << std::endl;
+    }
 
     return hasErrors;
 }
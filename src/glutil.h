@@ -1,6 +1,7 @@
 #ifndef SCOTT_GFXSANDBOX_GLUTIL_H
 #define SCOTT_GFXSANDBOX_GLUTIL_H
 
+#include "bufferarena.h"
 #include <GL/glew.h>
 #include <string>
 #include <vector>
@@ -11,17 +12,34 @@ GLuint createBuffer( GLenum target,
                      GLsizei bufferSize,
                      bool * ok = NULL );
 
-// Create a hardware buffer with the given array of typed data
+// Place an array of typed data in one of the shared buffer arenas
 template<typename T>
-GLuint createBufferT( GLenum target, const std::vector<T>& array );
+BufferRange createBufferT( GLenum target, const std::vector<T>& array );
 
-// Create a hardware buffer with the given array of typed data
+// Place an array of typed data in one of the shared buffer arenas
 template<typename T>
-GLuint createBufferT( GLenum target, const T* pElements, size_t count );
+BufferRange createBufferT( GLenum target, const T* pElements, size_t count );
 
+#ifdef GFXSANDBOX_GL_ERROR_CHECKS
 // Check if there were any OpenGL errors
 bool errorCheck( const char* state = NULL, bool dieOnError = true );
 
+// Report errors through a KHR_debug callback instead of glGetError
+bool enableDebugOutput();
+#else
+// Error checks are compiled out, so calls to these cost nothing at all. Code
+// that needs to know whether an operation worked uses checkGlFailure
+inline bool errorCheck( const char* = NULL, bool = true ) { return false; }
+inline bool enableDebugOutput() { return false; }
+#endif
+
+// Check if creating a resource or another one off operation raised an
+// OpenGL error. Always compiled in, unlike errorCheck
+bool checkGlFailure( const char* state );
+
+// Set how many vertical blanks buffer swaps wait for, 0 turns vsync off
+bool setSwapInterval( int interval );
+
 // Look up log info
 std::string showInfoLog( GLuint object,
                          PFNGLGETSHADERIVPROC glGet__iv,
@@ -31,15 +49,15 @@ std::string showInfoLog( GLuint object,
 // Implementation
 /////////////////////////////////////////////////////////////////////////////
 template<typename T>
-GLuint createBufferT( GLenum target, const std::vector<T>& array )
+BufferRange createBufferT( GLenum target, const std::vector<T>& array )
 {
-    return createBuffer( target, &array[0], array.size() * sizeof(T) );
+    return GBufferArenas.allocate( target, &array[0], array.size() * sizeof(T) );
 }
 
 template<typename T>
-GLuint createBufferT( GLenum target, const T* pElements, size_t count )
+BufferRange createBufferT( GLenum target, const T* pElements, size_t count )
 {
-    return createBuffer( target, pElements, count * sizeof(T) );
+    return GBufferArenas.allocate( target, pElements, count * sizeof(T) );
 }
 
 #endif
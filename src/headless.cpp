@@ -0,0 +1,1104 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "headless.h"
+#include "crossfade.h"
+#include "dds.h"
+#include "gfxsandbox.h"
+#include "glutil.h"
+#include "glstate.h"
+#include "imagecodec.h"
+#include "profiler.h"
+#include "spatialgrid.h"
+#include "spritebatch.h"
+#include "swizzle.h"
+#include "texture.h"
+#include "timing.h"
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Simulated time between two headless frames. This matches a 60hz display so
+// the fade factor sequence looks the same as it would in a window
+const float HEADLESS_FRAME_STEP = 1.0f / 60.0f;
+
+// Frames drawn before timing starts. The first frame pays for work the driver
+// deferred, and llvmpipe returns a bogus elapsed time (about the system
+// uptime) for the first timer query
+const int HEADLESS_WARMUP_FRAMES = 1;
+
+// Sprite counts the sprite benchmark steps through
+const size_t SPRITE_BENCHMARK_COUNTS[] = { 1000, 10000, 100000, 250000 };
+
+/**
+ * Parses the command line arguments that control a headless run. Arguments
+ * that are not understood cause this method to fail
+ *
+ * \param  argc      Number of command line arguments
+ * \param  argv      Command line arguments
+ * \param  pOptions  Receives the parsed options
+ * \return           True if all of the arguments were understood
+ */
+bool parseHeadlessOptions( int argc, char** argv, HeadlessOptions * pOptions )
+{
+    assert( pOptions != NULL );
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg  = argv[i];
+        bool hasValue    = ( i + 1 < argc );
+
+        if ( arg == "--headless" )
+        {
+            continue;
+        }
+        else if ( arg == "--frames" && hasValue )
+        {
+            pOptions->frameCount = atoi( argv[++i] );
+        }
+        else if ( arg == "--size" && hasValue )
+        {
+            if ( sscanf( argv[++i], "%dx%d",
+                         &pOptions->width, &pOptions->height ) != 2 )
+            {
+                return false;
+            }
+        }
+        else if ( arg == "--output" && hasValue )
+        {
+            pOptions->outputFile = argv[++i];
+        }
+        else if ( arg == "--trace" && hasValue )
+        {
+            pOptions->traceFile = argv[++i];
+        }
+        else if ( arg == "--sprite-bench" )
+        {
+            pOptions->spriteBenchmark = true;
+        }
+        else if ( arg == "--upload-bench" )
+        {
+            pOptions->uploadBenchmark = true;
+        }
+        else if ( arg == "--entities" && hasValue )
+        {
+            pOptions->entityCount = strtoul( argv[++i], NULL, 10 );
+        }
+        else if ( arg == "--zoom" && hasValue )
+        {
+            pOptions->zoom = static_cast<float>( atof( argv[++i] ) );
+        }
+        else if ( arg == "--validate" )
+        {
+            pOptions->validate = true;
+        }
+        else if ( arg == "--atlas" )
+        {
+            pOptions->textureMode = SCENE_TEXTURES_ATLAS;
+        }
+        else if ( arg == "--texture-array" )
+        {
+            pOptions->textureMode = SCENE_TEXTURES_ARRAY;
+        }
+        else if ( arg == "--compressed" )
+        {
+            pOptions->textureMode = SCENE_TEXTURES_COMPRESSED;
+        }
+        else if ( arg == "--qoi" )
+        {
+            pOptions->textureMode = SCENE_TEXTURES_QOI;
+        }
+        else
+        {
+            std::cerr << "Unknown headless argument: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    // Sprite batches sample the scene's images as separate 2D textures
+    if ( pOptions->spriteBenchmark &&
+         ( pOptions->textureMode == SCENE_TEXTURES_ATLAS ||
+           pOptions->textureMode == SCENE_TEXTURES_ARRAY ) )
+    {
+        std::cerr << "--sprite-bench can't be combined with --atlas or "
+                  << "--texture-array" << std::endl;
+        return false;
+    }
+
+    // Validation only knows what the scene's quad looks like, and entities
+    // are drawn from the two images as separate textures
+    if ( pOptions->entityCount > 0 &&
+         ( pOptions->validate ||
+           pOptions->textureMode == SCENE_TEXTURES_ATLAS ||
+           pOptions->textureMode == SCENE_TEXTURES_ARRAY ) )
+    {
+        std::cerr << "--entities can't be combined with --validate, --atlas "
+                  << "or --texture-array" << std::endl;
+        return false;
+    }
+
+    if ( pOptions->spriteBenchmark && pOptions->uploadBenchmark )
+    {
+        std::cerr << "--sprite-bench and --upload-bench can't be combined" << std::endl;
+        return false;
+    }
+
+    return pOptions->frameCount > 0 &&
+           pOptions->width > 0     &&
+           pOptions->height > 0    &&
+           pOptions->zoom > 0.0f;
+}
+
+/**
+ * Creates an EGL display and OpenGL context that is not attached to any
+ * window, and then creates a framebuffer object to render into. This works on
+ * machines without a display server (eg Mesa's llvmpipe on a build box)
+ *
+ * \param  width     Width of the offscreen framebuffer
+ * \param  height    Height of the offscreen framebuffer
+ * \param  pContext  Receives the created context
+ * \return           True if the context was created and made current
+ */
+bool createHeadlessContext( int width, int height, HeadlessContext * pContext )
+{
+    assert( pContext != NULL );
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    // Prefer Mesa's surfaceless platform since it never needs a display
+    // server. Fall back to the default display otherwise
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+
+    if ( eglGetPlatformDisplayEXT != NULL )
+    {
+        display = eglGetPlatformDisplayEXT( EGL_PLATFORM_SURFACELESS_MESA,
+                                            EGL_DEFAULT_DISPLAY,
+                                            NULL );
+    }
+
+    if ( display == EGL_NO_DISPLAY )
+    {
+        display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+    }
+
+    if ( display == EGL_NO_DISPLAY || !eglInitialize( display, NULL, NULL ) )
+    {
+        std::cerr << "Failed to initialize an EGL display" << std::endl;
+        return false;
+    }
+
+    const EGLint configAttributes[] =
+    {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE,        8,
+        EGL_GREEN_SIZE,      8,
+        EGL_BLUE_SIZE,       8,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+
+    if (! eglChooseConfig( display, configAttributes, &config, 1, &configCount ) ||
+        configCount == 0 )
+    {
+        std::cerr << "No EGL config supports desktop OpenGL" << std::endl;
+        eglTerminate( display );
+        return false;
+    }
+
+    eglBindAPI( EGL_OPENGL_API );
+    EGLContext context = EGL_NO_CONTEXT;
+
+#ifdef GFXSANDBOX_GL_ERROR_CHECKS
+    // Drivers don't have to send debug output to a normal context. Ask for
+    // a debug one, and fall back if EGL_KHR_create_context isn't there
+    const EGLint debugAttributes[] =
+    {
+        EGL_CONTEXT_FLAGS_KHR, EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR,
+        EGL_NONE
+    };
+
+    context = eglCreateContext( display, config, EGL_NO_CONTEXT, debugAttributes );
+#endif
+
+    if ( context == EGL_NO_CONTEXT )
+    {
+        context = eglCreateContext( display, config, EGL_NO_CONTEXT, NULL );
+    }
+
+    if ( context == EGL_NO_CONTEXT )
+    {
+        std::cerr << "Failed to create an EGL OpenGL context" << std::endl;
+        eglTerminate( display );
+        return false;
+    }
+
+    // All rendering goes into a framebuffer object, so the context does not
+    // need a surface. Drivers without surfaceless support get a tiny pbuffer
+    EGLSurface surface = EGL_NO_SURFACE;
+
+    if (! eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) )
+    {
+        const EGLint pbufferAttributes[] =
+        {
+            EGL_WIDTH,  1,
+            EGL_HEIGHT, 1,
+            EGL_NONE
+        };
+
+        surface = eglCreatePbufferSurface( display, config, pbufferAttributes );
+
+        if ( surface == EGL_NO_SURFACE ||
+             !eglMakeCurrent( display, surface, surface, context ) )
+        {
+            std::cerr << "Failed to make the EGL context current" << std::endl;
+            eglDestroyContext( display, context );
+            eglTerminate( display );
+            return false;
+        }
+    }
+
+    pContext->display = display;
+    pContext->context = context;
+    pContext->surface = surface;
+    pContext->width   = width;
+    pContext->height  = height;
+
+    // GLEW looks for a GLX display after it has loaded the GL entry points,
+    // which fails without an X server. The entry points are still usable
+    GLenum glewStatus = glewInit();
+
+    if ( glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY )
+    {
+        std::cerr << "Failed to initialize GLEW: "
+                  << glewGetErrorString( glewStatus ) << std::endl;
+        destroyHeadlessContext( pContext );
+        return false;
+    }
+
+    if (! GLEW_VERSION_3_0 && ! GLEW_ARB_framebuffer_object )
+    {
+        std::cerr << "Framebuffer objects are not available" << std::endl;
+        destroyHeadlessContext( pContext );
+        return false;
+    }
+
+    // Create the offscreen framebuffer that will stand in for the window
+    glGenRenderbuffers( 1, &pContext->colorBuffer );
+    glBindRenderbuffer( GL_RENDERBUFFER, pContext->colorBuffer );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+
+    glGenFramebuffers( 1, &pContext->framebuffer );
+    glBindFramebuffer( GL_FRAMEBUFFER, pContext->framebuffer );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER,
+                               GL_COLOR_ATTACHMENT0,
+                               GL_RENDERBUFFER,
+                               pContext->colorBuffer );
+
+    if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+    {
+        std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+        destroyHeadlessContext( pContext );
+        return false;
+    }
+
+    glViewport( 0, 0, width, height );
+    return !checkGlFailure( "Creating headless framebuffer" );
+}
+
+/**
+ * Releases the framebuffer, context and display created by
+ * createHeadlessContext
+ */
+void destroyHeadlessContext( HeadlessContext * pContext )
+{
+    assert( pContext != NULL );
+
+    if ( pContext->display == NULL )
+    {
+        return;
+    }
+
+    if ( pContext->framebuffer != 0 )
+    {
+        glDeleteFramebuffers( 1, &pContext->framebuffer );
+    }
+
+    if ( pContext->colorBuffer != 0 )
+    {
+        glDeleteRenderbuffers( 1, &pContext->colorBuffer );
+    }
+
+    eglMakeCurrent( pContext->display,
+                    EGL_NO_SURFACE,
+                    EGL_NO_SURFACE,
+                    EGL_NO_CONTEXT );
+
+    if ( pContext->surface != EGL_NO_SURFACE )
+    {
+        eglDestroySurface( pContext->display, pContext->surface );
+    }
+
+    eglDestroyContext( pContext->display, pContext->context );
+    eglTerminate( pContext->display );
+
+    *pContext = HeadlessContext();
+}
+
+/**
+ * Reads the offscreen framebuffer back as tightly packed BGR pixels
+ */
+static bool readFramebuffer( const HeadlessContext& context,
+                             std::vector<unsigned char> * pPixels )
+{
+    pPixels->resize( context.width * context.height * 3 );
+
+    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+    glReadPixels( 0, 0,
+                  context.width, context.height,
+                  GL_BGR,
+                  GL_UNSIGNED_BYTE,
+                  &(*pPixels)[0] );
+
+    return !checkGlFailure( "Reading back the framebuffer" );
+}
+
+/**
+ * Reads the offscreen framebuffer back and writes it to disk as a tga image
+ */
+static bool saveFramebuffer( const HeadlessContext& context,
+                             const std::string& filename )
+{
+    std::vector<unsigned char> pixels;
+
+    if (! readFramebuffer( context, &pixels ) )
+    {
+        return false;
+    }
+
+    return write_tga( filename.c_str(), context.width, context.height, &pixels[0] );
+}
+
+/**
+ * Loads the pixels a scene image should show, as tightly packed BGR rows.
+ * Compressed images are decompressed on the CPU, so the comparison is with
+ * what the blocks hold rather than with the original image
+ *
+ * \param  index        Which of the scene's two images to load
+ * \param  textureMode  How the scene stores its images
+ * \param  pImage       Receives the image
+ * \return              True if the image was loaded
+ */
+static bool loadSceneImage( size_t index, SceneTextureMode textureMode, Image * pImage )
+{
+    if ( textureMode == SCENE_TEXTURES_QOI )
+    {
+        return loadImageFile( SCENE_QOI_TEXTURE_FILES[index], pImage ) &&
+               pImage->format == PIXEL_FORMAT_BGR8;
+    }
+    else if ( textureMode != SCENE_TEXTURES_COMPRESSED )
+    {
+        return loadTga( SCENE_TEXTURE_FILES[index], pImage ) &&
+               pImage->format == PIXEL_FORMAT_BGR8;
+    }
+
+    CompressedImage compressed;
+    std::vector<unsigned char> bgra;
+
+    if (! loadDds( SCENE_COMPRESSED_TEXTURE_FILES[index], &compressed ) )
+    {
+        return false;
+    }
+
+    const CompressedLevel& level = compressed.levels[0];
+    decompressImage( compressed.levelData( 0 ), compressed.format, level.width, level.height, &bgra );
+
+    pImage->width  = level.width;
+    pImage->height = level.height;
+    pImage->format = PIXEL_FORMAT_BGR8;
+    pImage->mapping.reset();
+    pImage->buffer.resize( pImage->size() );
+
+    for ( size_t i = 0; i < bgra.size() / 4; ++i )
+    {
+        memcpy( &pImage->buffer[i * 3], &bgra[i * 4], 3 );
+    }
+
+    return true;
+}
+
+/**
+ * Checks the final frame against the CPU crossfade of the scene's images.
+ * The framebuffer has to be the same size as the images so that every pixel
+ * samples exactly one texel
+ *
+ * \param  context      Context holding the rendered frame
+ * \param  textureMode  How the scene stores its images
+ * \param  fadeFactor   Fade factor the frame was rendered with
+ * \return              True if every channel is close enough to the CPU
+ */
+static bool validateFramebuffer( const HeadlessContext& context,
+                                 SceneTextureMode textureMode,
+                                 float fadeFactor )
+{
+    Image images[2];
+
+    bool ok = loadSceneImage( 0, textureMode, &images[0] ) &&
+              loadSceneImage( 1, textureMode, &images[1] );
+
+    if ( ok && ( images[0].width  != context.width  || images[1].width  != context.width ||
+                 images[0].height != context.height || images[1].height != context.height ) )
+    {
+        std::cerr << "Validation needs --size " << images[0].width << "x"
+                  << images[0].height << " to match the scene images" << std::endl;
+        ok = false;
+    }
+
+    std::vector<unsigned char> actual;
+
+    if ( ok && readFramebuffer( context, &actual ) )
+    {
+        std::vector<unsigned char> expected( actual.size() );
+
+        double start = currentTimeMs();
+        crossfade( images[0].pixels(),
+                   images[1].pixels(),
+                   &expected[0],
+                   expected.size(),
+                   fadeFactor );
+        double elapsed = currentTimeMs() - start;
+
+        // S3TC leaves the rounding of interpolated colors up to the
+        // implementation, so the GPU's texels can be a unit away from ours
+        int tolerance       = ( textureMode == SCENE_TEXTURES_COMPRESSED ? 2 : 1 );
+        int maxError        = 0;
+        size_t errorCount   = 0;
+
+        for ( size_t i = 0; i < actual.size(); ++i )
+        {
+            int error = abs( static_cast<int>( actual[i] ) - expected[i] );
+            maxError  = std::max( maxError, error );
+
+            if ( error > tolerance )
+            {
+                errorCount++;
+            }
+        }
+
+        std::cout << "CPU crossfade (" << crossfadeKernelName( bestCrossfadeKernel() )
+                  << ") took " << elapsed << " ms, max channel error "
+                  << maxError << ", " << errorCount << " channels off by more "
+                  << "than " << tolerance << std::endl;
+
+        ok = ( errorCount == 0 );
+    }
+    else
+    {
+        ok = false;
+    }
+
+    return ok;
+}
+
+/**
+ * Scatters small sprites over the framebuffer, each showing a random part of
+ * the images. The random sequence is seeded so every run draws the same thing
+ *
+ * \param  count     Number of sprites to make
+ * \param  pSprites  Receives the sprites
+ */
+static void scatterSprites( size_t count, std::vector<Sprite> * pSprites )
+{
+    std::mt19937 random( 12345 );
+    std::uniform_real_distribution<float> unit( 0.0f, 1.0f );
+
+    pSprites->resize( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        Sprite& sprite = (*pSprites)[i];
+
+        sprite.x          = unit( random ) * 2.0f - 1.0f;
+        sprite.y          = unit( random ) * 2.0f - 1.0f;
+        sprite.halfWidth  = 0.01f + unit( random ) * 0.02f;
+        sprite.halfHeight = 0.01f + unit( random ) * 0.02f;
+        sprite.rotation   = unit( random ) * 6.2831853f;
+        sprite.u0         = unit( random ) * 0.75f;
+        sprite.v0         = unit( random ) * 0.75f;
+        sprite.u1         = sprite.u0 + 0.25f;
+        sprite.v1         = sprite.v0 + 0.25f;
+        sprite.fade       = 0.0f;
+    }
+}
+
+/**
+ * Reads back the GL_TIME_ELAPSED query of every timed frame. A frame can't
+ * take longer on the GPU than the whole run did on the wall clock, so any
+ * sample that does is a driver bug and is dropped rather than skewing the
+ * statistics
+ *
+ * \param  queries   One query per frame
+ * \param  runMs     Wall clock time of the frames, up to glFinish
+ * \param  pDropped  Receives the number of samples that were dropped
+ * \return           GPU time of each frame that looked sane, in milliseconds
+ */
+static std::vector<double> readGpuFrameTimes( const std::vector<GLuint>& queries,
+                                              double runMs,
+                                              size_t * pDropped )
+{
+    std::vector<double> times;
+    times.reserve( queries.size() );
+    *pDropped = 0;
+
+    for ( size_t frame = 0; frame < queries.size(); ++frame )
+    {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v( queries[frame], GL_QUERY_RESULT, &elapsed );
+
+        double ms = static_cast<double>( elapsed ) / 1000000.0;
+
+        if ( ms > runMs )
+        {
+            ++*pDropped;
+            continue;
+        }
+
+        times.push_back( ms );
+    }
+
+    return times;
+}
+
+/**
+ * Prints the GPU frame times, and how many impossible samples were dropped
+ */
+static SampleSummary printGpuFrameTimes( const std::string& label,
+                                         const std::vector<double>& times,
+                                         size_t dropped )
+{
+    SampleSummary summary = summarizeSamples( times );
+    printSummary( label, summary );
+
+    if ( dropped > 0 )
+    {
+        std::cout << "Dropped " << dropped << " GPU sample(s) longer than the "
+                  << "whole run, the driver's timer queries are unreliable"
+                  << std::endl;
+    }
+
+    return summary;
+}
+
+/**
+ * Times one sprite batch mode over increasing sprite counts. CPU time covers
+ * filling the batch and submitting it; the per sprite fade animation is done
+ * before the clock starts.
+ *
+ * \param  options          Settings for the run
+ * \param  allowInstancing  False to time the CPU expanded fallback
+ * \return                  False if the batch could not be created
+ */
+static bool benchmarkSpriteBatch( const HeadlessOptions& options,
+                                  bool allowInstancing )
+{
+    SpriteBatch batch;
+
+    if (! createSpriteBatch( &batch, allowInstancing ) )
+    {
+        return false;
+    }
+
+    const char * mode = batch.isInstanced() ? "instanced" : "expanded";
+    bool hasTimers    = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+
+    std::vector<Sprite> sprites;
+    std::vector<GLuint> queries( options.frameCount, 0 );
+
+    if ( hasTimers )
+    {
+        glGenQueries( options.frameCount, &queries[0] );
+    }
+
+    const size_t stepCount = sizeof( SPRITE_BENCHMARK_COUNTS ) /
+                             sizeof( SPRITE_BENCHMARK_COUNTS[0] );
+
+    for ( size_t step = 0; step < stepCount; ++step )
+    {
+        size_t spriteCount = SPRITE_BENCHMARK_COUNTS[step];
+        scatterSprites( spriteCount, &sprites );
+
+        std::vector<double> cpuTimes;
+        cpuTimes.reserve( options.frameCount );
+
+        for ( int frame = 0; frame < HEADLESS_WARMUP_FRAMES; ++frame )
+        {
+            batch.begin();
+
+            for ( size_t i = 0; i < spriteCount; ++i )
+            {
+                batch.add( sprites[i] );
+            }
+
+            drawSpriteBatch( &batch );
+            glFlush();
+            batch.endFrame();
+        }
+
+        glFinish();
+        double stepStart = currentTimeMs();
+
+        for ( int frame = 0; frame < options.frameCount; ++frame )
+        {
+            // Offset each sprite's fade so they don't all pulse together
+            float seconds = static_cast<float>( frame ) * HEADLESS_FRAME_STEP;
+
+            for ( size_t i = 0; i < spriteCount; ++i )
+            {
+                sprites[i].fade = fadeFactorAt( seconds + sprites[i].rotation );
+            }
+
+            glClearColor( 1.0f, 1.0f, 1.0f, 1.0f );
+            glClear( GL_COLOR_BUFFER_BIT );
+
+            if ( hasTimers )
+            {
+                glBeginQuery( GL_TIME_ELAPSED, queries[frame] );
+            }
+
+            double frameStart = currentTimeMs();
+
+            batch.begin();
+
+            for ( size_t i = 0; i < spriteCount; ++i )
+            {
+                batch.add( sprites[i] );
+            }
+
+            drawSpriteBatch( &batch );
+            cpuTimes.push_back( currentTimeMs() - frameStart );
+
+            if ( hasTimers )
+            {
+                glEndQuery( GL_TIME_ELAPSED );
+            }
+
+            glFlush();
+            batch.endFrame();
+            GProfiler.endFrame();
+        }
+
+        glFinish();
+        double stepTime = currentTimeMs() - stepStart;
+
+        std::ostringstream label;
+        label << mode << " " << spriteCount;
+
+        SampleSummary cpu = summarizeSamples( cpuTimes );
+        printSummary( label.str() + " cpu (ms)", cpu );
+
+        double gpuMedian = 0.0;
+
+        if ( hasTimers )
+        {
+            size_t dropped = 0;
+            std::vector<double> gpuTimes = readGpuFrameTimes( queries, stepTime, &dropped );
+
+            gpuMedian = printGpuFrameTimes( label.str() + " gpu (ms)",
+                                            gpuTimes,
+                                            dropped ).median;
+        }
+
+        // Throughput is limited by whichever side is slower
+        double frameMs = std::max( cpu.median, gpuMedian );
+
+        std::cout << label.str() << ": " << batch.drawCallCount()
+                  << " draw calls, "
+                  << ( spriteCount / std::max( frameMs, 1e-6 ) / 1000.0 )
+                  << " million sprites/s" << std::endl;
+    }
+
+    if ( batch.stream().isCreated() )
+    {
+        std::cout << mode << " stream buffer: "
+                  << ( batch.stream().isPersistent() ? "persistent" : "orphaned" )
+                  << ", " << batch.stream().wrapCount() << " wraps, "
+                  << batch.stream().stallCount() << " stalls" << std::endl;
+    }
+
+    if ( hasTimers )
+    {
+        glDeleteQueries( options.frameCount, &queries[0] );
+    }
+
+    batch.destroy();
+    return true;
+}
+
+/**
+ * Times the sprite batcher with instancing (when the context supports it) and
+ * with the CPU expanded fallback, over a range of sprite counts
+ *
+ * \param  options  Settings for the run
+ * \return          True if every benchmark ran
+ */
+static bool runSpriteBenchmark( const HeadlessOptions& options )
+{
+    bool ok = true;
+
+    if ( SpriteBatch::isInstancingSupported() )
+    {
+        ok = benchmarkSpriteBatch( options, true );
+    }
+    else
+    {
+        std::cout << "Instancing not available, only timing the fallback"
+                  << std::endl;
+    }
+
+    return benchmarkSpriteBatch( options, false ) && ok;
+}
+
+/**
+ * Times uploading one image of the framebuffer's size, once per frame, as
+ * tightly packed 24-bit BGR and as 32-bit BGRA. Each upload is timed up to
+ * glFinish so any conversion the driver does is included. Expanding the
+ * pixels to 32-bit is timed with every swizzle kernel the CPU supports, so
+ * the cost of the expansion can be weighed against what it saves
+ *
+ * \param  options  Settings for the run
+ * \return          True if the benchmark ran
+ */
+static bool runUploadBenchmark( const HeadlessOptions& options )
+{
+    size_t pixelCount = static_cast<size_t>( options.width ) * options.height;
+
+    std::vector<unsigned char> bgr( pixelCount * 3 );
+    std::vector<unsigned char> bgra( pixelCount * 4 );
+    std::vector<unsigned char> expected( pixelCount * 4 );
+
+    std::mt19937 random( 1234 );
+
+    for ( size_t i = 0; i < bgr.size(); ++i )
+    {
+        bgr[i] = static_cast<unsigned char>( random() );
+    }
+
+    expandBgrToBgraWith( SWIZZLE_SCALAR, &bgr[0], &expected[0], pixelCount );
+
+    double expandMedian = 0.0;
+
+    for ( int kernel = SWIZZLE_SCALAR; kernel <= SWIZZLE_AVX2; ++kernel )
+    {
+        SwizzleKernel swizzle = static_cast<SwizzleKernel>( kernel );
+
+        if (! isSwizzleKernelSupported( swizzle ) )
+        {
+            continue;
+        }
+
+        std::vector<double> times;
+
+        for ( int frame = 0; frame < options.frameCount; ++frame )
+        {
+            double start = currentTimeMs();
+            expandBgrToBgraWith( swizzle, &bgr[0], &bgra[0], pixelCount );
+            times.push_back( currentTimeMs() - start );
+        }
+
+        if ( bgra != expected )
+        {
+            std::cerr << swizzleKernelName( swizzle ) << " swizzle kernel "
+                      << "doesn't match the scalar kernel" << std::endl;
+            return false;
+        }
+
+        SampleSummary summary = summarizeSamples( times );
+        printSummary( std::string( "expand " ) + swizzleKernelName( swizzle ) + " (ms)",
+                      summary );
+
+        if ( swizzle == bestSwizzleKernel() )
+        {
+            expandMedian = summary.median;
+        }
+    }
+
+    GLuint texture;
+    glGenTextures( 1, &texture );
+    GStateCache.bindTexture( 0, GL_TEXTURE_2D, texture );
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    const PixelFormat FORMATS[] = { PIXEL_FORMAT_BGR8, PIXEL_FORMAT_BGRA8 };
+    double uploadMedians[2]     = { 0.0, 0.0 };
+
+    for ( size_t i = 0; i < 2; ++i )
+    {
+        PixelFormat format          = FORMATS[i];
+        const unsigned char * pData = ( format == PIXEL_FORMAT_BGR8 ? &bgr[0] : &bgra[0] );
+
+        // Storage is allocated up front so only the transfer is timed
+        glTexImage2D( GL_TEXTURE_2D, 0, textureInternalFormat( format ),
+                      options.width, options.height, 0,
+                      textureFormat( format ), GL_UNSIGNED_BYTE, NULL );
+        glPixelStorei( GL_UNPACK_ALIGNMENT,
+                       unpackAlignment( options.width * bytesPerPixel( format ) ) );
+        glFinish();
+
+        std::vector<double> times;
+
+        for ( int frame = 0; frame < options.frameCount; ++frame )
+        {
+            double start = currentTimeMs();
+            glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, options.width, options.height,
+                             textureFormat( format ), GL_UNSIGNED_BYTE, pData );
+            glFinish();
+            times.push_back( currentTimeMs() - start );
+        }
+
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+        SampleSummary summary = summarizeSamples( times );
+        printSummary( format == PIXEL_FORMAT_BGR8 ? "upload bgr (ms)" : "upload bgra (ms)",
+                      summary );
+        uploadMedians[i] = summary.median;
+    }
+
+    glDeleteTextures( 1, &texture );
+
+    // GL reuses names, so the cache must not think it is still bound
+    GStateCache.invalidate();
+
+    std::cout << options.width << "x" << options.height << ": expanding to BGRA ("
+              << swizzleKernelName( bestSwizzleKernel() ) << ") costs "
+              << expandMedian << " ms and saves "
+              << ( uploadMedians[0] - uploadMedians[1] ) << " ms per upload, "
+              << "driver " << ( prefersBgraUploads() ? "prefers" : "doesn't prefer" )
+              << " 32-bit uploads" << std::endl;
+
+    return true;
+}
+
+/**
+ * Loads the scene and renders a fixed number of frames into an offscreen
+ * framebuffer. The fade factor follows the same deterministic sequence on
+ * every run so that timings (and the final image) are comparable between
+ * builds.
+ *
+ * CPU time is the time taken to submit a frame's commands. GPU time comes from
+ * GL_TIME_ELAPSED queries, which are only read back once all frames have been
+ * submitted so that they never stall the pipeline.
+ *
+ * \param  options  Settings for the run
+ * \return          Process exit code
+ */
+int runHeadless( const HeadlessOptions& options )
+{
+    HeadlessContext context;
+
+    if (! createHeadlessContext( options.width, options.height, &context ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Renderer: " << glGetString( GL_RENDERER ) << std::endl;
+
+    if ( enableDebugOutput() )
+    {
+        std::cout << "Reporting OpenGL errors with debug output" << std::endl;
+    }
+
+    if (! GLEW_VERSION_2_0 )
+    {
+        std::cerr << "OpenGL 2.0 not available" << std::endl;
+        destroyHeadlessContext( &context );
+        return EXIT_FAILURE;
+    }
+
+    if (! loadResources( options.textureMode ) )
+    {
+        std::cerr << "Failed to load resources" << std::endl;
+        destroyHeadlessContext( &context );
+        return EXIT_FAILURE;
+    }
+
+    // Every frame should draw the real images, not the loading placeholders
+    double loadStart = currentTimeMs();
+    finishLoadingResources();
+    std::cout << "Resources finished loading in "
+              << ( currentTimeMs() - loadStart ) << " ms" << std::endl;
+
+    if ( options.spriteBenchmark || options.uploadBenchmark )
+    {
+        bool ok = options.spriteBenchmark ? runSpriteBenchmark( options )
+                                          : runUploadBenchmark( options );
+        ok = ok && !checkGlFailure( "after benchmark" );
+
+        if ( ok && !options.outputFile.empty() )
+        {
+            ok = saveFramebuffer( context, options.outputFile );
+        }
+
+        releaseResources();
+        GBufferArenas.releaseGpuResources();
+        GProfiler.releaseGpuResources();
+        destroyHeadlessContext( &context );
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    setSceneZoom( options.zoom );
+
+    if ( options.entityCount > 0 && !createSceneEntities( options.entityCount ) )
+    {
+        releaseResources();
+        GBufferArenas.releaseGpuResources();
+        GProfiler.releaseGpuResources();
+        destroyHeadlessContext( &context );
+        return EXIT_FAILURE;
+    }
+
+    // One timer query per frame. GL_TIME_ELAPSED queries can't be nested,
+    // but the profiler's GPU scopes inside drawScene() use GL_TIMESTAMP
+    // counters, which can be issued while one is active
+    bool hasTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    std::vector<GLuint> queries( options.frameCount, 0 );
+
+    if ( hasTimers )
+    {
+        glGenQueries( options.frameCount, &queries[0] );
+    }
+
+    std::vector<double> cpuTimes;
+    cpuTimes.reserve( options.frameCount );
+
+    CullStats cullTotals;
+
+    for ( int frame = 0; frame < HEADLESS_WARMUP_FRAMES; ++frame )
+    {
+        updateScene( 0.0f );
+        drawScene();
+        glFlush();
+        GProfiler.endFrame();
+    }
+
+    glFinish();
+
+    // Only count the state changes made while rendering frames
+    GStateCache.resetCounters();
+
+    double runStart = currentTimeMs();
+
+    for ( int frame = 0; frame < options.frameCount; ++frame )
+    {
+        updateScene( static_cast<float>( frame ) * HEADLESS_FRAME_STEP );
+
+        if ( hasTimers )
+        {
+            glBeginQuery( GL_TIME_ELAPSED, queries[frame] );
+        }
+
+        double frameStart = currentTimeMs();
+        drawScene();
+        cpuTimes.push_back( currentTimeMs() - frameStart );
+
+        const CullStats& cull = sceneCullStats();
+        cullTotals.visibleCount  += cull.visibleCount;
+        cullTotals.culledCount   += cull.culledCount;
+        cullTotals.objectsTested += cull.objectsTested;
+
+        if ( hasTimers )
+        {
+            glEndQuery( GL_TIME_ELAPSED );
+        }
+
+        // Stand in for the buffer swap so the driver doesn't batch up an
+        // unbounded amount of work
+        glFlush();
+        GProfiler.endFrame();
+    }
+
+    glFinish();
+    double runTime = currentTimeMs() - runStart;
+
+    printSummary( "cpu frame time (ms)", summarizeSamples( cpuTimes ) );
+
+    if ( hasTimers )
+    {
+        size_t dropped = 0;
+        std::vector<double> gpuTimes = readGpuFrameTimes( queries, runTime, &dropped );
+
+        glDeleteQueries( options.frameCount, &queries[0] );
+        printGpuFrameTimes( "gpu frame time (ms)", gpuTimes, dropped );
+    }
+    else
+    {
+        std::cout << "Timer queries not available, skipping GPU times" << std::endl;
+    }
+
+    std::cout << options.frameCount << " frames in " << runTime << " ms ("
+              << ( options.frameCount * 1000.0 / runTime ) << " fps)" << std::endl;
+
+    if ( options.entityCount > 0 )
+    {
+        std::cout << "Entities per frame: "
+                  << cullTotals.visibleCount / options.frameCount << " drawn, "
+                  << cullTotals.culledCount / options.frameCount << " culled, "
+                  << cullTotals.objectsTested / options.frameCount
+                  << " tested one by one" << std::endl;
+    }
+
+    GStateCache.printCounters();
+    GBufferArenas.printStats();
+    GProfiler.printStats();
+
+    if (! options.traceFile.empty() &&
+        GProfiler.writeChromeTrace( options.traceFile ) )
+    {
+        std::cout << "Wrote trace to " << options.traceFile << std::endl;
+    }
+
+    bool ok = !checkGlFailure( "after headless run" );
+
+    if ( ok && !options.outputFile.empty() )
+    {
+        ok = saveFramebuffer( context, options.outputFile );
+    }
+
+    if ( ok && options.validate )
+    {
+        float lastFrame = static_cast<float>( options.frameCount - 1 );
+        ok = validateFramebuffer( context,
+                                  options.textureMode,
+                                  fadeFactorAt( lastFrame * HEADLESS_FRAME_STEP ) );
+    }
+
+    releaseResources();
+    GBufferArenas.releaseGpuResources();
+    GProfiler.releaseGpuResources();
+    destroyHeadlessContext( &context );
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_HEADLESS_H
+#define SCOTT_GFXSANDBOX_HEADLESS_H
+
+#include "gfxsandbox.h"
+#include <string>
+#include <GL/glew.h>
+
+/**
+ * Settings for a headless benchmark run
+ */
+struct HeadlessOptions
+{
+    HeadlessOptions()
+        : frameCount( 300 ),
+          width( 640 ),
+          height( 480 ),
+          outputFile(),
+          validate( false ),
+          traceFile(),
+          spriteBenchmark( false ),
+          uploadBenchmark( false ),
+          entityCount( 0 ),
+          zoom( 1.0f ),
+          textureMode( SCENE_TEXTURES_SEPARATE )
+    {
+    }
+
+    int frameCount;             // number of frames to render
+    int width;                  // width of the offscreen framebuffer
+    int height;                 // height of the offscreen framebuffer
+    std::string outputFile;     // if not empty, final frame is saved here
+    bool validate;              // compare final frame to the CPU crossfade
+    std::string traceFile;      // if not empty, Chrome trace is saved here
+    bool spriteBenchmark;       // time sprite batches instead of the scene
+    bool uploadBenchmark;       // time 24 vs 32-bit uploads instead of the scene
+    size_t entityCount;         // animated sprites drawn on top of the scene
+    float zoom;                 // how far the view of the entities zooms in
+    SceneTextureMode textureMode;   // how the scene's images are stored
+};
+
+/**
+ * An OpenGL context that renders into an offscreen framebuffer object rather
+ * than a window. The EGL handles are stored as untyped pointers so that users
+ * of this header don't have to pull in the EGL headers
+ */
+struct HeadlessContext
+{
+    HeadlessContext()
+        : display( NULL ),
+          context( NULL ),
+          surface( NULL ),
+          framebuffer( 0 ),
+          colorBuffer( 0 ),
+          width( 0 ),
+          height( 0 )
+    {
+    }
+
+    void * display;
+    void * context;
+    void * surface;
+    GLuint framebuffer;
+    GLuint colorBuffer;
+    int width;
+    int height;
+};
+
+// Create a windowless OpenGL context that renders into a framebuffer object
+bool createHeadlessContext( int width, int height, HeadlessContext * pContext );
+
+// Destroy a context created with createHeadlessContext
+void destroyHeadlessContext( HeadlessContext * pContext );
+
+// Parse headless command line arguments. Returns false on bad arguments
+bool parseHeadlessOptions( int argc, char** argv, HeadlessOptions * pOptions );
+
+// Render frames offscreen without a window and report timings
+int runHeadless( const HeadlessOptions& options );
+
+#endif
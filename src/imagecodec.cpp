@@ -0,0 +1,267 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "imagecodec.h"
+#include "assetpack.h"
+#include "qoi.h"
+#include "util.h"
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static bool qoiMatches( const unsigned char * pData, size_t size )
+{
+    return isQoiData( pData, size );
+}
+
+static bool qoiParseHeader( const unsigned char * pData,
+                            size_t size,
+                            const char * name,
+                            ImageHeader * pHeader )
+{
+    QoiInfo info;
+
+    if (! parseQoiHeader( pData, size, name, &info ) )
+    {
+        return false;
+    }
+
+    pHeader->width          = info.width;
+    pHeader->height         = info.height;
+    pHeader->format         = info.format;
+    pHeader->rawPixelOffset = IMAGE_NO_RAW_PIXELS;
+
+    return true;
+}
+
+static bool qoiDecodePixels( const unsigned char * pData,
+                             size_t size,
+                             const ImageHeader& header,
+                             PixelFormat format,
+                             unsigned char * pDest )
+{
+    QoiInfo info;
+    info.width  = header.width;
+    info.height = header.height;
+    info.format = header.format;
+
+    return decodeQoiPixels( pData, size, info, format, pDest );
+}
+
+/**
+ * Tga files have no magic bytes, so the only way to recognise one is to see
+ * if its header makes sense. That makes tga the codec of last resort
+ */
+static bool tgaMatches( const unsigned char * pData, size_t size )
+{
+    return isTgaData( pData, size );
+}
+
+static bool tgaParseHeader( const unsigned char * pData,
+                            size_t size,
+                            const char * name,
+                            ImageHeader * pHeader )
+{
+    TgaInfo info;
+
+    if (! parseTgaHeader( pData, size, name, &info ) )
+    {
+        return false;
+    }
+
+    pHeader->width          = info.width;
+    pHeader->height         = info.height;
+    pHeader->format         = info.format;
+    pHeader->rawPixelOffset = ( info.isRle || info.isTopDown ) ? IMAGE_NO_RAW_PIXELS
+                                                               : info.pixelOffset;
+
+    return true;
+}
+
+static bool tgaDecodePixels( const unsigned char * pData,
+                             size_t size,
+                             const ImageHeader& header,
+                             PixelFormat format,
+                             unsigned char * pDest )
+{
+    TgaInfo info;
+
+    if (! parseTgaHeader( pData, size, "tga image", &info ) )
+    {
+        return false;
+    }
+
+    assert( info.width == header.width && info.height == header.height );
+
+    return ( format == info.format ) ? decodeTgaPixels( pData, size, info, pDest )
+                                     : decodeTgaPixelsAsBgra( pData, size, info, pDest );
+}
+
+/**
+ * Builds the list of built in codecs, most specific first. Formats with
+ * magic bytes come before tga, which would otherwise claim anything with a
+ * plausible looking header
+ */
+static std::vector<ImageCodec> builtinCodecs()
+{
+    ImageCodec qoi = { "qoi", qoiMatches, qoiParseHeader, qoiDecodePixels };
+    ImageCodec tga = { "tga", tgaMatches, tgaParseHeader, tgaDecodePixels };
+
+    std::vector<ImageCodec> codecs;
+    codecs.push_back( qoi );
+    codecs.push_back( tga );
+
+    return codecs;
+}
+
+/**
+ * Returns the list of codecs. The list is built during static
+ * initialisation of the local, which the compiler makes thread safe, so
+ * images can be loaded from several threads at once
+ */
+static std::vector<ImageCodec>& imageCodecs()
+{
+    static std::vector<ImageCodec> codecs = builtinCodecs();
+    return codecs;
+}
+
+/**
+ * Adds a codec for another image format. Codecs added later are checked
+ * first, and all of them are checked before the built in ones.
+ *
+ * This changes the list that loaders read without a lock, so it must only be
+ * called before any images are loaded, i.e. before the texture loader or the
+ * atlas builder start their worker threads
+ */
+void registerImageCodec( const ImageCodec& codec )
+{
+    assert( codec.matches != NULL && codec.parseHeader != NULL &&
+            codec.decodePixels != NULL );
+
+    std::vector<ImageCodec>& codecs = imageCodecs();
+    codecs.insert( codecs.begin(), codec );
+}
+
+/**
+ * Finds the codec for an image file by looking at its first bytes
+ *
+ * \param  pData  Start of the file
+ * \param  size   Size of the file in bytes
+ * \return        The codec, or NULL if no codec recognises the file
+ */
+const ImageCodec * findImageCodec( const unsigned char * pData, size_t size )
+{
+    const std::vector<ImageCodec>& codecs = imageCodecs();
+
+    for ( size_t i = 0; i < codecs.size(); ++i )
+    {
+        if ( codecs[i].matches( pData, size ) )
+        {
+            return &codecs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Memory maps an image file and reads its header with whichever codec
+ * recognises it
+ *
+ * \param  filename  Path to the image
+ * \param  pFile     Receives the mapped file
+ * \param  ppCodec   Receives the codec that decodes the file
+ * \param  pHeader   Receives the image's size and format
+ * \return           True if the file is an image we can decode
+ */
+bool openImageFile( const std::string& filename,
+                    MappedFile * pFile,
+                    const ImageCodec ** ppCodec,
+                    ImageHeader * pHeader )
+{
+    assert( pFile != NULL && ppCodec != NULL && pHeader != NULL );
+
+    if (! pFile->open( filename ) )
+    {
+        fprintf( stderr, "Unable to open %s for reading\n", filename.c_str() );
+        return false;
+    }
+
+    *ppCodec = findImageCodec( pFile->data(), pFile->size() );
+
+    if ( *ppCodec == NULL )
+    {
+        fprintf( stderr, "%s is not an image format we can decode\n", filename.c_str() );
+        return false;
+    }
+
+    return (*ppCodec)->parseHeader( pFile->data(), pFile->size(), filename.c_str(), pHeader );
+}
+
+/**
+ * Loads an image in any format that has a codec. Images in the asset pack
+ * are already decoded, and files that store their pixels the way Image does
+ * are used straight from the mapping. Anything else is decoded into the
+ * image's buffer
+ *
+ * \param  filename  Path to the image
+ * \param  pImage    Receives the image
+ * \return           True if the image was loaded
+ */
+bool loadImageFile( const std::string& filename, Image * pImage )
+{
+    assert( pImage != NULL );
+
+    if ( GAssetPack.loadImage( filename, pImage ) )
+    {
+        return true;
+    }
+
+    std::shared_ptr<MappedFile> file( new MappedFile );
+    const ImageCodec * pCodec = NULL;
+    ImageHeader header;
+
+    if (! openImageFile( filename, file.get(), &pCodec, &header ) )
+    {
+        return false;
+    }
+
+    Image image;
+    image.width  = header.width;
+    image.height = header.height;
+    image.format = header.format;
+
+    if ( header.rawPixelOffset != IMAGE_NO_RAW_PIXELS &&
+         file->size() - header.rawPixelOffset >= image.size() )
+    {
+        image.mapping       = file;
+        image.mappingOffset = header.rawPixelOffset;
+    }
+    else
+    {
+        image.buffer.resize( image.size() );
+
+        if (! pCodec->decodePixels( file->data(), file->size(), header,
+                                    image.format, &image.buffer[0] ) )
+        {
+            fprintf( stderr, "%s has incomplete image\n", filename.c_str() );
+            return false;
+        }
+    }
+
+    std::swap( *pImage, image );
+    return true;
+}
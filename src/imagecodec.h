@@ -0,0 +1,93 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_IMAGECODEC_H
+#define SCOTT_GFXSANDBOX_IMAGECODEC_H
+
+#include "tga.h"
+#include <cstddef>
+#include <string>
+
+class MappedFile;
+
+// Marks a header whose pixels can't be used straight from the file
+const size_t IMAGE_NO_RAW_PIXELS = static_cast<size_t>( -1 );
+
+/**
+ * What a codec found in an image file's header
+ */
+struct ImageHeader
+{
+    ImageHeader()
+        : width( 0 ),
+          height( 0 ),
+          format( PIXEL_FORMAT_BGR8 ),
+          rawPixelOffset( IMAGE_NO_RAW_PIXELS )
+    {
+    }
+
+    int width;
+    int height;
+    PixelFormat format;
+
+    // Offset of the pixels in the file if they are already stored the way
+    // Image wants them (tightly packed, bottom row first), so that they can
+    // be used without decoding
+    size_t rawPixelOffset;
+};
+
+/**
+ * A decoder for one image file format. Codecs are picked by looking at the
+ * first bytes of a file rather than at its name
+ */
+struct ImageCodec
+{
+    const char * name;
+
+    // Check if a file looks like this format
+    bool (*matches)( const unsigned char * pData, size_t size );
+
+    // Parse and validate the header, printing errors against the given name
+    bool (*parseHeader)( const unsigned char * pData,
+                         size_t size,
+                         const char * name,
+                         ImageHeader * pHeader );
+
+    // Decode every pixel into a buffer, bottom row first. The format is
+    // either the header's, or BGRA8 to expand a BGR8 image on the way
+    bool (*decodePixels)( const unsigned char * pData,
+                          size_t size,
+                          const ImageHeader& header,
+                          PixelFormat format,
+                          unsigned char * pDest );
+};
+
+// Add a codec, checked before the built in ones. Not thread safe, so
+// register codecs before any images are loaded
+void registerImageCodec( const ImageCodec& codec );
+
+// Find the codec that can decode a file, or NULL
+const ImageCodec * findImageCodec( const unsigned char * pData, size_t size );
+
+// Map an image file, find its codec and parse its header
+bool openImageFile( const std::string& filename,
+                    MappedFile * pFile,
+                    const ImageCodec ** ppCodec,
+                    ImageHeader * pHeader );
+
+// Load an image of any registered format, avoiding copies when possible
+bool loadImageFile( const std::string& filename, Image * pImage );
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "jobsystem.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cassert>
+
+/**
+ * Starts the worker threads. They sleep until there is work
+ *
+ * \param  threadCount  Threads that run jobs, including the caller of
+ *                      parallelFor. Zero uses one per core
+ */
+JobSystem::JobSystem( size_t threadCount )
+    : mQueues(),
+      mThreads(),
+      mWakeMutex(),
+      mWake(),
+      mQueuedJobs( 0 ),
+      mUnfinishedJobs( 0 ),
+      mStealCount( 0 ),
+      mIsStopping( false )
+{
+    if ( threadCount == 0 )
+    {
+        threadCount = hardwareThreadCount();
+    }
+
+    for ( size_t i = 0; i < threadCount; ++i )
+    {
+        mQueues.push_back( std::unique_ptr<JobQueue>( new JobQueue ) );
+    }
+
+    for ( size_t i = 1; i < threadCount; ++i )
+    {
+        mThreads.push_back( std::thread( &JobSystem::workerMain, this, i ) );
+    }
+}
+
+/**
+ * Stops the worker threads. There can't be a loop running, since
+ * parallelFor doesn't return until its jobs are done
+ */
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock( mWakeMutex );
+        mIsStopping = true;
+    }
+
+    mWake.notify_all();
+
+    for ( size_t i = 0; i < mThreads.size(); ++i )
+    {
+        mThreads[i].join();
+    }
+}
+
+/**
+ * Runs a loop across every thread. The calling thread runs jobs too, and
+ * only returns once every chunk has finished
+ *
+ * \param  count      Number of items in the loop
+ * \param  chunkSize  Items per job. Larger chunks cost less to hand out,
+ *                    smaller ones balance better
+ * \param  func       Called with the [begin, end) range of each chunk
+ */
+void JobSystem::parallelFor( size_t count, size_t chunkSize, const RangeFunc& func )
+{
+    assert( mUnfinishedJobs.load() == 0 && "parallelFor is not reentrant" );
+
+    chunkSize       = std::max<size_t>( chunkSize, 1 );
+    size_t jobCount = ( count + chunkSize - 1 ) / chunkSize;
+
+    // Not worth waking anyone for
+    if ( jobCount <= 1 || mQueues.size() == 1 )
+    {
+        for ( size_t begin = 0; begin < count; begin += chunkSize )
+        {
+            func( begin, std::min( begin + chunkSize, count ) );
+        }
+
+        return;
+    }
+
+    mUnfinishedJobs += jobCount;
+
+    // Each thread gets a contiguous run of chunks, so that with even work
+    // nothing needs to be stolen and every thread streams through its own
+    // part of the arrays
+    size_t queueCount = mQueues.size();
+
+    for ( size_t q = 0; q < queueCount; ++q )
+    {
+        size_t first = jobCount * q / queueCount;
+        size_t last  = jobCount * ( q + 1 ) / queueCount;
+
+        std::lock_guard<std::mutex> lock( mQueues[q]->mutex );
+
+        // Pushed in reverse so the owner, which pops from the back, works
+        // through its run from the start
+        for ( size_t j = last; j > first; --j )
+        {
+            Job job;
+            job.pFunc = &func;
+            job.begin = ( j - 1 ) * chunkSize;
+            job.end   = std::min( job.begin + chunkSize, count );
+
+            mQueues[q]->jobs.push_back( job );
+        }
+
+        mQueuedJobs += last - first;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( mWakeMutex );
+    }
+
+    mWake.notify_all();
+
+    // Help out until every job has finished, including ones still running
+    // on other threads
+    while ( mUnfinishedJobs.load() > 0 )
+    {
+        Job job;
+
+        if ( findJob( 0, &job ) )
+        {
+            runJob( job );
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * Takes a job from a thread's own queue, or failing that steals one from
+ * another thread's queue
+ *
+ * \param  queue  Index of the thread's own queue
+ * \param  pJob   Receives the job
+ * \return        True if a job was found
+ */
+bool JobSystem::findJob( size_t queue, Job * pJob )
+{
+    if ( mQueuedJobs.load() == 0 )
+    {
+        return false;
+    }
+
+    {
+        JobQueue& own = *mQueues[queue];
+        std::lock_guard<std::mutex> lock( own.mutex );
+
+        if (! own.jobs.empty() )
+        {
+            *pJob = own.jobs.back();
+            own.jobs.pop_back();
+            --mQueuedJobs;
+
+            return true;
+        }
+    }
+
+    // Steal from the opposite end to the owner, which is the work it would
+    // get to last
+    for ( size_t i = 1; i < mQueues.size(); ++i )
+    {
+        JobQueue& victim = *mQueues[( queue + i ) % mQueues.size()];
+        std::lock_guard<std::mutex> lock( victim.mutex );
+
+        if (! victim.jobs.empty() )
+        {
+            *pJob = victim.jobs.front();
+            victim.jobs.pop_front();
+            --mQueuedJobs;
+            ++mStealCount;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Runs a job and marks it as finished
+ */
+void JobSystem::runJob( const Job& job )
+{
+    ( *job.pFunc )( job.begin, job.end );
+    --mUnfinishedJobs;
+}
+
+/**
+ * Worker thread loop. Runs jobs while there are any, and sleeps otherwise
+ */
+void JobSystem::workerMain( size_t queue )
+{
+    for (;;)
+    {
+        Job job;
+
+        if ( findJob( queue, &job ) )
+        {
+            runJob( job );
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( mWakeMutex );
+
+        mWake.wait( lock, [this]()
+        {
+            return mIsStopping || mQueuedJobs.load() > 0;
+        } );
+
+        if ( mIsStopping )
+        {
+            return;
+        }
+    }
+}
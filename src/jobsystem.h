@@ -0,0 +1,99 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_JOBSYSTEM_H
+#define SCOTT_GFXSANDBOX_JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Size of a cache line on the CPUs we care about
+const size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * A fixed set of worker threads that run chunks of data parallel loops.
+ *
+ * parallelFor() splits the loop into jobs and deals out a contiguous run of
+ * them to every thread's queue, the calling thread included. Each thread
+ * works through its own queue from the back, and once it runs dry steals
+ * jobs from the front of the other queues, so uneven chunks balance out
+ * without a shared queue that every thread contends on.
+ *
+ * Unlike the parallelFor in parallel.h the threads are started once and
+ * then sleep between loops, so it is cheap enough to use every frame.
+ * parallelFor must only be called from one thread at a time, and not from
+ * inside a job.
+ */
+class JobSystem
+{
+public:
+    typedef std::function<void( size_t, size_t )> RangeFunc;
+
+    // Start threadCount - 1 workers, or one per core if threadCount is zero
+    explicit JobSystem( size_t threadCount = 0 );
+    ~JobSystem();
+
+    // Threads that run jobs, including the one that calls parallelFor
+    size_t threadCount() const { return mQueues.size(); }
+
+    // Call func( begin, end ) over [0, count) in chunks, and wait for all of them
+    void parallelFor( size_t count, size_t chunkSize, const RangeFunc& func );
+
+    // Number of jobs that ran on a thread other than the one they were dealt to
+    uint64_t stealCount() const { return mStealCount.load(); }
+
+private:
+    JobSystem( const JobSystem& );
+    JobSystem& operator = ( const JobSystem& );
+
+    struct Job
+    {
+        const RangeFunc * pFunc;
+        size_t begin;
+        size_t end;
+    };
+
+    // Queues are locked by different threads. The padding keeps the next
+    // queue's allocation off the lines this one uses
+    struct JobQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        char padding[CACHE_LINE_SIZE];
+    };
+
+    bool findJob( size_t queue, Job * pJob );
+    void runJob( const Job& job );
+    void workerMain( size_t queue );
+
+    std::vector<std::unique_ptr<JobQueue> > mQueues;    // 0 is the caller's
+    std::vector<std::thread> mThreads;
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    std::atomic<size_t> mQueuedJobs;        // waiting in a queue
+    std::atomic<size_t> mUnfinishedJobs;    // queued or running
+    std::atomic<uint64_t> mStealCount;
+    bool mIsStopping;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "linearallocator.h"
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <stdint.h>
+
+/**
+ * Creates an empty allocator. No memory is reserved until the first
+ * allocation
+ *
+ * \param  blockSize  Size of each block. Larger allocations get a block of
+ *                    their own
+ */
+LinearAllocator::LinearAllocator( size_t blockSize )
+    : mBlocks(),
+      mBlockSize( blockSize ),
+      mCurrentBlock( 0 ),
+      mOffset( 0 ),
+      mUsedBytes( 0 ),
+      mCapacity( 0 )
+{
+    assert( blockSize > 0 );
+}
+
+/**
+ * Reserves memory from the current block, moving on to the next block that
+ * is big enough (and creating it if need be) when it doesn't fit
+ *
+ * \param  size       Number of bytes to reserve
+ * \param  alignment  Alignment of the returned pointer, a power of two
+ * \return            Pointer to the reserved memory, valid until reset()
+ */
+void * LinearAllocator::allocate( size_t size, size_t alignment )
+{
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+
+    for (;;)
+    {
+        if ( mCurrentBlock < mBlocks.size() )
+        {
+            Block& block     = mBlocks[mCurrentBlock];
+            uintptr_t base   = reinterpret_cast<uintptr_t>( block.data.get() );
+            uintptr_t start  = ( base + mOffset + alignment - 1 ) & ~( alignment - 1 );
+            size_t end       = static_cast<size_t>( start - base ) + size;
+
+            if ( end <= block.size )
+            {
+                mOffset     = end;
+                mUsedBytes += size;
+
+                return reinterpret_cast<void*>( start );
+            }
+        }
+
+        // Move on to the first unused block that is big enough, making one if
+        // there isn't any. Blocks after the current one are all unused, so
+        // they can be reordered freely
+        size_t next  = mBlocks.empty() ? 0 : mCurrentBlock + 1;
+        size_t found = next;
+
+        while ( found < mBlocks.size() && mBlocks[found].size < size + alignment )
+        {
+            found++;
+        }
+
+        if ( found == mBlocks.size() )
+        {
+            Block block;
+            block.size = std::max( mBlockSize, size + alignment );
+            block.data.reset( new unsigned char[block.size] );
+
+            mCapacity += block.size;
+            mBlocks.push_back( std::move( block ) );
+        }
+
+        std::swap( mBlocks[next], mBlocks[found] );
+        mCurrentBlock = next;
+        mOffset       = 0;
+    }
+}
+
+/**
+ * Frees every allocation at once. The blocks are kept for reuse
+ */
+void LinearAllocator::reset()
+{
+    mCurrentBlock = 0;
+    mOffset       = 0;
+    mUsedBytes    = 0;
+}
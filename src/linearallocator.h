@@ -0,0 +1,91 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_LINEARALLOCATOR_H
+#define SCOTT_GFXSANDBOX_LINEARALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * Hands out memory by bumping a pointer through a list of fixed size blocks,
+ * and frees all of it at once with reset(). Blocks are kept across resets, so
+ * once the allocator has grown to fit a frame's data it stops allocating
+ * from the heap altogether.
+ *
+ * Nothing allocated here has its destructor run, so it is only meant for
+ * plain data. An allocator is not thread safe, give each thread its own.
+ */
+class LinearAllocator
+{
+public:
+    // Default size of each block
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit LinearAllocator( size_t blockSize = DEFAULT_BLOCK_SIZE );
+
+    // Reserve size bytes aligned to alignment, which must be a power of two
+    void * allocate( size_t size, size_t alignment );
+
+    // Reserve space for count default constructed objects of type T
+    template<typename T>
+    T * allocateArray( size_t count );
+
+    // Free everything allocated since the last reset
+    void reset();
+
+    // Bytes handed out since the last reset, not counting alignment padding
+    size_t usedBytes() const { return mUsedBytes; }
+
+    // Total size of the blocks owned by the allocator
+    size_t capacity() const { return mCapacity; }
+
+private:
+    LinearAllocator( const LinearAllocator& );
+    LinearAllocator& operator = ( const LinearAllocator& );
+
+    struct Block
+    {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> mBlocks;
+    size_t mBlockSize;
+    size_t mCurrentBlock;       // block that allocations come from
+    size_t mOffset;             // next free byte of the current block
+    size_t mUsedBytes;
+    size_t mCapacity;
+};
+
+/**
+ * Reserves space for an array of objects and constructs them in place
+ */
+template<typename T>
+T * LinearAllocator::allocateArray( size_t count )
+{
+    T * pArray = static_cast<T*>( allocate( sizeof( T ) * count, alignof( T ) ) );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        new ( pArray + i ) T();
+    }
+
+    return pArray;
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "gfxsandbox.h"
+#include "framescheduler.h"
+#include "glutil.h"
+#include "headless.h"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <GL/glew.h>
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
+#endif
+
+/**
+ * Checks if a flag was passed on the command line
+ */
+bool hasArgument( int argc, char** argv, const std::string& flag )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( flag == argv[i] )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the value following a flag on the command line, or NULL if the flag
+ * was not passed
+ */
+const char * argumentValue( int argc, char** argv, const std::string& flag )
+{
+    for ( int i = 1; i + 1 < argc; ++i )
+    {
+        if ( flag == argv[i] )
+        {
+            return argv[i + 1];
+        }
+    }
+
+    return NULL;
+}
+
+int main( int argc, char** argv )
+{
+    // Headless mode renders offscreen without ever touching GLUT, which would
+    // otherwise refuse to start on a machine without a display
+    if ( hasArgument( argc, argv, "--headless" ) )
+    {
+#ifdef GFXSANDBOX_HAS_EGL
+        HeadlessOptions options;
+
+        if (! parseHeadlessOptions( argc, argv, &options ) )
+        {
+            std::cerr << "Usage: " << argv[0] << " --headless [--frames N] "
+                      << "[--size WIDTHxHEIGHT] [--output frame.tga] [--validate] "
+                      << "[--trace trace.json] [--sprite-bench | --upload-bench] "
+                      << "[--entities N] [--zoom Z] "
+                      << "[--atlas | --texture-array | --compressed | --qoi]"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        return runHeadless( options );
+#else
+        std::cerr << "Headless mode requires EGL, which was not found when "
+                  << "gfxsandbox was built" << std::endl;
+        return EXIT_FAILURE;
+#endif
+    }
+
+    glutInit( &argc, argv );
+    glutInitDisplayMode( GLUT_RGB | GLUT_DOUBLE );
+    glutInitWindowSize( 640, 480 );
+
+#if defined( GFXSANDBOX_GL_ERROR_CHECKS ) && defined( GLUT_DEBUG )
+    // Drivers don't have to send debug output to a normal context
+    glutInitContextFlags( GLUT_DEBUG );
+#endif
+    glutCreateWindow( "Render Window" );
+    glutDisplayFunc( &render );
+    glutIdleFunc( &update );
+
+    glewInit();
+
+    if (! GLEW_VERSION_2_0 )
+    {
+        std::cerr << "OpenGL 2.0 not available" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Prefer the driver telling us about errors over polling glGetError
+    if ( enableDebugOutput() )
+    {
+        std::cout << "Reporting OpenGL errors with debug output" << std::endl;
+    }
+
+    // Let the buffer swap pace frames when vsync is available. Otherwise the
+    // scheduler sleeps between frames to hold the frame rate cap
+    bool vsync = false;
+
+    if ( hasArgument( argc, argv, "--no-vsync" ) )
+    {
+        setSwapInterval( 0 );
+    }
+    else
+    {
+        vsync = setSwapInterval( 1 );
+    }
+
+    const char * pFrameRate = argumentValue( argc, argv, "--fps" );
+
+    if ( pFrameRate != NULL )
+    {
+        GFrameScheduler.setMaxFrameRate( atof( pFrameRate ) );
+    }
+    else if ( vsync )
+    {
+        GFrameScheduler.setMaxFrameRate( 0.0 );
+    }
+
+    std::cout << "Vsync " << ( vsync ? "on" : "off" ) << std::endl;
+
+    SceneTextureMode textureMode = SCENE_TEXTURES_SEPARATE;
+
+    if ( hasArgument( argc, argv, "--atlas" ) )
+    {
+        textureMode = SCENE_TEXTURES_ATLAS;
+    }
+    else if ( hasArgument( argc, argv, "--texture-array" ) )
+    {
+        textureMode = SCENE_TEXTURES_ARRAY;
+    }
+    else if ( hasArgument( argc, argv, "--compressed" ) )
+    {
+        textureMode = SCENE_TEXTURES_COMPRESSED;
+    }
+    else if ( hasArgument( argc, argv, "--qoi" ) )
+    {
+        textureMode = SCENE_TEXTURES_QOI;
+    }
+
+    if (! loadResources( textureMode ) )
+    {
+        std::cerr << "Failed to load resources" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const char * pZoom = argumentValue( argc, argv, "--zoom" );
+
+    if ( pZoom != NULL && atof( pZoom ) > 0.0 )
+    {
+        setSceneZoom( static_cast<float>( atof( pZoom ) ) );
+    }
+
+    const char * pEntityCount = argumentValue( argc, argv, "--entities" );
+
+    if ( pEntityCount != NULL && !createSceneEntities( strtoul( pEntityCount, NULL, 10 ) ) )
+    {
+        return EXIT_FAILURE;
+    }
+
+    glutMainLoop();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,760 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mipmap.h"
+#include "parallel.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GFXSANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+// Directory generated mip chains are cached in. Empty disables caching
+static std::string GMipCacheDirectory = "mipcache";
+
+// Bump whenever the filters change, so old cached chains are ignored
+const uint32_t MIP_CACHE_VERSION = 1;
+
+// Half width of the Kaiser filter, in texels of the smaller level
+const float KAISER_RADIUS = 3.0f;
+
+// Shape of the Kaiser window. Larger is smoother with less ringing
+const double KAISER_ALPHA = 4.0;
+
+// Resolution of the linear to sRGB lookup table. Fine enough that the
+// steepest part of the curve (near black) is off by well under a unit
+const int LINEAR_TO_SRGB_STEPS = 16384;
+
+// Levels with fewer texels than this are filtered on a single thread
+const size_t PARALLEL_MIN_TEXELS = 16384;
+
+/**
+ * Conversions between sRGB encoded bytes and linear light. Filtering has to
+ * happen in linear light, otherwise every level gets a little darker than
+ * the one above it
+ */
+struct GammaTables
+{
+    GammaTables();
+
+    float toLinear[256];
+    unsigned char toSrgb[LINEAR_TO_SRGB_STEPS + 1];
+};
+
+GammaTables::GammaTables()
+{
+    for ( int i = 0; i < 256; ++i )
+    {
+        float value = i / 255.0f;
+        toLinear[i] = ( value <= 0.04045f ) ? value / 12.92f
+                                            : powf( ( value + 0.055f ) / 1.055f, 2.4f );
+    }
+
+    for ( int i = 0; i <= LINEAR_TO_SRGB_STEPS; ++i )
+    {
+        float value = static_cast<float>( i ) / LINEAR_TO_SRGB_STEPS;
+        float srgb  = ( value <= 0.0031308f ) ? value * 12.92f
+                                              : 1.055f * powf( value, 1.0f / 2.4f ) - 0.055f;
+
+        toSrgb[i] = static_cast<unsigned char>(
+            std::min( std::max( srgb * 255.0f + 0.5f, 0.0f ), 255.0f ) );
+    }
+}
+
+static const GammaTables& gammaTables()
+{
+    static const GammaTables tables;
+    return tables;
+}
+
+/**
+ * An image in linear light with four float channels per texel, in the same
+ * BGRA order as the 8-bit images. Opaque images get an alpha of 1
+ */
+struct LinearImage
+{
+    int width;
+    int height;
+    std::vector<float> texels;
+};
+
+/**
+ * The source texels that one output texel is made of. Weights for all the
+ * output texels live in one array, starting at weightOffset
+ */
+struct FilterTaps
+{
+    int first;
+    int count;
+    size_t weightOffset;
+};
+
+struct FilterTable
+{
+    std::vector<FilterTaps> taps;
+    std::vector<float> weights;
+};
+
+/**
+ * Zeroth order modified Bessel function of the first kind, which shapes the
+ * Kaiser window
+ */
+static double besselI0( double x )
+{
+    double sum  = 1.0;
+    double term = 1.0;
+
+    for ( int k = 1; k < 32 && term > sum * 1e-12; ++k )
+    {
+        term *= ( x * x ) / ( 4.0 * k * k );
+        sum  += term;
+    }
+
+    return sum;
+}
+
+/**
+ * Kaiser windowed sinc, with t measured in texels of the smaller level
+ */
+static double kaiserWeight( double t )
+{
+    if ( fabs( t ) >= KAISER_RADIUS )
+    {
+        return 0.0;
+    }
+
+    double sinc   = ( t == 0.0 ) ? 1.0 : sin( M_PI * t ) / ( M_PI * t );
+    double r      = t / KAISER_RADIUS;
+    double window = besselI0( KAISER_ALPHA * sqrt( 1.0 - r * r ) ) / besselI0( KAISER_ALPHA );
+
+    return sinc * window;
+}
+
+/**
+ * Works out the taps that shrink one dimension from sourceSize to destSize
+ * texels. Sizes don't need to be powers of two: when an odd size is halved
+ * every output texel covers a little more than two source texels, and the
+ * box filter weights each by how much of it is covered. Taps past the edge
+ * of the image are folded onto the edge texel
+ */
+static void buildFilterTable( int sourceSize, int destSize, MipFilter filter, FilterTable * pTable )
+{
+    double scale = static_cast<double>( sourceSize ) / destSize;
+
+    pTable->taps.resize( destSize );
+    pTable->weights.clear();
+
+    for ( int i = 0; i < destSize; ++i )
+    {
+        double center = ( i + 0.5 ) * scale;
+        double radius = ( filter == MIP_FILTER_BOX ? 0.5 : KAISER_RADIUS ) * scale;
+        double low    = center - radius;
+        double high   = center + radius;
+
+        int firstRaw = static_cast<int>( floor( low ) );
+        int lastRaw  = static_cast<int>( ceil( high ) ) - 1;
+        int first    = std::min( std::max( firstRaw, 0 ), sourceSize - 1 );
+        int last     = std::min( std::max( lastRaw,  0 ), sourceSize - 1 );
+
+        std::vector<double> weights( last - first + 1, 0.0 );
+        double total = 0.0;
+
+        for ( int j = firstRaw; j <= lastRaw; ++j )
+        {
+            double weight = 0.0;
+
+            if ( filter == MIP_FILTER_BOX )
+            {
+                weight = std::min( high, j + 1.0 ) - std::max( low, static_cast<double>( j ) );
+            }
+            else
+            {
+                weight = kaiserWeight( ( j + 0.5 - center ) / scale );
+            }
+
+            int clamped = std::min( std::max( j, 0 ), sourceSize - 1 );
+            weights[clamped - first] += weight;
+            total                    += weight;
+        }
+
+        FilterTaps& taps  = pTable->taps[i];
+        taps.first        = first;
+        taps.count        = static_cast<int>( weights.size() );
+        taps.weightOffset = pTable->weights.size();
+
+        for ( size_t k = 0; k < weights.size(); ++k )
+        {
+            pTable->weights.push_back( static_cast<float>( weights[k] / total ) );
+        }
+    }
+}
+
+/**
+ * Horizontal pass over one row. Each texel's four channels are filtered at
+ * once, so this is already a good fit for four wide vectors
+ */
+static void filterRowScalar( const float * pSource, const FilterTable& table, float * pDest )
+{
+    for ( size_t x = 0; x < table.taps.size(); ++x )
+    {
+        const FilterTaps& taps = table.taps[x];
+        const float * pWeight  = &table.weights[ taps.weightOffset ];
+        float sum[4]           = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for ( int k = 0; k < taps.count; ++k )
+        {
+            const float * pTexel = pSource + ( taps.first + k ) * 4;
+
+            for ( int c = 0; c < 4; ++c )
+            {
+                sum[c] += pWeight[k] * pTexel[c];
+            }
+        }
+
+        memcpy( pDest + x * 4, sum, sizeof( sum ) );
+    }
+}
+
+/**
+ * Vertical pass for one output row, a weighted sum of whole source rows
+ */
+static void filterColumnsScalar( const float * pSource,
+                                 size_t pitch,
+                                 const float * pWeights,
+                                 int count,
+                                 float * pDest,
+                                 size_t floatCount )
+{
+    for ( size_t i = 0; i < floatCount; ++i )
+    {
+        float sum = 0.0f;
+
+        for ( int k = 0; k < count; ++k )
+        {
+            sum += pWeights[k] * pSource[k * pitch + i];
+        }
+
+        pDest[i] = sum;
+    }
+}
+
+#ifdef GFXSANDBOX_X86
+__attribute__(( target( "sse2" ) ))
+static void filterRowSse2( const float * pSource, const FilterTable& table, float * pDest )
+{
+    for ( size_t x = 0; x < table.taps.size(); ++x )
+    {
+        const FilterTaps& taps = table.taps[x];
+        const float * pWeight  = &table.weights[ taps.weightOffset ];
+        __m128 sum             = _mm_setzero_ps();
+
+        for ( int k = 0; k < taps.count; ++k )
+        {
+            __m128 texel = _mm_loadu_ps( pSource + ( taps.first + k ) * 4 );
+            sum          = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( pWeight[k] ), texel ) );
+        }
+
+        _mm_storeu_ps( pDest + x * 4, sum );
+    }
+}
+
+__attribute__(( target( "sse2" ) ))
+static void filterColumnsSse2( const float * pSource,
+                               size_t pitch,
+                               const float * pWeights,
+                               int count,
+                               float * pDest,
+                               size_t floatCount )
+{
+    size_t i = 0;
+
+    for ( ; i + 4 <= floatCount; i += 4 )
+    {
+        __m128 sum = _mm_setzero_ps();
+
+        for ( int k = 0; k < count; ++k )
+        {
+            __m128 value = _mm_loadu_ps( pSource + k * pitch + i );
+            sum          = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( pWeights[k] ), value ) );
+        }
+
+        _mm_storeu_ps( pDest + i, sum );
+    }
+
+    filterColumnsScalar( pSource + i, pitch, pWeights, count, pDest + i, floatCount - i );
+}
+
+/**
+ * AVX version of the vertical pass, eight channels (two texels) at a time.
+ * The horizontal pass stays at four wide since each tap is one texel
+ */
+__attribute__(( target( "avx" ) ))
+static void filterColumnsAvx( const float * pSource,
+                              size_t pitch,
+                              const float * pWeights,
+                              int count,
+                              float * pDest,
+                              size_t floatCount )
+{
+    size_t i = 0;
+
+    for ( ; i + 8 <= floatCount; i += 8 )
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for ( int k = 0; k < count; ++k )
+        {
+            __m256 value = _mm256_loadu_ps( pSource + k * pitch + i );
+            sum          = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_set1_ps( pWeights[k] ), value ) );
+        }
+
+        _mm256_storeu_ps( pDest + i, sum );
+    }
+
+    filterColumnsScalar( pSource + i, pitch, pWeights, count, pDest + i, floatCount - i );
+}
+#endif
+
+bool isMipKernelSupported( MipKernel kernel )
+{
+    switch ( kernel )
+    {
+        case MIP_KERNEL_SCALAR:
+            return true;
+
+#ifdef GFXSANDBOX_X86
+        case MIP_KERNEL_SSE2:
+            return __builtin_cpu_supports( "sse2" );
+
+        case MIP_KERNEL_AVX:
+            return __builtin_cpu_supports( "avx" );
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Picks the widest kernel the CPU supports. This is only worked out once
+ */
+MipKernel bestMipKernel()
+{
+    static const MipKernel best =
+        isMipKernelSupported( MIP_KERNEL_AVX )  ? MIP_KERNEL_AVX :
+        isMipKernelSupported( MIP_KERNEL_SSE2 ) ? MIP_KERNEL_SSE2 :
+                                                  MIP_KERNEL_SCALAR;
+    return best;
+}
+
+const char * mipKernelName( MipKernel kernel )
+{
+    switch ( kernel )
+    {
+        case MIP_KERNEL_SCALAR: return "scalar";
+        case MIP_KERNEL_SSE2:   return "sse2";
+        case MIP_KERNEL_AVX:    return "avx";
+        default:                return "unknown";
+    }
+}
+
+static void filterRow( MipKernel kernel, const float * pSource, const FilterTable& table, float * pDest )
+{
+#ifdef GFXSANDBOX_X86
+    if ( kernel != MIP_KERNEL_SCALAR )
+    {
+        filterRowSse2( pSource, table, pDest );
+        return;
+    }
+#endif
+
+    filterRowScalar( pSource, table, pDest );
+}
+
+static void filterColumns( MipKernel kernel,
+                           const float * pSource,
+                           size_t pitch,
+                           const float * pWeights,
+                           int count,
+                           float * pDest,
+                           size_t floatCount )
+{
+    switch ( kernel )
+    {
+#ifdef GFXSANDBOX_X86
+        case MIP_KERNEL_AVX:
+            filterColumnsAvx( pSource, pitch, pWeights, count, pDest, floatCount );
+            break;
+
+        case MIP_KERNEL_SSE2:
+            filterColumnsSse2( pSource, pitch, pWeights, count, pDest, floatCount );
+            break;
+#endif
+
+        default:
+            filterColumnsScalar( pSource, pitch, pWeights, count, pDest, floatCount );
+            break;
+    }
+}
+
+int mipLevelCount( int width, int height )
+{
+    int count = 1;
+
+    while ( width > 1 || height > 1 )
+    {
+        width  = std::max( width / 2, 1 );
+        height = std::max( height / 2, 1 );
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Builds the mip chain of an image. Each level is filtered from the float
+ * linear light version of the level above rather than from its 8-bit pixels,
+ * so rounding errors don't build up down the chain. Both filter passes are
+ * split over threads by rows
+ *
+ * \param  kernel       Implementation of the filter loops to use
+ * \param  source       The full size image
+ * \param  filter       Filter to shrink each level with
+ * \param  pLevels      Receives the levels below the source, largest first,
+ *                      in the same pixel format as the source
+ * \param  threadCount  Threads to use, or zero for one per core
+ */
+void generateMipChainWith( MipKernel kernel,
+                           const Image& source,
+                           MipFilter filter,
+                           std::vector<Image> * pLevels,
+                           size_t threadCount )
+{
+    assert( pLevels != NULL );
+    assert( isMipKernelSupported( kernel ) );
+
+    const GammaTables& gamma = gammaTables();
+    size_t pixelSize         = bytesPerPixel( source.format );
+    bool hasAlpha            = ( source.format == PIXEL_FORMAT_BGRA8 );
+
+    if ( threadCount == 0 )
+    {
+        threadCount = hardwareThreadCount();
+    }
+
+    pLevels->clear();
+
+    LinearImage current;
+    current.width  = source.width;
+    current.height = source.height;
+    current.texels.resize( static_cast<size_t>( source.width ) * source.height * 4 );
+
+    const unsigned char * pPixels = source.pixels();
+
+    for ( size_t i = 0; i < current.texels.size() / 4; ++i )
+    {
+        const unsigned char * pTexel = pPixels + i * pixelSize;
+
+        current.texels[i * 4 + 0] = gamma.toLinear[ pTexel[0] ];
+        current.texels[i * 4 + 1] = gamma.toLinear[ pTexel[1] ];
+        current.texels[i * 4 + 2] = gamma.toLinear[ pTexel[2] ];
+        current.texels[i * 4 + 3] = hasAlpha ? pTexel[3] / 255.0f : 1.0f;
+    }
+
+    while ( current.width > 1 || current.height > 1 )
+    {
+        LinearImage next;
+        next.width  = std::max( current.width / 2, 1 );
+        next.height = std::max( current.height / 2, 1 );
+        next.texels.resize( static_cast<size_t>( next.width ) * next.height * 4 );
+
+        FilterTable columns, rows;
+        buildFilterTable( current.width, next.width, filter, &columns );
+        buildFilterTable( current.height, next.height, filter, &rows );
+
+        size_t texelCount = static_cast<size_t>( current.width ) * current.height;
+        size_t threads    = ( texelCount >= PARALLEL_MIN_TEXELS ? threadCount : 1 );
+
+        // Shrink every row first, then blend the shrunk rows together
+        size_t pitch = static_cast<size_t>( next.width ) * 4;
+        std::vector<float> shrunkRows( pitch * current.height );
+
+        parallelFor( current.height, threads, [&]( size_t y )
+        {
+            filterRow( kernel,
+                       &current.texels[ y * current.width * 4 ],
+                       columns,
+                       &shrunkRows[ y * pitch ] );
+        });
+
+        Image level;
+        level.width  = next.width;
+        level.height = next.height;
+        level.format = source.format;
+        level.buffer.resize( level.size() );
+
+        parallelFor( next.height, threads, [&]( size_t y )
+        {
+            const FilterTaps& taps = rows.taps[y];
+            float * pRow           = &next.texels[ y * pitch ];
+
+            filterColumns( kernel,
+                           &shrunkRows[ taps.first * pitch ],
+                           pitch,
+                           &rows.weights[ taps.weightOffset ],
+                           taps.count,
+                           pRow,
+                           pitch );
+
+            unsigned char * pDest = &level.buffer[ y * next.width * pixelSize ];
+
+            for ( int x = 0; x < next.width; ++x )
+            {
+                const float * pTexel = pRow + x * 4;
+
+                // Sharper filters overshoot a little around edges
+                for ( int c = 0; c < 3; ++c )
+                {
+                    float value = std::min( std::max( pTexel[c], 0.0f ), 1.0f );
+                    pDest[c]    = gamma.toSrgb[ static_cast<int>( value * LINEAR_TO_SRGB_STEPS + 0.5f ) ];
+                }
+
+                if ( hasAlpha )
+                {
+                    float value = std::min( std::max( pTexel[3], 0.0f ), 1.0f );
+                    pDest[3]    = static_cast<unsigned char>( value * 255.0f + 0.5f );
+                }
+
+                pDest += pixelSize;
+            }
+        });
+
+        pLevels->push_back( Image() );
+        std::swap( pLevels->back(), level );
+        std::swap( current, next );
+    }
+}
+
+/**
+ * Builds the mip chain of an image with the fastest kernel the CPU supports
+ */
+void generateMipChain( const Image& source,
+                       MipFilter filter,
+                       std::vector<Image> * pLevels,
+                       size_t threadCount )
+{
+    generateMipChainWith( bestMipKernel(), source, filter, pLevels, threadCount );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Disk cache
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Start of a cached chain. The header is followed by the size of every level
+ * (two uint32_t each), and then the pixels of every level back to back
+ */
+struct MipCacheHeader
+{
+    char magic[4];              // "MIPC"
+    uint32_t version;
+    uint32_t format;
+    uint32_t levelCount;
+};
+
+void setMipCacheDirectory( const std::string& directory )
+{
+    GMipCacheDirectory = directory;
+}
+
+/**
+ * Works out where the chain for an image lives in the cache. The key covers
+ * the pixels as well as everything that changes how the levels come out
+ */
+static std::string mipCachePath( const Image& source, MipFilter filter )
+{
+    uint32_t settings[5] =
+    {
+        MIP_CACHE_VERSION,
+        static_cast<uint32_t>( source.width ),
+        static_cast<uint32_t>( source.height ),
+        static_cast<uint32_t>( source.format ),
+        static_cast<uint32_t>( filter )
+    };
+
+    uint64_t hash = hashData( settings, sizeof( settings ) );
+    hash          = hashData( source.pixels(), source.size(), hash );
+
+    char name[32];
+    snprintf( name, sizeof( name ), "%016llx.mip", static_cast<unsigned long long>( hash ) );
+
+    return GMipCacheDirectory + "/" + name;
+}
+
+/**
+ * Loads a cached chain. The levels point into the mapped cache file
+ *
+ * \return  False if there is no usable chain at the path
+ */
+static bool loadCachedMipChain( const std::string& path,
+                                const Image& source,
+                                std::vector<Image> * pLevels )
+{
+    std::shared_ptr<MappedFile> file( new MappedFile );
+
+    if (! file->open( path ) || file->size() < sizeof( MipCacheHeader ) )
+    {
+        return false;
+    }
+
+    MipCacheHeader header;
+    memcpy( &header, file->data(), sizeof( header ) );
+
+    size_t levelCount = static_cast<size_t>( mipLevelCount( source.width, source.height ) - 1 );
+
+    if ( memcmp( header.magic, "MIPC", 4 ) != 0 ||
+         header.version != MIP_CACHE_VERSION ||
+         header.format != static_cast<uint32_t>( source.format ) ||
+         header.levelCount != levelCount )
+    {
+        return false;
+    }
+
+    // The level sizes follow the header, make sure a truncated file still
+    // has all of them before reading any
+    size_t offset = sizeof( header ) + levelCount * 2 * sizeof( uint32_t );
+
+    if ( file->size() < offset )
+    {
+        return false;
+    }
+    int width     = source.width;
+    int height    = source.height;
+
+    std::vector<Image> levels( levelCount );
+
+    for ( size_t i = 0; i < levelCount; ++i )
+    {
+        uint32_t size[2];
+        memcpy( size, file->data() + sizeof( header ) + i * sizeof( size ), sizeof( size ) );
+
+        width  = std::max( width / 2, 1 );
+        height = std::max( height / 2, 1 );
+
+        Image& level        = levels[i];
+        level.width         = width;
+        level.height        = height;
+        level.format        = source.format;
+        level.mapping       = file;
+        level.mappingOffset = offset;
+
+        if ( size[0] != static_cast<uint32_t>( width ) ||
+             size[1] != static_cast<uint32_t>( height ) ||
+             offset > file->size() || level.size() > file->size() - offset )
+        {
+            return false;
+        }
+
+        offset += level.size();
+    }
+
+    pLevels->swap( levels );
+    return true;
+}
+
+/**
+ * Writes a chain to the cache, going through a temporary file so that a
+ * crash never leaves a truncated chain behind
+ */
+static void saveCachedMipChain( const std::string& path, const std::vector<Image>& levels )
+{
+    if ( levels.empty() || !makeDirectory( GMipCacheDirectory ) )
+    {
+        return;
+    }
+
+    MipCacheHeader header;
+    memcpy( header.magic, "MIPC", 4 );
+    header.version    = MIP_CACHE_VERSION;
+    header.format     = static_cast<uint32_t>( levels[0].format );
+    header.levelCount = static_cast<uint32_t>( levels.size() );
+
+    std::string tempPath = path + ".tmp";
+    FILE * pFile         = fopen( tempPath.c_str(), "wb" );
+
+    if ( pFile == NULL )
+    {
+        return;
+    }
+
+    bool ok = fwrite( &header, sizeof( header ), 1, pFile ) == 1;
+
+    for ( size_t i = 0; ok && i < levels.size(); ++i )
+    {
+        uint32_t size[2] = { static_cast<uint32_t>( levels[i].width ),
+                             static_cast<uint32_t>( levels[i].height ) };
+        ok = fwrite( size, sizeof( size ), 1, pFile ) == 1;
+    }
+
+    for ( size_t i = 0; ok && i < levels.size(); ++i )
+    {
+        ok = fwrite( levels[i].pixels(), 1, levels[i].size(), pFile ) == levels[i].size();
+    }
+
+    ok = ( fclose( pFile ) == 0 ) && ok;
+
+    if ( !ok || rename( tempPath.c_str(), path.c_str() ) != 0 )
+    {
+        remove( tempPath.c_str() );
+    }
+}
+
+/**
+ * Gets the mip chain of an image, from the disk cache if it has been built
+ * before. Safe to call from several threads at once
+ *
+ * \param  source   The full size image
+ * \param  filter   Filter to shrink each level with
+ * \param  pLevels  Receives the levels below the source, largest first
+ */
+void loadMipChain( const Image& source, MipFilter filter, std::vector<Image> * pLevels )
+{
+    assert( pLevels != NULL );
+
+    if ( GMipCacheDirectory.empty() )
+    {
+        generateMipChain( source, filter, pLevels );
+        return;
+    }
+
+    std::string path = mipCachePath( source, filter );
+
+    if ( loadCachedMipChain( path, source, pLevels ) )
+    {
+        return;
+    }
+
+    generateMipChain( source, filter, pLevels );
+    saveCachedMipChain( path, *pLevels );
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_MIPMAP_H
+#define SCOTT_GFXSANDBOX_MIPMAP_H
+
+#include "tga.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Filters for shrinking one mip level into the next
+ */
+enum MipFilter
+{
+    MIP_FILTER_BOX,             // average of the texels each texel covers
+    MIP_FILTER_KAISER           // Kaiser windowed sinc, sharper than box
+};
+
+/**
+ * Implementations of the filter loops. The best one supported by the CPU is
+ * picked at runtime, but benchmarks can ask for a specific one
+ */
+enum MipKernel
+{
+    MIP_KERNEL_SCALAR,
+    MIP_KERNEL_SSE2,
+    MIP_KERNEL_AVX
+};
+
+// Number of levels in a full mip chain, down to 1x1
+int mipLevelCount( int width, int height );
+
+// Build every level below the source image, largest first
+void generateMipChain( const Image& source,
+                       MipFilter filter,
+                       std::vector<Image> * pLevels,
+                       size_t threadCount = 0 );
+
+// Build the levels with a specific kernel
+void generateMipChainWith( MipKernel kernel,
+                           const Image& source,
+                           MipFilter filter,
+                           std::vector<Image> * pLevels,
+                           size_t threadCount = 0 );
+
+// Like generateMipChain, but reuses a chain cached on disk when possible
+void loadMipChain( const Image& source, MipFilter filter, std::vector<Image> * pLevels );
+
+// Set the directory chains are cached in. Empty turns the cache off
+void setMipCacheDirectory( const std::string& directory );
+
+// Returns the fastest kernel supported by this CPU
+MipKernel bestMipKernel();
+
+// Returns true if the CPU can run the given kernel
+bool isMipKernelSupported( MipKernel kernel );
+
+// Returns a printable name for the kernel
+const char * mipKernelName( MipKernel kernel );
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_PARALLEL_H
+#define SCOTT_GFXSANDBOX_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Returns the number of threads worth using for CPU bound work
+ */
+inline size_t hardwareThreadCount()
+{
+    return std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+/**
+ * Calls func( i ) for every i in [0, count), spread over up to threadCount
+ * threads including the calling one. Indices are handed out one at a time in
+ * increasing order, so uneven work items balance out
+ */
+template<typename Func>
+void parallelFor( size_t count, size_t threadCount, Func func )
+{
+    std::atomic<size_t> next( 0 );
+
+    auto worker = [&]()
+    {
+        for ( size_t i = next++; i < count; i = next++ )
+        {
+            func( i );
+        }
+    };
+
+    threadCount = std::min( threadCount, count );
+
+    if ( threadCount <= 1 )
+    {
+        worker();
+        return;
+    }
+
+    std::vector<std::thread> threads;
+
+    for ( size_t t = 1; t < threadCount; ++t )
+    {
+        threads.push_back( std::thread( worker ) );
+    }
+
+    worker();
+
+    for ( size_t t = 0; t < threads.size(); ++t )
+    {
+        threads[t].join();
+    }
+}
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "pixelbuffer.h"
+#include "glutil.h"
+#include "glstate.h"
+#include "texture.h"
+#include <cassert>
+#include <cstring>
+
+PixelUploadRing::PixelUploadRing()
+    : mBuffer( 0 ),
+      mSlotSize( 0 ),
+      mpPersistent( NULL ),
+      mStates(),
+      mFences(),
+      mMutex(),
+      mSlotFreed(),
+      mIsCancelled( false )
+{
+}
+
+PixelUploadRing::~PixelUploadRing()
+{
+    destroy();
+}
+
+/**
+ * Creates the pixel buffer backing the ring. Fences are needed to know when a
+ * slot can be reused, so without ARB_sync no ring is created and callers
+ * should upload from client memory instead
+ *
+ * \param  slotSize   Largest upload that fits in a slot, in bytes
+ * \param  slotCount  Number of uploads that can be in flight at once
+ * \return            True if the ring was created
+ */
+bool PixelUploadRing::create( size_t slotSize, size_t slotCount )
+{
+    assert( slotSize > 0 && slotCount > 0 );
+    destroy();
+
+    bool hasPbo  = GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object;
+    bool hasSync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+    bool hasMap  = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+
+    if (! hasPbo || ! hasSync || ! hasMap )
+    {
+        return false;
+    }
+
+    GLsizeiptr totalSize = static_cast<GLsizeiptr>( slotSize * slotCount );
+
+    glGenBuffers( 1, &mBuffer );
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+
+    if ( GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage )
+    {
+        // Coherent so that writes from decoding threads are visible to the GPU
+        // without an explicit flush
+        const GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glBufferStorage( GL_PIXEL_UNPACK_BUFFER, totalSize, NULL, flags );
+        mpPersistent = static_cast<unsigned char*>(
+            glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, totalSize, flags ) );
+    }
+    else
+    {
+        glBufferData( GL_PIXEL_UNPACK_BUFFER, totalSize, NULL, GL_STREAM_DRAW );
+    }
+
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    if ( checkGlFailure( "Creating pixel upload ring" ) )
+    {
+        destroy();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    mSlotSize    = slotSize;
+    mIsCancelled = false;
+    mStates.assign( slotCount, SLOT_FREE );
+    mFences.assign( slotCount, static_cast<GLsync>( NULL ) );
+
+    return true;
+}
+
+/**
+ * Releases the ring's buffer without waiting for outstanding uploads. Threads
+ * blocked in acquire() are woken and fail. Uploads the GPU hasn't finished
+ * keep the storage alive on the driver's side, so the fences can be deleted
+ * straight away
+ */
+void PixelUploadRing::destroy()
+{
+    if ( mBuffer == 0 )
+    {
+        return;
+    }
+
+    cancelWaits();
+
+    for ( size_t i = 0; i < mFences.size(); ++i )
+    {
+        if ( mFences[i] != NULL )
+        {
+            glDeleteSync( mFences[i] );
+        }
+    }
+
+    if ( mpPersistent != NULL )
+    {
+        GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+        glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+        GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    }
+
+    glDeleteBuffers( 1, &mBuffer );
+
+    std::lock_guard<std::mutex> lock( mMutex );
+
+    mBuffer       = 0;
+    mSlotSize     = 0;
+    mpPersistent  = NULL;
+    mStates.clear();
+    mFences.clear();
+}
+
+/**
+ * Makes every current and future call to acquire() fail. Used when shutting
+ * down so that threads waiting for a slot don't block forever
+ */
+void PixelUploadRing::cancelWaits()
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mIsCancelled = true;
+    }
+
+    mSlotFreed.notify_all();
+}
+
+/**
+ * Claims a slot in a persistently mapped ring, waiting until one frees up if
+ * they are all in use. Safe to call from any thread
+ *
+ * \param  size      Number of bytes that will be written
+ * \param  ppMemory  Receives a pointer to the slot's mapped memory
+ * \return           The slot, or -1 if the ring can't take the upload
+ */
+int PixelUploadRing::acquire( size_t size, unsigned char ** ppMemory )
+{
+    assert( ppMemory != NULL );
+    std::unique_lock<std::mutex> lock( mMutex );
+
+    if ( mpPersistent == NULL || size > mSlotSize )
+    {
+        return -1;
+    }
+
+    int slot = findFreeSlot();
+
+    while ( slot < 0 && !mIsCancelled )
+    {
+        mSlotFreed.wait( lock );
+        slot = findFreeSlot();
+    }
+
+    if ( mIsCancelled )
+    {
+        return -1;
+    }
+
+    mStates[slot] = SLOT_WRITING;
+    *ppMemory     = mpPersistent + mSlotSize * slot;
+
+    return slot;
+}
+
+/**
+ * Returns a claimed slot to the ring without uploading anything from it
+ */
+void PixelUploadRing::release( int slot )
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        assert( mStates[slot] == SLOT_WRITING );
+        mStates[slot] = SLOT_FREE;
+    }
+
+    mSlotFreed.notify_one();
+}
+
+/**
+ * Copies an image into a free slot and uploads it. This is how the GL thread
+ * uses rings that aren't persistently mapped: the slot is mapped
+ * unsynchronized, since the fences already guarantee the GPU is done with it
+ *
+ * \param  texture  Texture to upload into
+ * \param  image    Image to upload
+ * \return          False if the image is too big or no slot was free
+ */
+bool PixelUploadRing::uploadCopy( GLuint texture, const Image& image )
+{
+    if ( mBuffer == 0 || image.size() > mSlotSize )
+    {
+        return false;
+    }
+
+    int slot = -1;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        slot = findFreeSlot();
+
+        if ( slot < 0 )
+        {
+            return false;
+        }
+
+        mStates[slot] = SLOT_WRITING;
+    }
+
+    unsigned char * pMemory = NULL;
+
+    if ( mpPersistent != NULL )
+    {
+        pMemory = mpPersistent + mSlotSize * slot;
+    }
+    else
+    {
+        GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+        pMemory = static_cast<unsigned char*>(
+            glMapBufferRange( GL_PIXEL_UNPACK_BUFFER,
+                              static_cast<GLintptr>( mSlotSize * slot ),
+                              static_cast<GLsizeiptr>( image.size() ),
+                              GL_MAP_WRITE_BIT |
+                              GL_MAP_INVALIDATE_RANGE_BIT |
+                              GL_MAP_UNSYNCHRONIZED_BIT ) );
+    }
+
+    if ( pMemory == NULL )
+    {
+        GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        release( slot );
+        return false;
+    }
+
+    memcpy( pMemory, image.pixels(), image.size() );
+
+    if ( mpPersistent == NULL )
+    {
+        glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+    }
+
+    upload( slot, texture, image.width, image.height, image.format );
+    return true;
+}
+
+/**
+ * Checks the fences of in flight uploads and frees any slots whose upload
+ * has completed. This never waits on the GPU
+ */
+void PixelUploadRing::retire()
+{
+    bool freedAny = false;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+
+        for ( size_t i = 0; i < mStates.size(); ++i )
+        {
+            if ( mStates[i] != SLOT_IN_FLIGHT )
+            {
+                continue;
+            }
+
+            GLenum status = glClientWaitSync( mFences[i], 0, 0 );
+
+            if ( status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED )
+            {
+                glDeleteSync( mFences[i] );
+                mFences[i] = NULL;
+                mStates[i] = SLOT_FREE;
+                freedAny   = true;
+            }
+        }
+    }
+
+    if ( freedAny )
+    {
+        mSlotFreed.notify_all();
+    }
+}
+
+/**
+ * Finds a free slot. Must be called with the mutex held
+ */
+int PixelUploadRing::findFreeSlot() const
+{
+    for ( size_t i = 0; i < mStates.size(); ++i )
+    {
+        if ( mStates[i] == SLOT_FREE )
+        {
+            return static_cast<int>( i );
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Uploads pixels that were written into a claimed slot. The upload is issued
+ * from the slot's offset in the buffer and then fenced
+ */
+void PixelUploadRing::upload( int slot,
+                              GLuint texture,
+                              int width,
+                              int height,
+                              PixelFormat format )
+{
+    assert( mStates[slot] == SLOT_WRITING );
+
+    // With a pixel unpack buffer bound the pixel pointer is an offset into it
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+    uploadTexturePixels( texture,
+                         width,
+                         height,
+                         format,
+                         reinterpret_cast<const void*>( mSlotSize * slot ) );
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    GLsync fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+    std::lock_guard<std::mutex> lock( mMutex );
+    mFences[slot] = fence;
+    mStates[slot] = SLOT_IN_FLIGHT;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_PIXELBUFFER_H
+#define SCOTT_GFXSANDBOX_PIXELBUFFER_H
+
+#include "tga.h"
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * A ring of pixel buffer object slots used to stream texture data to the GPU.
+ * Pixels are written into a slot, the texture upload is issued from the
+ * slot's buffer offset, and a fence is placed after it. The slot is only
+ * reused once its fence has signaled, so writing never waits on the GPU and
+ * the upload never waits on the CPU.
+ *
+ * When ARB_buffer_storage is available the whole ring is persistently mapped.
+ * Slots can then be claimed and filled from any thread (eg texture decoding
+ * threads) with acquire(). Otherwise only the GL thread can use the ring,
+ * through uploadCopy(), which maps a slot unsynchronized and copies into it.
+ *
+ * Everything except acquire() and release() must be called on the GL thread.
+ */
+class PixelUploadRing
+{
+public:
+    PixelUploadRing();
+    ~PixelUploadRing();
+
+    // Create the buffer backing the ring. Returns false if PBOs are unusable
+    bool create( size_t slotSize, size_t slotCount );
+
+    // Release the buffer and any fences
+    void destroy();
+
+    // Wake up and fail any threads blocked in acquire()
+    void cancelWaits();
+
+    // Claim a persistently mapped slot, blocking until one is free
+    int acquire( size_t size, unsigned char ** ppMemory );
+
+    // Give back a slot claimed with acquire() without uploading from it
+    void release( int slot );
+
+    // Upload from a slot filled after acquire() into a texture
+    void upload( int slot,
+                 GLuint texture,
+                 int width,
+                 int height,
+                 PixelFormat format );
+
+    // Copy an image into a free slot and upload it. False if no slot was free
+    bool uploadCopy( GLuint texture, const Image& image );
+
+    // Free slots whose uploads have finished on the GPU
+    void retire();
+
+    bool isCreated() const { return mBuffer != 0; }
+    bool isPersistent() const { return mpPersistent != NULL; }
+    size_t slotSize() const { return mSlotSize; }
+
+private:
+    PixelUploadRing( const PixelUploadRing& );
+    PixelUploadRing& operator = ( const PixelUploadRing& );
+
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_WRITING,       // claimed, being filled by the CPU
+        SLOT_IN_FLIGHT      // upload issued, waiting on the fence
+    };
+
+    int findFreeSlot() const;
+
+    GLuint mBuffer;
+    size_t mSlotSize;
+    unsigned char * mpPersistent;
+    std::vector<SlotState> mStates;
+    std::vector<GLsync> mFences;
+    std::mutex mMutex;
+    std::condition_variable mSlotFreed;
+    bool mIsCancelled;
+};
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "profiler.h"
+#include <cassert>
+#include <cstdio>
+
+Profiler GProfiler;
+
+// Trace thread id used for GPU events, so they get their own track
+const uint32_t GPU_TRACE_THREAD_ID = 0;
+
+/**
+ * Returns a small integer that identifies the calling thread. Ids are handed
+ * out in the order threads first record something, starting at one
+ */
+static uint32_t currentThreadId()
+{
+    static std::atomic<uint32_t> nextId( 1 );
+    static thread_local uint32_t threadId = nextId.fetch_add( 1 );
+
+    return threadId;
+}
+
+/**
+ * Creates a profiler whose ring buffer holds the given number of events. The
+ * capacity is rounded up to a power of two
+ */
+Profiler::Profiler( size_t capacity )
+    : mSlots(),
+      mMask( 0 ),
+      mWriteIndex( 0 ),
+      mStatsIndex( 0 ),
+      mRollingSamples(),
+      mGpuTimers( -1 ),
+      mGpuClockOffsetMs( 0.0 ),
+      mFrameIndex( 0 ),
+      mFreeQueries()
+{
+    size_t size = 1;
+
+    while ( size < capacity )
+    {
+        size *= 2;
+    }
+
+    mSlots.reset( new Slot[size] );
+    mMask = size - 1;
+
+    for ( size_t i = 0; i < size; ++i )
+    {
+        mSlots[i].sequence.store( 0 );
+    }
+}
+
+Profiler::~Profiler()
+{
+}
+
+/**
+ * Adds an event to the ring. Each slot carries a sequence number that is odd
+ * while the slot is being written and even once it's done, so readers can
+ * tell a finished event from a half written or overwritten one without
+ * taking a lock
+ *
+ * \param  name        Name of the scope, must outlive the profiler
+ * \param  startMs     When the scope started, on the currentTimeMs() clock
+ * \param  durationMs  How long the scope took
+ * \param  isGpu       True if this was measured on the GPU
+ */
+void Profiler::record( const char * name,
+                       double startMs,
+                       double durationMs,
+                       bool isGpu )
+{
+    uint64_t index = mWriteIndex.fetch_add( 1, std::memory_order_relaxed );
+    Slot& slot     = mSlots[index & mMask];
+
+    slot.sequence.store( index * 2 + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    slot.event.name       = name;
+    slot.event.startMs    = startMs;
+    slot.event.durationMs = durationMs;
+    slot.event.threadId   = isGpu ? GPU_TRACE_THREAD_ID : currentThreadId();
+    slot.event.isGpu      = isGpu;
+
+    slot.sequence.store( index * 2 + 2, std::memory_order_release );
+}
+
+/**
+ * Copies the event written at the given index out of the ring
+ *
+ * \return  False if the event is still being written or was overwritten
+ */
+bool Profiler::readSlot( uint64_t index, ProfileEvent * pEvent ) const
+{
+    const Slot& slot  = mSlots[index & mMask];
+    uint64_t expected = index * 2 + 2;
+
+    if ( slot.sequence.load( std::memory_order_acquire ) != expected )
+    {
+        return false;
+    }
+
+    *pEvent = slot.event;
+    std::atomic_thread_fence( std::memory_order_acquire );
+
+    return slot.sequence.load( std::memory_order_relaxed ) == expected;
+}
+
+/**
+ * Checks if GPU timer queries can be used, and if so lines the GPU clock up
+ * with the CPU clock so GPU events land in the right place on the timeline
+ */
+bool Profiler::hasGpuTimers()
+{
+    if ( mGpuTimers < 0 )
+    {
+        mGpuTimers = ( GLEW_VERSION_3_3 || GLEW_ARB_timer_query ) ? 1 : 0;
+
+        if ( mGpuTimers )
+        {
+            GLint64 timestamp = 0;
+            glGetInteger64v( GL_TIMESTAMP, &timestamp );
+
+            mGpuClockOffsetMs = currentTimeMs() -
+                                static_cast<double>( timestamp ) / 1000000.0;
+        }
+    }
+
+    return mGpuTimers == 1;
+}
+
+/**
+ * Takes a query object from the pool, creating one if the pool is empty
+ */
+GLuint Profiler::allocateQuery()
+{
+    GLuint query = 0;
+
+    if ( mFreeQueries.empty() )
+    {
+        glGenQueries( 1, &query );
+    }
+    else
+    {
+        query = mFreeQueries.back();
+        mFreeQueries.pop_back();
+    }
+
+    return query;
+}
+
+/**
+ * Starts timing GPU work by writing a timestamp query into the command stream
+ *
+ * \param  name  Name of the scope, must outlive the profiler
+ * \return       Handle to pass to endGpuScope, or -1 without timer support
+ */
+int Profiler::beginGpuScope( const char * name )
+{
+    if (! hasGpuTimers() )
+    {
+        return -1;
+    }
+
+    GpuScope scope;
+    scope.name       = name;
+    scope.beginQuery = allocateQuery();
+    scope.endQuery   = allocateQuery();
+    scope.isOpen     = true;
+
+    glQueryCounter( scope.beginQuery, GL_TIMESTAMP );
+
+    std::vector<GpuScope>& frame = mGpuFrames[mFrameIndex];
+    frame.push_back( scope );
+
+    return static_cast<int>( frame.size() - 1 );
+}
+
+/**
+ * Finishes timing a GPU scope started with beginGpuScope
+ */
+void Profiler::endGpuScope( int handle )
+{
+    if ( handle < 0 )
+    {
+        return;
+    }
+
+    GpuScope& scope = mGpuFrames[mFrameIndex][handle];
+    assert( scope.isOpen && "GPU scope ended twice" );
+
+    glQueryCounter( scope.endQuery, GL_TIMESTAMP );
+    scope.isOpen = false;
+}
+
+/**
+ * Moves on to the next frame. The GPU queries issued GPU_FRAME_LATENCY frames
+ * ago are read back, and the rolling statistics catch up with new events
+ */
+void Profiler::endFrame()
+{
+    mFrameIndex = ( mFrameIndex + 1 ) % GPU_FRAME_LATENCY;
+    collectGpuFrame( mGpuFrames[mFrameIndex] );
+    updateRollingStats();
+}
+
+/**
+ * Reads back the timestamps for a frame's GPU scopes and records them as
+ * events. Queries whose results aren't ready yet are dropped
+ */
+void Profiler::collectGpuFrame( std::vector<GpuScope>& scopes )
+{
+    for ( size_t i = 0; i < scopes.size(); ++i )
+    {
+        const GpuScope& scope = scopes[i];
+        GLuint available      = GL_FALSE;
+
+        if (! scope.isOpen )
+        {
+            glGetQueryObjectuiv( scope.endQuery, GL_QUERY_RESULT_AVAILABLE, &available );
+        }
+
+        if ( available )
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v( scope.beginQuery, GL_QUERY_RESULT, &begin );
+            glGetQueryObjectui64v( scope.endQuery, GL_QUERY_RESULT, &end );
+
+            record( scope.name,
+                    mGpuClockOffsetMs + static_cast<double>( begin ) / 1000000.0,
+                    static_cast<double>( end - begin ) / 1000000.0,
+                    true );
+        }
+
+        mFreeQueries.push_back( scope.beginQuery );
+        mFreeQueries.push_back( scope.endQuery );
+    }
+
+    scopes.clear();
+}
+
+/**
+ * Adds events recorded since the last update to each scope's rolling window
+ */
+void Profiler::updateRollingStats()
+{
+    uint64_t writeIndex = mWriteIndex.load( std::memory_order_acquire );
+    uint64_t capacity   = mMask + 1;
+
+    if ( writeIndex - mStatsIndex > capacity )
+    {
+        mStatsIndex = writeIndex - capacity;
+    }
+
+    for ( ; mStatsIndex < writeIndex; ++mStatsIndex )
+    {
+        ProfileEvent event;
+
+        if (! readSlot( mStatsIndex, &event ) )
+        {
+            continue;
+        }
+
+        std::string key = event.isGpu ? std::string( "gpu: " ) + event.name
+                                      : std::string( event.name );
+        std::deque<double>& samples = mRollingSamples[key];
+
+        samples.push_back( event.durationMs );
+
+        if ( samples.size() > ROLLING_WINDOW )
+        {
+            samples.pop_front();
+        }
+    }
+}
+
+/**
+ * Summarises the recent samples of a scope. GPU scopes are named with a
+ * "gpu: " prefix
+ */
+SampleSummary Profiler::scopeSummary( const std::string& name ) const
+{
+    std::map<std::string, std::deque<double> >::const_iterator itr =
+        mRollingSamples.find( name );
+
+    if ( itr == mRollingSamples.end() )
+    {
+        return SampleSummary();
+    }
+
+    return summarizeSamples( std::vector<double>( itr->second.begin(),
+                                                  itr->second.end() ) );
+}
+
+/**
+ * Prints rolling statistics (in milliseconds) for every scope
+ */
+void Profiler::printStats() const
+{
+    std::map<std::string, std::deque<double> >::const_iterator itr;
+
+    for ( itr = mRollingSamples.begin(); itr != mRollingSamples.end(); ++itr )
+    {
+        printSummary( itr->first, scopeSummary( itr->first ) );
+    }
+}
+
+/**
+ * Writes a string as a JSON string literal
+ */
+static void writeJsonString( FILE * pFile, const char * pText )
+{
+    fputc( '"', pFile );
+
+    for ( ; *pText != '\0'; ++pText )
+    {
+        if ( *pText == '"' || *pText == '\\' )
+        {
+            fputc( '\\', pFile );
+        }
+
+        fputc( *pText, pFile );
+    }
+
+    fputc( '"', pFile );
+}
+
+/**
+ * Writes every event still held in the ring to a file in the Chrome trace
+ * event format. Times are written in microseconds
+ *
+ * \param  filename  Path of the JSON file to write
+ * \return           True if the file was written
+ */
+bool Profiler::writeChromeTrace( const std::string& filename ) const
+{
+    FILE * pFile = fopen( filename.c_str(), "w" );
+
+    if ( pFile == NULL )
+    {
+        fprintf( stderr, "Unable to open %s for writing\n", filename.c_str() );
+        return false;
+    }
+
+    fprintf( pFile, "{\"traceEvents\":[\n" );
+    fprintf( pFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":\"GPU\"}}", GPU_TRACE_THREAD_ID );
+
+    uint64_t writeIndex = mWriteIndex.load( std::memory_order_acquire );
+    uint64_t capacity   = mMask + 1;
+    uint64_t index      = ( writeIndex > capacity ? writeIndex - capacity : 0 );
+
+    for ( ; index < writeIndex; ++index )
+    {
+        ProfileEvent event;
+
+        if (! readSlot( index, &event ) )
+        {
+            continue;
+        }
+
+        fprintf( pFile, ",\n{\"name\":" );
+        writeJsonString( pFile, event.name );
+        fprintf( pFile, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":1,\"tid\":%u}",
+                 event.isGpu ? "gpu" : "cpu",
+                 event.startMs * 1000.0,
+                 event.durationMs * 1000.0,
+                 event.threadId );
+    }
+
+    fprintf( pFile, "\n]}\n" );
+    bool ok = ( ferror( pFile ) == 0 );
+    fclose( pFile );
+
+    return ok;
+}
+
+/**
+ * Deletes all GPU query objects, dropping any results not read back yet
+ */
+void Profiler::releaseGpuResources()
+{
+    for ( unsigned int frame = 0; frame < GPU_FRAME_LATENCY; ++frame )
+    {
+        for ( size_t i = 0; i < mGpuFrames[frame].size(); ++i )
+        {
+            mFreeQueries.push_back( mGpuFrames[frame][i].beginQuery );
+            mFreeQueries.push_back( mGpuFrames[frame][i].endQuery );
+        }
+
+        mGpuFrames[frame].clear();
+    }
+
+    if (! mFreeQueries.empty() )
+    {
+        glDeleteQueries( static_cast<GLsizei>( mFreeQueries.size() ), &mFreeQueries[0] );
+        mFreeQueries.clear();
+    }
+
+    mGpuTimers = -1;
+}
+
+ProfileScope::ProfileScope( const char * name )
+    : mName( name ),
+      mStartMs( currentTimeMs() )
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+    GProfiler.record( mName, mStartMs, currentTimeMs() - mStartMs );
+}
+
+GpuProfileScope::GpuProfileScope( const char * name )
+    : mHandle( GProfiler.beginGpuScope( name ) )
+{
+}
+
+GpuProfileScope::~GpuProfileScope()
+{
+    GProfiler.endGpuScope( mHandle );
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_PROFILER_H
+#define SCOTT_GFXSANDBOX_PROFILER_H
+
+#include "timing.h"
+#include <GL/glew.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * A single timed scope. Names must be string literals (or otherwise live for
+ * the whole program) since only the pointer is stored
+ */
+struct ProfileEvent
+{
+    const char * name;
+    double startMs;         // on the currentTimeMs() clock
+    double durationMs;
+    uint32_t threadId;      // small integer id of the recording thread
+    bool isGpu;             // measured with GPU timer queries
+};
+
+/**
+ * Collects timed scopes from any thread into a fixed size lock-free ring
+ * buffer. When the ring fills up the oldest events are overwritten.
+ *
+ * GPU scopes are measured with a pair of GL_TIMESTAMP queries. Their results
+ * are read a few frames after they were issued, by which point they are
+ * almost always ready, so reading them never stalls the pipeline. Results
+ * that still aren't ready are dropped rather than waited on.
+ *
+ * Events can be exported as Chrome trace event JSON (load the file in
+ * chrome://tracing or Perfetto), and are summarised as rolling statistics for
+ * each scope name.
+ */
+class Profiler
+{
+public:
+    // Number of frames between issuing GPU queries and reading them back
+    static const unsigned int GPU_FRAME_LATENCY = 4;
+
+    // Number of recent samples kept for each scope's rolling statistics
+    static const size_t ROLLING_WINDOW = 120;
+
+    explicit Profiler( size_t capacity = 1 << 16 );
+    ~Profiler();
+
+    // Record a finished scope. Safe to call from any thread
+    void record( const char * name, double startMs, double durationMs, bool isGpu = false );
+
+    // Start a GPU scope, returns a handle for endGpuScope. GL thread only
+    int beginGpuScope( const char * name );
+
+    // Finish a GPU scope. GL thread only
+    void endGpuScope( int handle );
+
+    // Mark the end of a frame, reading back old GPU queries. GL thread only
+    void endFrame();
+
+    // Write every event still in the ring as Chrome trace JSON
+    bool writeChromeTrace( const std::string& filename ) const;
+
+    // Summarise the most recent samples of a scope
+    SampleSummary scopeSummary( const std::string& name ) const;
+
+    // Print rolling statistics for every scope seen so far
+    void printStats() const;
+
+    // Release GPU queries. Must be called while the context still exists
+    void releaseGpuResources();
+
+private:
+    Profiler( const Profiler& );
+    Profiler& operator = ( const Profiler& );
+
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        ProfileEvent event;
+    };
+
+    struct GpuScope
+    {
+        const char * name;
+        GLuint beginQuery;
+        GLuint endQuery;
+        bool isOpen;
+    };
+
+    bool readSlot( uint64_t index, ProfileEvent * pEvent ) const;
+    void updateRollingStats();
+    void collectGpuFrame( std::vector<GpuScope>& scopes );
+    GLuint allocateQuery();
+    bool hasGpuTimers();
+
+    std::unique_ptr<Slot[]> mSlots;
+    size_t mMask;
+    std::atomic<uint64_t> mWriteIndex;
+    uint64_t mStatsIndex;
+    std::map<std::string, std::deque<double> > mRollingSamples;
+
+    int mGpuTimers;                 // -1 unknown, 0 unavailable, 1 available
+    double mGpuClockOffsetMs;       // add to GPU timestamps to get cpu time
+    unsigned int mFrameIndex;
+    std::vector<GpuScope> mGpuFrames[GPU_FRAME_LATENCY];
+    std::vector<GLuint> mFreeQueries;
+};
+
+/**
+ * Times the CPU work done between its construction and destruction
+ */
+class ProfileScope
+{
+public:
+    explicit ProfileScope( const char * name );
+    ~ProfileScope();
+
+private:
+    const char * mName;
+    double mStartMs;
+};
+
+/**
+ * Times the GPU work issued between its construction and destruction. Can
+ * only be used on the GL thread
+ */
+class GpuProfileScope
+{
+public:
+    explicit GpuProfileScope( const char * name );
+    ~GpuProfileScope();
+
+private:
+    int mHandle;
+};
+
+// Profiler shared by the whole program
+extern Profiler GProfiler;
+
+#endif
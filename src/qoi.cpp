@@ -0,0 +1,446 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "qoi.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// "qoif", then big endian width and height, channel count and colorspace
+const size_t QOI_HEADER_SIZE = 14;
+
+// Every file ends with seven zero bytes and a one. Since no chunk is longer
+// than five bytes, a chunk that starts before the padding can be read
+// without checking the remaining size again
+const size_t QOI_PADDING_SIZE = 8;
+const unsigned char QOI_PADDING[QOI_PADDING_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Largest image we will decode, to keep width * height * 4 well within size_t
+const uint32_t QOI_MAX_PIXELS = 400000000u;
+
+enum QoiChunkTag
+{
+    QOI_OP_INDEX = 0x00,    // 00xxxxxx  pixel from the index
+    QOI_OP_DIFF  = 0x40,    // 01rrggbb  small difference from the previous
+    QOI_OP_LUMA  = 0x80,    // 10gggggg  rrrrbbbb  difference relative to green
+    QOI_OP_RUN   = 0xC0,    // 11xxxxxx  previous pixel repeated
+    QOI_OP_RGB   = 0xFE,    // followed by red, green and blue
+    QOI_OP_RGBA  = 0xFF     // followed by red, green, blue and alpha
+};
+
+const unsigned char QOI_TAG_MASK = 0xC0;
+
+// Longest run a single chunk can hold. 63 and 64 would clash with the
+// QOI_OP_RGB and QOI_OP_RGBA tags
+const int QOI_MAX_RUN = 62;
+
+/**
+ * Slot in the index of recently seen pixels that a pixel is stored in
+ */
+static inline unsigned int qoiHash( const unsigned char * pRgba )
+{
+    return ( pRgba[0] * 3 + pRgba[1] * 5 + pRgba[2] * 7 + pRgba[3] * 11 ) & 63;
+}
+
+static uint32_t readBigEndian32( const unsigned char * pData )
+{
+    return ( static_cast<uint32_t>( pData[0] ) << 24 ) |
+           ( static_cast<uint32_t>( pData[1] ) << 16 ) |
+           ( static_cast<uint32_t>( pData[2] ) << 8 )  |
+             static_cast<uint32_t>( pData[3] );
+}
+
+static void writeBigEndian32( uint32_t value, std::vector<unsigned char> * pOutput )
+{
+    pOutput->push_back( static_cast<unsigned char>( value >> 24 ) );
+    pOutput->push_back( static_cast<unsigned char>( value >> 16 ) );
+    pOutput->push_back( static_cast<unsigned char>( value >> 8 ) );
+    pOutput->push_back( static_cast<unsigned char>( value ) );
+}
+
+/**
+ * Checks if a buffer starts with the qoi magic bytes
+ */
+bool isQoiData( const unsigned char * pData, size_t size )
+{
+    return size >= 4 && memcmp( pData, "qoif", 4 ) == 0;
+}
+
+/**
+ * Reads the header of a qoi file
+ *
+ * \param  pData  Start of the qoi file
+ * \param  size   Size of the qoi file in bytes
+ * \param  name   Name of the file, used when printing errors
+ * \param  pInfo  Receives the size and pixel format
+ * \return        True if the file is a qoi image we can decode
+ */
+bool parseQoiHeader( const unsigned char * pData,
+                     size_t size,
+                     const char * name,
+                     QoiInfo * pInfo )
+{
+    assert( pData != NULL && pInfo != NULL );
+
+    if ( size < QOI_HEADER_SIZE + QOI_PADDING_SIZE || !isQoiData( pData, size ) )
+    {
+        fprintf( stderr, "%s is not a qoi file\n", name );
+        return false;
+    }
+
+    uint32_t width    = readBigEndian32( pData + 4 );
+    uint32_t height   = readBigEndian32( pData + 8 );
+    unsigned channels = pData[12];
+
+    if ( width == 0 || height == 0 || width > 65536 || height > 65536 ||
+         static_cast<uint64_t>( width ) * height > QOI_MAX_PIXELS )
+    {
+        fprintf( stderr, "%s has an invalid size\n", name );
+        return false;
+    }
+
+    if ( channels != 3 && channels != 4 )
+    {
+        fprintf( stderr, "%s has %u channels, only 3 or 4 are supported\n", name, channels );
+        return false;
+    }
+
+    pInfo->width  = static_cast<int>( width );
+    pInfo->height = static_cast<int>( height );
+    pInfo->format = ( channels == 4 ? PIXEL_FORMAT_BGRA8 : PIXEL_FORMAT_BGR8 );
+
+    return true;
+}
+
+QoiDecoder::QoiDecoder()
+    : mpNext( NULL ),
+      mpEnd( NULL ),
+      mInfo(),
+      mDestFormat( PIXEL_FORMAT_BGR8 ),
+      mRun( 0 ),
+      mRow( 0 )
+{
+    memset( mIndex, 0, sizeof( mIndex ) );
+    memset( mPixel, 0, sizeof( mPixel ) );
+}
+
+/**
+ * Gets ready to decode a file. The file must stay mapped until decoding is
+ * finished
+ *
+ * \param  pData       Start of the qoi file
+ * \param  size        Size of the qoi file in bytes
+ * \param  info        Header information returned by parseQoiHeader
+ * \param  destFormat  Layout to write pixels in. Three channel files can be
+ *                     written as BGRA8, with an opaque alpha
+ */
+void QoiDecoder::begin( const unsigned char * pData,
+                        size_t size,
+                        const QoiInfo& info,
+                        PixelFormat destFormat )
+{
+    assert( size >= QOI_HEADER_SIZE + QOI_PADDING_SIZE );
+    assert( destFormat == info.format || destFormat == PIXEL_FORMAT_BGRA8 );
+
+    mpNext      = pData + QOI_HEADER_SIZE;
+    mpEnd       = pData + size - QOI_PADDING_SIZE;
+    mInfo       = info;
+    mDestFormat = destFormat;
+    mRun        = 0;
+    mRow        = 0;
+
+    memset( mIndex, 0, sizeof( mIndex ) );
+
+    mPixel[0] = 0;
+    mPixel[1] = 0;
+    mPixel[2] = 0;
+    mPixel[3] = 255;
+}
+
+/**
+ * Decodes the next rows of the image. Decoding stops early if the file runs
+ * out of chunks, in which case the image is incomplete
+ *
+ * \param  pDest     Buffer for the whole image, bottom row first
+ * \param  rowCount  Number of rows to decode. Rows past the bottom of the
+ *                   image are ignored
+ * \return           True if the rows were decoded
+ */
+bool QoiDecoder::decodeRows( unsigned char * pDest, int rowCount )
+{
+    assert( pDest != NULL && mpNext != NULL );
+
+    size_t pixelSize = bytesPerPixel( mDestFormat );
+    size_t pitch     = static_cast<size_t>( mInfo.width ) * pixelSize;
+    int lastRow      = std::min( mRow + rowCount, mInfo.height );
+
+    const unsigned char * pNext = mpNext;
+    unsigned char pixel[4]      = { mPixel[0], mPixel[1], mPixel[2], mPixel[3] };
+    int run                     = mRun;
+
+    for ( ; mRow < lastRow; ++mRow )
+    {
+        unsigned char * pOut = pDest + ( mInfo.height - 1 - mRow ) * pitch;
+
+        for ( int x = 0; x < mInfo.width; ++x )
+        {
+            if ( run > 0 )
+            {
+                run--;
+            }
+            else
+            {
+                if ( pNext >= mpEnd )
+                {
+                    mpNext = pNext;
+                    return false;
+                }
+
+                unsigned char chunk = *pNext++;
+
+                if ( chunk == QOI_OP_RGB )
+                {
+                    pixel[0] = pNext[0];
+                    pixel[1] = pNext[1];
+                    pixel[2] = pNext[2];
+                    pNext   += 3;
+                }
+                else if ( chunk == QOI_OP_RGBA )
+                {
+                    pixel[0] = pNext[0];
+                    pixel[1] = pNext[1];
+                    pixel[2] = pNext[2];
+                    pixel[3] = pNext[3];
+                    pNext   += 4;
+                }
+                else if ( ( chunk & QOI_TAG_MASK ) == QOI_OP_INDEX )
+                {
+                    memcpy( pixel, mIndex[chunk], 4 );
+                }
+                else if ( ( chunk & QOI_TAG_MASK ) == QOI_OP_DIFF )
+                {
+                    pixel[0] += ( ( chunk >> 4 ) & 3 ) - 2;
+                    pixel[1] += ( ( chunk >> 2 ) & 3 ) - 2;
+                    pixel[2] += (   chunk        & 3 ) - 2;
+                }
+                else if ( ( chunk & QOI_TAG_MASK ) == QOI_OP_LUMA )
+                {
+                    int green = ( chunk & 0x3F ) - 32;
+                    int next  = *pNext++;
+
+                    pixel[0] += green - 8 + ( ( next >> 4 ) & 0x0F );
+                    pixel[1] += green;
+                    pixel[2] += green - 8 + ( next & 0x0F );
+                }
+                else
+                {
+                    run = chunk & 0x3F;
+                }
+
+                memcpy( mIndex[ qoiHash( pixel ) ], pixel, 4 );
+            }
+
+            // Files hold rgba, images are bgra
+            pOut[0] = pixel[2];
+            pOut[1] = pixel[1];
+            pOut[2] = pixel[0];
+
+            if ( pixelSize == 4 )
+            {
+                pOut[3] = ( mInfo.format == PIXEL_FORMAT_BGRA8 ? pixel[3] : 255 );
+            }
+
+            pOut += pixelSize;
+        }
+    }
+
+    mpNext = pNext;
+    memcpy( mPixel, pixel, 4 );
+    mRun = run;
+
+    return true;
+}
+
+/**
+ * Decodes a whole qoi file into a caller provided buffer, with the bottom
+ * row first. The buffer must have room for width * height pixels in the
+ * destination format
+ *
+ * \param  pData       Start of the qoi file
+ * \param  size        Size of the qoi file in bytes
+ * \param  info        Header information returned by parseQoiHeader
+ * \param  destFormat  Layout to write the pixels in
+ * \param  pDest       Receives the decoded pixels
+ * \return             True if the file contained the whole image
+ */
+bool decodeQoiPixels( const unsigned char * pData,
+                      size_t size,
+                      const QoiInfo& info,
+                      PixelFormat destFormat,
+                      unsigned char * pDest )
+{
+    QoiDecoder decoder;
+    decoder.begin( pData, size, info, destFormat );
+
+    return decoder.decodeRows( pDest, info.height );
+}
+
+/**
+ * Encodes an image as qoi. Three channel images are stored with three
+ * channels, and images are always tagged as sRGB
+ *
+ * \param  image    Image to encode
+ * \param  pOutput  Receives the encoded file
+ */
+void encodeQoi( const Image& image, std::vector<unsigned char> * pOutput )
+{
+    assert( pOutput != NULL );
+
+    size_t pixelSize = bytesPerPixel( image.format );
+    size_t pitch     = static_cast<size_t>( image.width ) * pixelSize;
+    bool hasAlpha    = ( image.format == PIXEL_FORMAT_BGRA8 );
+
+    std::vector<unsigned char>& output = *pOutput;
+    output.clear();
+    output.reserve( QOI_HEADER_SIZE + image.size() / 2 + QOI_PADDING_SIZE );
+
+    output.insert( output.end(), "qoif", "qoif" + 4 );
+    writeBigEndian32( static_cast<uint32_t>( image.width ), pOutput );
+    writeBigEndian32( static_cast<uint32_t>( image.height ), pOutput );
+    output.push_back( hasAlpha ? 4 : 3 );
+    output.push_back( 0 );
+
+    unsigned char index[64][4];
+    memset( index, 0, sizeof( index ) );
+
+    unsigned char previous[4] = { 0, 0, 0, 255 };
+    int run                   = 0;
+
+    const unsigned char * pPixels = image.pixels();
+    size_t pixelCount             = static_cast<size_t>( image.width ) * image.height;
+    size_t pixelIndex             = 0;
+
+    // Files are stored top row first
+    for ( int y = image.height - 1; y >= 0; --y )
+    {
+        const unsigned char * pIn = pPixels + y * pitch;
+
+        for ( int x = 0; x < image.width; ++x, ++pixelIndex, pIn += pixelSize )
+        {
+            unsigned char pixel[4] = { pIn[2], pIn[1], pIn[0],
+                                       static_cast<unsigned char>( hasAlpha ? pIn[3] : 255 ) };
+
+            if ( memcmp( pixel, previous, 4 ) == 0 )
+            {
+                run++;
+
+                if ( run == QOI_MAX_RUN || pixelIndex + 1 == pixelCount )
+                {
+                    output.push_back( static_cast<unsigned char>( QOI_OP_RUN | ( run - 1 ) ) );
+                    run = 0;
+                }
+
+                continue;
+            }
+
+            if ( run > 0 )
+            {
+                output.push_back( static_cast<unsigned char>( QOI_OP_RUN | ( run - 1 ) ) );
+                run = 0;
+            }
+
+            unsigned int slot = qoiHash( pixel );
+
+            if ( memcmp( index[slot], pixel, 4 ) == 0 )
+            {
+                output.push_back( static_cast<unsigned char>( QOI_OP_INDEX | slot ) );
+            }
+            else if ( pixel[3] == previous[3] )
+            {
+                memcpy( index[slot], pixel, 4 );
+
+                int red        = static_cast<signed char>( pixel[0] - previous[0] );
+                int green      = static_cast<signed char>( pixel[1] - previous[1] );
+                int blue       = static_cast<signed char>( pixel[2] - previous[2] );
+                int redGreen   = red - green;
+                int blueGreen  = blue - green;
+
+                if ( red   >= -2 && red   <= 1 &&
+                     green >= -2 && green <= 1 &&
+                     blue  >= -2 && blue  <= 1 )
+                {
+                    output.push_back( static_cast<unsigned char>(
+                        QOI_OP_DIFF | ( red + 2 ) << 4 | ( green + 2 ) << 2 | ( blue + 2 ) ) );
+                }
+                else if ( green     >= -32 && green     <= 31 &&
+                          redGreen  >= -8  && redGreen  <= 7  &&
+                          blueGreen >= -8  && blueGreen <= 7 )
+                {
+                    output.push_back( static_cast<unsigned char>( QOI_OP_LUMA | ( green + 32 ) ) );
+                    output.push_back( static_cast<unsigned char>( ( redGreen + 8 ) << 4 | ( blueGreen + 8 ) ) );
+                }
+                else
+                {
+                    output.push_back( QOI_OP_RGB );
+                    output.insert( output.end(), pixel, pixel + 3 );
+                }
+            }
+            else
+            {
+                memcpy( index[slot], pixel, 4 );
+
+                output.push_back( QOI_OP_RGBA );
+                output.insert( output.end(), pixel, pixel + 4 );
+            }
+
+            memcpy( previous, pixel, 4 );
+        }
+    }
+
+    output.insert( output.end(), QOI_PADDING, QOI_PADDING + QOI_PADDING_SIZE );
+}
+
+/**
+ * Encodes an image and writes it to a qoi file
+ *
+ * \param  filename  Path to write the file to
+ * \param  image     Image to write
+ * \return           True if the file was written
+ */
+bool writeQoi( const std::string& filename, const Image& image )
+{
+    std::vector<unsigned char> encoded;
+    encodeQoi( image, &encoded );
+
+    FILE * pFile = fopen( filename.c_str(), "wb" );
+
+    if ( pFile == NULL )
+    {
+        fprintf( stderr, "Unable to open %s for writing\n", filename.c_str() );
+        return false;
+    }
+
+    bool ok = fwrite( &encoded[0], 1, encoded.size(), pFile ) == encoded.size();
+    ok      = ( fclose( pFile ) == 0 ) && ok;
+
+    if (! ok )
+    {
+        fprintf( stderr, "Unable to write %s\n", filename.c_str() );
+    }
+
+    return ok;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_QOI_H
+#define SCOTT_GFXSANDBOX_QOI_H
+
+#include "tga.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Information from a qoi file's header
+ */
+struct QoiInfo
+{
+    QoiInfo()
+        : width( 0 ),
+          height( 0 ),
+          format( PIXEL_FORMAT_BGR8 )
+    {
+    }
+
+    int width;
+    int height;
+    PixelFormat format;     // BGR8 for three channel files, BGRA8 for four
+};
+
+/**
+ * Decodes the pixels of a qoi ("Quite OK Image") file a few rows at a time.
+ * The decoder keeps its place between calls, so a large image can be decoded
+ * into an upload staging buffer in chunks (eg while earlier rows are already
+ * being copied) without ever holding a second copy of the pixels.
+ *
+ * Rows come out of the file top row first, and are written into the image's
+ * bottom row first layout as they are decoded.
+ */
+class QoiDecoder
+{
+public:
+    QoiDecoder();
+
+    // Start decoding a file whose header has already been parsed
+    void begin( const unsigned char * pData,
+                size_t size,
+                const QoiInfo& info,
+                PixelFormat destFormat );
+
+    // Decode the next rows into an image sized buffer
+    bool decodeRows( unsigned char * pDest, int rowCount );
+
+    // Number of rows decoded so far
+    int rowsDecoded() const { return mRow; }
+
+    // True once every row has been decoded
+    bool isFinished() const { return mRow >= mInfo.height; }
+
+private:
+    const unsigned char * mpNext;
+    const unsigned char * mpEnd;
+    QoiInfo mInfo;
+    PixelFormat mDestFormat;
+    unsigned char mIndex[64][4];    // recently seen pixels, as rgba
+    unsigned char mPixel[4];        // previous pixel, as rgba
+    int mRun;                       // repeats of mPixel still to write
+    int mRow;
+};
+
+// Check if a buffer starts with the qoi magic bytes
+bool isQoiData( const unsigned char * pData, size_t size );
+
+// Parse a qoi header, checking that it is an image we can decode
+bool parseQoiHeader( const unsigned char * pData,
+                     size_t size,
+                     const char * name,
+                     QoiInfo * pInfo );
+
+// Decode every pixel of a qoi file into a buffer, as BGR8 or BGRA8
+bool decodeQoiPixels( const unsigned char * pData,
+                      size_t size,
+                      const QoiInfo& info,
+                      PixelFormat destFormat,
+                      unsigned char * pDest );
+
+// Encode an image as qoi
+void encodeQoi( const Image& image, std::vector<unsigned char> * pOutput );
+
+// Encode an image and write it to a qoi file
+bool writeQoi( const std::string& filename, const Image& image );
+
+#endif
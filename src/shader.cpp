@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 #include "shader.h"
+#include "assetpack.h"
 #include "glutil.h"
+#include "shadersource.h"
 #include "util.h"
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <GL/glew.h>
 #ifdef __APPLE__
@@ -27,76 +32,464 @@
 #include <GL/glut.h>
 #endif
 
+// Directory compiled program binaries are cached in. Empty disables caching
+static std::string GShaderCacheDirectory = "shadercache";
+
+// Counters describing how well the program binary cache is working
+static ShaderCacheStats GShaderCacheStats;
+
+static GLuint submitShader( GLenum type, const std::string& source );
+
 /**
- * Creates a new shader object by loading the requested vertex shader and
- * fragment shader. The engine will load both of these from disk, compile them
- * and then assemble the final shader program.
+ * Sets the directory that linked program binaries are cached in. Passing an
+ * empty string turns the cache off
+ */
+void setShaderCacheDirectory( const std::string& directory )
+{
+    GShaderCacheDirectory = directory;
+}
+
+/**
+ * Returns the cache hit and miss counts since the program started
+ */
+ShaderCacheStats shaderCacheStats()
+{
+    return GShaderCacheStats;
+}
+
+/**
+ * Checks if the driver can save and restore linked programs
+ */
+static bool isProgramBinarySupported()
+{
+    if (! GLEW_VERSION_4_1 && ! GLEW_ARB_get_program_binary )
+    {
+        return false;
+    }
+
+    // Some drivers expose the extension without supporting any formats
+    GLint formatCount = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount );
+
+    return formatCount > 0;
+}
+
+/**
+ * Works out where the cached binary for a pair of shader sources lives. The
+ * key covers the sources and the driver, since binaries are only valid for
+ * the driver build that produced them
+ */
+static std::string programCachePath( const std::string& vertexSource,
+                                     const std::string& fragmentSource )
+{
+    const GLenum DRIVER_STRINGS[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    uint64_t hash = HASH_SEED;
+
+    for ( size_t i = 0; i < sizeof( DRIVER_STRINGS ) / sizeof( GLenum ); ++i )
+    {
+        const GLubyte * pValue = glGetString( DRIVER_STRINGS[i] );
+
+        if ( pValue != NULL )
+        {
+            hash = hashData( pValue, strlen( reinterpret_cast<const char*>( pValue ) ), hash );
+        }
+    }
+
+    // Hash the lengths too so that moving text between the two shaders
+    // changes the key
+    uint64_t lengths[2] = { vertexSource.size(), fragmentSource.size() };
+
+    hash = hashData( lengths, sizeof( lengths ), hash );
+    hash = hashData( vertexSource.data(), vertexSource.size(), hash );
+    hash = hashData( fragmentSource.data(), fragmentSource.size(), hash );
+
+    char name[32];
+    snprintf( name, sizeof( name ), "%016llx.bin", static_cast<unsigned long long>( hash ) );
+
+    return GShaderCacheDirectory + "/" + name;
+}
+
+/**
+ * Checks if the driver still accepts a program binary format. Formats go away
+ * when the driver is updated, and passing one of those to glProgramBinary
+ * raises GL_INVALID_ENUM, which debug output would report as a real error
+ */
+static bool isProgramBinaryFormatSupported( GLenum format )
+{
+    GLint count = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &count );
+
+    if ( count <= 0 )
+    {
+        return false;
+    }
+
+    std::vector<GLint> formats( count );
+    glGetIntegerv( GL_PROGRAM_BINARY_FORMATS, &formats[0] );
+
+    for ( size_t i = 0; i < formats.size(); ++i )
+    {
+        if ( static_cast<GLenum>( formats[i] ) == format )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Tries to create a program from a cached binary. The cache file holds the
+ * binary format enum followed by the binary itself
  *
- * \param  vertexShader    Path to the vertex shader
- * \param  fragmentShader  Path to the fragment shader
- * \return                 Shader object containing details on the shader
+ * \param  path      Path to the cached binary
+ * \param  pProgram  Receives the program if the binary was accepted
+ * \return           True if the cached binary was loaded
  */
-Shader loadShaderProgram( const std::string& vertexShader,
-                          const std::string& fragmentShader )
+static bool loadProgramBinary( const std::string& path, GLuint * pProgram )
 {
-    Shader shader;
+    MappedFile file;
 
-    // First attempt to load and compile the requested vertex and fragment
-    // shaders
-    shader.vertexShader   = loadShader( GL_VERTEX_SHADER, vertexShader );
-    shader.fragmentShader = loadShader( GL_FRAGMENT_SHADER, fragmentShader ); 
+    if (! file.open( path ) || file.size() <= sizeof( GLenum ) )
+    {
+        return false;
+    }
 
-    // Generate a new shader program
-    shader.program = glCreateProgram();
+    GLenum format = 0;
+    memcpy( &format, file.data(), sizeof( format ) );
 
-    // Attach the vertex and fragment shaders
-    glAttachShader( shader.program, shader.vertexShader );
-    glAttachShader( shader.program, shader.fragmentShader );
-    glLinkProgram( shader.program );
+    if (! isProgramBinaryFormatSupported( format ) )
+    {
+        GShaderCacheStats.rejected++;
+        remove( path.c_str() );
+
+        return false;
+    }
 
-    errorCheck( "Linking shader" );
+    GLuint program = glCreateProgram();
+    glProgramBinary( program,
+                     format,
+                     file.data() + sizeof( format ),
+                     static_cast<GLsizei>( file.size() - sizeof( format ) ) );
 
-    // Check if we were able to succesfully create the shader program
+    // The driver is allowed to reject a binary in a supported format for any
+    // reason (eg corrupt data). That fails the link without raising an error,
+    // so check the link status like we would after compiling
     GLint ok = 0;
-    glGetProgramiv( shader.program, GL_LINK_STATUS, &ok );
+    glGetProgramiv( program, GL_LINK_STATUS, &ok );
 
     if (! ok )
     {
-        std::string message =
-            showInfoLog( shader.program, glGetProgramiv, glGetProgramInfoLog );
+        glDeleteProgram( program );
 
-        std::cerr << "Failed to link shader program" << std::endl;
-        std::cerr << "ERROR: " << message << std::endl;
+        GShaderCacheStats.rejected++;
+        remove( path.c_str() );
 
-        exit( 1 );
+        return false;
     }
 
-    return shader;
+    *pProgram = program;
+    return true;
 }
 
 /**
- * Loads a GLSL shader from disk, compiles it and returns it's assigned object
- * id
+ * Saves a linked program's binary to the cache
+ */
+static void saveProgramBinary( const std::string& path, GLuint program )
+{
+    GLint length = 0;
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+
+    if ( length <= 0 || !makeDirectory( GShaderCacheDirectory ) )
+    {
+        return;
+    }
+
+    std::vector<unsigned char> binary( length );
+    GLenum format = 0;
+
+    glGetProgramBinary( program, length, &length, &format, &binary[0] );
+
+    if ( checkGlFailure( "Reading program binary" ) )
+    {
+        return;
+    }
+
+    FILE * pFile = fopen( path.c_str(), "wb" );
+
+    if ( pFile == NULL )
+    {
+        return;
+    }
+
+    bool ok = fwrite( &format, sizeof( format ), 1, pFile ) == 1 &&
+              fwrite( &binary[0], 1, length, pFile ) == static_cast<size_t>( length );
+    fclose( pFile );
+
+    if ( ok )
+    {
+        GShaderCacheStats.writes++;
+    }
+    else
+    {
+        remove( path.c_str() );
+    }
+}
+
+/**
+ * Returns the compile log of a shader if it failed to compile, or an empty
+ * string if it compiled. Shaders built from several files also list which
+ * file each source string number in the log refers to
+ */
+static std::string shaderCompileError( GLuint shader,
+                                       const std::string& name,
+                                       const ShaderSource& source )
+{
+    GLint ok = 0;
+    glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+
+    if ( ok )
+    {
+        return std::string();
+    }
+
+    std::string error = "Failed to compile " + name + ": " +
+                        showInfoLog( shader, glGetShaderiv, glGetShaderInfoLog );
+
+    if ( source.files.size() > 1 )
+    {
+        error += "\n" + describeShaderSourceFiles( source );
+    }
+
+    return error;
+}
+
+/**
+ * Blocks until the driver has finished compiling and linking every program.
+ * With KHR_parallel_shader_compile the driver does this on its own threads,
+ * and we can poll for completion instead of stalling on the first program
+ */
+static void waitForPrograms( const std::vector<ShaderBuildResult>& results )
+{
+    if (! GLEW_KHR_parallel_shader_compile )
+    {
+        return;     // the status queries will block as needed
+    }
+
+    for ( size_t i = 0; i < results.size(); )
+    {
+        GLint done = GL_TRUE;
+
+        if ( results[i].ok && results[i].shader.program != 0 )
+        {
+            glGetProgramiv( results[i].shader.program, GL_COMPLETION_STATUS_KHR, &done );
+        }
+
+        if ( done )
+        {
+            ++i;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * Builds a batch of shader programs. Every compile and link is submitted to
+ * the driver before any status is queried, so drivers that compile in the
+ * background can work on all of them at once. When KHR_parallel_shader_compile
+ * is available the driver is told to use as many threads as it likes.
  *
- * \param  type      The type of OpenGL shader to create
- * \param  filename  Path to the shader code
- * \return           Shader's object id
+ * Linked programs are cached on disk, keyed by their source code and the
+ * driver. When a cached binary is accepted by the driver nothing is compiled,
+ * and the program has no vertex or fragment shader objects.
+ *
+ * Failures don't stop the batch. Each result says whether its program was
+ * built, and if not why.
+ *
+ * \param  programs  Descriptions of the programs to build
+ * \return           One result per description, in the same order
  */
-GLuint loadShader( GLenum type, const std::string& filename )
+std::vector<ShaderBuildResult> loadShaderPrograms(
+        const std::vector<ShaderProgramDesc>& programs )
 {
-    std::cout << "Loading shader: " << filename << std::endl;
+    std::vector<ShaderBuildResult> results( programs.size() );
+    std::vector<ShaderSource> vertexSources( programs.size() );
+    std::vector<ShaderSource> fragmentSources( programs.size() );
+    std::vector<std::string> cachePaths( programs.size() );
 
-    // Load the shader source code from disk and verify that everything went
-    // according to plan
-    bool didWork = false;
-    std::string source = loadTextFile( filename, &didWork );
+    bool useCache = !GShaderCacheDirectory.empty() && isProgramBinarySupported();
+
+    if ( GLEW_KHR_parallel_shader_compile )
+    {
+        glMaxShaderCompilerThreadsKHR( 0xFFFFFFFF );
+    }
+
+    // Expand every source file, and take any programs we can from the cache.
+    // Files shared between programs are only read and expanded once
+    for ( size_t i = 0; i < programs.size(); ++i )
+    {
+        const ShaderProgramDesc& desc = programs[i];
+        ShaderBuildResult& result     = results[i];
+        result.ok = true;
+
+        if (! loadShaderSource( desc.vertexShader, desc.defines,
+                                &vertexSources[i], &result.error ) ||
+            ! loadShaderSource( desc.fragmentShader, desc.defines,
+                                &fragmentSources[i], &result.error ) )
+        {
+            result.ok = false;
+        }
+        else if ( useCache )
+        {
+            cachePaths[i] = programCachePath( vertexSources[i].text, fragmentSources[i].text );
+
+            if ( loadProgramBinary( cachePaths[i], &result.shader.program ) )
+            {
+                GShaderCacheStats.hits++;
+                result.fromCache = true;
+            }
+            else
+            {
+                GShaderCacheStats.misses++;
+            }
+        }
+    }
+
+    // Submit all of the compiles without checking on any of them
+    for ( size_t i = 0; i < programs.size(); ++i )
+    {
+        ShaderBuildResult& result = results[i];
+
+        if ( result.ok && !result.fromCache )
+        {
+            result.shader.vertexShader =
+                submitShader( GL_VERTEX_SHADER, vertexSources[i].text );
+            result.shader.fragmentShader =
+                submitShader( GL_FRAGMENT_SHADER, fragmentSources[i].text );
+        }
+    }
+
+    // Then all of the links. The driver waits for each program's shaders
+    // itself, which still lets it overlap work across programs
+    for ( size_t i = 0; i < programs.size(); ++i )
+    {
+        Shader& shader = results[i].shader;
+
+        if ( results[i].ok && !results[i].fromCache )
+        {
+            shader.program = glCreateProgram();
+
+            if ( useCache )
+            {
+                glProgramParameteri( shader.program,
+                                     GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                     GL_TRUE );
+            }
+
+            glAttachShader( shader.program, shader.vertexShader );
+            glAttachShader( shader.program, shader.fragmentShader );
+            glLinkProgram( shader.program );
+        }
+    }
+
+    errorCheck( "Linking shader batch", false );
+    waitForPrograms( results );
+
+    // Now collect the results, and save anything new to the cache
+    for ( size_t i = 0; i < programs.size(); ++i )
+    {
+        ShaderBuildResult& result = results[i];
+
+        if (! result.ok || result.fromCache )
+        {
+            continue;
+        }
+
+        GLint ok = 0;
+        glGetProgramiv( result.shader.program, GL_LINK_STATUS, &ok );
+
+        if ( ok )
+        {
+            if ( useCache )
+            {
+                saveProgramBinary( cachePaths[i], result.shader.program );
+            }
+
+            continue;
+        }
+
+        // Linking fails when either shader failed to compile, and the compile
+        // log is much more useful than the link log in that case
+        result.ok    = false;
+        result.error = shaderCompileError( result.shader.vertexShader,
+                                           programs[i].vertexShader,
+                                           vertexSources[i] );
 
-    if (! didWork )
+        if ( result.error.empty() )
+        {
+            result.error = shaderCompileError( result.shader.fragmentShader,
+                                               programs[i].fragmentShader,
+                                               fragmentSources[i] );
+        }
+
+        if ( result.error.empty() )
+        {
+            result.error = "Failed to link shader program: " +
+                showInfoLog( result.shader.program, glGetProgramiv, glGetProgramInfoLog );
+        }
+
+        glDeleteProgram( result.shader.program );
+        glDeleteShader( result.shader.vertexShader );
+        glDeleteShader( result.shader.fragmentShader );
+        result.shader = Shader();
+    }
+
+    return results;
+}
+
+/**
+ * Creates a new shader object by loading the requested vertex shader and
+ * fragment shader. The engine will load both of these from disk, compile them
+ * and then assemble the final shader program. Exits if anything goes wrong.
+ *
+ * \param  vertexShader    Path to the vertex shader
+ * \param  fragmentShader  Path to the fragment shader
+ * \param  defines         Defines added to both shaders, as "NAME" or "NAME=VALUE"
+ * \return                 Shader object containing details on the shader
+ */
+Shader loadShaderProgram( const std::string& vertexShader,
+                          const std::string& fragmentShader,
+                          const std::vector<std::string>& defines )
+{
+    std::vector<ShaderProgramDesc> programs( 1 );
+    programs[0].vertexShader   = vertexShader;
+    programs[0].fragmentShader = fragmentShader;
+    programs[0].defines        = defines;
+
+    ShaderBuildResult result = loadShaderPrograms( programs )[0];
+
+    if (! result.ok )
     {
-        std::cerr << "Failed to load shader from disk: " << filename << std::endl;
+        std::cerr << "ERROR: " << result.error << std::endl;
         exit( 1 );
     }
-    
+
+    return result.shader;
+}
+
+/**
+ * Creates a shader object and starts compiling it without waiting for the
+ * result
+ *
+ * \param  type    The type of OpenGL shader to create
+ * \param  source  The shader's source code
+ * \return         Shader's object id
+ */
+static GLuint submitShader( GLenum type, const std::string& source )
+{
     // Generate a new shader object
     GLuint shader = glCreateShader( type );
 
@@ -110,17 +503,36 @@ GLuint loadShader( GLenum type, const std::string& filename )
     glShaderSource( shader, 1, &pSource, &sourceLength );
     glCompileShader( shader );
 
-    // Check to see if the shader successfully compiled. If it didn't, go figure
-    // out why
-    GLint ok = 0;
-    glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+    return shader;
+}
 
-    if (! ok )
+/**
+ * Loads a GLSL shader from disk, compiles it and returns it's assigned object
+ * id
+ *
+ * \param  type      The type of OpenGL shader to create
+ * \param  filename  Path to the shader code
+ * \return           Shader's object id
+ */
+GLuint loadShader( GLenum type, const std::string& filename )
+{
+    // Load the shader source code from disk and verify that everything went
+    // according to plan
+    ShaderSource source;
+    std::string error;
+
+    if (! loadShaderSource( filename, std::vector<std::string>(), &source, &error ) )
     {
-        std::cerr << "Failed to compile: " << filename << std::endl;
-        std::string error = showInfoLog( shader, glGetShaderiv, glGetShaderInfoLog );
-        std::cerr << "ERROR: " << error << std::endl;
+        std::cerr << error << std::endl;
+        exit( 1 );
+    }
 
+    GLuint shader = submitShader( type, source.text );
+    error         = shaderCompileError( shader, filename, source );
+
+    if (! error.empty() )
+    {
+        std::cerr << "ERROR: " << error << std::endl;
         exit( 1 );
     }
 
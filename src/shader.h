@@ -16,6 +16,7 @@
 #ifndef SCOTT_GFXSANDBOX_SHADER_H
 #define SCOTT_GFXSANDBOX_SHADER_H
 #include <string>
+#include <vector>
 #include <GL/glew.h>
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -44,8 +45,63 @@ struct Shader
     GLuint fragmentShader;
 };
 
+/**
+ * Describes a shader program to build with loadShaderPrograms
+ */
+struct ShaderProgramDesc
+{
+    std::string vertexShader;       // path to the vertex shader
+    std::string fragmentShader;     // path to the fragment shader
+    std::vector<std::string> defines;   // added to both, "NAME" or "NAME=VALUE"
+};
+
+/**
+ * Outcome of building one program in a batch
+ */
+struct ShaderBuildResult
+{
+    ShaderBuildResult()
+        : shader(),
+          ok( false ),
+          fromCache( false ),
+          error()
+    {
+    }
+
+    Shader shader;
+    bool ok;                // true if the program is ready to use
+    bool fromCache;         // true if it came from a cached binary
+    std::string error;      // why the program failed to build
+};
+
+/**
+ * Counters for the on disk program binary cache
+ */
+struct ShaderCacheStats
+{
+    ShaderCacheStats()
+        : hits( 0 ),
+          misses( 0 ),
+          rejected( 0 ),
+          writes( 0 )
+    {
+    }
+
+    unsigned int hits;          // programs loaded from a cached binary
+    unsigned int misses;        // programs that had to be compiled
+    unsigned int rejected;      // cached binaries the driver refused
+    unsigned int writes;        // binaries written to the cache
+};
+
 GLuint loadShader( GLenum type, const std::string& filename );
 Shader loadShaderProgram( const std::string& vertexShader,
-                          const std::string& fragmentShader );
+                          const std::string& fragmentShader,
+                          const std::vector<std::string>& defines =
+                              std::vector<std::string>() );
+std::vector<ShaderBuildResult> loadShaderPrograms(
+        const std::vector<ShaderProgramDesc>& programs );
+
+void setShaderCacheDirectory( const std::string& directory );
+ShaderCacheStats shaderCacheStats();
 
 #endif
@@ -0,0 +1,550 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "shadersource.h"
+#include "assetpack.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Includes nested deeper than this are assumed to be a mistake
+const size_t MAX_INCLUDE_DEPTH = 16;
+
+/**
+ * A shader file as it was last read. Files on disk are checked against their
+ * size and modification time before being reused, while files in the pack
+ * can't change under us
+ */
+struct ShaderFile
+{
+    std::string text;
+    uint64_t hash;              // hashData of the text
+    time_t modifiedTime;
+    off_t size;
+    bool fromPack;
+};
+
+/**
+ * An expanded shader and the content hash of every file that went into it.
+ * The expansion is only reused while all of those hashes still match
+ */
+struct ShaderExpansion
+{
+    ShaderSource source;
+    std::vector<std::pair<std::string, uint64_t> > dependencies;
+};
+
+/**
+ * State shared by every file in one expansion
+ */
+struct ExpandState
+{
+    const std::vector<std::string> * pDefines;
+    ShaderExpansion * pExpansion;
+    std::vector<std::string> includeStack;  // files being expanded right now
+    int lineOffset;                         // 1 if #line names the line before
+    std::string error;
+};
+
+static std::mutex GShaderSourceMutex;
+static std::map<std::string, ShaderFile> GShaderFiles;
+static std::map<uint64_t, ShaderExpansion> GShaderExpansions;
+static ShaderSourceStats GShaderSourceStats;
+
+// Loose files are read through one view, so its read buffer is reused
+static MappedFile GShaderReadFile;
+
+/**
+ * Returns the text of a shader file, reading it only if it isn't cached or
+ * has changed since it was cached. Entries in the asset pack take priority
+ * over loose files. Must be called with the cache locked
+ *
+ * \param  filename  Path to the file
+ * \param  ppFile    Receives the cached file
+ * \return           True if the file could be read
+ */
+static bool readShaderFile( const std::string& filename, const ShaderFile ** ppFile )
+{
+    std::map<std::string, ShaderFile>::iterator itr = GShaderFiles.find( filename );
+
+    if ( itr != GShaderFiles.end() && itr->second.fromPack )
+    {
+        *ppFile = &itr->second;
+        return true;
+    }
+
+    ShaderFile file;
+    file.modifiedTime = 0;
+    file.size         = 0;
+    file.fromPack     = GAssetPack.loadText( filename, &file.text );
+
+    if ( file.fromPack )
+    {
+        std::cout << "Loading shader: " << filename << " (from pack)" << std::endl;
+    }
+    else
+    {
+        struct stat info;
+
+        if ( stat( filename.c_str(), &info ) != 0 )
+        {
+            return false;
+        }
+
+        if ( itr != GShaderFiles.end() &&
+             itr->second.modifiedTime == info.st_mtime &&
+             itr->second.size == info.st_size )
+        {
+            *ppFile = &itr->second;
+            return true;
+        }
+
+        std::cout << "Loading shader: " << filename << std::endl;
+
+        if (! loadTextFile( filename, &GShaderReadFile, &file.text ) )
+        {
+            return false;
+        }
+
+        file.modifiedTime = info.st_mtime;
+        file.size         = info.st_size;
+    }
+
+    GShaderSourceStats.fileReads++;
+    file.hash = hashData( file.text.data(), file.text.size() );
+
+    ShaderFile& cached = GShaderFiles[filename];
+    cached  = std::move( file );
+    *ppFile = &cached;
+
+    return true;
+}
+
+/**
+ * Works out the path of an included file. Includes are relative to the
+ * directory of the file that includes them, and "." and ".." are collapsed so
+ * that the result matches the names used in the asset pack
+ */
+static std::string resolveIncludePath( const std::string& includer,
+                                       const std::string& name )
+{
+    std::string path = name;
+
+    if ( name.empty() || name[0] != '/' )
+    {
+        size_t slash = includer.rfind( '/' );
+        path = ( slash == std::string::npos ? std::string() :
+                                              includer.substr( 0, slash + 1 ) ) + name;
+    }
+
+    std::vector<std::string> parts;
+    size_t start = 0;
+
+    while ( start <= path.size() )
+    {
+        size_t end = path.find( '/', start );
+        end        = ( end == std::string::npos ) ? path.size() : end;
+
+        std::string part = path.substr( start, end - start );
+
+        if ( part == ".." && !parts.empty() && parts.back() != ".." && !parts.back().empty() )
+        {
+            parts.pop_back();
+        }
+        else if ( part != "." && !( part.empty() && !parts.empty() ) )
+        {
+            parts.push_back( part );
+        }
+
+        start = end + 1;
+    }
+
+    std::string resolved;
+
+    for ( size_t i = 0; i < parts.size(); ++i )
+    {
+        resolved += ( i > 0 ? "/" : "" ) + parts[i];
+    }
+
+    return resolved;
+}
+
+/**
+ * Checks if a line starts with the given preprocessor directive. Whitespace
+ * is allowed before and after the '#', as in the GLSL preprocessor
+ *
+ * \param  text       Text containing the line
+ * \param  start      Index of the first character of the line
+ * \param  end        Index one past the last character of the line
+ * \param  directive  Name of the directive, eg "include"
+ * \param  pArgument  Receives the index just after the directive's name
+ * \return            True if the line holds the directive
+ */
+static bool isDirective( const std::string& text,
+                         size_t start,
+                         size_t end,
+                         const char * directive,
+                         size_t * pArgument )
+{
+    size_t i = start;
+
+    while ( i < end && ( text[i] == ' ' || text[i] == '\t' ) )
+    {
+        ++i;
+    }
+
+    if ( i == end || text[i] != '#' )
+    {
+        return false;
+    }
+
+    ++i;
+
+    while ( i < end && ( text[i] == ' ' || text[i] == '\t' ) )
+    {
+        ++i;
+    }
+
+    size_t length = strlen( directive );
+
+    if ( end - i < length || text.compare( i, length, directive ) != 0 )
+    {
+        return false;
+    }
+
+    i += length;
+
+    // Don't match longer names, eg #includes
+    if ( i < end && ( isalnum( static_cast<unsigned char>( text[i] ) ) || text[i] == '_' ) )
+    {
+        return false;
+    }
+
+    *pArgument = i;
+    return true;
+}
+
+/**
+ * Returns the GLSL version a shader asks for, or 0 if it has no #version line
+ */
+static int shaderVersion( const std::string& text )
+{
+    size_t start = 0;
+
+    while ( start < text.size() )
+    {
+        size_t end = text.find( '\n', start );
+        end        = ( end == std::string::npos ) ? text.size() : end;
+        size_t argument = 0;
+
+        if ( isDirective( text, start, end, "version", &argument ) )
+        {
+            return atoi( text.c_str() + argument );
+        }
+
+        start = end + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a #line directive that makes the next line report as the given line
+ * of the given file. Before GLSL 3.30 the directive names the line before it
+ */
+static void appendLineDirective( std::string * pText,
+                                 int line,
+                                 size_t sourceIndex,
+                                 const ExpandState& state )
+{
+    char directive[64];
+    snprintf( directive, sizeof( directive ), "#line %d %zu\n",
+              line - state.lineOffset, sourceIndex );
+
+    pText->append( directive );
+}
+
+/**
+ * Writes the defines of an expansion as #define directives
+ */
+static void appendDefines( std::string * pText, const ExpandState& state )
+{
+    for ( size_t i = 0; i < state.pDefines->size(); ++i )
+    {
+        std::string define = (*state.pDefines)[i];
+        size_t equals      = define.find( '=' );
+
+        if ( equals != std::string::npos )
+        {
+            define[equals] = ' ';
+        }
+
+        pText->append( "#define " + define + "\n" );
+    }
+}
+
+/**
+ * Appends a file to an expansion, recursively expanding its #include lines.
+ * The first file expanded is the root, and the defines go right after its
+ * #version line. Must be called with the cache locked
+ *
+ * \param  filename  Path to the file to expand
+ * \param  pState    The expansion being built
+ * \return           True if the file and everything it includes was expanded
+ */
+static bool expandShaderFile( const std::string& filename, ExpandState * pState )
+{
+    ShaderSource& source = pState->pExpansion->source;
+    std::vector<std::string>& stack = pState->includeStack;
+    bool isRoot = stack.empty();
+
+    if ( std::find( stack.begin(), stack.end(), filename ) != stack.end() )
+    {
+        pState->error = stack.back() + " includes itself through " + filename;
+        return false;
+    }
+
+    if ( stack.size() >= MAX_INCLUDE_DEPTH )
+    {
+        pState->error = "Includes nested too deeply at " + filename;
+        return false;
+    }
+
+    const ShaderFile * pFile = NULL;
+
+    if (! readShaderFile( filename, &pFile ) )
+    {
+        pState->error = "Failed to load shader from disk: " + filename;
+        return false;
+    }
+
+    // Copied because the cache entry is replaced if the file is read again
+    const std::string text = pFile->text;
+    size_t sourceIndex     = std::find( source.files.begin(),
+                                        source.files.end(),
+                                        filename ) - source.files.begin();
+
+    if ( sourceIndex == source.files.size() )
+    {
+        source.files.push_back( filename );
+        pState->pExpansion->dependencies.push_back( std::make_pair( filename, pFile->hash ) );
+    }
+
+    if (! isRoot )
+    {
+        appendLineDirective( &source.text, 1, sourceIndex, *pState );
+    }
+
+    // Without a #version line the defines have to come first
+    bool needsDefines = isRoot && !pState->pDefines->empty();
+
+    if ( needsDefines && shaderVersion( text ) == 0 )
+    {
+        appendDefines( &source.text, *pState );
+        appendLineDirective( &source.text, 1, sourceIndex, *pState );
+        needsDefines = false;
+    }
+
+    stack.push_back( filename );
+
+    size_t start = 0;
+    int line     = 1;
+
+    while ( start < text.size() )
+    {
+        size_t end = text.find( '\n', start );
+        end        = ( end == std::string::npos ) ? text.size() : end;
+        size_t argument = 0;
+
+        if ( isDirective( text, start, end, "include", &argument ) )
+        {
+            size_t open  = text.find( '"', argument );
+            size_t close = ( open < end ) ? text.find( '"', open + 1 ) : std::string::npos;
+
+            if ( open >= end || close >= end )
+            {
+                char location[32];
+                snprintf( location, sizeof( location ), ":%d: ", line );
+                pState->error = filename + location + "malformed #include";
+                return false;
+            }
+
+            std::string name = text.substr( open + 1, close - open - 1 );
+
+            if (! expandShaderFile( resolveIncludePath( filename, name ), pState ) )
+            {
+                return false;
+            }
+
+            appendLineDirective( &source.text, line + 1, sourceIndex, *pState );
+        }
+        else
+        {
+            source.text.append( text, start, end - start );
+            source.text.push_back( '\n' );
+
+            if ( needsDefines && isDirective( text, start, end, "version", &argument ) )
+            {
+                appendDefines( &source.text, *pState );
+                appendLineDirective( &source.text, line + 1, sourceIndex, *pState );
+                needsDefines = false;
+            }
+        }
+
+        start = end + 1;
+        line++;
+    }
+
+    stack.pop_back();
+    return true;
+}
+
+/**
+ * Checks that every file an expansion was built from still has the same
+ * contents. Must be called with the cache locked
+ */
+static bool isExpansionCurrent( const ShaderExpansion& expansion )
+{
+    for ( size_t i = 0; i < expansion.dependencies.size(); ++i )
+    {
+        const ShaderFile * pFile = NULL;
+
+        if (! readShaderFile( expansion.dependencies[i].first, &pFile ) ||
+              pFile->hash != expansion.dependencies[i].second )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Loads a shader and runs the parts of the preprocessor that the driver
+ * can't: #include "file" lines are replaced with the file's contents, and
+ * the defines are added after the #version line. Everything else, including
+ * any #ifdef on the defines, is left for the driver.
+ *
+ * Files are read once and then only checked for changes. Expanded sources
+ * are cached by the content hash of the root file and the defines, so
+ * building many variants of a shader only preprocesses each one once.
+ *
+ * \param  filename  Path to the shader
+ * \param  defines   Defines to add, as "NAME" or "NAME=VALUE"
+ * \param  pSource   Receives the expanded source
+ * \param  pError    Receives why the shader couldn't be loaded
+ * \return           True if the shader and all of its includes were loaded
+ */
+bool loadShaderSource( const std::string& filename,
+                       const std::vector<std::string>& defines,
+                       ShaderSource * pSource,
+                       std::string * pError )
+{
+    std::lock_guard<std::mutex> lock( GShaderSourceMutex );
+    const ShaderFile * pRoot = NULL;
+
+    if (! readShaderFile( filename, &pRoot ) )
+    {
+        *pError = "Failed to load shader from disk: " + filename;
+        return false;
+    }
+
+    // Includes are relative to the root, so its path is part of the key
+    uint64_t key = hashData( filename.data(), filename.size() );
+    key = hashData( &pRoot->hash, sizeof( pRoot->hash ), key );
+
+    for ( size_t i = 0; i < defines.size(); ++i )
+    {
+        key = hashData( defines[i].c_str(), defines[i].size() + 1, key );
+    }
+
+    std::map<uint64_t, ShaderExpansion>::iterator itr = GShaderExpansions.find( key );
+
+    if ( itr != GShaderExpansions.end() && isExpansionCurrent( itr->second ) )
+    {
+        GShaderSourceStats.hits++;
+        *pSource = itr->second.source;
+        return true;
+    }
+
+    ExpandState state;
+    ShaderExpansion expansion;
+
+    state.pDefines   = &defines;
+    state.pExpansion = &expansion;
+    // Shaders without a #version line are GLSL 1.10
+    state.lineOffset = ( shaderVersion( pRoot->text ) < 330 ) ? 1 : 0;
+
+    if (! expandShaderFile( filename, &state ) )
+    {
+        *pError = state.error;
+        return false;
+    }
+
+    GShaderSourceStats.expansions++;
+    *pSource = expansion.source;
+    GShaderExpansions[key] = std::move( expansion );
+
+    return true;
+}
+
+/**
+ * Lists the files of an expanded shader by their source string number, for
+ * making sense of compile logs
+ */
+std::string describeShaderSourceFiles( const ShaderSource& source )
+{
+    std::string description;
+
+    for ( size_t i = 0; i < source.files.size(); ++i )
+    {
+        char number[32];
+        snprintf( number, sizeof( number ), "  source %zu: ", i );
+
+        description += number + source.files[i] + "\n";
+    }
+
+    return description;
+}
+
+/**
+ * Forgets every cached file and expansion, so the next load reads everything
+ * again
+ */
+void clearShaderSourceCache()
+{
+    std::lock_guard<std::mutex> lock( GShaderSourceMutex );
+
+    GShaderFiles.clear();
+    GShaderExpansions.clear();
+}
+
+/**
+ * Returns how often files were read and sources expanded since the program
+ * started
+ */
+ShaderSourceStats shaderSourceStats()
+{
+    std::lock_guard<std::mutex> lock( GShaderSourceMutex );
+    return GShaderSourceStats;
+}
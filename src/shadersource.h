@@ -0,0 +1,65 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_SHADERSOURCE_H
+#define SCOTT_GFXSANDBOX_SHADERSOURCE_H
+
+#include <string>
+#include <vector>
+
+/**
+ * A shader's source code after its includes have been pasted in and its
+ * defines added. The expanded text carries #line directives, so errors in
+ * the compile log point at source string N, which is files[N]
+ */
+struct ShaderSource
+{
+    std::string text;                   // ready to hand to glShaderSource
+    std::vector<std::string> files;     // every file that went into it
+};
+
+/**
+ * Counters for the shader source caches
+ */
+struct ShaderSourceStats
+{
+    ShaderSourceStats()
+        : fileReads( 0 ),
+          expansions( 0 ),
+          hits( 0 )
+    {
+    }
+
+    unsigned int fileReads;     // files read from disk or the pack
+    unsigned int expansions;    // sources that had to be preprocessed
+    unsigned int hits;          // sources that were already expanded
+};
+
+// Load a shader, resolving #include lines and adding the given defines.
+// Defines are written like compiler flags, either "NAME" or "NAME=VALUE"
+bool loadShaderSource( const std::string& filename,
+                       const std::vector<std::string>& defines,
+                       ShaderSource * pSource,
+                       std::string * pError );
+
+// Describe which file each source string number in a compile log refers to
+std::string describeShaderSourceFiles( const ShaderSource& source );
+
+// Forget every cached file and expansion
+void clearShaderSourceCache();
+
+ShaderSourceStats shaderSourceStats();
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "spatialgrid.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cassert>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GFXSANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Checks if an object's bounds overlap the view. Touching counts
+ */
+static inline bool overlapsView( const CullRect& view, float x, float y, float halfSize )
+{
+    return x - halfSize <= view.maxX && x + halfSize >= view.minX &&
+           y - halfSize <= view.maxY && y + halfSize >= view.minY;
+}
+
+/**
+ * Portable version of the bounds test, also used to finish off the objects
+ * left over by the vectorized kernels
+ *
+ * \param  view      Rectangle to test against
+ * \param  pX        Center x of every object
+ * \param  pY        Center y of every object
+ * \param  pHalf     Half size of every object
+ * \param  pIndices  Objects to test
+ * \param  count     Number of objects to test
+ * \param  pVisible  The objects that overlap the view are appended to this
+ */
+static void testScalar( const CullRect& view,
+                        const float * pX,
+                        const float * pY,
+                        const float * pHalf,
+                        const uint32_t * pIndices,
+                        size_t count,
+                        std::vector<uint32_t> * pVisible )
+{
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint32_t index = pIndices[i];
+
+        if ( overlapsView( view, pX[index], pY[index], pHalf[index] ) )
+        {
+            pVisible->push_back( index );
+        }
+    }
+}
+
+#ifdef GFXSANDBOX_X86
+/**
+ * SSE2 kernel, tests four objects per iteration. There is no gather before
+ * AVX2, so the objects are loaded one lane at a time
+ */
+static void testSse2( const CullRect& view,
+                      const float * pX,
+                      const float * pY,
+                      const float * pHalf,
+                      const uint32_t * pIndices,
+                      size_t count,
+                      std::vector<uint32_t> * pVisible )
+{
+    const __m128 minX = _mm_set1_ps( view.minX );
+    const __m128 minY = _mm_set1_ps( view.minY );
+    const __m128 maxX = _mm_set1_ps( view.maxX );
+    const __m128 maxY = _mm_set1_ps( view.maxY );
+
+    size_t i = 0;
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        const uint32_t * pIndex = pIndices + i;
+
+        __m128 x = _mm_setr_ps( pX[pIndex[0]], pX[pIndex[1]], pX[pIndex[2]], pX[pIndex[3]] );
+        __m128 y = _mm_setr_ps( pY[pIndex[0]], pY[pIndex[1]], pY[pIndex[2]], pY[pIndex[3]] );
+        __m128 h = _mm_setr_ps( pHalf[pIndex[0]], pHalf[pIndex[1]],
+                                pHalf[pIndex[2]], pHalf[pIndex[3]] );
+
+        __m128 inX = _mm_and_ps( _mm_cmple_ps( _mm_sub_ps( x, h ), maxX ),
+                                 _mm_cmpge_ps( _mm_add_ps( x, h ), minX ) );
+        __m128 inY = _mm_and_ps( _mm_cmple_ps( _mm_sub_ps( y, h ), maxY ),
+                                 _mm_cmpge_ps( _mm_add_ps( y, h ), minY ) );
+
+        unsigned int mask = _mm_movemask_ps( _mm_and_ps( inX, inY ) );
+
+        while ( mask != 0 )
+        {
+            pVisible->push_back( pIndex[ __builtin_ctz( mask ) ] );
+            mask &= mask - 1;
+        }
+    }
+
+    testScalar( view, pX, pY, pHalf, pIndices + i, count - i, pVisible );
+}
+
+/**
+ * AVX2 kernel, gathers and tests eight objects per iteration
+ */
+__attribute__(( target( "avx2" ) ))
+static void testAvx2( const CullRect& view,
+                      const float * pX,
+                      const float * pY,
+                      const float * pHalf,
+                      const uint32_t * pIndices,
+                      size_t count,
+                      std::vector<uint32_t> * pVisible )
+{
+    const __m256 minX = _mm256_set1_ps( view.minX );
+    const __m256 minY = _mm256_set1_ps( view.minY );
+    const __m256 maxX = _mm256_set1_ps( view.maxX );
+    const __m256 maxY = _mm256_set1_ps( view.maxY );
+
+    size_t i = 0;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        const uint32_t * pIndex = pIndices + i;
+        __m256i indices = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pIndex ) );
+
+        __m256 x = _mm256_i32gather_ps( pX, indices, 4 );
+        __m256 y = _mm256_i32gather_ps( pY, indices, 4 );
+        __m256 h = _mm256_i32gather_ps( pHalf, indices, 4 );
+
+        __m256 inX = _mm256_and_ps( _mm256_cmp_ps( _mm256_sub_ps( x, h ), maxX, _CMP_LE_OQ ),
+                                    _mm256_cmp_ps( _mm256_add_ps( x, h ), minX, _CMP_GE_OQ ) );
+        __m256 inY = _mm256_and_ps( _mm256_cmp_ps( _mm256_sub_ps( y, h ), maxY, _CMP_LE_OQ ),
+                                    _mm256_cmp_ps( _mm256_add_ps( y, h ), minY, _CMP_GE_OQ ) );
+
+        unsigned int mask = _mm256_movemask_ps( _mm256_and_ps( inX, inY ) );
+
+        while ( mask != 0 )
+        {
+            pVisible->push_back( pIndex[ __builtin_ctz( mask ) ] );
+            mask &= mask - 1;
+        }
+    }
+
+    testScalar( view, pX, pY, pHalf, pIndices + i, count - i, pVisible );
+}
+#endif
+
+/**
+ * Checks if the CPU we are running on supports a kernel
+ */
+bool isCullKernelSupported( CullKernel kernel )
+{
+    switch ( kernel )
+    {
+        case CULL_KERNEL_SCALAR:
+            return true;
+
+#ifdef GFXSANDBOX_X86
+        case CULL_KERNEL_SSE2:
+            return __builtin_cpu_supports( "sse2" );
+
+        case CULL_KERNEL_AVX2:
+            return __builtin_cpu_supports( "avx2" );
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Picks the widest kernel the CPU supports. This is only worked out once
+ */
+CullKernel bestCullKernel()
+{
+    static const CullKernel best =
+        isCullKernelSupported( CULL_KERNEL_AVX2 ) ? CULL_KERNEL_AVX2 :
+        isCullKernelSupported( CULL_KERNEL_SSE2 ) ? CULL_KERNEL_SSE2 :
+                                                    CULL_KERNEL_SCALAR;
+    return best;
+}
+
+const char * cullKernelName( CullKernel kernel )
+{
+    switch ( kernel )
+    {
+        case CULL_KERNEL_SCALAR:    return "scalar";
+        case CULL_KERNEL_SSE2:      return "sse2";
+        case CULL_KERNEL_AVX2:      return "avx2";
+        default:                    return "unknown";
+    }
+}
+
+SpatialGrid::SpatialGrid()
+    : mBounds(),
+      mCellsX( 0 ),
+      mCellsY( 0 ),
+      mCellWidth( 0.0f ),
+      mCellHeight( 0.0f ),
+      mMaxHalfSize( 0.0f ),
+      mMovedCount( 0 ),
+      mCells(),
+      mObjectCell(),
+      mObjectSlot(),
+      mNextCell(),
+      mChunkMaxHalfSize()
+{
+}
+
+/**
+ * Lays the grid out. Cells should be a few times larger than the typical
+ * object, and hold somewhere around a few dozen objects each
+ *
+ * \param  bounds  Area the objects normally stay within
+ * \param  cellsX  Number of cells across
+ * \param  cellsY  Number of cells down
+ */
+void SpatialGrid::create( const CullRect& bounds, unsigned int cellsX, unsigned int cellsY )
+{
+    assert( cellsX > 0 && cellsY > 0 );
+    assert( bounds.maxX > bounds.minX && bounds.maxY > bounds.minY );
+
+    mBounds     = bounds;
+    mCellsX     = cellsX;
+    mCellsY     = cellsY;
+    mCellWidth  = ( bounds.maxX - bounds.minX ) / cellsX;
+    mCellHeight = ( bounds.maxY - bounds.minY ) / cellsY;
+
+    mCells.assign( static_cast<size_t>( cellsX ) * cellsY, std::vector<uint32_t>() );
+    clear();
+}
+
+void SpatialGrid::clear()
+{
+    for ( size_t i = 0; i < mCells.size(); ++i )
+    {
+        mCells[i].clear();
+    }
+
+    mObjectCell.clear();
+    mObjectSlot.clear();
+    mMaxHalfSize = 0.0f;
+    mMovedCount  = 0;
+}
+
+/**
+ * Returns the column holding an x coordinate, clamped to the grid
+ */
+unsigned int SpatialGrid::cellX( float x ) const
+{
+    float cell = ( x - mBounds.minX ) / mCellWidth;
+
+    // Also catches NaN
+    if (! ( cell > 0.0f ) )
+    {
+        return 0;
+    }
+
+    return std::min( static_cast<unsigned int>( std::min( cell, 4.0e9f ) ), mCellsX - 1 );
+}
+
+/**
+ * Returns the row holding a y coordinate, clamped to the grid
+ */
+unsigned int SpatialGrid::cellY( float y ) const
+{
+    float cell = ( y - mBounds.minY ) / mCellHeight;
+
+    if (! ( cell > 0.0f ) )
+    {
+        return 0;
+    }
+
+    return std::min( static_cast<unsigned int>( std::min( cell, 4.0e9f ) ), mCellsY - 1 );
+}
+
+/**
+ * Brings the grid up to date. If the number of objects is the same as last
+ * time, only the objects that moved into a different cell are touched,
+ * otherwise the grid is rebuilt from scratch
+ *
+ * \param  count      Number of objects
+ * \param  pX         Center x of every object
+ * \param  pY         Center y of every object
+ * \param  pHalfSize  Half the width (and height) of every object
+ * \param  pJobs      Threads to work out the cells on, or NULL
+ */
+void SpatialGrid::update( size_t count,
+                          const float * pX,
+                          const float * pY,
+                          const float * pHalfSize,
+                          JobSystem * pJobs )
+{
+    assert( !mCells.empty() && "SpatialGrid::create must be called first" );
+    assert( count == 0 || ( pX != NULL && pY != NULL && pHalfSize != NULL ) );
+
+    ProfileScope scope( "update grid" );
+
+    size_t chunkCount = ( count + UPDATE_CHUNK_SIZE - 1 ) / UPDATE_CHUNK_SIZE;
+
+    mNextCell.resize( count );
+    mChunkMaxHalfSize.assign( chunkCount, 0.0f );
+
+    auto findCells = [&]( size_t begin, size_t end )
+    {
+        float maxHalfSize = 0.0f;
+
+        for ( size_t i = begin; i < end; ++i )
+        {
+            mNextCell[i] = cellY( pY[i] ) * mCellsX + cellX( pX[i] );
+            maxHalfSize  = std::max( maxHalfSize, pHalfSize[i] );
+        }
+
+        mChunkMaxHalfSize[ begin / UPDATE_CHUNK_SIZE ] = maxHalfSize;
+    };
+
+    if ( pJobs != NULL )
+    {
+        pJobs->parallelFor( count, UPDATE_CHUNK_SIZE, findCells );
+    }
+    else if ( count > 0 )
+    {
+        findCells( 0, count );
+    }
+
+    mMaxHalfSize = 0.0f;
+
+    for ( size_t i = 0; i < chunkCount; ++i )
+    {
+        mMaxHalfSize = std::max( mMaxHalfSize, mChunkMaxHalfSize[i] );
+    }
+
+    if ( count != mObjectCell.size() )
+    {
+        rebuild();
+        return;
+    }
+
+    // Moving between cells is a swap with the last object in the old cell
+    // and an append to the new one, so order within a cell isn't kept
+    size_t moved = 0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        uint32_t oldCell = mObjectCell[i];
+        uint32_t newCell = mNextCell[i];
+
+        if ( oldCell == newCell )
+        {
+            continue;
+        }
+
+        std::vector<uint32_t>& from = mCells[oldCell];
+        std::vector<uint32_t>& to   = mCells[newCell];
+
+        uint32_t slot     = mObjectSlot[i];
+        uint32_t last     = from.back();
+        from[slot]        = last;
+        mObjectSlot[last] = slot;
+        from.pop_back();
+
+        mObjectCell[i] = newCell;
+        mObjectSlot[i] = static_cast<uint32_t>( to.size() );
+        to.push_back( static_cast<uint32_t>( i ) );
+
+        ++moved;
+    }
+
+    mMovedCount = moved;
+}
+
+/**
+ * Puts every object into the cell update() worked out for it
+ */
+void SpatialGrid::rebuild()
+{
+    size_t count = mNextCell.size();
+
+    for ( size_t i = 0; i < mCells.size(); ++i )
+    {
+        mCells[i].clear();
+    }
+
+    mObjectCell.resize( count );
+    mObjectSlot.resize( count );
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        std::vector<uint32_t>& cell = mCells[ mNextCell[i] ];
+
+        mObjectCell[i] = mNextCell[i];
+        mObjectSlot[i] = static_cast<uint32_t>( cell.size() );
+        cell.push_back( static_cast<uint32_t>( i ) );
+    }
+
+    mMovedCount = count;
+}
+
+/**
+ * Finds every object whose bounds overlap a rectangle, using the fastest
+ * kernel the CPU supports. The arrays must be the ones last passed to
+ * update()
+ *
+ * \param  view       Rectangle to test against
+ * \param  pX         Center x of every object
+ * \param  pY         Center y of every object
+ * \param  pHalfSize  Half size of every object
+ * \param  pVisible   Receives the indices of the visible objects, grouped by
+ *                    cell
+ * \param  pStats     If not NULL, receives what the cull did
+ */
+void SpatialGrid::cull( const CullRect& view,
+                        const float * pX,
+                        const float * pY,
+                        const float * pHalfSize,
+                        std::vector<uint32_t> * pVisible,
+                        CullStats * pStats ) const
+{
+    cullWith( bestCullKernel(), view, pX, pY, pHalfSize, pVisible, pStats );
+}
+
+/**
+ * Culls using a specific kernel. The kernel must be supported by the CPU.
+ * Every kernel finds the same objects in the same order
+ */
+void SpatialGrid::cullWith( CullKernel kernel,
+                            const CullRect& view,
+                            const float * pX,
+                            const float * pY,
+                            const float * pHalfSize,
+                            std::vector<uint32_t> * pVisible,
+                            CullStats * pStats ) const
+{
+    assert( pVisible != NULL );
+    assert( isCullKernelSupported( kernel ) );
+
+    ProfileScope scope( "cull" );
+
+    void ( *pTest )( const CullRect&, const float *, const float *, const float *,
+                     const uint32_t *, size_t, std::vector<uint32_t> * ) = &testScalar;
+
+#ifdef GFXSANDBOX_X86
+    if ( kernel == CULL_KERNEL_AVX2 )
+    {
+        pTest = &testAvx2;
+    }
+    else if ( kernel == CULL_KERNEL_SSE2 )
+    {
+        pTest = &testSse2;
+    }
+#endif
+
+    CullStats stats;
+    stats.objectCount = mObjectCell.size();
+
+    pVisible->clear();
+
+    if ( stats.objectCount > 0 )
+    {
+        // Objects are filed under their centers, so one in a cell just
+        // outside the view can still reach into it
+        unsigned int firstX = cellX( view.minX - mMaxHalfSize );
+        unsigned int lastX  = cellX( view.maxX + mMaxHalfSize );
+        unsigned int firstY = cellY( view.minY - mMaxHalfSize );
+        unsigned int lastY  = cellY( view.maxY + mMaxHalfSize );
+
+        for ( unsigned int cy = firstY; cy <= lastY; ++cy )
+        {
+            float cellMinY = mBounds.minY + cy * mCellHeight;
+            float cellMaxY = cellMinY + mCellHeight;
+
+            for ( unsigned int cx = firstX; cx <= lastX; ++cx )
+            {
+                const std::vector<uint32_t>& cell = mCells[ cy * mCellsX + cx ];
+                stats.cellsVisited++;
+
+                if ( cell.empty() )
+                {
+                    continue;
+                }
+
+                float cellMinX = mBounds.minX + cx * mCellWidth;
+                float cellMaxX = cellMinX + mCellWidth;
+
+                // Every center in the cell is inside the view, so every
+                // object overlaps it. Edge cells also hold the objects that
+                // are outside the grid, so they always get tested
+                bool isEdge = ( cx == 0 || cy == 0 || cx == mCellsX - 1 || cy == mCellsY - 1 );
+
+                if ( !isEdge &&
+                     cellMinX >= view.minX && cellMaxX <= view.maxX &&
+                     cellMinY >= view.minY && cellMaxY <= view.maxY )
+                {
+                    pVisible->insert( pVisible->end(), cell.begin(), cell.end() );
+                    stats.cellsAccepted++;
+                    continue;
+                }
+
+                pTest( view, pX, pY, pHalfSize, &cell[0], cell.size(), pVisible );
+                stats.objectsTested += cell.size();
+            }
+        }
+    }
+
+    stats.visibleCount = pVisible->size();
+    stats.culledCount  = stats.objectCount - stats.visibleCount;
+
+    if ( pStats != NULL )
+    {
+        *pStats = stats;
+    }
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_SPATIALGRID_H
+#define SCOTT_GFXSANDBOX_SPATIALGRID_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+class JobSystem;
+
+/**
+ * Implementations of the per object bounds test. The best one supported by
+ * the CPU is picked at runtime, but benchmarks can ask for a specific one
+ */
+enum CullKernel
+{
+    CULL_KERNEL_SCALAR,
+    CULL_KERNEL_SSE2,
+    CULL_KERNEL_AVX2
+};
+
+/**
+ * An axis aligned rectangle, in the same space as the objects
+ */
+struct CullRect
+{
+    float minX, minY;
+    float maxX, maxY;
+};
+
+/**
+ * What one cull() did
+ */
+struct CullStats
+{
+    CullStats()
+        : objectCount( 0 ),
+          visibleCount( 0 ),
+          culledCount( 0 ),
+          cellsVisited( 0 ),
+          cellsAccepted( 0 ),
+          objectsTested( 0 )
+    {
+    }
+
+    size_t objectCount;     // objects in the grid
+    size_t visibleCount;    // objects handed back as visible
+    size_t culledCount;     // objects left out
+    size_t cellsVisited;    // cells that overlapped the view
+    size_t cellsAccepted;   // cells inside the view, not tested object by object
+    size_t objectsTested;   // objects whose bounds were tested
+};
+
+/**
+ * A uniform grid over square objects that are stored as separate arrays of
+ * center x, center y and half size, like EntityStore's.
+ *
+ * It is a loose grid: each object lives only in the cell holding its center,
+ * and queries are grown by the largest half size so that objects hanging
+ * over a cell's edge are still found. Objects never need to be in more than
+ * one cell, so keeping the grid up to date as they move is cheap. update()
+ * works out every object's cell in parallel, and then only moves the ones
+ * that crossed into a different cell.
+ *
+ * cull() visits the cells that overlap the view. Cells that are completely
+ * inside it are accepted without looking at their objects, and the objects
+ * in the cells along its edges are tested four or eight at a time.
+ *
+ * Objects outside the grid's rectangle are kept in the nearest edge cell, so
+ * they are still found, just less efficiently.
+ */
+class SpatialGrid
+{
+public:
+    // Objects whose cells are worked out by one job
+    static const size_t UPDATE_CHUNK_SIZE = 4096;
+
+    SpatialGrid();
+
+    // Lay a grid of cellsX by cellsY cells over a rectangle, and empty it
+    void create( const CullRect& bounds, unsigned int cellsX, unsigned int cellsY );
+
+    // Remove every object
+    void clear();
+
+    // Bring the grid up to date with the objects' current positions and sizes
+    void update( size_t count,
+                 const float * pX,
+                 const float * pY,
+                 const float * pHalfSize,
+                 JobSystem * pJobs );
+
+    // Find the objects that overlap a rectangle
+    void cull( const CullRect& view,
+               const float * pX,
+               const float * pY,
+               const float * pHalfSize,
+               std::vector<uint32_t> * pVisible,
+               CullStats * pStats ) const;
+
+    // Cull with a specific kernel
+    void cullWith( CullKernel kernel,
+                   const CullRect& view,
+                   const float * pX,
+                   const float * pY,
+                   const float * pHalfSize,
+                   std::vector<uint32_t> * pVisible,
+                   CullStats * pStats ) const;
+
+    // Number of objects in the grid
+    size_t size() const { return mObjectCell.size(); }
+
+    // Number of cells along each axis
+    unsigned int cellsX() const { return mCellsX; }
+    unsigned int cellsY() const { return mCellsY; }
+
+    // Objects that changed cells during the last update()
+    size_t movedCount() const { return mMovedCount; }
+
+private:
+    unsigned int cellX( float x ) const;
+    unsigned int cellY( float y ) const;
+    void rebuild();
+
+    CullRect mBounds;
+    unsigned int mCellsX, mCellsY;
+    float mCellWidth, mCellHeight;
+    float mMaxHalfSize;             // largest object, queries grow by this
+    size_t mMovedCount;
+
+    std::vector<std::vector<uint32_t> > mCells;     // objects in each cell
+    std::vector<uint32_t> mObjectCell;              // cell each object is in
+    std::vector<uint32_t> mObjectSlot;              // where in that cell
+    std::vector<uint32_t> mNextCell;                // scratch for update()
+    std::vector<float> mChunkMaxHalfSize;           // scratch for update()
+};
+
+// Returns the fastest kernel supported by this CPU
+CullKernel bestCullKernel();
+
+// Returns true if the CPU can run the given kernel
+bool isCullKernelSupported( CullKernel kernel );
+
+// Returns a printable name for the kernel
+const char * cullKernelName( CullKernel kernel );
+
+#endif
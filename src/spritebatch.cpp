@@ -0,0 +1,515 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "spritebatch.h"
+#include "glutil.h"
+#include "glstate.h"
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * Sets how often an attribute advances, using the core entry point when it
+ * is there and the ARB one otherwise
+ */
+static void vertexAttribDivisor( GLuint index, GLuint divisor )
+{
+    if ( GLEW_VERSION_3_3 )
+    {
+        glVertexAttribDivisor( index, divisor );
+    }
+    else
+    {
+        glVertexAttribDivisorARB( index, divisor );
+    }
+}
+
+/**
+ * Sets up a float vertex attribute from the currently bound array buffer.
+ * Attributes the shader compiler optimised away are skipped
+ */
+static void vertexAttrib( GLint location,
+                          GLint size,
+                          GLsizei stride,
+                          size_t offset )
+{
+    if ( location < 0 )
+    {
+        return;
+    }
+
+    glVertexAttribPointer( location,
+                           size,
+                           GL_FLOAT,
+                           GL_FALSE,
+                           stride,
+                           reinterpret_cast<void*>( offset ) );
+    GStateCache.enableVertexAttribArray( location );
+}
+
+SpriteBatch::SpriteBatch()
+    : mCreated( false ),
+      mInstanced( false ),
+      mShader(),
+      mQuadVertices(),
+      mQuadElements(),
+      mStream(),
+      mStagingBuffer( 0 ),
+      mExpandedIndices(),
+      mInstances(),
+      mStaging(),
+      mDrawCalls( 0 )
+{
+}
+
+SpriteBatch::~SpriteBatch()
+{
+    // GL objects can only be released while the context is current, which
+    // is the owner's job. Complain loudly if it was forgotten
+    assert( !mCreated && "SpriteBatch destroyed without calling destroy()" );
+}
+
+/**
+ * Checks if the current context can draw instanced sprites
+ */
+bool SpriteBatch::isInstancingSupported()
+{
+    return GLEW_VERSION_3_3 ||
+           ( GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced );
+}
+
+/**
+ * Builds the sprite shader and the buffers the batch streams into
+ *
+ * \param  quadVertices       Corners of the unit quad, two floats each
+ * \param  quadElements       Four indices drawing the quad as a strip
+ * \param  allowInstancing    False to always expand sprites on the CPU
+ * \return                    True if the batch is ready to use
+ */
+bool SpriteBatch::create( const BufferRange& quadVertices,
+                          const BufferRange& quadElements,
+                          bool allowInstancing )
+{
+    assert( !mCreated );
+
+    mInstanced         = allowInstancing && isInstancingSupported();
+    mQuadVertices      = quadVertices;
+    mQuadElements      = quadElements;
+
+    std::vector<ShaderProgramDesc> programs( 1 );
+    programs[0].vertexShader   = mInstanced ?
+                                 "content/shaders/sprite.vs.glsl" :
+                                 "content/shaders/sprite_expanded.vs.glsl";
+    programs[0].fragmentShader = "content/shaders/sprite.ps.glsl";
+
+    ShaderBuildResult result = loadShaderPrograms( programs )[0];
+
+    if (! result.ok )
+    {
+        std::cerr << "Failed to build the sprite shader: " << result.error
+                  << std::endl;
+        return false;
+    }
+
+    mShader = result.shader;
+
+    GLuint program = mShader.program;
+
+    mUniforms.textures[0]     = glGetUniformLocation( program, "textures[0]" );
+    mUniforms.textures[1]     = glGetUniformLocation( program, "textures[1]" );
+    mAttributes.position      = glGetAttribLocation( program, "position" );
+    mAttributes.transform     = glGetAttribLocation( program, "transform" );
+    mAttributes.rotationFade  = glGetAttribLocation( program, "rotationFade" );
+    mAttributes.uvRect        = glGetAttribLocation( program, "uvRect" );
+    mAttributes.texcoord      = glGetAttribLocation( program, "uv" );
+    mAttributes.fade          = glGetAttribLocation( program, "fade_factor" );
+
+    if (! mStream.create( GL_ARRAY_BUFFER, STREAM_BUFFER_SIZE ) )
+    {
+        glGenBuffers( 1, &mStagingBuffer );
+    }
+
+    if (! mInstanced )
+    {
+        // Two triangles per sprite. The pattern is the same for every chunk,
+        // so one static buffer serves them all
+        std::vector<GLushort> indices;
+        indices.reserve( EXPANDED_SPRITES_PER_DRAW * 6 );
+
+        for ( size_t i = 0; i < EXPANDED_SPRITES_PER_DRAW; ++i )
+        {
+            GLushort base = static_cast<GLushort>( i * 4 );
+
+            indices.push_back( base + 0 );
+            indices.push_back( base + 1 );
+            indices.push_back( base + 2 );
+            indices.push_back( base + 2 );
+            indices.push_back( base + 1 );
+            indices.push_back( base + 3 );
+        }
+
+        mExpandedIndices = createBufferT( GL_ELEMENT_ARRAY_BUFFER, indices );
+
+    }
+
+    mCreated = true;
+
+    if (! mInstanced && ! mExpandedIndices.isValid() )
+    {
+        destroy();
+        return false;
+    }
+    errorCheck( "after creating sprite batch" );
+
+    return true;
+}
+
+/**
+ * Releases the shader and buffers. The unit quad belongs to the caller and
+ * is left alone
+ */
+void SpriteBatch::destroy()
+{
+    if (! mCreated )
+    {
+        return;
+    }
+
+    mStream.destroy();
+    glDeleteBuffers( 1, &mStagingBuffer );
+    GBufferArenas.free( &mExpandedIndices );
+    glDeleteProgram( mShader.program );
+    glDeleteShader( mShader.vertexShader );
+    glDeleteShader( mShader.fragmentShader );
+
+    // The cache may still think the deleted objects are bound, and GL reuses
+    // names
+    GStateCache.invalidate();
+
+    mStagingBuffer       = 0;
+    mShader              = Shader();
+    mCreated             = false;
+}
+
+void SpriteBatch::begin()
+{
+    mInstances.clear();
+}
+
+/**
+ * Adds a sprite to the batch. The rotation is turned into a sine and cosine
+ * here so that the vertex shader doesn't have to
+ */
+void SpriteBatch::add( const Sprite& sprite )
+{
+    Instance instance;
+
+    instance.transform[0]    = sprite.x;
+    instance.transform[1]    = sprite.y;
+    instance.transform[2]    = sprite.halfWidth;
+    instance.transform[3]    = sprite.halfHeight;
+    instance.rotationFade[0] = cosf( sprite.rotation );
+    instance.rotationFade[1] = sinf( sprite.rotation );
+    instance.rotationFade[2] = sprite.fade;
+    instance.rotationFade[3] = 0.0f;
+    instance.uvRect[0]       = sprite.u0;
+    instance.uvRect[1]       = sprite.v0;
+    instance.uvRect[2]       = sprite.u1;
+    instance.uvRect[3]       = sprite.v1;
+
+    mInstances.push_back( instance );
+}
+
+/**
+ * Draws every sprite in the batch, crossfading between two textures
+ *
+ * \param  firstTexture   Texture shown when a sprite's fade is 0
+ * \param  secondTexture  Texture shown when a sprite's fade is 1
+ */
+void SpriteBatch::draw( GLuint firstTexture, GLuint secondTexture )
+{
+    assert( mCreated );
+    mDrawCalls = 0;
+
+    if ( mInstances.empty() )
+    {
+        return;
+    }
+
+    GStateCache.useProgram( mShader.program );
+
+    GStateCache.bindTexture( 0, GL_TEXTURE_2D, firstTexture );
+    GStateCache.uniform1i( mUniforms.textures[0], 0 );
+
+    GStateCache.bindTexture( 1, GL_TEXTURE_2D, secondTexture );
+    GStateCache.uniform1i( mUniforms.textures[1], 1 );
+
+    if ( mInstanced )
+    {
+        drawInstanced();
+    }
+    else
+    {
+        drawExpanded();
+    }
+
+    errorCheck( "after drawing sprite batch" );
+}
+
+/**
+ * Marks the end of a frame, so that the space the frame streamed through can
+ * be reused once the GPU is done with it. Call this once per frame after the
+ * frame's draws have been submitted
+ */
+void SpriteBatch::endFrame()
+{
+    if ( mStream.isCreated() )
+    {
+        mStream.endFrame();
+    }
+}
+
+/**
+ * Returns memory to write the vertex data for one draw call into. Data goes
+ * into the stream buffer when there is one, and is staged in client memory
+ * otherwise
+ *
+ * \param  size     Number of bytes that will be written
+ * \param  pOffset  Receives the offset of the data in the array buffer
+ */
+void * SpriteBatch::mapVertices( size_t size, size_t * pOffset )
+{
+    if (! mStream.isCreated() )
+    {
+        mStaging.resize( size );
+        *pOffset = 0;
+
+        return &mStaging[0];
+    }
+
+    void * pMemory = mStream.map( size, sizeof(GLfloat) * 4, pOffset );
+
+    if ( pMemory == NULL )
+    {
+        // This batch alone has filled the ring. Fence what has been drawn so
+        // far, which lets the ring wait for the GPU to free up some space
+        mStream.endFrame();
+        pMemory = mStream.map( size, sizeof(GLfloat) * 4, pOffset );
+    }
+
+    assert( pMemory != NULL && "Sprite chunks should always fit the ring" );
+    return pMemory;
+}
+
+/**
+ * Finishes writing vertex data and leaves the buffer holding it bound to
+ * GL_ARRAY_BUFFER
+ *
+ * \param  size  Number of bytes that were written
+ */
+void SpriteBatch::unmapVertices( size_t size )
+{
+    if ( mStream.isCreated() )
+    {
+        mStream.unmap();
+        GStateCache.bindBuffer( GL_ARRAY_BUFFER, mStream.buffer() );
+    }
+    else
+    {
+        // Respecifying the whole store lets the driver hand us fresh memory
+        // instead of waiting for the last draw to finish with it
+        GStateCache.bindBuffer( GL_ARRAY_BUFFER, mStagingBuffer );
+        glBufferData( GL_ARRAY_BUFFER, size, &mStaging[0], GL_STREAM_DRAW );
+    }
+}
+
+/**
+ * Streams one instance per sprite and draws them as instances of the unit
+ * quad. With a stream buffer, batches too big for a quarter of it are split
+ * into several draws so the ring always has room to work with
+ */
+void SpriteBatch::drawInstanced()
+{
+    size_t maxPerDraw = mInstances.size();
+
+    if ( mStream.isCreated() )
+    {
+        maxPerDraw = mStream.size() / 4 / sizeof(Instance);
+    }
+
+    const GLint instanceAttribs[3] =
+    {
+        mAttributes.transform,
+        mAttributes.rotationFade,
+        mAttributes.uvRect
+    };
+
+    GStateCache.bindBuffer( GL_ARRAY_BUFFER, GBufferArenas.bufferName( mQuadVertices ) );
+    vertexAttrib( mAttributes.position, 2, sizeof(GLfloat) * 2, mQuadVertices.offset );
+    GStateCache.bindBuffer( GL_ELEMENT_ARRAY_BUFFER,
+                            GBufferArenas.bufferName( mQuadElements ) );
+
+    for ( size_t first = 0; first < mInstances.size(); first += maxPerDraw )
+    {
+        size_t count = std::min( maxPerDraw, mInstances.size() - first );
+        size_t bytes = count * sizeof(Instance);
+        size_t offset = 0;
+
+        memcpy( mapVertices( bytes, &offset ), &mInstances[first], bytes );
+        unmapVertices( bytes );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            vertexAttrib( instanceAttribs[i],
+                          4,
+                          sizeof(Instance),
+                          offset + i * sizeof(GLfloat) * 4 );
+
+            if ( instanceAttribs[i] >= 0 )
+            {
+                vertexAttribDivisor( instanceAttribs[i], 1 );
+            }
+        }
+
+        if ( GLEW_VERSION_3_3 )
+        {
+            glDrawElementsInstanced( GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT,
+                                     mQuadElements.pointer(),
+                                     static_cast<GLsizei>( count ) );
+        }
+        else
+        {
+            glDrawElementsInstancedARB( GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_SHORT,
+                                        mQuadElements.pointer(),
+                                        static_cast<GLsizei>( count ) );
+        }
+
+        mDrawCalls++;
+    }
+
+    // Other shaders can end up with their attributes at these locations, and
+    // they expect them to advance per vertex
+    for ( int i = 0; i < 3; ++i )
+    {
+        if ( instanceAttribs[i] >= 0 )
+        {
+            vertexAttribDivisor( instanceAttribs[i], 0 );
+            GStateCache.disableVertexAttribArray( instanceAttribs[i] );
+        }
+    }
+}
+
+/**
+ * Transforms the corners of each sprite on the CPU and draws the results as
+ * plain triangles, in chunks small enough for 16 bit indices. Vertices are
+ * written straight into the mapped stream buffer
+ */
+void SpriteBatch::drawExpanded()
+{
+    // Corners in the same order as the unit quad's vertex buffer
+    const float CORNERS[4][2] =
+    {
+        { -1.0f, -1.0f },
+        {  1.0f, -1.0f },
+        { -1.0f,  1.0f },
+        {  1.0f,  1.0f }
+    };
+
+    const GLint attribs[3] =
+    {
+        mAttributes.position,
+        mAttributes.texcoord,
+        mAttributes.fade
+    };
+
+    const size_t attribSizes[3]   = { 2, 2, 1 };
+    const size_t attribOffsets[3] =
+    {
+        offsetof( ExpandedVertex, position ),
+        offsetof( ExpandedVertex, texcoord ),
+        offsetof( ExpandedVertex, fade )
+    };
+
+    GStateCache.bindBuffer( GL_ELEMENT_ARRAY_BUFFER,
+                            GBufferArenas.bufferName( mExpandedIndices ) );
+
+    for ( size_t first = 0; first < mInstances.size();
+          first += EXPANDED_SPRITES_PER_DRAW )
+    {
+        size_t count = mInstances.size() - first;
+
+        if ( count > EXPANDED_SPRITES_PER_DRAW )
+        {
+            count = EXPANDED_SPRITES_PER_DRAW;
+        }
+
+        size_t bytes  = count * 4 * sizeof(ExpandedVertex);
+        size_t offset = 0;
+
+        ExpandedVertex * pVertices =
+            static_cast<ExpandedVertex*>( mapVertices( bytes, &offset ) );
+
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const Instance& instance = mInstances[first + i];
+            const GLfloat * t  = instance.transform;
+            const GLfloat * rf = instance.rotationFade;
+            const GLfloat * uv = instance.uvRect;
+
+            for ( int c = 0; c < 4; ++c )
+            {
+                ExpandedVertex& vertex = pVertices[i * 4 + c];
+
+                float cx = CORNERS[c][0] * t[2];
+                float cy = CORNERS[c][1] * t[3];
+                float s  = CORNERS[c][0] * 0.5f + 0.5f;
+                float r  = CORNERS[c][1] * 0.5f + 0.5f;
+
+                vertex.position[0] = t[0] + cx * rf[0] - cy * rf[1];
+                vertex.position[1] = t[1] + cx * rf[1] + cy * rf[0];
+                vertex.texcoord[0] = uv[0] + ( uv[2] - uv[0] ) * s;
+                vertex.texcoord[1] = uv[1] + ( uv[3] - uv[1] ) * r;
+                vertex.fade        = rf[2];
+            }
+        }
+
+        unmapVertices( bytes );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            vertexAttrib( attribs[i],
+                          attribSizes[i],
+                          sizeof(ExpandedVertex),
+                          offset + attribOffsets[i] );
+        }
+
+        glDrawElements( GL_TRIANGLES,
+                        static_cast<GLsizei>( count * 6 ),
+                        GL_UNSIGNED_SHORT,
+                        mExpandedIndices.pointer() );
+        mDrawCalls++;
+    }
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        if ( attribs[i] >= 0 )
+        {
+            GStateCache.disableVertexAttribArray( attribs[i] );
+        }
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_SPRITEBATCH_H
+#define SCOTT_GFXSANDBOX_SPRITEBATCH_H
+
+#include "bufferarena.h"
+#include "shader.h"
+#include "streambuffer.h"
+#include <cstddef>
+#include <vector>
+#include <GL/glew.h>
+
+/**
+ * A textured quad that crossfades between the batch's two textures
+ */
+struct Sprite
+{
+    float x, y;                     // center, in clip space
+    float halfWidth, halfHeight;    // half of the size, in clip space
+    float rotation;                 // radians, counter clockwise
+    float u0, v0, u1, v1;           // texture coordinates of the corners
+    float fade;                     // 0 shows the first texture, 1 the second
+};
+
+/**
+ * Draws large numbers of sprites with as few draw calls as possible.
+ *
+ * When instancing is available every sprite becomes one instance of the unit
+ * quad, and the whole batch is drawn with a single glDrawElementsInstanced
+ * call. Otherwise sprites are transformed on the CPU into plain vertices and
+ * drawn in chunks that fit 16 bit indices.
+ *
+ * Per frame data is written into a StreamBuffer, so drawing never waits for
+ * earlier frames or makes the driver reallocate. Contexts that can't map
+ * buffers unsynchronized respecify a plain buffer each draw instead.
+ *
+ * Usage is begin(), add() for each sprite, then draw(), and endFrame() once
+ * the frame has been submitted. The sprites are kept until the next begin(),
+ * so an unchanged batch can be drawn again.
+ */
+class SpriteBatch
+{
+public:
+    // Most sprites drawn with one call when expanding them on the CPU
+    static const size_t EXPANDED_SPRITES_PER_DRAW = 16384;
+
+    // Size of the ring that instances and vertices are streamed through
+    static const size_t STREAM_BUFFER_SIZE = 32 * 1024 * 1024;
+
+    SpriteBatch();
+    ~SpriteBatch();
+
+    // Build the shader and buffers, using the given unit quad
+    bool create( const BufferRange& quadVertices,
+                 const BufferRange& quadElements,
+                 bool allowInstancing = true );
+
+    // Release everything that create() made
+    void destroy();
+
+    // Throw away the sprites from the previous batch
+    void begin();
+
+    // Add a sprite to the batch
+    void add( const Sprite& sprite );
+
+    // Draw all of the sprites in the batch
+    void draw( GLuint firstTexture, GLuint secondTexture );
+
+    // Let the space used by this frame's draws be reused later
+    void endFrame();
+
+    // True between create() and destroy()
+    bool isCreated() const { return mCreated; }
+
+    // True if the batch is drawn with instancing
+    bool isInstanced() const { return mInstanced; }
+
+    // Number of sprites currently in the batch
+    size_t spriteCount() const { return mInstances.size(); }
+
+    // Number of draw calls the last draw() made
+    size_t drawCallCount() const { return mDrawCalls; }
+
+    // Stream buffer the batch writes through, not created on old contexts
+    const StreamBuffer& stream() const { return mStream; }
+
+    // Check if the current context can draw instanced sprites
+    static bool isInstancingSupported();
+
+private:
+    SpriteBatch( const SpriteBatch& );
+    SpriteBatch& operator = ( const SpriteBatch& );
+
+    /**
+     * Per instance data, three vec4 attributes
+     */
+    struct Instance
+    {
+        GLfloat transform[4];       // center x, y and half width, height
+        GLfloat rotationFade[4];    // cos, sin of the rotation, fade, unused
+        GLfloat uvRect[4];          // u0, v0, u1, v1
+    };
+
+    /**
+     * Vertex of a sprite that was expanded on the CPU
+     */
+    struct ExpandedVertex
+    {
+        GLfloat position[2];
+        GLfloat texcoord[2];
+        GLfloat fade;
+    };
+
+    void * mapVertices( size_t size, size_t * pOffset );
+    void unmapVertices( size_t size );
+    void drawInstanced();
+    void drawExpanded();
+
+private:
+    bool mCreated;
+    bool mInstanced;
+    Shader mShader;
+    BufferRange mQuadVertices;
+    BufferRange mQuadElements;
+    StreamBuffer mStream;           // instances or expanded vertices
+    GLuint mStagingBuffer;          // used instead when there is no stream
+    BufferRange mExpandedIndices;
+
+    struct
+    {
+        GLint textures[2];
+    } mUniforms;
+
+    struct
+    {
+        GLint position;
+        GLint transform;            // instanced only
+        GLint rotationFade;         // instanced only
+        GLint uvRect;               // instanced only
+        GLint texcoord;             // expanded only
+        GLint fade;                 // expanded only
+    } mAttributes;
+
+    std::vector<Instance> mInstances;
+    std::vector<unsigned char> mStaging;
+    size_t mDrawCalls;
+};
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "streambuffer.h"
+#include "glutil.h"
+#include "glstate.h"
+#include <cassert>
+
+// How long to wait on a fence before checking it again, in nanoseconds
+const GLuint64 FENCE_WAIT_TIMEOUT_NS = 1000000;
+
+StreamBuffer::StreamBuffer()
+    : mBuffer( 0 ),
+      mTarget( GL_ARRAY_BUFFER ),
+      mSize( 0 ),
+      mpPersistent( NULL ),
+      mIsMapped( false ),
+      mHead( 0 ),
+      mTail( 0 ),
+      mFrameStart( 0 ),
+      mFrames(),
+      mStallCount( 0 ),
+      mWrapCount( 0 )
+{
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    destroy();
+}
+
+/**
+ * Creates the buffer backing the ring. Without ARB_map_buffer_range there is
+ * no way to write into the buffer without synchronising, so no ring is created
+ *
+ * \param  target  Buffer target used while mapping, eg GL_ARRAY_BUFFER
+ * \param  size    Size of the ring in bytes. This should hold a few frames
+ *                 worth of data
+ * \return         True if the ring was created
+ */
+bool StreamBuffer::create( GLenum target, size_t size )
+{
+    assert( size > 0 );
+    destroy();
+
+    if (! GLEW_VERSION_3_0 && ! GLEW_ARB_map_buffer_range )
+    {
+        return false;
+    }
+
+    glGenBuffers( 1, &mBuffer );
+    GStateCache.bindBuffer( target, mBuffer );
+
+    // Buffer storage implies fences are there to track when space is free
+    if ( GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage )
+    {
+        const GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glBufferStorage( target, size, NULL, flags );
+        mpPersistent = static_cast<unsigned char*>(
+            glMapBufferRange( target, 0, size, flags ) );
+    }
+    else
+    {
+        glBufferData( target, size, NULL, GL_STREAM_DRAW );
+    }
+
+    if ( checkGlFailure( "Creating stream buffer" ) )
+    {
+        destroy();
+        return false;
+    }
+
+    mTarget     = target;
+    mSize       = size;
+    mHead       = 0;
+    mTail       = 0;
+    mFrameStart = 0;
+
+    return true;
+}
+
+/**
+ * Releases the buffer. Frames still in flight keep the storage alive on the
+ * driver's side, so there is no need to wait for them
+ */
+void StreamBuffer::destroy()
+{
+    if ( mBuffer == 0 )
+    {
+        return;
+    }
+
+    while (! mFrames.empty() )
+    {
+        glDeleteSync( mFrames.front().fence );
+        mFrames.pop_front();
+    }
+
+    if ( mpPersistent != NULL || mIsMapped )
+    {
+        GStateCache.bindBuffer( mTarget, mBuffer );
+        glUnmapBuffer( mTarget );
+    }
+
+    glDeleteBuffers( 1, &mBuffer );
+
+    // GL reuses buffer names, so the cache must not think this is still bound
+    GStateCache.invalidate();
+
+    mBuffer      = 0;
+    mSize        = 0;
+    mpPersistent = NULL;
+    mIsMapped    = false;
+}
+
+/**
+ * Reserves space in the ring for this frame. If the space is still being
+ * read by an earlier frame this waits for that frame to finish, which only
+ * happens when the ring is too small for the amount of data streamed.
+ *
+ * \param  size       Number of bytes to reserve
+ * \param  alignment  Alignment of the offset, must be a power of two. Uniform
+ *                    data needs GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+ * \param  pOffset    Receives the offset of the space in buffer()
+ * \return            Memory to write the data to, or NULL if it can't fit
+ *                    alongside what this frame has already reserved
+ */
+void * StreamBuffer::map( size_t size, size_t alignment, size_t * pOffset )
+{
+    assert( mBuffer != 0 && !mIsMapped );
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+    assert( pOffset != NULL );
+
+    if ( size == 0 || size > mSize )
+    {
+        return NULL;
+    }
+
+    uint64_t start = ( mHead + alignment - 1 ) & ~static_cast<uint64_t>( alignment - 1 );
+    bool wrapped   = false;
+
+    // Allocations don't straddle the end of the buffer, skip to the start
+    if ( start % mSize + size > mSize )
+    {
+        start   = ( start / mSize + 1 ) * mSize;
+        wrapped = true;
+    }
+
+    uint64_t end = start + size;
+
+    if ( mpPersistent != NULL && end - mFrameStart > mSize )
+    {
+        return NULL;
+    }
+
+    if ( mpPersistent != NULL )
+    {
+        // The space may still be in use by an earlier frame
+        while ( end - mTail > mSize )
+        {
+            retireOldestFrame( true );
+        }
+    }
+    else if ( wrapped )
+    {
+        // Orphan the storage so the driver can give us a fresh copy instead of
+        // making us wait for the GPU. Draws already issued keep the old copy
+        GStateCache.bindBuffer( mTarget, mBuffer );
+        glBufferData( mTarget, mSize, NULL, GL_STREAM_DRAW );
+
+        mTail       = start;
+        mFrameStart = start;
+    }
+
+    if ( wrapped )
+    {
+        mWrapCount++;
+    }
+
+    mHead    = end;
+    *pOffset = static_cast<size_t>( start % mSize );
+
+    if ( mpPersistent != NULL )
+    {
+        return mpPersistent + *pOffset;
+    }
+
+    GStateCache.bindBuffer( mTarget, mBuffer );
+    void * pMemory = glMapBufferRange( mTarget,
+                                       *pOffset,
+                                       size,
+                                       GL_MAP_WRITE_BIT |
+                                       GL_MAP_INVALIDATE_RANGE_BIT |
+                                       GL_MAP_UNSYNCHRONIZED_BIT );
+    mIsMapped = ( pMemory != NULL );
+
+    return pMemory;
+}
+
+/**
+ * Finishes the last call to map(). Persistent mappings are coherent, so this
+ * only does anything on the fallback path
+ */
+void StreamBuffer::unmap()
+{
+    if ( mIsMapped )
+    {
+        GStateCache.bindBuffer( mTarget, mBuffer );
+        glUnmapBuffer( mTarget );
+        mIsMapped = false;
+    }
+}
+
+/**
+ * Places a fence after the commands that read this frame's data, and frees
+ * the space of any earlier frames the GPU has finished with. The fallback
+ * path orphans instead of reusing space, so it has nothing to fence
+ */
+void StreamBuffer::endFrame()
+{
+    assert( !mIsMapped );
+
+    if ( mpPersistent != NULL && mHead != mFrameStart )
+    {
+        PendingFrame frame;
+        frame.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        frame.end   = mHead;
+
+        mFrames.push_back( frame );
+    }
+
+    mFrameStart = mHead;
+
+    if ( mFrames.empty() )
+    {
+        mTail = mHead;
+    }
+
+    while ( retireOldestFrame( false ) )
+    {
+    }
+}
+
+/**
+ * Frees the space used by the oldest frame still in flight, if the GPU is
+ * done with it
+ *
+ * \param  wait  True to block until the GPU is done with the frame
+ * \return       True if a frame was retired
+ */
+bool StreamBuffer::retireOldestFrame( bool wait )
+{
+    if ( mFrames.empty() )
+    {
+        return false;
+    }
+
+    PendingFrame& frame = mFrames.front();
+    GLenum status = glClientWaitSync( frame.fence, 0, 0 );
+
+    if ( status == GL_TIMEOUT_EXPIRED && wait )
+    {
+        mStallCount++;
+
+        do
+        {
+            status = glClientWaitSync( frame.fence,
+                                       GL_SYNC_FLUSH_COMMANDS_BIT,
+                                       FENCE_WAIT_TIMEOUT_NS );
+        }
+        while ( status == GL_TIMEOUT_EXPIRED );
+    }
+
+    if ( status == GL_TIMEOUT_EXPIRED )
+    {
+        return false;
+    }
+
+    glDeleteSync( frame.fence );
+    mTail = frame.end;
+    mFrames.pop_front();
+
+    // Nothing in flight, so only the current frame's data is in use
+    if ( mFrames.empty() )
+    {
+        mTail = mFrameStart;
+    }
+
+    return true;
+}
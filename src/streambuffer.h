@@ -0,0 +1,106 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_STREAMBUFFER_H
+#define SCOTT_GFXSANDBOX_STREAMBUFFER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <deque>
+#include <stdint.h>
+
+/**
+ * A large buffer that per frame data (dynamic vertices, instance data,
+ * constants) is written into as a ring. Space is handed out with map() and
+ * handed back a few frames later, once a fence placed by endFrame() shows the
+ * GPU has finished with it. Nothing is reallocated and the driver is never
+ * asked to synchronise implicitly.
+ *
+ * With ARB_buffer_storage the buffer is persistently and coherently mapped,
+ * so map() is just pointer arithmetic and unmap() does nothing. Otherwise
+ * each allocation is mapped with GL_MAP_UNSYNCHRONIZED_BIT, which is safe
+ * because space is never handed out twice between wraps, and wrapping
+ * orphans the buffer so the driver supplies fresh storage instead of the GPU
+ * being waited on. Orphaning drops anything not yet drawn, so on that path
+ * the draws that read a mapping must be issued before map() is called again.
+ *
+ * All methods must be called on the GL thread.
+ */
+class StreamBuffer
+{
+public:
+    StreamBuffer();
+    ~StreamBuffer();
+
+    // Create the ring. Target is where the buffer gets bound when mapping
+    bool create( GLenum target, size_t size );
+
+    // Release the buffer and its fences
+    void destroy();
+
+    // Reserve space and return where to write it, or NULL if it can't fit
+    void * map( size_t size, size_t alignment, size_t * pOffset );
+
+    // Finish writing the last mapping. Must be called before it is drawn
+    void unmap();
+
+    // Fence everything mapped since the last call
+    void endFrame();
+
+    GLuint buffer() const { return mBuffer; }
+    size_t size() const { return mSize; }
+    bool isCreated() const { return mBuffer != 0; }
+    bool isPersistent() const { return mpPersistent != NULL; }
+
+    // Number of times map() had to wait for the GPU
+    uint64_t stallCount() const { return mStallCount; }
+
+    // Number of times the ring wrapped back to the start
+    uint64_t wrapCount() const { return mWrapCount; }
+
+private:
+    StreamBuffer( const StreamBuffer& );
+    StreamBuffer& operator = ( const StreamBuffer& );
+
+    /**
+     * A frame that the GPU may still be reading from
+     */
+    struct PendingFrame
+    {
+        GLsync fence;
+        uint64_t end;       // ring position just past the frame's data
+    };
+
+    bool retireOldestFrame( bool wait );
+
+private:
+    GLuint mBuffer;
+    GLenum mTarget;
+    size_t mSize;
+    unsigned char * mpPersistent;
+    bool mIsMapped;
+
+    // Positions only ever grow. The offset into the buffer is the position
+    // modulo the size, and allocations never straddle the end of the buffer
+    uint64_t mHead;         // where the next allocation starts
+    uint64_t mTail;         // oldest byte the GPU may still be reading
+    uint64_t mFrameStart;   // where the current frame's data starts
+
+    std::deque<PendingFrame> mFrames;
+    uint64_t mStallCount;
+    uint64_t mWrapCount;
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "swizzle.h"
+#include "tga.h"
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GFXSANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Portable version of the kernel, also used to finish off the pixels left
+ * over by the vectorized kernels
+ */
+static void expandScalar( const unsigned char * pSource,
+                          unsigned char * pDest,
+                          size_t pixelCount )
+{
+    for ( size_t i = 0; i < pixelCount; ++i )
+    {
+        pDest[0] = pSource[0];
+        pDest[1] = pSource[1];
+        pDest[2] = pSource[2];
+        pDest[3] = 255;
+
+        pSource += 3;
+        pDest   += 4;
+    }
+}
+
+#ifdef GFXSANDBOX_X86
+/**
+ * SSSE3 kernel, expands 16 pixels (48 bytes in, 64 out) per iteration. The
+ * three loads are realigned so that each shuffle starts on a pixel boundary,
+ * then the shuffle spreads four pixels out to 32 bits and the alpha is or'd in
+ */
+__attribute__(( target( "ssse3" ) ))
+static void expandSsse3( const unsigned char * pSource,
+                         unsigned char * pDest,
+                         size_t pixelCount )
+{
+    const __m128i mask  = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1,
+                                         6, 7, 8, -1, 9, 10, 11, -1 );
+    const __m128i alpha = _mm_set1_epi32( static_cast<int>( 0xff000000u ) );
+
+    size_t i = 0;
+
+    for ( ; i + 16 <= pixelCount; i += 16 )
+    {
+        const __m128i * pIn = reinterpret_cast<const __m128i*>( pSource + i * 3 );
+        __m128i * pOut      = reinterpret_cast<__m128i*>( pDest + i * 4 );
+
+        __m128i in0 = _mm_loadu_si128( pIn );
+        __m128i in1 = _mm_loadu_si128( pIn + 1 );
+        __m128i in2 = _mm_loadu_si128( pIn + 2 );
+
+        __m128i pixels0 = in0;
+        __m128i pixels1 = _mm_alignr_epi8( in1, in0, 12 );
+        __m128i pixels2 = _mm_alignr_epi8( in2, in1, 8 );
+        __m128i pixels3 = _mm_srli_si128( in2, 4 );
+
+        _mm_storeu_si128( pOut,     _mm_or_si128( _mm_shuffle_epi8( pixels0, mask ), alpha ) );
+        _mm_storeu_si128( pOut + 1, _mm_or_si128( _mm_shuffle_epi8( pixels1, mask ), alpha ) );
+        _mm_storeu_si128( pOut + 2, _mm_or_si128( _mm_shuffle_epi8( pixels2, mask ), alpha ) );
+        _mm_storeu_si128( pOut + 3, _mm_or_si128( _mm_shuffle_epi8( pixels3, mask ), alpha ) );
+    }
+
+    expandScalar( pSource + i * 3, pDest + i * 4, pixelCount - i );
+}
+
+/**
+ * AVX2 kernel, expands 16 pixels per iteration. The byte shuffle can't cross
+ * 128 bit lanes, so each lane is loaded separately starting on its own first
+ * pixel. The last load reads four bytes past the pixels it expands, which is
+ * why the loop stops a little before the end
+ */
+__attribute__(( target( "avx2" ) ))
+static void expandAvx2( const unsigned char * pSource,
+                        unsigned char * pDest,
+                        size_t pixelCount )
+{
+    const __m256i mask  = _mm256_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1,
+                                            6, 7, 8, -1, 9, 10, 11, -1 );
+    const __m256i alpha = _mm256_set1_epi32( static_cast<int>( 0xff000000u ) );
+
+    size_t i = 0;
+
+    for ( ; i + 18 <= pixelCount; i += 16 )
+    {
+        const unsigned char * pIn = pSource + i * 3;
+        __m256i * pOut            = reinterpret_cast<__m256i*>( pDest + i * 4 );
+
+        __m256i pixels0 = _mm256_inserti128_si256(
+            _mm256_castsi128_si256( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn ) ) ),
+            _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + 12 ) ),
+            1 );
+        __m256i pixels1 = _mm256_inserti128_si256(
+            _mm256_castsi128_si256( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + 24 ) ) ),
+            _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + 36 ) ),
+            1 );
+
+        _mm256_storeu_si256( pOut,     _mm256_or_si256( _mm256_shuffle_epi8( pixels0, mask ), alpha ) );
+        _mm256_storeu_si256( pOut + 1, _mm256_or_si256( _mm256_shuffle_epi8( pixels1, mask ), alpha ) );
+    }
+
+    expandScalar( pSource + i * 3, pDest + i * 4, pixelCount - i );
+}
+#endif
+
+/**
+ * Checks if the CPU we are running on supports a kernel
+ */
+bool isSwizzleKernelSupported( SwizzleKernel kernel )
+{
+    switch ( kernel )
+    {
+        case SWIZZLE_SCALAR:
+            return true;
+
+#ifdef GFXSANDBOX_X86
+        case SWIZZLE_SSSE3:
+            return __builtin_cpu_supports( "ssse3" );
+
+        case SWIZZLE_AVX2:
+            return __builtin_cpu_supports( "avx2" );
+#endif
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Picks the widest kernel the CPU supports. This is only worked out once
+ */
+SwizzleKernel bestSwizzleKernel()
+{
+    static const SwizzleKernel best =
+        isSwizzleKernelSupported( SWIZZLE_AVX2 )  ? SWIZZLE_AVX2 :
+        isSwizzleKernelSupported( SWIZZLE_SSSE3 ) ? SWIZZLE_SSSE3 :
+                                                    SWIZZLE_SCALAR;
+    return best;
+}
+
+const char * swizzleKernelName( SwizzleKernel kernel )
+{
+    switch ( kernel )
+    {
+        case SWIZZLE_SCALAR:    return "scalar";
+        case SWIZZLE_SSSE3:     return "ssse3";
+        case SWIZZLE_AVX2:      return "avx2";
+        default:                return "unknown";
+    }
+}
+
+/**
+ * Expands tightly packed 24-bit BGR pixels into 32-bit BGRA pixels, with
+ * every alpha set to 255. Drivers can usually copy 32-bit pixels straight
+ * into the texture, whereas 24-bit pixels go through a slow repacking path
+ *
+ * \param  pSource     Pixels to expand, three bytes each
+ * \param  pDest       Receives the expanded pixels, four bytes each. Must not
+ *                     overlap the source
+ * \param  pixelCount  Number of pixels to expand
+ */
+void expandBgrToBgra( const unsigned char * pSource,
+                      unsigned char * pDest,
+                      size_t pixelCount )
+{
+    expandBgrToBgraWith( bestSwizzleKernel(), pSource, pDest, pixelCount );
+}
+
+/**
+ * Expands pixels using a specific kernel. The kernel must be supported by the
+ * CPU
+ */
+void expandBgrToBgraWith( SwizzleKernel kernel,
+                          const unsigned char * pSource,
+                          unsigned char * pDest,
+                          size_t pixelCount )
+{
+    assert( pSource != NULL && pDest != NULL );
+    assert( isSwizzleKernelSupported( kernel ) );
+
+    switch ( kernel )
+    {
+#ifdef GFXSANDBOX_X86
+        case SWIZZLE_AVX2:
+            expandAvx2( pSource, pDest, pixelCount );
+            break;
+
+        case SWIZZLE_SSSE3:
+            expandSsse3( pSource, pDest, pixelCount );
+            break;
+#endif
+
+        default:
+            expandScalar( pSource, pDest, pixelCount );
+            break;
+    }
+}
+
+/**
+ * Converts a 24-bit image into a 32-bit one. The result may be the source
+ *
+ * \param  source   Image to convert, which must be 24-bit
+ * \param  pResult  Receives the converted image
+ */
+void expandImageToBgra( const Image& source, Image * pResult )
+{
+    assert( source.format == PIXEL_FORMAT_BGR8 && pResult != NULL );
+
+    Image result;
+    result.width  = source.width;
+    result.height = source.height;
+    result.format = PIXEL_FORMAT_BGRA8;
+    result.buffer.resize( result.size() );
+
+    expandBgrToBgra( source.pixels(),
+                     &result.buffer[0],
+                     static_cast<size_t>( source.width ) * source.height );
+
+    std::swap( *pResult, result );
+}
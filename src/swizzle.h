@@ -0,0 +1,57 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_SWIZZLE_H
+#define SCOTT_GFXSANDBOX_SWIZZLE_H
+
+#include <cstddef>
+
+struct Image;
+
+/**
+ * Implementations of the BGR to BGRA expansion. The best one supported by
+ * the CPU is picked at runtime, but benchmarks can ask for a specific one
+ */
+enum SwizzleKernel
+{
+    SWIZZLE_SCALAR,
+    SWIZZLE_SSSE3,
+    SWIZZLE_AVX2
+};
+
+// Expand 24-bit BGR pixels into 32-bit BGRA pixels with an opaque alpha
+void expandBgrToBgra( const unsigned char * pSource,
+                      unsigned char * pDest,
+                      size_t pixelCount );
+
+// Expand pixels with a specific kernel
+void expandBgrToBgraWith( SwizzleKernel kernel,
+                          const unsigned char * pSource,
+                          unsigned char * pDest,
+                          size_t pixelCount );
+
+// Convert a 24-bit image into a new 32-bit image
+void expandImageToBgra( const Image& source, Image * pResult );
+
+// Returns the fastest kernel supported by this CPU
+SwizzleKernel bestSwizzleKernel();
+
+// Returns true if the CPU can run the given kernel
+bool isSwizzleKernelSupported( SwizzleKernel kernel );
+
+// Returns a printable name for the kernel
+const char * swizzleKernelName( SwizzleKernel kernel );
+
+#endif
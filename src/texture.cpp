@@ -15,6 +15,13 @@
  */
 #include "texture.h"
 #include "glutil.h"
+#include "glstate.h"
+#include "tga.h"
+#include "dds.h"
+#include "imagecodec.h"
+#include "mipmap.h"
+#include "swizzle.h"
+#include "util.h"
 #include <iostream>
 #include <cassert>
 #include <cmath>
@@ -27,23 +34,123 @@
 #include <GL/glut.h>
 #endif
 
-GLuint loadTexture( const std::string& filename )
+/**
+ * Loads an image from disk and uploads it into a new texture. Dds images are
+ * uploaded block compressed, anything else goes through the image codecs.
+ * Trilinear filtering builds a mip chain for decoded images (or reuses the
+ * one cached on disk). Dds images already carry their own mip levels
+ *
+ * \param  filename  Path to the image
+ * \param  filter    How the texture is sampled when minified
+ * \return           Id of the new texture
+ */
+GLuint loadTexture( const std::string& filename, TextureFilter filter )
 {
     std::cout << "Loading texture: " << filename << std::endl;
 
-    // Read the tga texture image in
+    if ( hasExtension( filename, ".dds" ) )
+    {
+        CompressedImage compressed;
+
+        bool didLoad = loadDds( filename, &compressed );
+        assert( didLoad && "Failed to load compressed texture image" );
+        (void) didLoad;
+
+        GLuint id;
+        glGenTextures( 1, &id );
+        uploadCompressedTexture( id, compressed );
+
+        return id;
+    }
+
+    // Read the texture image in. For uncompressed tga files the pixels point
+    // straight into the memory mapped file, so there is no copy until the
+    // driver takes the data
     GLuint id;
-    int width, height;
+    Image image;
 
-    void * pPixels = read_tga( filename.c_str(), &width, &height );
+    bool didLoad = loadImageFile( filename, &image );
 
     // Make sure it loaded correctly
-    assert( pPixels != NULL );
+    assert( didLoad && "Failed to load texture image" );
+    (void) didLoad;
+
+    if ( image.format == PIXEL_FORMAT_BGR8 && prefersBgraUploads() )
+    {
+        expandImageToBgra( image, &image );
+    }
+
+    // Generate a new texture id, and then upload the image into it
+    glGenTextures( 1, &id );
+    uploadTexture( id, image );
+
+    if ( filter == TEXTURE_FILTER_TRILINEAR )
+    {
+        std::vector<Image> levels;
+        loadMipChain( image, MIP_FILTER_KAISER, &levels );
+        uploadTextureMipLevels( id, levels );
+    }
+
+    return id;
+}
+
+/**
+ * Creates a texture that holds a tiny checkerboard image. Textures that are
+ * still loading show this until their real image has been uploaded
+ *
+ * \return  Id of the new texture
+ */
+GLuint createPlaceholderTexture()
+{
+    const unsigned char PLACEHOLDER_PIXELS[] =
+    {
+        255,   0, 255,    128, 128, 128,
+        128, 128, 128,    255,   0, 255
+    };
 
-    // Generate a new texture id, and then make it the active texture so we can
-    // upload texture data to it
+    Image image;
+    image.width  = 2;
+    image.height = 2;
+    image.format = PIXEL_FORMAT_BGR8;
+    image.buffer.assign( PLACEHOLDER_PIXELS,
+                         PLACEHOLDER_PIXELS + sizeof( PLACEHOLDER_PIXELS ) );
+
+    GLuint id;
     glGenTextures( 1, &id );
-    glBindTexture( GL_TEXTURE_2D, id );
+    uploadTexture( id, image );
+
+    return id;
+}
+
+/**
+ * Uploads an image into an existing texture, replacing whatever it held
+ *
+ * \param  id     Id of the texture to upload into
+ * \param  image  The image to upload
+ */
+void uploadTexture( GLuint id, const Image& image )
+{
+    uploadTexturePixels( id, image.width, image.height, image.format, image.pixels() );
+}
+
+/**
+ * Uploads pixels into an existing texture, replacing whatever it held. If a
+ * pixel unpack buffer is bound then pPixels is an offset into that buffer
+ *
+ * \param  id       Id of the texture to upload into
+ * \param  width    Width of the image in pixels
+ * \param  height   Height of the image in pixels
+ * \param  format   Layout of the pixels
+ * \param  pPixels  Pointer to (or buffer offset of) the pixels
+ */
+void uploadTexturePixels( GLuint id,
+                          int width,
+                          int height,
+                          PixelFormat format,
+                          const void * pPixels )
+{
+    // Make the texture active so we can upload texture data to it
+    GStateCache.bindTexture( 0, GL_TEXTURE_2D, id );
 
     // Apply texture filtering options as well as uv options
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
@@ -51,109 +158,222 @@ GLuint loadTexture( const std::string& filename )
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE );
 
+    // Rows are tightly packed, which only matches the default alignment of
+    // four bytes when the row size happens to be a multiple of four
+    glPixelStorei( GL_UNPACK_ALIGNMENT,
+                   unpackAlignment( static_cast<size_t>( width ) * bytesPerPixel( format ) ) );
+
     // Upload contents of the image into the graphics card
     glTexImage2D(
             GL_TEXTURE_2D,      // target
             0,                  // level of detail
-            GL_RGB8,            // internal format
+            textureInternalFormat( format ),
             width,
             height,
             0,                  // border
-            GL_BGR,             // incoming (external) format
+            textureFormat( format ),
             GL_UNSIGNED_BYTE,   // incoming (external) type
             pPixels             // dat pixel data
     );
 
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
     // Make sure it worked!
     errorCheck( "Uploading texture" );
-    free( pPixels );
-
-    return id;
 }
 
+/**
+ * Uploads the mip levels below level 0 into a texture, and switches it over
+ * to trilinear filtering. Level 0 must already have been uploaded
+ *
+ * \param  id      Id of the texture to upload into
+ * \param  levels  Levels 1 and down, largest first
+ */
+void uploadTextureMipLevels( GLuint id, const std::vector<Image>& levels )
+{
+    if ( levels.empty() )
+    {
+        return;
+    }
+
+    GStateCache.bindTexture( 0, GL_TEXTURE_2D, id );
 
-short le_short( unsigned char *bytes )
+    // The levels are in client memory, not a staging buffer
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    for ( size_t i = 0; i < levels.size(); ++i )
+    {
+        const Image& level = levels[i];
+
+        // Rows of odd sized levels are rarely four byte aligned
+        glPixelStorei( GL_UNPACK_ALIGNMENT,
+                       unpackAlignment( level.width * bytesPerPixel( level.format ) ) );
+
+        glTexImage2D( GL_TEXTURE_2D,
+                      static_cast<GLint>( i + 1 ),
+                      textureInternalFormat( level.format ),
+                      level.width,
+                      level.height,
+                      0,
+                      textureFormat( level.format ),
+                      GL_UNSIGNED_BYTE,
+                      level.pixels() );
+    }
+
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                     static_cast<GLint>( levels.size() ) );
+
+    errorCheck( "Uploading texture mip levels" );
+}
+
+/**
+ * Checks if the driver can sample BC1 and BC3 (DXT1 and DXT5) textures
+ */
+bool isBlockCompressionSupported()
 {
-    return bytes[0] | ( static_cast<char>(bytes[1]) << 8 );
+    return GLEW_EXT_texture_compression_s3tc;
 }
 
-void *read_tga(const char *filename, int *width, int *height)
+/**
+ * Uploads a block compressed image and its mip chain into an existing
+ * texture. The blocks go to the driver as they are, which takes a sixth (BC1)
+ * or a quarter (BC3) of the bandwidth of uncompressed pixels. Drivers without
+ * S3TC support get the blocks decompressed on the CPU instead
+ *
+ * \param  id     Id of the texture to upload into
+ * \param  image  The image to upload
+ */
+void uploadCompressedTexture( GLuint id, const CompressedImage& image )
 {
-    struct tga_header
+    assert( !image.levels.empty() );
+
+    GStateCache.bindTexture( 0, GL_TEXTURE_2D, id );
+
+    // The blocks are in client memory, not a staging buffer
+    GStateCache.bindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    GLint levelCount = static_cast<GLint>( image.levels.size() );
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                     levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,  levelCount - 1 );
+
+    bool native = isBlockCompressionSupported();
+    GLenum internalFormat = ( image.format == BLOCK_FORMAT_BC1 ?
+                              GL_COMPRESSED_RGB_S3TC_DXT1_EXT :
+                              GL_COMPRESSED_RGBA_S3TC_DXT5_EXT );
+
+    for ( GLint i = 0; i < levelCount; ++i )
     {
-       char  id_length;
-       char  color_map_type;
-       char  data_type_code;
-       unsigned char  color_map_origin[2];
-       unsigned char  color_map_length[2];
-       char  color_map_depth;
-       unsigned char  x_origin[2];
-       unsigned char  y_origin[2];
-       unsigned char  width[2];
-       unsigned char  height[2];
-       char  bits_per_pixel;
-       char  image_descriptor;
-    } header;
-    int i, color_map_size;
-    size_t pixels_size;
-    FILE *f;
-    size_t read;
-    void *pixels;
-
-    f = fopen(filename, "rb");
-
-    if (!f) {
-        fprintf(stderr, "Unable to open %s for reading\n", filename);
-        return NULL;
+        const CompressedLevel& level = image.levels[i];
+
+        if ( native )
+        {
+            glCompressedTexImage2D( GL_TEXTURE_2D,
+                                    i,
+                                    internalFormat,
+                                    level.width,
+                                    level.height,
+                                    0,
+                                    static_cast<GLsizei>( level.size ),
+                                    image.levelData( i ) );
+        }
+        else
+        {
+            std::vector<unsigned char> pixels;
+            decompressImage( image.levelData( i ),
+                             image.format,
+                             level.width,
+                             level.height,
+                             &pixels );
+
+            glTexImage2D( GL_TEXTURE_2D,
+                          i,
+                          GL_RGBA8,
+                          level.width,
+                          level.height,
+                          0,
+                          GL_BGRA,
+                          GL_UNSIGNED_BYTE,
+                          &pixels[0] );
+        }
     }
 
-    read = fread(&header, 1, sizeof(header), f);
+    errorCheck( "Uploading compressed texture" );
+}
 
-    if (read != sizeof(header)) {
-        fprintf(stderr, "%s has incomplete tga header\n", filename);
-        fclose(f);
-        return NULL;
+/**
+ * Returns the largest GL_UNPACK_ALIGNMENT that tightly packed rows of the
+ * given size satisfy
+ */
+GLint unpackAlignment( size_t rowPitch )
+{
+    if ( rowPitch % 8 == 0 )
+    {
+        return 8;
     }
-    if (header.data_type_code != 2) {
-        fprintf(stderr, "%s is not an uncompressed RGB tga file\n", filename);
-        fclose(f);
-        return NULL;
+    else if ( rowPitch % 4 == 0 )
+    {
+        return 4;
     }
-    if (header.bits_per_pixel != 24) {
-        fprintf(stderr, "%s is not a 24-bit uncompressed RGB tga file\n", filename);
-        fclose(f);
-        return NULL;
+    else if ( rowPitch % 2 == 0 )
+    {
+        return 2;
     }
 
-    for (i = 0; i < header.id_length; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete id string\n", filename);
-            fclose(f);
-            return NULL;
-        }
+    return 1;
+}
 
-    color_map_size = le_short(header.color_map_length) * (header.color_map_depth/8);
-    for (i = 0; i < color_map_size; ++i)
-        if (getc(f) == EOF) {
-            fprintf(stderr, "%s has incomplete color map\n", filename);
-            fclose(f);
-            return NULL;
-        }
+/**
+ * Checks if 24-bit images should be expanded to 32-bit BGRA before they are
+ * uploaded. Most drivers store RGB8 textures with a padding byte anyway, and
+ * convert 24-bit uploads on the CPU through a slow generic path, while 32-bit
+ * BGRA is usually copied as is. When the driver can be asked (through
+ * ARB_internalformat_query2) we expand only if it doesn't keep RGB8 as it
+ * is. The answer is worked out once, and must first be asked on the GL thread
+ */
+bool prefersBgraUploads()
+{
+    static int prefersBgra = -1;
 
-    *width = le_short(header.width); *height = le_short(header.height);
-    pixels_size = *width * *height * (header.bits_per_pixel/8);
-    pixels = malloc(pixels_size);
+    if ( prefersBgra < 0 )
+    {
+        prefersBgra = 1;
 
-    read = fread(pixels, 1, pixels_size, f);
+        if ( GLEW_ARB_internalformat_query2 )
+        {
+            GLint preferred = GL_NONE;
+            glGetInternalformativ( GL_TEXTURE_2D,
+                                   GL_RGB8,
+                                   GL_INTERNALFORMAT_PREFERRED,
+                                   1,
+                                   &preferred );
 
-    if ( read != pixels_size )
-    {
-        fprintf(stderr, "%s has incomplete image\n", filename);
-        fclose(f);
-        free(pixels);
-        return NULL;
+            prefersBgra = ( preferred != GL_RGB8 ) ? 1 : 0;
+        }
     }
 
-    return pixels;
+    return prefersBgra != 0;
 }
 
+/**
+ * Returns the OpenGL format that describes pixels in the given layout
+ */
+GLenum textureFormat( PixelFormat format )
+{
+    return ( format == PIXEL_FORMAT_BGRA8 ? GL_BGRA : GL_BGR );
+}
+
+/**
+ * Returns the OpenGL internal format to store pixels of the given layout in
+ */
+GLenum textureInternalFormat( PixelFormat format )
+{
+    return ( format == PIXEL_FORMAT_BGRA8 ? GL_RGBA8 : GL_RGB8 );
+}
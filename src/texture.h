@@ -18,8 +18,35 @@
 
 #include <GL/glew.h>
 #include <string>
+#include <vector>
+#include "tga.h"
 
-GLuint loadTexture( const std::string& filename );
-void * read_tga(const char *filename, int *width, int *height);
+struct CompressedImage;
+
+/**
+ * How a texture is sampled when it is drawn smaller than its full size
+ */
+enum TextureFilter
+{
+    TEXTURE_FILTER_LINEAR,      // bilinear from the full size image only
+    TEXTURE_FILTER_TRILINEAR    // blend between the two nearest mip levels
+};
+
+GLuint loadTexture( const std::string& filename,
+                    TextureFilter filter = TEXTURE_FILTER_LINEAR );
+GLuint createPlaceholderTexture();
+void uploadTexture( GLuint id, const Image& image );
+void uploadTextureMipLevels( GLuint id, const std::vector<Image>& levels );
+void uploadCompressedTexture( GLuint id, const CompressedImage& image );
+bool isBlockCompressionSupported();
+void uploadTexturePixels( GLuint id,
+                          int width,
+                          int height,
+                          PixelFormat format,
+                          const void * pPixels );
+GLint unpackAlignment( size_t rowPitch );
+bool prefersBgraUploads();
+GLenum textureFormat( PixelFormat format );
+GLenum textureInternalFormat( PixelFormat format );
 
 #endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "textureloader.h"
+#include "assetpack.h"
+#include "imagecodec.h"
+#include "mipmap.h"
+#include "texture.h"
+#include "timing.h"
+#include "profiler.h"
+#include "swizzle.h"
+#include "util.h"
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+// Size of each staging slot in the upload ring. Images that don't fit are
+// uploaded from client memory instead
+const size_t STAGING_SLOT_SIZE = 8 * 1024 * 1024;
+
+// Number of uploads that can be in flight at once
+const size_t STAGING_SLOT_COUNT = 4;
+
+/**
+ * Creates the loader and starts its worker threads. Must be called on the GL
+ * thread since it also creates the upload staging buffers
+ *
+ * \param  threadCount  Number of decoding threads, or zero to use one per core
+ */
+TextureLoader::TextureLoader( unsigned int threadCount )
+    : mUploadRing(),
+      mWorkers(),
+      mMutex(),
+      mRequestReady(),
+      mResultReady(),
+      mRequests(),
+      mResults(),
+      mPendingCount( 0 ),
+      mIsStopping( false ),
+      mExpandToBgra( prefersBgraUploads() )
+{
+    if (! mUploadRing.create( STAGING_SLOT_SIZE, STAGING_SLOT_COUNT ) )
+    {
+        std::cout << "Pixel buffer objects unavailable, uploading textures "
+                  << "from client memory" << std::endl;
+    }
+
+    if ( mExpandToBgra )
+    {
+        std::cout << "Expanding 24-bit textures to 32-bit BGRA ("
+                  << swizzleKernelName( bestSwizzleKernel() ) << ")" << std::endl;
+    }
+
+    if ( threadCount == 0 )
+    {
+        threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+
+    for ( unsigned int i = 0; i < threadCount; ++i )
+    {
+        mWorkers.push_back( std::thread( &TextureLoader::workerMain, this ) );
+    }
+}
+
+/**
+ * Stops the worker threads. Images that have not been uploaded yet are thrown
+ * away and their textures keep showing the placeholder
+ */
+TextureLoader::~TextureLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mIsStopping = true;
+    }
+
+    // Workers may be waiting for a staging slot rather than a request
+    mUploadRing.cancelWaits();
+    mRequestReady.notify_all();
+
+    for ( size_t i = 0; i < mWorkers.size(); ++i )
+    {
+        mWorkers[i].join();
+    }
+}
+
+/**
+ * Queues an image to be decoded in the background. The returned texture shows
+ * a placeholder until uploadPending() uploads the real image
+ *
+ * \param  filename  Path to the image to load
+ * \param  filter    How the texture is sampled when minified
+ * \return           Id of the texture the image will be uploaded into
+ */
+GLuint TextureLoader::load( const std::string& filename, TextureFilter filter )
+{
+    GLuint id = createPlaceholderTexture();
+
+    Request request;
+    request.texture  = id;
+    request.filename = filename;
+    request.filter   = filter;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mRequests.push_back( request );
+        ++mPendingCount;
+    }
+
+    mRequestReady.notify_one();
+    return id;
+}
+
+/**
+ * Uploads decoded images until the time budget runs out. At least one image
+ * is uploaded if any are ready, so loading always makes progress even with a
+ * tiny budget
+ *
+ * \param  budgetMs  Time that may be spent uploading, in milliseconds
+ * \return           Number of images that were uploaded
+ */
+size_t TextureLoader::uploadPending( double budgetMs )
+{
+    // Skip the lock entirely once everything has been loaded, since this is
+    // called every frame
+    if ( mPendingCount.load() == 0 )
+    {
+        return 0;
+    }
+
+    mUploadRing.retire();
+
+    double start    = currentTimeMs();
+    size_t uploaded = 0;
+
+    while ( uploadNext() )
+    {
+        uploaded++;
+
+        if ( currentTimeMs() - start >= budgetMs )
+        {
+            break;
+        }
+    }
+
+    return uploaded;
+}
+
+/**
+ * Waits for all queued images to be decoded and uploads them
+ */
+void TextureLoader::finish()
+{
+    while ( mPendingCount.load() > 0 )
+    {
+        // Workers can be blocked waiting for a staging slot, and slots are
+        // only freed by retiring them here. Don't sleep for long
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+
+            if ( mResults.empty() )
+            {
+                mResultReady.wait_for( lock, std::chrono::milliseconds( 1 ) );
+            }
+        }
+
+        mUploadRing.retire();
+
+        while ( uploadNext() )
+        {
+        }
+    }
+}
+
+/**
+ * Uploads one decoded image if there is one waiting
+ *
+ * \return  True if an image was taken off the queue
+ */
+bool TextureLoader::uploadNext()
+{
+    Result result;
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+
+        if ( mResults.empty() )
+        {
+            return false;
+        }
+
+        result = std::move( mResults.front() );
+        mResults.pop_front();
+    }
+
+    ProfileScope scope( "upload texture" );
+
+    if ( result.ok && result.isCompressed )
+    {
+        uploadCompressedTexture( result.texture, result.compressed );
+    }
+    else if ( result.ok && result.stagingSlot >= 0 )
+    {
+        mUploadRing.upload( result.stagingSlot,
+                            result.texture,
+                            result.image.width,
+                            result.image.height,
+                            result.image.format );
+    }
+    else if ( result.ok )
+    {
+        if (! mUploadRing.uploadCopy( result.texture, result.image ) )
+        {
+            uploadTexture( result.texture, result.image );
+        }
+    }
+    else
+    {
+        std::cerr << "Failed to load texture: " << result.filename << std::endl;
+    }
+
+    if ( result.ok && !result.mips.empty() )
+    {
+        uploadTextureMipLevels( result.texture, result.mips );
+    }
+
+    --mPendingCount;
+    return true;
+}
+
+/**
+ * Worker thread loop. Takes load requests off the queue, decodes them and
+ * passes them back to be uploaded
+ */
+void TextureLoader::workerMain()
+{
+    for (;;)
+    {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+
+            while ( mRequests.empty() && !mIsStopping )
+            {
+                mRequestReady.wait( lock );
+            }
+
+            if ( mIsStopping )
+            {
+                return;
+            }
+
+            request = std::move( mRequests.front() );
+            mRequests.pop_front();
+        }
+
+        Result result;
+        result.texture  = request.texture;
+        result.filename = request.filename;
+        result.ok       = decode( request, &result );
+
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            mResults.push_back( std::move( result ) );
+        }
+
+        mResultReady.notify_one();
+    }
+}
+
+/**
+ * Decodes an image on a worker thread. If the upload ring is persistently
+ * mapped the pixels are decoded straight into a staging slot, otherwise they
+ * end up in the result's image
+ *
+ * \param  request  The image to decode and how it will be filtered
+ * \param  pResult  Receives the decoded image, its mips and staging slot
+ * \return          True if the image was decoded
+ */
+bool TextureLoader::decode( const Request& request, Result * pResult )
+{
+    ProfileScope scope( "decode texture" );
+    const std::string& filename = request.filename;
+    pResult->stagingSlot  = -1;
+    pResult->isCompressed = hasExtension( filename, ".dds" );
+
+    // Compressed images are uploaded block for block, there is no decoding
+    if ( pResult->isCompressed )
+    {
+        return loadDds( filename, &pResult->compressed );
+    }
+
+    // Mip levels are built from the decoded image, so images that need them
+    // can't go straight into a staging slot
+    if ( request.filter == TEXTURE_FILTER_TRILINEAR )
+    {
+        if (! loadImageFile( filename, &pResult->image ) )
+        {
+            return false;
+        }
+
+        if ( mExpandToBgra && pResult->image.format == PIXEL_FORMAT_BGR8 )
+        {
+            expandImageToBgra( pResult->image, &pResult->image );
+        }
+
+        ProfileScope mipScope( "generate mips" );
+        loadMipChain( pResult->image, MIP_FILTER_KAISER, &pResult->mips );
+
+        return true;
+    }
+
+    // Packed images need no decoding, and are copied into a staging slot by
+    // uploadCopy() instead
+    if ( mUploadRing.isPersistent() && GAssetPack.find( filename ) == NULL )
+    {
+        MappedFile file;
+        const ImageCodec * pCodec = NULL;
+        ImageHeader header;
+
+        if (! openImageFile( filename, &file, &pCodec, &header ) )
+        {
+            return false;
+        }
+
+        bool expand  = ( mExpandToBgra && header.format == PIXEL_FORMAT_BGR8 );
+
+        Image& image = pResult->image;
+        image.width  = header.width;
+        image.height = header.height;
+        image.format = expand ? PIXEL_FORMAT_BGRA8 : header.format;
+
+        unsigned char * pStaging = NULL;
+        int slot = mUploadRing.acquire( image.size(), &pStaging );
+
+        if ( slot >= 0 )
+        {
+            if (! pCodec->decodePixels( file.data(), file.size(), header,
+                                        image.format, pStaging ) )
+            {
+                mUploadRing.release( slot );
+                return false;
+            }
+
+            pResult->stagingSlot = slot;
+            return true;
+        }
+    }
+
+    if (! loadImageFile( filename, &pResult->image ) )
+    {
+        return false;
+    }
+
+    if ( mExpandToBgra && pResult->image.format == PIXEL_FORMAT_BGR8 )
+    {
+        expandImageToBgra( pResult->image, &pResult->image );
+    }
+
+    return true;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_TEXTURELOADER_H
+#define SCOTT_GFXSANDBOX_TEXTURELOADER_H
+
+#include "dds.h"
+#include "pixelbuffer.h"
+#include "texture.h"
+#include "tga.h"
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Loads textures in the background. Image files (tga, qoi, or block
+ * compressed dds) are read and decoded by a pool of worker threads, and the
+ * decoded images are queued up until the GL thread uploads them within a per
+ * frame time budget.
+ *
+ * When pixel buffer objects are available, uploads go through a ring of
+ * staging buffers so the GL thread never waits on the driver copying pixels.
+ * If the ring is persistently mapped, worker threads decode straight into it.
+ * 24-bit images are expanded to 32-bit BGRA while they are decoded, when the
+ * driver uploads those faster (see prefersBgraUploads).
+ * Mip chains for trilinear filtering are built on the worker threads too.
+ *
+ * Every requested texture gets its id straight away. The id holds a small
+ * placeholder image until the real one has been uploaded, so it can be bound
+ * and drawn with immediately.
+ *
+ * All methods other than the constructor and destructor must be called from
+ * the thread that owns the OpenGL context.
+ */
+class TextureLoader
+{
+public:
+    explicit TextureLoader( unsigned int threadCount = 0 );
+    ~TextureLoader();
+
+    // Queue an image to be loaded, and return the texture it will go into
+    GLuint load( const std::string& filename,
+                 TextureFilter filter = TEXTURE_FILTER_LINEAR );
+
+    // Upload decoded images until the time budget (in ms) has been used up
+    size_t uploadPending( double budgetMs );
+
+    // Block until every queued image has been uploaded
+    void finish();
+
+    // Number of images that have been queued but not uploaded yet
+    size_t pendingCount() const { return mPendingCount.load(); }
+
+    // Number of worker threads decoding images
+    size_t threadCount() const { return mWorkers.size(); }
+
+private:
+    TextureLoader( const TextureLoader& );
+    TextureLoader& operator = ( const TextureLoader& );
+
+    struct Request
+    {
+        GLuint texture;
+        std::string filename;
+        TextureFilter filter;
+    };
+
+    struct Result
+    {
+        GLuint texture;
+        std::string filename;
+        bool ok;
+        int stagingSlot;        // upload ring slot holding the pixels, or -1
+        Image image;
+        std::vector<Image> mips;    // levels below image, if trilinear
+        bool isCompressed;      // compressed holds the image instead
+        CompressedImage compressed;
+    };
+
+    void workerMain();
+    bool decode( const Request& request, Result * pResult );
+    bool uploadNext();
+
+    PixelUploadRing mUploadRing;
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mRequestReady;
+    std::condition_variable mResultReady;
+    std::deque<Request> mRequests;
+    std::deque<Result> mResults;
+    std::atomic<size_t> mPendingCount;
+    bool mIsStopping;
+    bool mExpandToBgra;         // decode 24-bit images as 32-bit BGRA
+};
+
+#endif
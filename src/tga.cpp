@@ -0,0 +1,508 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "tga.h"
+#include "assetpack.h"
+#include "swizzle.h"
+#include "util.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const size_t TGA_HEADER_SIZE = 18;
+
+enum TgaDataType
+{
+    TGA_TYPE_TRUE_COLOR     = 2,
+    TGA_TYPE_RLE_TRUE_COLOR = 10
+};
+
+// Bit in the image descriptor that is set when the first row is the top
+const unsigned char TGA_DESCRIPTOR_TOP_DOWN = 0x20;
+
+// Bit in the image descriptor that is set when rows go right to left
+const unsigned char TGA_DESCRIPTOR_RIGHT_TO_LEFT = 0x10;
+
+unsigned short le_short( const unsigned char *bytes )
+{
+    return static_cast<unsigned short>( bytes[0] | ( bytes[1] << 8 ) );
+}
+
+size_t bytesPerPixel( PixelFormat format )
+{
+    return ( format == PIXEL_FORMAT_BGRA8 ? 4 : 3 );
+}
+
+/**
+ * Returns a pointer to the image's pixels, wherever they are stored
+ */
+const unsigned char * Image::pixels() const
+{
+    if ( mapping )
+    {
+        return mapping->data() + mappingOffset;
+    }
+    else
+    {
+        return buffer.empty() ? NULL : &buffer[0];
+    }
+}
+
+/**
+ * Returns the size of the image's pixel data in bytes
+ */
+size_t Image::size() const
+{
+    return static_cast<size_t>( width ) * height * bytesPerPixel( format );
+}
+
+/**
+ * Checks if a buffer looks like the start of a tga file that parseTgaHeader
+ * would accept. Tga has no magic bytes, so this can only check that the
+ * header fields hold values we support
+ */
+bool isTgaData( const unsigned char * pData, size_t size )
+{
+    return pData != NULL && size >= TGA_HEADER_SIZE &&
+           pData[1] <= 1 &&
+           ( pData[2] == TGA_TYPE_TRUE_COLOR || pData[2] == TGA_TYPE_RLE_TRUE_COLOR ) &&
+           ( pData[16] == 24 || pData[16] == 32 ) &&
+           ( pData[17] & TGA_DESCRIPTOR_RIGHT_TO_LEFT ) == 0;
+}
+
+/**
+ * Reads a tga header and checks that the image is something we know how to
+ * decode: uncompressed or run length encoded true color images with 24 or 32
+ * bits per pixel.
+ *
+ * \param  pData  Start of the tga file
+ * \param  size   Size of the tga file in bytes
+ * \param  name   Name of the file, used when printing errors
+ * \param  pInfo  Receives information about the image
+ * \return        True if the image can be decoded
+ */
+bool parseTgaHeader( const unsigned char * pData,
+                     size_t size,
+                     const char * name,
+                     TgaInfo * pInfo )
+{
+    assert( pInfo != NULL );
+
+    if ( pData == NULL || size < TGA_HEADER_SIZE )
+    {
+        fprintf( stderr, "%s has incomplete tga header\n", name );
+        return false;
+    }
+
+    unsigned char idLength       = pData[0];
+    unsigned char colorMapType   = pData[1];
+    unsigned char dataType       = pData[2];
+    unsigned short colorMapCount = le_short( pData + 5 );
+    unsigned char colorMapDepth  = pData[7];
+    unsigned char bitsPerPixel   = pData[16];
+    unsigned char descriptor     = pData[17];
+
+    if ( dataType != TGA_TYPE_TRUE_COLOR && dataType != TGA_TYPE_RLE_TRUE_COLOR )
+    {
+        fprintf( stderr, "%s is not a true color tga file\n", name );
+        return false;
+    }
+
+    if ( bitsPerPixel != 24 && bitsPerPixel != 32 )
+    {
+        fprintf( stderr, "%s is not a 24 or 32-bit tga file\n", name );
+        return false;
+    }
+
+    if ( descriptor & TGA_DESCRIPTOR_RIGHT_TO_LEFT )
+    {
+        fprintf( stderr, "%s stores its rows right to left\n", name );
+        return false;
+    }
+
+    // Skip past the id string and the color map, which true color images
+    // don't use
+    size_t offset = TGA_HEADER_SIZE + idLength;
+
+    if ( colorMapType != 0 )
+    {
+        offset += colorMapCount * ( ( colorMapDepth + 7 ) / 8 );
+    }
+
+    if ( offset > size )
+    {
+        fprintf( stderr, "%s has incomplete color map\n", name );
+        return false;
+    }
+
+    pInfo->width       = le_short( pData + 12 );
+    pInfo->height      = le_short( pData + 14 );
+    pInfo->format      = ( bitsPerPixel == 32 ? PIXEL_FORMAT_BGRA8 : PIXEL_FORMAT_BGR8 );
+    pInfo->isRle       = ( dataType == TGA_TYPE_RLE_TRUE_COLOR );
+    pInfo->isTopDown   = ( descriptor & TGA_DESCRIPTOR_TOP_DOWN ) != 0;
+    pInfo->pixelOffset = offset;
+
+    if ( pInfo->width == 0 || pInfo->height == 0 )
+    {
+        fprintf( stderr, "%s has no pixels\n", name );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Decodes run length encoded pixels. Each packet starts with a byte whose high
+ * bit says if it is a run (one pixel repeated) or raw pixels, and whose low
+ * seven bits hold the pixel count minus one. Packets may cross rows.
+ *
+ * \return  True if the encoded data covered the whole image
+ */
+static bool decodeRle( const unsigned char * pSource,
+                       const unsigned char * pSourceEnd,
+                       unsigned char * pDest,
+                       size_t destSize,
+                       size_t pixelSize )
+{
+    unsigned char * pOut    = pDest;
+    unsigned char * pOutEnd = pDest + destSize;
+
+    while ( pOut < pOutEnd )
+    {
+        if ( pSource >= pSourceEnd )
+        {
+            return false;
+        }
+
+        unsigned char packet = *pSource++;
+        size_t count         = ( packet & 0x7F ) + 1;
+        size_t bytes         = std::min( count * pixelSize,
+                                         static_cast<size_t>( pOutEnd - pOut ) );
+
+        if ( packet & 0x80 )
+        {
+            if ( static_cast<size_t>( pSourceEnd - pSource ) < pixelSize )
+            {
+                return false;
+            }
+
+            // Write the pixel once and then keep doubling the filled region,
+            // which turns a run into a handful of memcpy calls
+            size_t filled = std::min( pixelSize, bytes );
+            memcpy( pOut, pSource, filled );
+
+            while ( filled < bytes )
+            {
+                size_t chunk = std::min( filled, bytes - filled );
+                memcpy( pOut + filled, pOut, chunk );
+                filled += chunk;
+            }
+
+            pSource += pixelSize;
+        }
+        else
+        {
+            if ( static_cast<size_t>( pSourceEnd - pSource ) < count * pixelSize )
+            {
+                return false;
+            }
+
+            memcpy( pOut, pSource, bytes );
+            pSource += count * pixelSize;
+        }
+
+        pOut += bytes;
+    }
+
+    return true;
+}
+
+/**
+ * Swaps the rows of an image so the top row becomes the bottom row
+ */
+static void flipRows( unsigned char * pPixels, size_t rowSize, int height )
+{
+    std::vector<unsigned char> temp( rowSize );
+
+    for ( int top = 0, bottom = height - 1; top < bottom; ++top, --bottom )
+    {
+        unsigned char * pTop    = pPixels + rowSize * top;
+        unsigned char * pBottom = pPixels + rowSize * bottom;
+
+        memcpy( &temp[0], pTop, rowSize );
+        memcpy( pTop, pBottom, rowSize );
+        memcpy( pBottom, &temp[0], rowSize );
+    }
+}
+
+/**
+ * Decodes the pixels of a tga file into a caller provided buffer, with the
+ * bottom row first. The buffer must have room for width * height pixels in
+ * the format given by the header.
+ *
+ * \param  pData  Start of the tga file
+ * \param  size   Size of the tga file in bytes
+ * \param  info   Header information returned by parseTgaHeader
+ * \param  pDest  Receives the decoded pixels
+ * \return        True if the file contained the whole image
+ */
+bool decodeTgaPixels( const unsigned char * pData,
+                      size_t size,
+                      const TgaInfo& info,
+                      unsigned char * pDest )
+{
+    assert( pData != NULL && pDest != NULL );
+    assert( info.pixelOffset <= size );
+
+    size_t pixelSize = bytesPerPixel( info.format );
+    size_t imageSize = static_cast<size_t>( info.width ) * info.height * pixelSize;
+
+    const unsigned char * pSource    = pData + info.pixelOffset;
+    const unsigned char * pSourceEnd = pData + size;
+
+    if ( info.isRle )
+    {
+        if (! decodeRle( pSource, pSourceEnd, pDest, imageSize, pixelSize ) )
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if ( static_cast<size_t>( pSourceEnd - pSource ) < imageSize )
+        {
+            return false;
+        }
+
+        memcpy( pDest, pSource, imageSize );
+    }
+
+    if ( info.isTopDown )
+    {
+        flipRows( pDest, info.width * pixelSize, info.height );
+    }
+
+    return true;
+}
+
+/**
+ * Decodes the pixels of a tga file into 32-bit BGRA, with the bottom row
+ * first. Uncompressed 24-bit files are expanded straight out of the file a
+ * row at a time, so the pixels are only touched once. The buffer must have
+ * room for width * height 32-bit pixels.
+ *
+ * \param  pData  Start of the tga file
+ * \param  size   Size of the tga file in bytes
+ * \param  info   Header information returned by parseTgaHeader
+ * \param  pDest  Receives the decoded pixels
+ * \return        True if the file contained the whole image
+ */
+bool decodeTgaPixelsAsBgra( const unsigned char * pData,
+                            size_t size,
+                            const TgaInfo& info,
+                            unsigned char * pDest )
+{
+    if ( info.format == PIXEL_FORMAT_BGRA8 )
+    {
+        return decodeTgaPixels( pData, size, info, pDest );
+    }
+
+    size_t pixelCount = static_cast<size_t>( info.width ) * info.height;
+
+    if ( info.isRle )
+    {
+        std::vector<unsigned char> decoded( pixelCount * 3 );
+
+        if (! decodeTgaPixels( pData, size, info, &decoded[0] ) )
+        {
+            return false;
+        }
+
+        expandBgrToBgra( &decoded[0], pDest, pixelCount );
+        return true;
+    }
+
+    assert( info.pixelOffset <= size );
+
+    size_t sourcePitch = static_cast<size_t>( info.width ) * 3;
+    size_t destPitch   = static_cast<size_t>( info.width ) * 4;
+
+    if ( size - info.pixelOffset < pixelCount * 3 )
+    {
+        return false;
+    }
+
+    for ( int y = 0; y < info.height; ++y )
+    {
+        int row = info.isTopDown ? info.height - 1 - y : y;
+
+        expandBgrToBgra( pData + info.pixelOffset + y * sourcePitch,
+                         pDest + row * destPitch,
+                         info.width );
+    }
+
+    return true;
+}
+
+/**
+ * Memory maps a tga file and reads its header
+ *
+ * \param  filename  Path to the tga file
+ * \param  pFile     Receives the mapped file
+ * \param  pInfo     Receives information about the image
+ * \return           True if the file is a tga image we can decode
+ */
+bool openTga( const std::string& filename, MappedFile * pFile, TgaInfo * pInfo )
+{
+    assert( pFile != NULL && pInfo != NULL );
+
+    if (! pFile->open( filename ) )
+    {
+        fprintf( stderr, "Unable to open %s for reading\n", filename.c_str() );
+        return false;
+    }
+
+    return parseTgaHeader( pFile->data(), pFile->size(), filename.c_str(), pInfo );
+}
+
+/**
+ * Loads a tga image from disk. The file is memory mapped, and if it is stored
+ * uncompressed with the bottom row first then the image points straight at
+ * the mapped pixels. Otherwise the pixels are decoded into the image's buffer
+ *
+ * \param  filename  Path to the tga file
+ * \param  pImage    Receives the image
+ * \return           True if the image was loaded
+ */
+bool loadTga( const std::string& filename, Image * pImage )
+{
+    assert( pImage != NULL );
+
+    // Packed images were decoded when the pack was built
+    if ( GAssetPack.loadImage( filename, pImage ) )
+    {
+        return true;
+    }
+
+    std::shared_ptr<MappedFile> file( new MappedFile );
+    TgaInfo info;
+
+    if (! openTga( filename, file.get(), &info ) )
+    {
+        return false;
+    }
+
+    Image image;
+    image.width  = info.width;
+    image.height = info.height;
+    image.format = info.format;
+
+    if (! info.isRle && ! info.isTopDown &&
+        file->size() - info.pixelOffset >= image.size() )
+    {
+        // Already in the layout we want, keep the mapping alive and use it
+        image.mapping       = file;
+        image.mappingOffset = info.pixelOffset;
+    }
+    else
+    {
+        image.buffer.resize( image.size() );
+
+        if (! decodeTgaPixels( file->data(), file->size(), info, &image.buffer[0] ) )
+        {
+            fprintf( stderr, "%s has incomplete image\n", filename.c_str() );
+            return false;
+        }
+    }
+
+    pImage->width         = image.width;
+    pImage->height        = image.height;
+    pImage->format        = image.format;
+    pImage->mapping       = image.mapping;
+    pImage->mappingOffset = image.mappingOffset;
+    pImage->buffer.swap( image.buffer );
+
+    return true;
+}
+
+/**
+ * Loads a 24-bit tga image into a newly allocated buffer, which the caller
+ * must release with free()
+ */
+void *read_tga(const char *filename, int *width, int *height)
+{
+    Image image;
+
+    if (!loadTga(filename, &image))
+        return NULL;
+
+    if (image.format != PIXEL_FORMAT_BGR8) {
+        fprintf(stderr, "%s is not a 24-bit tga file\n", filename);
+        return NULL;
+    }
+
+    void *pixels = malloc(image.size());
+    memcpy(pixels, image.pixels(), image.size());
+
+    *width  = image.width;
+    *height = image.height;
+
+    return pixels;
+}
+
+/**
+ * Writes an uncompressed 24-bit tga image to disk. Pixels are expected to be
+ * tightly packed BGR triplets, with the first row being the bottom of the image
+ *
+ * \param  filename  Path to write the image to
+ * \param  width     Width of the image in pixels
+ * \param  height    Height of the image in pixels
+ * \param  pPixels   Pointer to the BGR pixel data
+ * \return           True if the image was written, false otherwise
+ */
+bool write_tga(const char *filename, int width, int height, const void *pPixels)
+{
+    unsigned char header[18] = { 0 };
+    size_t pixels_size, written;
+    FILE *f;
+
+    header[2]  = 2;                         /* uncompressed true color */
+    header[12] = width & 0xFF;
+    header[13] = (width >> 8) & 0xFF;
+    header[14] = height & 0xFF;
+    header[15] = (height >> 8) & 0xFF;
+    header[16] = 24;                        /* bits per pixel */
+
+    f = fopen(filename, "wb");
+
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for writing\n", filename);
+        return false;
+    }
+
+    pixels_size = static_cast<size_t>(width) * height * 3;
+    written     = fwrite(header, 1, sizeof(header), f);
+    written    += fwrite(pPixels, 1, pixels_size, f);
+    fclose(f);
+
+    if (written != sizeof(header) + pixels_size) {
+        fprintf(stderr, "Failed to write all of %s\n", filename);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_TGA_H
+#define SCOTT_GFXSANDBOX_TGA_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+/**
+ * Layout of the pixels in a decoded image
+ */
+enum PixelFormat
+{
+    PIXEL_FORMAT_BGR8,          // 24-bit, blue green red
+    PIXEL_FORMAT_BGRA8          // 32-bit, blue green red alpha
+};
+
+// Number of bytes used by a single pixel in the given format
+size_t bytesPerPixel( PixelFormat format );
+
+/**
+ * A decoded image. Rows are tightly packed with the bottom row first, which is
+ * what glTexImage2D expects.
+ *
+ * The pixels either live in the image's own buffer, or (when the file on disk
+ * already has the right layout) point straight into a memory mapped file so
+ * that nothing has to be copied before uploading
+ */
+struct Image
+{
+    Image()
+        : width( 0 ),
+          height( 0 ),
+          format( PIXEL_FORMAT_BGR8 ),
+          mapping(),
+          mappingOffset( 0 ),
+          buffer()
+    {
+    }
+
+    const unsigned char * pixels() const;
+    size_t size() const;
+
+    int width;
+    int height;
+    PixelFormat format;
+
+    std::shared_ptr<MappedFile> mapping;
+    size_t mappingOffset;
+    std::vector<unsigned char> buffer;
+};
+
+/**
+ * Information from a tga file's header that is needed to decode it
+ */
+struct TgaInfo
+{
+    TgaInfo()
+        : width( 0 ),
+          height( 0 ),
+          format( PIXEL_FORMAT_BGR8 ),
+          isRle( false ),
+          isTopDown( false ),
+          pixelOffset( 0 )
+    {
+    }
+
+    int width;
+    int height;
+    PixelFormat format;
+    bool isRle;             // pixels are run length encoded
+    bool isTopDown;         // first row in the file is the top of the image
+    size_t pixelOffset;     // offset of the pixel data from the start of file
+};
+
+// Check if a buffer looks like the start of a tga file we can decode
+bool isTgaData( const unsigned char * pData, size_t size );
+
+// Parse a tga header, checking that it is a format we can decode
+bool parseTgaHeader( const unsigned char * pData,
+                     size_t size,
+                     const char * name,
+                     TgaInfo * pInfo );
+
+// Decode tga pixels into a buffer with room for width * height pixels
+bool decodeTgaPixels( const unsigned char * pData,
+                      size_t size,
+                      const TgaInfo& info,
+                      unsigned char * pDest );
+
+// Decode tga pixels, expanding 24-bit images to 32-bit BGRA on the way
+bool decodeTgaPixelsAsBgra( const unsigned char * pData,
+                            size_t size,
+                            const TgaInfo& info,
+                            unsigned char * pDest );
+
+// Map a tga file and parse its header
+bool openTga( const std::string& filename, MappedFile * pFile, TgaInfo * pInfo );
+
+// Load a tga image, avoiding a copy of the pixels when possible
+bool loadTga( const std::string& filename, Image * pImage );
+
+// Load a 24-bit tga image into a buffer that must be released with free()
+void * read_tga(const char *filename, int *width, int *height);
+
+// Save tightly packed 24-bit BGR pixels as an uncompressed tga
+bool write_tga(const char *filename, int width, int height, const void *pPixels);
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "timing.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+/**
+ * Returns the current value of a monotonic clock in milliseconds. The epoch is
+ * unspecified, so this is only useful for measuring intervals
+ */
+double currentTimeMs()
+{
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::duration<double, std::milli> milliseconds;
+
+    return milliseconds( clock::now().time_since_epoch() ).count();
+}
+
+/**
+ * Computes summary statistics over a list of samples. The list is taken by
+ * value because it has to be sorted to find the percentiles
+ *
+ * \param  samples  Samples to summarize
+ * \return          Summary of the samples, or all zeros if there were none
+ */
+SampleSummary summarizeSamples( std::vector<double> samples )
+{
+    SampleSummary summary;
+
+    if ( samples.empty() )
+    {
+        return summary;
+    }
+
+    std::sort( samples.begin(), samples.end() );
+
+    double total = 0.0;
+
+    for ( size_t i = 0; i < samples.size(); ++i )
+    {
+        total += samples[i];
+    }
+
+    // Nearest rank percentiles. For small sample counts p99 ends up being the
+    // max, which is what we want
+    size_t p99Index = ( samples.size() * 99 + 99 ) / 100;
+    p99Index        = std::min( p99Index, samples.size() ) - 1;
+
+    summary.count  = samples.size();
+    summary.min    = samples.front();
+    summary.median = samples[ samples.size() / 2 ];
+    summary.p99    = samples[ p99Index ];
+    summary.max    = samples.back();
+    summary.mean   = total / static_cast<double>( samples.size() );
+
+    return summary;
+}
+
+/**
+ * Prints a summary of timing samples on a single line
+ */
+void printSummary( const std::string& label, const SampleSummary& summary )
+{
+    printf( "%-24s n=%-6zu min=%9.4f  median=%9.4f  p99=%9.4f  max=%9.4f\n",
+            label.c_str(),
+            summary.count,
+            summary.min,
+            summary.median,
+            summary.p99,
+            summary.max );
+}
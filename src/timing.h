@@ -0,0 +1,56 @@
+/*
+ * Copyright 2012 Scott MacDonald
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCOTT_GFXSANDBOX_TIMING_H
+#define SCOTT_GFXSANDBOX_TIMING_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Summary statistics for a set of timing samples. All values are in the same
+ * unit as the samples that were summarized (usually milliseconds)
+ */
+struct SampleSummary
+{
+    SampleSummary()
+        : count( 0 ),
+          min( 0.0 ),
+          median( 0.0 ),
+          p99( 0.0 ),
+          max( 0.0 ),
+          mean( 0.0 )
+    {
+    }
+
+    size_t count;
+    double min;
+    double median;
+    double p99;
+    double max;
+    double mean;
+};
+
+// Returns a monotonic timestamp in milliseconds
+double currentTimeMs();
+
+// Compute min/median/p99/max/mean of a list of samples
+SampleSummary summarizeSamples( std::vector<double> samples );
+
+// Print a one line summary of the samples to standard out
+void printSummary( const std::string& label, const SampleSummary& summary );
+
+#endif
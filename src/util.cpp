@@ -6,55 +6,236 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files smaller than this are read rather than mapped. Setting up and tearing
+// down a mapping costs more than copying a few pages
+const size_t MAPPED_FILE_MIN_MAP_SIZE = 64 * 1024;
 
 /**
- * Reads the contents of a file into a string and returns it
+ * Reads the contents of a file into a string and returns it. The file is
+ * read with a single call (or mapped, if it is large) and copied into the
+ * string once. Nothing is reused between calls, so code that reads files
+ * repeatedly should keep its own MappedFile and use the other overload
+ *
+ * \param  filename  Path to the file
+ * \param  pStatus   If not NULL, receives whether the file could be read
+ * \return           Contents of the file, or an empty string
  */
 std::string loadTextFile( const std::string& filename, bool *pStatus )
 {
-    std::string contents;
-    FILE *pFile = fopen( filename.c_str(), "r" );
+    MappedFile file;
+    std::string text;
+    bool didRead = loadTextFile( filename, &file, &text );
 
-    // Were we able to open the file?
-    if ( pFile == NULL )
+    if ( pStatus != NULL )
     {
-        if ( pStatus != NULL )
-        {
-            *pStatus = false;
-        }
+        *pStatus = didRead;
+    }
+
+    return text;
+}
+
+/**
+ * Reads the contents of a file into a string through a view the caller
+ * keeps. The view is closed again afterwards, but keeps its read buffer, and
+ * assigning to the string reuses its storage when it is large enough
+ *
+ * \param  filename  Path to the file
+ * \param  pFile     View to read the file through
+ * \param  pText     Receives the contents of the file, or is emptied
+ * \return           True if the file could be read
+ */
+bool loadTextFile( const std::string& filename, MappedFile * pFile, std::string * pText )
+{
+    assert( pFile != NULL && pText != NULL );
+
+    if (! pFile->open( filename ) )
+    {
+        pText->clear();
+        return false;
+    }
+
+    if ( pFile->size() > 0 )
+    {
+        pText->assign( reinterpret_cast<const char*>( pFile->data() ), pFile->size() );
     }
     else
     {
-        // Wonderful. Seek to the end of the file so we can see how long it is
-        fseek( pFile,  0, SEEK_END );
-        size_t length = static_cast<size_t>( ftell( pFile ) );
-        fseek( pFile, 0, SEEK_SET );
+        pText->clear();
+    }
 
-        // Generate a temporary string buffer and read the contents of the file into
-        // that buffer
-        char * pBuffer = new char[ length + 1 ];
-        size_t readlen = fread( pBuffer, 1, length, pFile );
+    pFile->close();
 
-        assert( length == readlen && "File length does not match initial seek" );
+    return true;
+}
 
-        // Ensure that there is a terminating null
-        pBuffer[length] = '\0';
+/**
+ * Hashes a buffer with 64-bit FNV-1a. This is not cryptographic, but it is
+ * fast and good enough to key caches on file contents
+ *
+ * \param  pData  Pointer to the data to hash
+ * \param  size   Number of bytes to hash
+ * \param  seed   Starting value, or the result of a previous call to chain
+ * \return        The hash value
+ */
+uint64_t hashData( const void * pData, size_t size, uint64_t seed )
+{
+    const unsigned char * pBytes = static_cast<const unsigned char*>( pData );
+    uint64_t hash                = seed;
 
-        // Now copy the temporary buffer into the string. Once that's done, make
-        // sure we do our job and clean up
-        contents = std::string( pBuffer );
+    for ( size_t i = 0; i < size; ++i )
+    {
+        hash ^= pBytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Creates a directory. It is not an error if the directory already exists
+ *
+ * \param  path  Path of the directory to create
+ * \return       True if the directory exists afterwards
+ */
+bool makeDirectory( const std::string& path )
+{
+    if ( mkdir( path.c_str(), 0755 ) == 0 )
+    {
+        return true;
+    }
+
+    struct stat info;
+    return stat( path.c_str(), &info ) == 0 && S_ISDIR( info.st_mode );
+}
+
+/**
+ * Checks if a path ends with the given extension, eg ".tga". The comparison
+ * is case sensitive
+ */
+bool hasExtension( const std::string& path, const std::string& extension )
+{
+    return path.size() >= extension.size() &&
+           path.compare( path.size() - extension.size(), extension.size(), extension ) == 0;
+}
 
-        delete( pBuffer );
-        fclose( pFile );
+/**
+ * Creates a view that is not attached to any file
+ */
+MappedFile::MappedFile()
+    : mpData( NULL ),
+      mSize( 0 ),
+      mIsOpen( false ),
+      mIsMapped( false ),
+      mFallback()
+{
+}
 
-        // It worked!
-        if ( pStatus != NULL )
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/**
+ * Maps a file into memory. Small files, and files that can't be mapped (eg
+ * they live on a filesystem that doesn't support it), are read into memory
+ * instead. The read buffer is kept when the file is closed, so a view that
+ * opens many small files in turn only allocates for the largest of them
+ *
+ * \param  filename  Path to the file to open
+ * \return           True if the file contents are available
+ */
+bool MappedFile::open( const std::string& filename )
+{
+    close();
+
+    int fd = ::open( filename.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if ( fstat( fd, &info ) != 0 )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    mSize   = static_cast<size_t>( info.st_size );
+    mIsOpen = true;
+
+    // Zero length files can't be mapped, but there is nothing to read either
+    if ( mSize == 0 )
+    {
+        ::close( fd );
+        return true;
+    }
+
+    void * pMapping = MAP_FAILED;
+
+    if ( mSize >= MAPPED_FILE_MIN_MAP_SIZE )
+    {
+        pMapping = mmap( NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+
+    if ( pMapping != MAP_FAILED )
+    {
+        mpData    = static_cast<const unsigned char*>( pMapping );
+        mIsMapped = true;
+    }
+    else
+    {
+        // Read the whole file in one go
+        mFallback.resize( mSize );
+        size_t offset = 0;
+
+        while ( offset < mSize )
+        {
+            ssize_t count = read( fd, &mFallback[offset], mSize - offset );
+
+            if ( count <= 0 )
+            {
+                break;
+            }
+
+            offset += static_cast<size_t>( count );
+        }
+
+        if ( offset != mSize )
         {
-            *pStatus = true;
+            ::close( fd );
+            close();
+            return false;
         }
+
+        mpData = &mFallback[0];
     }
 
-    return contents;
+    // The mapping stays valid after the descriptor is closed
+    ::close( fd );
+    return true;
 }
 
+/**
+ * Unmaps the file, invalidating any pointers into it
+ */
+void MappedFile::close()
+{
+    if ( mIsMapped )
+    {
+        munmap( const_cast<unsigned char*>( mpData ), mSize );
+    }
 
+    mpData    = NULL;
+    mSize     = 0;
+    mIsOpen   = false;
+    mIsMapped = false;
+    mFallback.clear();
+}
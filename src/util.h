@@ -1,8 +1,62 @@
 #ifndef SCOTT_GFXSANDBOX_UTIL_H
 #define SCOTT_GFXSANDBOX_UTIL_H
 
+#include <cstddef>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
+// Seed for hashData, can be used to start a hash of several buffers
+const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+class MappedFile;
+
+// Read a whole file into a new string, through a view that only lives for
+// the call
 std::string loadTextFile( const std::string& filename, bool *pStatus = NULL );
 
+// Read a whole file into a string through a long lived view, so that the
+// view's read buffer and the string's storage are reused from call to call
+bool loadTextFile( const std::string& filename, MappedFile * pFile, std::string * pText );
+
+// 64-bit FNV-1a hash of a buffer. Pass a previous hash as the seed to chain
+uint64_t hashData( const void * pData, size_t size, uint64_t seed = HASH_SEED );
+
+// Create a directory if it doesn't already exist
+bool makeDirectory( const std::string& path );
+
+// Check if a path ends with the given extension (including the dot)
+bool hasExtension( const std::string& path, const std::string& extension );
+
+/**
+ * Read only view of a file's contents. Large files are memory mapped when
+ * possible so that nothing is read until it is touched. Small files (and
+ * files that can't be mapped) are read with a single call into a heap
+ * buffer. The buffer belongs to the view and survives close(), so keeping
+ * one view around to open many files in turn avoids reallocating it
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open( const std::string& filename );
+    void close();
+
+    const unsigned char * data() const { return mpData; }
+    size_t size() const { return mSize; }
+    bool isOpen() const { return mIsOpen; }
+
+private:
+    MappedFile( const MappedFile& );
+    MappedFile& operator = ( const MappedFile& );
+
+    const unsigned char * mpData;
+    size_t mSize;
+    bool mIsOpen;
+    bool mIsMapped;
+    std::vector<unsigned char> mFallback;
+};
+
 #endif